@@ -0,0 +1,206 @@
+#include "async_renderer.h"
+
+#include <iostream>
+#include <algorithm>
+#include <stdint.h>
+
+namespace indoor_context {
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	AsyncRendererT<LabelT, DepthT, kStorage>::AsyncRendererT()
+		: next_slot_(0),
+			num_submitted_(0),
+			rendering_(false),
+			stopping_(false) {
+		thread_ = std::thread(&AsyncRendererT::RenderLoop, this);
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	AsyncRendererT<LabelT, DepthT, kStorage>::AsyncRendererT(const LinearCamera& camera,
+																													 Vec2I viewport,
+																													 int num_targets)
+		: next_slot_(0),
+			num_submitted_(0),
+			rendering_(false),
+			stopping_(false) {
+		Configure(camera, viewport, num_targets);
+		thread_ = std::thread(&AsyncRendererT::RenderLoop, this);
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	AsyncRendererT<LabelT, DepthT, kStorage>::~AsyncRendererT() {
+		{
+			std::lock_guard<std::mutex> guard(lock_);
+			stopping_ = true;
+		}
+		work_cond_.notify_one();
+		thread_.join();
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	bool AsyncRendererT<LabelT, DepthT, kStorage>::Configure(const LinearCamera& camera,
+																													 Vec2I viewport,
+																													 int num_targets) {
+		std::unique_lock<std::mutex> lock(lock_);
+		WaitIdle(lock);
+		for (int i = 0; i < slots_.size(); i++) {
+			if (slots_[i].in_use) {
+				std::cerr << "Warning: AsyncRenderer::Configure() called while frame "
+									<< slots_[i].sequence << " is held, ignoring";
+				return false;
+			}
+		}
+
+		// Copy the options of the existing targets
+		FrameRenderer prototype;
+		if (!slots_.empty()) {
+			prototype = slots_[0].renderer;
+		}
+		prototype.Configure(camera, viewport);
+		slots_.resize(std::max(num_targets, 1));
+		for (int i = 0; i < slots_.size(); i++) {
+			slots_[i].renderer = prototype;
+			slots_[i].in_use = false;
+		}
+		next_slot_ = 0;
+		return true;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void AsyncRendererT<LabelT, DepthT, kStorage>::SetNumThreads(int n) {
+		std::unique_lock<std::mutex> lock(lock_);
+		WaitIdle(lock);
+		if (slots_.empty()) return;
+		// Copies of a renderer share its threads
+		slots_[0].renderer.SetNumThreads(n);
+		for (int i = 1; i < slots_.size(); i++) {
+			slots_[i].renderer = slots_[0].renderer;
+		}
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void AsyncRendererT<LabelT, DepthT, kStorage>::EnableHiZ(bool enable) {
+		std::unique_lock<std::mutex> lock(lock_);
+		WaitIdle(lock);
+		for (int i = 0; i < slots_.size(); i++) {
+			slots_[i].renderer.EnableHiZ(enable);
+		}
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void AsyncRendererT<LabelT, DepthT, kStorage>::SetBufferLayout(BufferLayout layout) {
+		std::unique_lock<std::mutex> lock(lock_);
+		WaitIdle(lock);
+		for (int i = 0; i < slots_.size(); i++) {
+			slots_[i].renderer.SetBufferLayout(layout);
+		}
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	std::future<typename AsyncRendererT<LabelT, DepthT, kStorage>::Frame>
+	AsyncRendererT<LabelT, DepthT, kStorage>::Submit(Commands& commands) {
+		std::unique_lock<std::mutex> lock(lock_);
+		if (slots_.empty()) {
+			std::cerr << "Warning: AsyncRenderer::Submit() called before Configure()";
+			return std::future<Frame>();
+		}
+
+		// Take the first free slot, in round-robin order
+		int index = -1;
+		while (true) {
+			for (int i = 0; i < slots_.size() && index < 0; i++) {
+				const int s = (next_slot_+i) % slots_.size();
+				if (!slots_[s].in_use) {
+					index = s;
+				}
+			}
+			if (index >= 0) break;
+			free_cond_.wait(lock);
+		}
+		next_slot_ = (index+1) % slots_.size();
+
+		// The render thread reset the slot's commands after the last
+		// frame that used it, so the caller gets an empty buffer back
+		Slot& slot = slots_[index];
+		slot.in_use = true;
+		slot.sequence = num_submitted_++;
+		slot.commands.Swap(commands);
+		slot.promise = std::promise<Frame>();
+		std::future<Frame> future = slot.promise.get_future();
+		queue_.push_back(index);
+		work_cond_.notify_one();
+		return future;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void AsyncRendererT<LabelT, DepthT, kStorage>::Release(const Frame& frame) {
+		{
+			std::lock_guard<std::mutex> guard(lock_);
+			if (frame.slot < 0 || frame.slot >= slots_.size() ||
+					!slots_[frame.slot].in_use || slots_[frame.slot].sequence != frame.sequence) {
+				std::cerr << "Warning: frame "<<frame.sequence<<" passed to AsyncRenderer::Release() is not held";
+				return;
+			}
+			slots_[frame.slot].in_use = false;
+		}
+		free_cond_.notify_all();
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void AsyncRendererT<LabelT, DepthT, kStorage>::WaitIdle() {
+		std::unique_lock<std::mutex> lock(lock_);
+		WaitIdle(lock);
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void AsyncRendererT<LabelT, DepthT, kStorage>::WaitIdle(std::unique_lock<std::mutex>& lock) {
+		while (!queue_.empty() || rendering_) {
+			idle_cond_.wait(lock);
+		}
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void AsyncRendererT<LabelT, DepthT, kStorage>::RenderLoop() {
+		std::unique_lock<std::mutex> lock(lock_);
+		while (true) {
+			while (!stopping_ && queue_.empty()) {
+				work_cond_.wait(lock);
+			}
+			// Finish the submitted frames before stopping
+			if (queue_.empty()) return;
+			const int index = queue_.front();
+			queue_.pop_front();
+			rendering_ = true;
+			Slot& slot = slots_[index];
+			Frame frame;
+			frame.slot = index;
+			frame.sequence = slot.sequence;
+
+			// The slot belongs to this thread until the promise is set.
+			// Undo any state left by the last frame in the slot, so that
+			// the output does not depend on which slot a frame uses.
+			lock.unlock();
+			slot.renderer.ResetScissor();
+			if (slot.renderer.query_active()) {
+				slot.renderer.EndOcclusionQuery();
+			}
+			slot.commands.Execute(slot.renderer, frame.results);
+			slot.commands.Reset();
+			slot.promise.set_value(frame);
+			lock.lock();
+
+			rendering_ = false;
+			idle_cond_.notify_all();
+		}
+	}
+
+#define INSTANTIATE_ASYNC_RENDERER_ALL_STORAGE(LabelT, DepthT)					\
+	template class AsyncRendererT<LabelT, DepthT, kStoreDepth>;					\
+	template class AsyncRendererT<LabelT, DepthT, kStoreInverseDepth>;
+
+	INSTANTIATE_ASYNC_RENDERER_ALL_STORAGE(int, double)
+	INSTANTIATE_ASYNC_RENDERER_ALL_STORAGE(int, float)
+	INSTANTIATE_ASYNC_RENDERER_ALL_STORAGE(uint16_t, double)
+	INSTANTIATE_ASYNC_RENDERER_ALL_STORAGE(uint16_t, float)
+	INSTANTIATE_ASYNC_RENDERER_ALL_STORAGE(uint8_t, double)
+	INSTANTIATE_ASYNC_RENDERER_ALL_STORAGE(uint8_t, float)
+}  // namespace indoor_context
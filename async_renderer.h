@@ -0,0 +1,128 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "matrix_types.h"
+#include "simple_renderer.h"
+#include "command_buffer.h"
+
+namespace indoor_context {
+	// Executes command buffers on a dedicated render thread, with
+	// several render targets so that producers can record and submit the
+	// next frame while consumers are still reading the buffers of
+	// earlier ones. Each submitted frame is rendered into a free target,
+	// in submission order, and its future becomes ready once the
+	// commands have been executed. The target then belongs to the
+	// consumer until the frame is passed to Release(). Every frame
+	// starts with no scissor rectangle and no open occlusion query,
+	// whichever target it uses, but the buffers hold whatever the last
+	// frame in that target drew, so frames should begin with Clear().
+	//
+	// For example, with two targets:
+	//   AsyncRenderer renderer(camera, viewport, 2);
+	//   std::future<AsyncRenderer::Frame> next = renderer.Submit(commands);
+	//   while (...) {
+	//     AsyncRenderer::Frame frame = next.get();
+	//     (record the next hypothesis into commands)
+	//     next = renderer.Submit(commands);  // renders while we score
+	//     Score(renderer.target(frame.slot).framebuffer());
+	//     renderer.Release(frame);
+	//   }
+	template <typename LabelT = int,
+						typename DepthT = double,
+						DepthStorage kStorage = kStoreDepth>
+	class AsyncRendererT {
+	public:
+		typedef SimpleRendererT<LabelT, DepthT, kStorage> FrameRenderer;
+		typedef CommandBufferT<LabelT> Commands;
+
+		// A frame that has been rendered
+		struct Frame {
+			int slot;  // the render target holding the buffers
+			long sequence;  // number of frames submitted before this one
+			CommandResults results;
+		};
+
+		// Initialize with no targets
+		AsyncRendererT();
+		// Initialize with the given number of targets, each with the given
+		// camera and viewport
+		AsyncRendererT(const LinearCamera& cam, Vec2I viewport, int num_targets = 2);
+		// Wait for all submitted frames to be rendered and stop the
+		// render thread
+		~AsyncRendererT();
+
+		// Configure the given number of targets, each with the given
+		// camera and viewport. Waits for all submitted frames to be
+		// rendered. Returns false if any frame has not been released.
+		bool Configure(const LinearCamera& cam, Vec2I viewport, int num_targets = 2);
+		// Set options on every target, as for the SimpleRendererT methods
+		// of the same name. The options are kept by Configure(). These
+		// wait for all submitted frames to be rendered, and may modify
+		// the buffers of every target, so only call them when no frames
+		// are held. The targets share one set of threads, which only the
+		// render thread uses, one frame at a time.
+		void SetNumThreads(int n);
+		void EnableHiZ(bool enable);
+		void SetBufferLayout(BufferLayout layout);
+
+		// Submit a frame. The commands are moved into the frame, leaving
+		// commands empty, possibly with memory left over from an earlier
+		// frame. Blocks until a target is free, so do not hold
+		// num_targets() frames while submitting another. Can be called
+		// from several threads. Returns an invalid future if there are no
+		// targets.
+		std::future<Frame> Submit(Commands& commands);
+		// Return the target of a frame so that it can be re-used. The
+		// target's buffers must not be accessed afterwards.
+		void Release(const Frame& frame);
+		// Wait until every submitted frame has been rendered
+		void WaitIdle();
+
+		// Get the number of targets
+		int num_targets() const { return slots_.size(); }
+		// Get a target. Only read the target of a frame that has been
+		// rendered and not released.
+		const FrameRenderer& target(int slot) const { return slots_[slot].renderer; }
+
+	private:
+		// A render target and the state of the frame that uses it
+		struct Slot {
+			FrameRenderer renderer;
+			Commands commands;
+			std::promise<Frame> promise;
+			long sequence;
+			bool in_use;  // from Submit() until Release()
+		};
+
+		// Main loop for the render thread
+		void RenderLoop();
+		// Wait until every submitted frame has been rendered. The lock
+		// must be held.
+		void WaitIdle(std::unique_lock<std::mutex>& lock);
+
+		std::vector<Slot, Eigen::aligned_allocator<Slot> > slots_;
+		int next_slot_;  // where to start looking for a free slot
+		long num_submitted_;
+
+		std::thread thread_;
+		std::mutex lock_;  // protects the members below and slots_
+		std::condition_variable work_cond_;  // signalled when queue_ grows or stopping_ is set
+		std::condition_variable idle_cond_;  // signalled when a frame has been rendered
+		std::condition_variable free_cond_;  // signalled when a slot is released
+		std::deque<int> queue_;  // slots waiting to be rendered
+		bool rendering_;  // true while the render thread executes a frame
+		bool stopping_;
+
+		// Not copyable
+		AsyncRendererT(const AsyncRendererT&);
+		AsyncRendererT& operator=(const AsyncRendererT&);
+	};
+
+	typedef AsyncRendererT<> AsyncRenderer;
+}  // namespace indoor_context
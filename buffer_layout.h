@@ -0,0 +1,186 @@
+#pragma once
+
+#include <algorithm>
+#include <iterator>
+
+#include "matrix_types.h"
+
+namespace indoor_context {
+	// How the pixels of a frame buffer or depth buffer are arranged in
+	// memory
+	enum BufferLayout {
+		kRowMajorLayout,  // one row after another, as in an Eigen array
+		kTiledLayout  // 8x8 tiles in row-major order, each stored row by row
+	};
+
+	// Size of the tiles of kTiledLayout. In either layout, each aligned
+	// run of this many pixels within a row is contiguous in memory.
+	static const int kLayoutTileSize = 8;
+
+	// Maps pixel coordinates to offsets into a buffer with either
+	// layout. The offset of pixel (y,x) is RowOffset(y) + ColOffset(x).
+	struct PixelLayout {
+		long band_stride;  // from row y to row y+8, for y a multiple of 8
+		int row_stride;  // from row y to row y+1, within a band of 8 rows
+		int run_stride;  // from pixel x to pixel x+8, for x a multiple of 8
+
+		// Get the offset of the start of row y
+		long RowOffset(int y) const {
+			return (y >> 3)*band_stride + (y & 7)*row_stride;
+		}
+		// Get the offset of pixel x from the start of its row
+		int ColOffset(int x) const {
+			return (x >> 3)*run_stride + (x & 7);
+		}
+		// Get the offset of pixel (y,x)
+		long Offset(int y, int x) const {
+			return RowOffset(y) + ColOffset(x);
+		}
+		// Returns true if the runs of each row are adjacent in memory, so
+		// any span of a row is contiguous
+		bool contiguous_rows() const {
+			return run_stride == kLayoutTileSize;
+		}
+	};
+
+	// Get the size of the Eigen array that holds a buffer for a
+	// viewport. Tiled buffers are padded to a whole number of tiles, so
+	// their storage cannot be indexed as an image.
+	inline Vec2I LayoutStorageSize(BufferLayout layout, const Vec2I& viewport) {
+		if (layout == kRowMajorLayout) {
+			return viewport;
+		}
+		const int n = kLayoutTileSize;
+		return Vec2I((viewport[0]+n-1) / n * n, (viewport[1]+n-1) / n * n);
+	}
+
+	// Get the mapping from pixels to offsets for a viewport
+	inline PixelLayout MakePixelLayout(BufferLayout layout, const Vec2I& viewport) {
+		const int n = kLayoutTileSize;
+		PixelLayout result;
+		if (layout == kRowMajorLayout) {
+			result.band_stride = static_cast<long>(n) * viewport[0];
+			result.row_stride = viewport[0];
+			result.run_stride = n;
+		} else {
+			const Vec2I size = LayoutStorageSize(layout, viewport);
+			result.band_stride = static_cast<long>(n) * size[0];
+			result.row_stride = n;
+			result.run_stride = n*n;
+		}
+		return result;
+	}
+
+	// Set the pixels in the rectangle [xa,xb)x[ya,yb) of a buffer
+	template <typename T>
+	void FillPixels(T* data, const PixelLayout& layout,
+									int ya, int yb, int xa, int xb,
+									T value) {
+		for (int y = ya; y < yb; y++) {
+			T* row = data + layout.RowOffset(y);
+			if (layout.contiguous_rows()) {
+				std::fill(row + xa, row + xb, value);
+				continue;
+			}
+			for (int x = xa; x < xb; ) {
+				const int run_end = std::min((x | 7) + 1, xb);
+				std::fill_n(row + layout.ColOffset(x), run_end-x, value);
+				x = run_end;
+			}
+		}
+	}
+
+	// Copy between a buffer with any layout and a row-major array of
+	// the viewport size, one contiguous run at a time. The array is
+	// resized if necessary.
+	template <typename T>
+	void CopyToRowMajor(const T* data, const PixelLayout& layout, const Vec2I& viewport,
+											Eigen::Array<T, Eigen::Dynamic, Eigen::Dynamic>& out) {
+		out.resize(viewport[1], viewport[0]);
+		for (int y = 0; y < viewport[1]; y++) {
+			const T* row = data + layout.RowOffset(y);
+			T* out_row = out.data() + static_cast<long>(y)*viewport[0];
+			if (layout.contiguous_rows()) {
+				std::copy_n(row, viewport[0], out_row);
+				continue;
+			}
+			for (int x = 0; x < viewport[0]; x += kLayoutTileSize) {
+				std::copy_n(row + layout.ColOffset(x), std::min(kLayoutTileSize, viewport[0]-x), out_row + x);
+			}
+		}
+	}
+	template <typename T>
+	void CopyFromRowMajor(const Eigen::Array<T, Eigen::Dynamic, Eigen::Dynamic>& in,
+												T* data, const PixelLayout& layout) {
+		for (int y = 0; y < in.rows(); y++) {
+			T* row = data + layout.RowOffset(y);
+			const T* in_row = in.data() + static_cast<long>(y)*in.cols();
+			if (layout.contiguous_rows()) {
+				std::copy_n(in_row, in.cols(), row);
+				continue;
+			}
+			for (int x = 0; x < in.cols(); x += kLayoutTileSize) {
+				std::copy_n(in_row + x, std::min<int>(kLayoutTileSize, in.cols()-x), row + layout.ColOffset(x));
+			}
+		}
+	}
+
+	// Read-only access to a buffer with any layout, in row-major
+	// order. The view is invalidated by anything that reallocates the
+	// buffer, such as reconfiguring the renderer that owns it.
+	template <typename T>
+	class BufferView {
+	public:
+		// Visits the pixels of one row from left to right
+		class RowIterator {
+		public:
+			typedef std::forward_iterator_tag iterator_category;
+			typedef T value_type;
+			typedef long difference_type;
+			typedef const T* pointer;
+			typedef const T& reference;
+
+			RowIterator(const T* row, int run_stride, int x)
+				: row_(row), run_stride_(run_stride), x_(x) { }
+			const T& operator*() const { return row_[(x_ >> 3)*run_stride_ + (x_ & 7)]; }
+			RowIterator& operator++() { x_++; return *this; }
+			RowIterator operator++(int) { RowIterator old = *this; x_++; return old; }
+			bool operator==(const RowIterator& other) const { return x_ == other.x_ && row_ == other.row_; }
+			bool operator!=(const RowIterator& other) const { return !(*this == other); }
+		private:
+			const T* row_;
+			int run_stride_;
+			int x_;
+		};
+
+		BufferView(const T* data, const PixelLayout& layout, const Vec2I& viewport)
+			: data_(data), layout_(layout), viewport_(viewport) { }
+
+		// Get the size of the buffer in pixels
+		int rows() const { return viewport_[1]; }
+		int cols() const { return viewport_[0]; }
+		// Get the value of pixel (y,x)
+		const T& operator()(int y, int x) const { return data_[layout_.Offset(y, x)]; }
+		// Iterate over row y
+		RowIterator row_begin(int y) const {
+			return RowIterator(data_ + layout_.RowOffset(y), layout_.run_stride, 0);
+		}
+		RowIterator row_end(int y) const {
+			return RowIterator(data_ + layout_.RowOffset(y), layout_.run_stride, viewport_[0]);
+		}
+		// Copy the whole buffer into a row-major array, which is resized
+		// if necessary
+		void CopyTo(Eigen::Array<T, Eigen::Dynamic, Eigen::Dynamic>& out) const {
+			CopyToRowMajor(data_, layout_, viewport_, out);
+		}
+
+		// Get the underlying storage and its layout
+		const T* data() const { return data_; }
+		const PixelLayout& layout() const { return layout_; }
+
+	private:
+		const T* data_;
+		PixelLayout layout_;
+		Vec2I viewport_;
+	};
+}  // namespace indoor_context
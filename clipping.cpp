@@ -44,28 +44,12 @@ namespace indoor_context {
 	int ClipAgainstPlane(const vector<Vec3>& poly,
 											 const Vec4& plane,
 											 vector<Vec3>& out) {
-		int n = poly.size();
-		bool prev = false;
-		for (int i = 0; i < n; i++) {
-			const Vec3& a = poly[i];
-			const Vec3& b = poly[(i+1)%n];
-			bool aa = a.dot(plane.head<3>()) + plane[3] >= 0;
-			bool bb = b.dot(plane.head<3>()) + plane[3] >= 0;
-			if (aa || bb) {
-				Vec3 isct = aa && bb ? Vec3::Zero() : Project(PlaneLineIsct(LineThrough(a,b), plane));
-				if (!aa) {
-					out.push_back(isct);
-				} else if (!prev) {
-					out.push_back(a);
-				}
-				if (!bb) {
-					out.push_back(isct);
-				} else if (i+1 < n) {
-					out.push_back(b);
-				}
-			}
-			prev = bb;
-		}
+		const int n = poly.size();
+		const int start = out.size();
+		out.resize(start+n+1);
+		const int m = ClipAgainstPlane(poly.data(), n, plane, &out[start]);
+		out.resize(start+m);
+		return out.size();
 	}
 
 	// Clip a polygon against a frustrum
@@ -73,9 +57,19 @@ namespace indoor_context {
 										 const LinearCamera& cam,
 										 const Vec2I& viewport,
 										 vector<Vec3>& out) {
+		vector<Vec3> clipped, temp;
+		ClipToFrustrum(poly, cam, viewport, clipped, temp);
+		std::copy(clipped.begin(), clipped.end(), back_inserter(out));
+		return out.size();
+	}
+
+	// Compute the frustrum for a camera and viewport
+	void ComputeFrustrum(const LinearCamera& cam,
+											 const Vec2I& viewport,
+											 Frustrum& frustrum) {
 		// Create the frustrum in camera coords
 		Bounds2D<> vp = Bounds2D<>::FromSize(viewport);
-		Vec4 frustrum[] = {
+		Vec4 planes[] = {
 			MakeVector<double>(0, 0, 1, -kZNear),
 			MakeVector<double>(0, 0, -1, kZFar),
 			Concatenate(vp.left_eqn(), 0),
@@ -89,13 +83,145 @@ namespace indoor_context {
 		m.topRows<3>() = cam;
 
 		// Transfer planes _from camera to world_ using the _forwards_ camera matrix
-		vector<Vec3> temp1, temp2;
-		std::copy(poly.begin(), poly.end(), back_inserter(temp1));
 		for (int i = 0; i < 6; i++) {
-			ClipAgainstPlane(temp1, m.transpose()*frustrum[i], temp2);
-			swap(temp1,temp2);
-			temp2.clear();
+			frustrum.planes[i] = m.transpose()*planes[i];
+		}
+	}
+
+	// Clip a polygon against a frustrum, using temp as scratch space
+	int ClipToFrustrum(const vector<Vec3>& poly,
+										 const LinearCamera& cam,
+										 const Vec2I& viewport,
+										 vector<Vec3>& out,
+										 vector<Vec3>& temp) {
+		Frustrum frustrum;
+		ComputeFrustrum(cam, viewport, frustrum);
+		return ClipToFrustrum(poly, frustrum, kAllFrustrumPlanes, out, temp);
+	}
+
+	// Clip a polygon against selected planes of a frustrum
+	int ClipToFrustrum(const vector<Vec3>& poly,
+										 const Frustrum& frustrum,
+										 int plane_mask,
+										 vector<Vec3>& out,
+										 vector<Vec3>& temp) {
+		// Ping-pong between out and temp, which keep their capacity
+		// across calls. Each plane adds at most one vertex.
+		const int capacity = poly.size() + 6;
+		out.resize(capacity);
+		temp.resize(capacity);
+		std::copy(poly.begin(), poly.end(), out.begin());
+		int n = poly.size();
+		for (int i = 0; i < 6 && n > 0; i++) {
+			if (plane_mask & (1 << i)) {
+				n = ClipAgainstPlane(out.data(), n, frustrum.planes[i], temp.data());
+				swap(out, temp);
+			}
+		}
+		out.resize(n);
+		return n;
+	}
+
+	// Clips a triangle against the planes selected by a plane mask
+	typedef int (*TriangleClipper)(const Vec3* poly, const Frustrum& frustrum, Vec3* out);
+
+	// Fill in the triangle clippers for plane masks 0 to kPlaneMask
+	template <int kPlaneMask>
+	struct TriangleClipperTable {
+		static void Fill(TriangleClipper* table) {
+			table[kPlaneMask] = &FrustrumClipper<3, kPlaneMask>::Clip;
+			TriangleClipperTable<kPlaneMask-1>::Fill(table);
+		}
+	};
+
+	template <>
+	struct TriangleClipperTable<-1> {
+		static void Fill(TriangleClipper* /*table*/) { }
+	};
+
+	// The triangle clipper for each plane mask
+	struct TriangleClippers {
+		TriangleClipper clippers[kAllFrustrumPlanes+1];
+		TriangleClippers() {
+			TriangleClipperTable<kAllFrustrumPlanes>::Fill(clippers);
+		}
+	};
+
+	static const TriangleClippers triangle_clippers;
+
+	// Clip a triangle against selected planes of a frustrum
+	int ClipTriangleToFrustrum(const Vec3& p, const Vec3& q, const Vec3& r,
+														 const Frustrum& frustrum,
+														 int plane_mask,
+														 Vec3* out) {
+		const Vec3 poly[] = { p, q, r };
+		return triangle_clippers.clippers[plane_mask & kAllFrustrumPlanes](poly, frustrum, out);
+	}
+
+	// Number of triangles whose outcodes are computed together by
+	// ClipTrianglesToFrustrum
+	static const int kClipBlockSize = 64;
+
+	// Clip a batch of triangles against a frustrum
+	int ClipTrianglesToFrustrum(const Vec3* vertices, int num_vertices,
+															const Vec3I* triangles, int num_triangles,
+															const Frustrum& frustrum,
+															Vec3* out,
+															int* counts) {
+		// The vertices of a block of triangles, one array per coordinate
+		// with the three vertices of each triangle in consecutive blocks
+		double xs[3*kClipBlockSize], ys[3*kClipBlockSize], zs[3*kClipBlockSize];
+		int outcodes[3*kClipBlockSize];
+		bool valid[kClipBlockSize];
+		int nvisible = 0;
+		for (int begin = 0; begin < num_triangles; begin += kClipBlockSize) {
+			const int size = std::min(kClipBlockSize, num_triangles-begin);
+			for (int i = 0; i < size; i++) {
+				const Vec3I& tri = triangles[begin+i];
+				valid[i] = tri.minCoeff() >= 0 && tri.maxCoeff() < num_vertices;
+				for (int j = 0; j < 3; j++) {
+					const Vec3 v = valid[i] ? vertices[tri[j]] : Vec3(Vec3::Zero());
+					xs[j*kClipBlockSize+i] = v[0];
+					ys[j*kClipBlockSize+i] = v[1];
+					zs[j*kClipBlockSize+i] = v[2];
+				}
+			}
+
+			// Compute the outcodes one plane at a time, across the
+			// vertices of the block. Only the first size entries of each
+			// vertex's block are filled in.
+			std::fill(outcodes, outcodes+3*kClipBlockSize, 0);
+			for (int k = 0; k < 6; k++) {
+				const Vec4& w = frustrum.planes[k];
+				const double w0 = w[0], w1 = w[1], w2 = w[2], w3 = w[3];
+				for (int j = 0; j < 3*kClipBlockSize; j += kClipBlockSize) {
+					for (int i = j; i < j+size; i++) {
+						const double d = xs[i]*w0 + ys[i]*w1 + zs[i]*w2 + w3;
+						outcodes[i] |= (d < 0) << k;
+					}
+				}
+			}
+
+			// Clip the triangles that cross a plane and copy those that are
+			// entirely inside
+			for (int i = 0; i < size; i++) {
+				const int t = begin+i;
+				const int a = outcodes[i];
+				const int b = outcodes[kClipBlockSize+i];
+				const int c = outcodes[2*kClipBlockSize+i];
+				Vec3* polygon = out + static_cast<long>(t)*kMaxClippedVertices;
+				if (!valid[i] || (a & b & c)) {
+					counts[t] = 0;
+				} else {
+					const Vec3I& tri = triangles[t];
+					const Vec3 poly[] = { vertices[tri[0]], vertices[tri[1]], vertices[tri[2]] };
+					counts[t] = triangle_clippers.clippers[a | b | c](poly, frustrum, polygon);
+				}
+				if (counts[t] > 0) {
+					nvisible++;
+				}
+			}
 		}
-		std::copy(temp1.begin(), temp1.end(), back_inserter(out));
+		return nvisible;
 	}
 }
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <vector>
+#include <algorithm>
+
 #include "matrix_types.h"
 
 namespace indoor_context {
@@ -13,7 +15,70 @@ namespace indoor_context {
 	// Get the intersection between a plane and a line (in Plucker coordinates)
 	Vec4 PlaneLineIsct(const PluckerLine& m, const Vec4& w);
 
-	// Clip a polygon to the positive side of a plane
+	// The six planes bounding the region of space visible to a camera,
+	// in world coordinates, with the inside on the positive side of
+	// each. The planes are ordered near, far, left, right, top, bottom.
+	struct Frustrum {
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+		Vec4 planes[6];
+	};
+
+	// Bit mask selecting all planes of a frustrum
+	static const int kAllFrustrumPlanes = (1 << 6) - 1;
+
+	// Compute the frustrum for a camera and viewport
+	void ComputeFrustrum(const LinearCamera& cam,
+											 const Vec2I& viewport,
+											 Frustrum& frustrum);
+
+	// Get a bit mask in which bit i is set if the point x is outside
+	// the i-th plane of the frustrum
+	inline int ComputeOutcode(const Frustrum& frustrum, const Vec3& x) {
+		int code = 0;
+		for (int i = 0; i < 6; i++) {
+			const Vec4& w = frustrum.planes[i];
+			if (x.dot(w.head<3>()) + w[3] < 0) {
+				code |= 1 << i;
+			}
+		}
+		return code;
+	}
+
+	// Clip a convex polygon with n vertices to the positive side of a
+	// plane, which is one pass of the Sutherland-Hodgman algorithm. The
+	// result is written to out, which must have room for n+1 vertices
+	// and must not overlap poly. A convex polygon crosses a plane at
+	// most twice; more crossings mean that it is degenerate to within
+	// rounding error, so it is discarded rather than growing by more
+	// than one vertex. Returns the number of vertices written, which is
+	// zero if the polygon is entirely outside.
+	inline int ClipAgainstPlane(const Vec3* poly, int n, const Vec4& plane, Vec3* out) {
+		if (n <= 0) return 0;
+		const double first = poly[0].dot(plane.head<3>()) + plane[3];
+		double da = first;
+		int m = 0;
+		int crossings = 0;
+		for (int i = 0; i < n; i++) {
+			const Vec3& a = poly[i];
+			const Vec3& b = poly[i+1 < n ? i+1 : 0];
+			const double db = i+1 < n ? b.dot(plane.head<3>()) + plane[3] : first;
+			if (da >= 0) {
+				out[m++] = a;
+			}
+			if ((da >= 0) != (db >= 0)) {
+				if (++crossings > 2) return 0;
+				// Interpolate along the edge, which unlike PlaneLineIsct()
+				// keeps the intersection on the edge when the edge is
+				// nearly parallel to the plane
+				out[m++] = a + (da/(da-db))*(b-a);
+			}
+			da = db;
+		}
+		return m;
+	}
+
+	// Clip a polygon to the positive side of a plane, appending the
+	// result to out. Returns the size of out.
 	int ClipAgainstPlane(const std::vector<Vec3>& poly,
 											 const Vec4& plane,
 											 std::vector<Vec3>& out);
@@ -23,4 +88,105 @@ namespace indoor_context {
 										 const LinearCamera& cam,
 										 const Vec2I& viewport,
 										 std::vector<Vec3>& out);
+
+	// Clip a polygon against a frustrum, using temp as scratch space so
+	// that no allocations are made once the buffers have grown. Unlike
+	// the above, out is cleared first. Returns the number of vertices
+	// in the clipped polygon.
+	int ClipToFrustrum(const std::vector<Vec3>& poly,
+										 const LinearCamera& cam,
+										 const Vec2I& viewport,
+										 std::vector<Vec3>& out,
+										 std::vector<Vec3>& temp);
+
+	// Clip a polygon against those planes of a frustrum that are
+	// selected by plane_mask, which would usually be the bitwise-or of
+	// the outcodes of its vertices. Uses temp as scratch space and
+	// clears out first. Returns the number of vertices in the clipped
+	// polygon.
+	int ClipToFrustrum(const std::vector<Vec3>& poly,
+										 const Frustrum& frustrum,
+										 int plane_mask,
+										 std::vector<Vec3>& out,
+										 std::vector<Vec3>& temp);
+
+	// The number of planes selected by a plane mask
+	template <int kPlaneMask>
+	struct PlaneCount {
+		static const int value = (kPlaneMask & 1) + PlaneCount<(kPlaneMask >> 1)>::value;
+	};
+
+	template <>
+	struct PlaneCount<0> {
+		static const int value = 0;
+	};
+
+	// Clips polygons with kNumVertices vertices against the planes of a
+	// frustrum selected by kPlaneMask. Since both are known at compile
+	// time, the passes are unrolled, planes that are not selected cost
+	// nothing, and all storage is on the stack.
+	template <int kNumVertices, int kPlaneMask>
+	struct FrustrumClipper {
+		// Each plane adds at most one vertex to a convex polygon
+		static const int kMaxVertices = kNumVertices + PlaneCount<kPlaneMask>::value;
+
+		// Clip a polygon, writing the result to out, which must have
+		// room for kMaxVertices vertices. Returns the number of vertices
+		// in the clipped polygon, which is zero if it is entirely
+		// outside.
+		static int Clip(const Vec3* poly, const Frustrum& frustrum, Vec3* out) {
+			static const int kNumPlanes = PlaneCount<kPlaneMask>::value;
+			if (kNumPlanes == 0) {
+				std::copy(poly, poly+kNumVertices, out);
+				return kNumVertices;
+			}
+			// Alternate between temp and out so that the last pass writes
+			// to out
+			Vec3 temp[kMaxVertices];
+			const Vec3* in = poly;
+			int n = kNumVertices;
+			int pass = 0;
+			for (int i = 0; i < 6; i++) {
+				if (kPlaneMask & (1 << i)) {
+					Vec3* dest = (kNumPlanes-pass) % 2 == 1 ? out : temp;
+					n = ClipAgainstPlane(in, n, frustrum.planes[i], dest);
+					if (n == 0) return 0;
+					in = dest;
+					pass++;
+				}
+			}
+			return n;
+		}
+	};
+
+	// Max vertices of a triangle clipped against all six planes of a
+	// frustrum
+	static const int kMaxClippedVertices = FrustrumClipper<3, kAllFrustrumPlanes>::kMaxVertices;
+
+	// Clip a triangle against those planes of a frustrum that are
+	// selected by plane_mask, using the FrustrumClipper for that
+	// mask. The result is written to out, which must have room for
+	// kMaxClippedVertices vertices. Returns the number of vertices in
+	// the clipped polygon.
+	int ClipTriangleToFrustrum(const Vec3& p, const Vec3& q, const Vec3& r,
+														 const Frustrum& frustrum,
+														 int plane_mask,
+														 Vec3* out);
+
+	// Clip a batch of triangles against a frustrum. The vertices of
+	// triangle i are the elements of vertices selected by
+	// triangles[i]. The outcodes of the vertices are computed a block of
+	// triangles at a time, in loops over the block that the compiler can
+	// vectorize, and then each triangle that crosses a plane is clipped
+	// against the planes that it crosses, as in
+	// ClipTriangleToFrustrum. Polygon i is written to
+	// out[i*kMaxClippedVertices] onwards and its number of vertices to
+	// counts[i], which is zero if it is entirely outside. Triangles
+	// with out-of-range indices are treated as outside. Returns the
+	// number of polygons that are not empty.
+	int ClipTrianglesToFrustrum(const Vec3* vertices, int num_vertices,
+															const Vec3I* triangles, int num_triangles,
+															const Frustrum& frustrum,
+															Vec3* out,
+															int* counts);
 }
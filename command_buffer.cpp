@@ -0,0 +1,216 @@
+#include "command_buffer.h"
+
+#include <algorithm>
+#include <stdint.h>
+
+namespace indoor_context {
+	using std::vector;
+
+	void CommandResults::Reset() {
+		triangles_affected = 0;
+		planes_affected = 0;
+		pixels_written = 0;
+		query_pixels.clear();
+		nsmoothed = 0;
+	}
+
+	template <typename LabelT>
+	CommandBufferT<LabelT>::CommandBufferT()
+		: num_meshes_(0),
+			num_layouts_(0) {
+	}
+
+	template <typename LabelT>
+	void CommandBufferT<LabelT>::Reset() {
+		commands_.clear();
+		triangles_.clear();
+		num_meshes_ = 0;
+		num_layouts_ = 0;
+	}
+
+	template <typename LabelT>
+	typename CommandBufferT<LabelT>::Command& CommandBufferT<LabelT>::Add(CommandType type) {
+		commands_.push_back(Command());
+		Command& command = commands_.back();
+		command.type = type;
+		return command;
+	}
+
+	template <typename LabelT>
+	void CommandBufferT<LabelT>::Clear(LabelT bg) {
+		Add(kClearCommand).label = bg;
+	}
+
+	template <typename LabelT>
+	void CommandBufferT<LabelT>::ClearRect(LabelT bg, int ya, int yb, int xa, int xb) {
+		Command& command = Add(kClearRectCommand);
+		command.label = bg;
+		command.ya = ya;
+		command.yb = yb;
+		command.xa = xa;
+		command.xb = xb;
+	}
+
+	template <typename LabelT>
+	void CommandBufferT<LabelT>::SetScissor(int ya, int yb, int xa, int xb) {
+		Command& command = Add(kSetScissorCommand);
+		command.ya = ya;
+		command.yb = yb;
+		command.xa = xa;
+		command.xb = xb;
+	}
+
+	template <typename LabelT>
+	void CommandBufferT<LabelT>::ResetScissor() {
+		Add(kResetScissorCommand);
+	}
+
+	template <typename LabelT>
+	void CommandBufferT<LabelT>::Render(const Vec3& p, const Vec3& q, const Vec3& r, LabelT label) {
+		Command& command = Add(kRenderCommand);
+		command.label = label;
+		command.index = triangles_.size();
+		Triangle tri;
+		tri.p = p;
+		tri.q = q;
+		tri.r = r;
+		triangles_.push_back(tri);
+	}
+
+	template <typename LabelT>
+	void CommandBufferT<LabelT>::RenderMesh(const vector<Vec3>& vertices,
+																					const vector<Vec3I>& indices,
+																					const vector<LabelT>& labels) {
+		Add(kRenderMeshCommand).index = num_meshes_;
+		if (num_meshes_ == meshes_.size()) {
+			meshes_.push_back(Mesh());
+		}
+		Mesh& mesh = meshes_[num_meshes_++];
+		mesh.vertices.assign(vertices.begin(), vertices.end());
+		mesh.indices.assign(indices.begin(), indices.end());
+		mesh.labels.assign(labels.begin(), labels.end());
+	}
+
+	template <typename LabelT>
+	void CommandBufferT<LabelT>::RenderInfinitePlane(double z0, LabelT label) {
+		Command& command = Add(kInfinitePlaneCommand);
+		command.z0 = z0;
+		command.label = label;
+	}
+
+	template <typename LabelT>
+	void CommandBufferT<LabelT>::RenderManhattanLayout(double floor_z,
+																										 double ceiling_z,
+																										 const vector<Vec2>& corners,
+																										 const vector<LabelT>& wall_labels,
+																										 LabelT floor_label,
+																										 LabelT ceiling_label) {
+		Add(kLayoutCommand).index = num_layouts_;
+		if (num_layouts_ == layouts_.size()) {
+			layouts_.push_back(Layout());
+		}
+		Layout& layout = layouts_[num_layouts_++];
+		layout.floor_z = floor_z;
+		layout.ceiling_z = ceiling_z;
+		layout.corners.assign(corners.begin(), corners.end());
+		layout.wall_labels.assign(wall_labels.begin(), wall_labels.end());
+		layout.floor_label = floor_label;
+		layout.ceiling_label = ceiling_label;
+	}
+
+	template <typename LabelT>
+	void CommandBufferT<LabelT>::BeginOcclusionQuery(bool write) {
+		Add(kBeginQueryCommand).write = write;
+	}
+
+	template <typename LabelT>
+	void CommandBufferT<LabelT>::EndOcclusionQuery() {
+		Add(kEndQueryCommand);
+	}
+
+	template <typename LabelT>
+	void CommandBufferT<LabelT>::SmoothInfiniteDepths(DepthFillPolicy policy) {
+		Add(kSmoothDepthsCommand).policy = policy;
+	}
+
+	template <typename LabelT>
+	template <typename DepthT, DepthStorage kStorage>
+	void CommandBufferT<LabelT>::Execute(SimpleRendererT<LabelT, DepthT, kStorage>& renderer,
+																			 CommandResults& results) const {
+		results.Reset();
+		for (int i = 0; i < commands_.size(); i++) {
+			const Command& command = commands_[i];
+			switch (command.type) {
+			case kClearCommand:
+				renderer.Clear(command.label);
+				break;
+			case kClearRectCommand:
+				renderer.ClearRect(command.label, command.ya, command.yb, command.xa, command.xb);
+				break;
+			case kSetScissorCommand:
+				renderer.SetScissor(command.ya, command.yb, command.xa, command.xb);
+				break;
+			case kResetScissorCommand:
+				renderer.ResetScissor();
+				break;
+			case kRenderCommand: {
+				const Triangle& tri = triangles_[command.index];
+				results.triangles_affected += renderer.Render(tri.p, tri.q, tri.r, command.label);
+				break;
+			}
+			case kRenderMeshCommand: {
+				const Mesh& mesh = meshes_[command.index];
+				results.triangles_affected += renderer.RenderMesh(mesh.vertices, mesh.indices, mesh.labels);
+				break;
+			}
+			case kInfinitePlaneCommand:
+				results.planes_affected += renderer.RenderInfinitePlane(command.z0, command.label);
+				break;
+			case kLayoutCommand: {
+				const Layout& layout = layouts_[command.index];
+				results.pixels_written += renderer.RenderManhattanLayout(layout.floor_z,
+																																 layout.ceiling_z,
+																																 layout.corners,
+																																 layout.wall_labels,
+																																 layout.floor_label,
+																																 layout.ceiling_label);
+				break;
+			}
+			case kBeginQueryCommand:
+				renderer.BeginOcclusionQuery(command.write);
+				break;
+			case kEndQueryCommand:
+				results.query_pixels.push_back(renderer.EndOcclusionQuery());
+				break;
+			case kSmoothDepthsCommand:
+				results.nsmoothed += renderer.SmoothInfiniteDepths(command.policy);
+				break;
+			}
+		}
+	}
+
+	template <typename LabelT>
+	void CommandBufferT<LabelT>::Swap(CommandBufferT& other) {
+		commands_.swap(other.commands_);
+		triangles_.swap(other.triangles_);
+		meshes_.swap(other.meshes_);
+		std::swap(num_meshes_, other.num_meshes_);
+		layouts_.swap(other.layouts_);
+		std::swap(num_layouts_, other.num_layouts_);
+	}
+
+#define INSTANTIATE_EXECUTE(LabelT, DepthT, kStorage)										\
+	template void CommandBufferT<LabelT>::Execute(												\
+		SimpleRendererT<LabelT, DepthT, kStorage>&, CommandResults&) const;
+
+#define INSTANTIATE_COMMAND_BUFFER(LabelT)																\
+	template class CommandBufferT<LabelT>;																\
+	INSTANTIATE_EXECUTE(LabelT, double, kStoreDepth)												\
+	INSTANTIATE_EXECUTE(LabelT, double, kStoreInverseDepth)								\
+	INSTANTIATE_EXECUTE(LabelT, float, kStoreDepth)												\
+	INSTANTIATE_EXECUTE(LabelT, float, kStoreInverseDepth)
+
+	INSTANTIATE_COMMAND_BUFFER(int)
+	INSTANTIATE_COMMAND_BUFFER(uint16_t)
+	INSTANTIATE_COMMAND_BUFFER(uint8_t)
+}  // namespace indoor_context
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <vector>
+
+#include "matrix_types.h"
+#include "simple_renderer.h"
+
+namespace indoor_context {
+	// Results of executing a command buffer
+	struct CommandResults {
+		// Number of triangles drawn by Render and RenderMesh commands
+		// that affected at least one pixel
+		long triangles_affected;
+		// Number of RenderInfinitePlane commands that affected at least
+		// one pixel
+		int planes_affected;
+		// Number of pixels written by RenderManhattanLayout commands
+		long pixels_written;
+		// Number of pixels that passed the depth test in each occlusion
+		// query, in the order in which the queries were ended
+		std::vector<long> query_pixels;
+		// Number of depths replaced by SmoothInfiniteDepths commands
+		long nsmoothed;
+
+		// Set all results to zero
+		void Reset();
+	};
+
+	// A recorded sequence of rendering commands that can be executed
+	// later, possibly on another thread, by a SimpleRendererT with the
+	// same label type. All geometry is copied when it is recorded, so
+	// the caller's vectors can be re-used immediately. Reset() keeps the
+	// allocated memory, so a command buffer that is re-recorded every
+	// frame stops allocating once it reaches its peak size.
+	template <typename LabelT = int>
+	class CommandBufferT {
+	public:
+		// Initialize empty
+		CommandBufferT();
+
+		// Remove all commands
+		void Reset();
+		// Get the number of commands recorded
+		int size() const { return commands_.size(); }
+		// Returns true if no commands have been recorded
+		bool empty() const { return commands_.empty(); }
+
+		// Record a call to the SimpleRendererT method of the same name
+		void Clear(LabelT bg);
+		void ClearRect(LabelT bg, int ya, int yb, int xa, int xb);
+		void SetScissor(int ya, int yb, int xa, int xb);
+		void ResetScissor();
+		void Render(const Vec3& p, const Vec3& q, const Vec3& r, LabelT label);
+		void RenderMesh(const std::vector<Vec3>& vertices,
+										const std::vector<Vec3I>& indices,
+										const std::vector<LabelT>& labels);
+		void RenderInfinitePlane(double z0, LabelT label);
+		void RenderManhattanLayout(double floor_z,
+															 double ceiling_z,
+															 const std::vector<Vec2>& corners,
+															 const std::vector<LabelT>& wall_labels,
+															 LabelT floor_label,
+															 LabelT ceiling_label);
+		void BeginOcclusionQuery(bool write);
+		// The pixel count of the query is appended to
+		// CommandResults::query_pixels
+		void EndOcclusionQuery();
+		void SmoothInfiniteDepths(DepthFillPolicy policy = kFillNearest);
+
+		// Execute the commands in order on a renderer and write the
+		// results. The command buffer is not modified, so it can be
+		// executed many times.
+		template <typename DepthT, DepthStorage kStorage>
+		void Execute(SimpleRendererT<LabelT, DepthT, kStorage>& renderer,
+								 CommandResults& results) const;
+
+		// Exchange the commands of two command buffers without copying
+		void Swap(CommandBufferT& other);
+
+	private:
+		enum CommandType {
+			kClearCommand,
+			kClearRectCommand,
+			kSetScissorCommand,
+			kResetScissorCommand,
+			kRenderCommand,
+			kRenderMeshCommand,
+			kInfinitePlaneCommand,
+			kLayoutCommand,
+			kBeginQueryCommand,
+			kEndQueryCommand,
+			kSmoothDepthsCommand
+		};
+
+		// One recorded command. Only the fields used by its type are set.
+		struct Command {
+			CommandType type;
+			LabelT label;
+			int ya, yb, xa, xb;
+			double z0;
+			bool write;
+			DepthFillPolicy policy;
+			int index;  // into triangles_, meshes_ or layouts_
+		};
+
+		struct Triangle {
+			Vec3 p, q, r;
+		};
+
+		struct Mesh {
+			std::vector<Vec3> vertices;
+			std::vector<Vec3I> indices;
+			std::vector<LabelT> labels;
+		};
+
+		struct Layout {
+			double floor_z, ceiling_z;
+			std::vector<Vec2> corners;
+			std::vector<LabelT> wall_labels;
+			LabelT floor_label, ceiling_label;
+		};
+
+		// Append a command of the given type and return it
+		Command& Add(CommandType type);
+
+		std::vector<Command> commands_;
+		std::vector<Triangle> triangles_;
+		// Meshes and layouts beyond num_meshes_ and num_layouts_ are left
+		// over from before the last Reset() and are re-used to avoid
+		// allocating
+		std::vector<Mesh> meshes_;
+		int num_meshes_;
+		std::vector<Layout> layouts_;
+		int num_layouts_;
+	};
+
+	typedef CommandBufferT<> CommandBuffer;
+}  // namespace indoor_context
@@ -1,20 +1,93 @@
 #include "depth_equation.h"
 
-#include <Eigen/SVD>
+#include <cmath>
+
+#include <Eigen/Geometry>
 
 #include "matrix_types.h"
 #include "vector_utils.tpp"
 
 namespace indoor_context {
+	// Planes are considered to pass through the camera centre when the
+	// determinant is this small relative to its largest possible value
+	static const double kDegenerateTol = 1e-12;
+
+	DepthEqnBasis ComputeDepthEqnBasis(const LinearCamera& camera) {
+		Vec3 a0 = camera.block<1,3>(0,0).transpose();
+		Vec3 a1 = camera.block<1,3>(1,0).transpose();
+		Vec3 a2 = camera.block<1,3>(2,0).transpose();
+
+		// Cofactors of the last column of [camera; plane] for the first
+		// three rows, as linear functions of the plane normal
+		DepthEqnBasis basis;
+		basis.L.row(0) = -a1.cross(a2);
+		basis.L.row(1) = a0.cross(a2);
+		basis.L.row(2) = -a0.cross(a1);
+
+		// Cofactors of the last row, which is the camera centre up to scale
+		for (int k = 0; k < 4; k++) {
+			Mat3 minor;
+			for (int j = 0, col = 0; j < 4; j++) {
+				if (j != k) minor.col(col++) = camera.col(j);
+			}
+			basis.c[k] = (k%2 == 0 ? -1 : 1) * minor.determinant();
+		}
+		return basis;
+	}
+
 	Vec3 PlaneToDepthEqn(const LinearCamera& camera, const Vec4& plane) {
-		Mat4 M;
-		M.topRows<3>() = camera;
-		M.row(3) = plane;
-		Eigen::JacobiSVD<Mat4> svd(M, Eigen::ComputeFullU | Eigen::ComputeFullV);
-		double du = 1. / camera.row(2).dot(AtRetina(svd.solve(MakeVector<double>(1,0,1,0)).eval()));
-		double dv = 1. / camera.row(2).dot(AtRetina(svd.solve(MakeVector<double>(0,1,1,0)).eval()));
-		double dw = 1. / camera.row(2).dot(AtRetina(svd.solve(MakeVector<double>(0,0,1,0)).eval()));
-		return MakeVector(du-dw, dv-dw, dw);
+		Vec3 eqn;
+		PlaneToDepthEqn(ComputeDepthEqnBasis(camera), plane, eqn);
+		return eqn;
+	}
+
+	// The single and batch versions below evaluate the same expressions
+	// in the same order so that their results are identical.
+	bool PlaneToDepthEqn(const DepthEqnBasis& basis, const Vec4& plane, Vec3& eqn) {
+		const Mat3& L = basis.L;
+		const Vec4& c = basis.c;
+		double det = c[0]*plane[0] + c[1]*plane[1] + c[2]*plane[2] + c[3]*plane[3];
+		double norm = std::sqrt(plane[0]*plane[0] + plane[1]*plane[1] +
+														plane[2]*plane[2] + plane[3]*plane[3]);
+		if (std::abs(det) <= kDegenerateTol * c.norm() * norm) {
+			eqn.setZero();
+			return false;
+		}
+		double inv_det = 1. / det;
+		for (int j = 0; j < 3; j++) {
+			eqn[j] = (L(j,0)*plane[0] + L(j,1)*plane[1] + L(j,2)*plane[2]) * inv_det;
+		}
+		return true;
+	}
+
+	Vec4 TrianglePlane(const Vec3& p, const Vec3& q, const Vec3& r) {
+		Vec3 nrm = (p-q).cross( p-r );
+		return Concatenate(nrm, -nrm.dot(p));
+	}
+
+	int PlanesToDepthEqns(const DepthEqnBasis& basis,
+												const PlaneArray& planes,
+												DepthEqnArray& eqns,
+												Eigen::Array<bool,Eigen::Dynamic,1>& degenerate) {
+		const Mat3& L = basis.L;
+		const Vec4& c = basis.c;
+		const int n = planes.cols();
+
+		// Each row of planes is contiguous so these vectorize across planes
+		Eigen::ArrayXd x = planes.row(0).transpose().array();
+		Eigen::ArrayXd y = planes.row(1).transpose().array();
+		Eigen::ArrayXd z = planes.row(2).transpose().array();
+		Eigen::ArrayXd w = planes.row(3).transpose().array();
+		Eigen::ArrayXd dets = c[0]*x + c[1]*y + c[2]*z + c[3]*w;
+		Eigen::ArrayXd norms = (x*x + y*y + z*z + w*w).sqrt();
+		degenerate = dets.abs() <= kDegenerateTol * c.norm() * norms;
+		Eigen::ArrayXd inv_dets = degenerate.select(0., 1. / dets);
+
+		eqns.resize(3, n);
+		for (int j = 0; j < 3; j++) {
+			eqns.row(j) = ((L(j,0)*x + L(j,1)*y + L(j,2)*z) * inv_dets).transpose();
+		}
+		return degenerate.count();
 	}
 
 	double EvaluateDepthEqn(const Vec3& depth_eqn, const Vec2& p) {
@@ -24,10 +97,8 @@ namespace indoor_context {
 	double GetPlaneDepth(const Vec3& p,
 											 const LinearCamera& camera,
 											 const Vec4& plane) {
-		Mat4 M;
-		M.topRows<3>() = camera;
-		M.bottomRows<1>() = plane;
-		return camera.row(2).dot( M.jacobiSvd(Eigen::ComputeFullU | Eigen::ComputeFullV)
-															 .solve(Concatenate(p, 0.)) );
+		// The point X on the plane that projects to p has homogeneous
+		// coordinate eqn.dot(p) and camera.row(2)*X = p[2]
+		return p[2] / PlaneToDepthEqn(camera, plane).dot(p);
 	}
 }
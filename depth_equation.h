@@ -3,12 +3,52 @@
 #include "matrix_types.h"
 
 namespace indoor_context {
+	// Planes stored one per column. Since matrices are row-major, each
+	// of the four coefficients is contiguous across planes (SoA layout).
+	typedef Eigen::Matrix<double,4,Eigen::Dynamic> PlaneArray;
+	// Depth equations stored one per column, also in SoA layout
+	typedef Eigen::Matrix<double,3,Eigen::Dynamic> DepthEqnArray;
+
+	// The parts of the depth equation computation that depend only on
+	// the camera. For a plane w=[n,d], the depth equation is
+	// L*n / c.dot(w), where c.dot(w) is the determinant of the camera
+	// matrix stacked on top of w and L*n are the corresponding
+	// cofactors. This is just the last row of the inverse of that 4x4
+	// matrix, computed in closed form.
+	struct DepthEqnBasis {
+		Mat3 L;
+		Vec4 c;
+	};
+
+	// Compute the depth equation basis for a camera
+	DepthEqnBasis ComputeDepthEqnBasis(const LinearCamera& camera);
+
+	// Get the plane through the three vertices of a triangle, in the
+	// form used by the renderer. The plane is zero if the triangle has
+	// zero area.
+	Vec4 TrianglePlane(const Vec3& p, const Vec3& q, const Vec3& r);
+
 	// Find an equation relating the (x,y) coordinates in an image to
 	// the depth of a plane. The depth at pixel (x,y) is
 	// 1./(eqn*makeVector(x,y,1)), where eqn is the return value from
 	// this function
 	Vec3 PlaneToDepthEqn(const LinearCamera& camera, const Vec4& plane);
 
+	// As above, using a basis computed once per camera. Returns false
+	// if the plane passes through (or almost through) the camera
+	// centre, in which case it projects to a line and eqn is set to
+	// zero, so that the plane appears infinitely far away.
+	bool PlaneToDepthEqn(const DepthEqnBasis& basis, const Vec4& plane, Vec3& eqn);
+
+	// Compute the depth equations for many planes at once. Degenerate
+	// planes (see above) are flagged in the corresponding element of
+	// degenerate and their equations are set to zero. Returns the
+	// number of degenerate planes.
+	int PlanesToDepthEqns(const DepthEqnBasis& basis,
+												const PlaneArray& planes,
+												DepthEqnArray& eqns,
+												Eigen::Array<bool,Eigen::Dynamic,1>& degenerate);
+
 	// Evaluate a depth equation as returned from PlaneToDepthEquation
 	// at a particular image location.
 	double EvaluateDepthEqn(const Vec3& depth_eqn, const Vec2& p);
@@ -0,0 +1,622 @@
+// Benchmark the renderer on deterministic synthetic indoor workloads
+// and report throughput for each render path, optionally as JSON so
+// that results can be compared across releases.
+//
+// Usage: renderer_bench [--quick] [--threads N] [--filter NAME] [--json FILE]
+//
+// Every workload is generated from a fixed seed with a platform-
+// independent generator, so the scenes are the same from one run and
+// one machine to the next. For each workload and path the benchmark
+// reports:
+//   ms/frame   median time to clear the buffers and render one frame
+//   Mtris/s    triangles submitted per second
+//   Mpix/s     pixels written (passing the depth test) per second
+//   ns/tri     time per submitted triangle; the "setup" workload covers
+//              no pixels, so there this is the cost of triangle setup.
+//              Room layouts submit no triangles, so this and Mtris/s are
+//              zero for them.
+//   GB/s       estimated memory traffic: the mesh, one depth read per
+//              covered pixel not skipped by hierarchical-Z culling, one
+//              label and depth write per pixel written, and clearing the
+//              buffers once per frame
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "matrix_types.h"
+#include "rasterizer.h"
+#include "simple_renderer.h"
+#include "multi_view_renderer.h"
+
+#include "vector_utils.tpp"
+
+using namespace indoor_context;
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+// Uniform random numbers from std::mt19937, whose output is fully
+// specified by the standard (unlike std::uniform_real_distribution)
+class Random {
+public:
+	explicit Random(uint32_t seed) : engine_(seed) { }
+	double Uniform(double a, double b) {
+		return a + (b-a) * (engine_() / 4294967296.);
+	}
+	// Log-uniform in [a,b], for sizes spread evenly across scales
+	double LogUniform(double a, double b) {
+		return a * exp(Uniform(0, log(b/a)));
+	}
+	int Int(int n) {
+		return engine_() % n;
+	}
+private:
+	mt19937 engine_;
+};
+
+// A room made of vertical walls around the camera, a floor and a ceiling
+struct Room {
+	double floor_z, ceiling_z;
+	vector<Vec2> corners;  // closed: the first corner is repeated at the end
+	vector<int> wall_labels;
+};
+
+enum WorkloadKind {
+	kMeshWorkload,  // every frame renders the whole mesh
+	kRoomMeshWorkload,  // frame i renders room i as a mesh
+	kRoomLayoutWorkload,  // frame i renders room i with RenderManhattanLayout
+	kSweepWorkload  // every frame renders the whole mesh from many cameras
+};
+
+struct Workload {
+	string name;
+	WorkloadKind kind;
+	int frames;  // frames per timed run
+	vector<Vec3> vertices;
+	vector<Vec3I> indices;
+	vector<int> labels;
+	// For room workloads, the triangles of room i are
+	// [room_offsets[i], room_offsets[i+1])
+	vector<Room> rooms;
+	vector<int> room_offsets;
+	// For the sweep workload
+	vector<LinearCamera> cameras;
+	// Per-frame averages, measured once since all paths give identical
+	// output
+	double triangles;
+	double vertices_used;
+	double fragments;
+	double pixels_written;
+};
+
+struct RenderPath {
+	string name;
+	RasterPath raster;
+	int threads;
+	bool hiz;
+	BufferLayout layout;
+};
+
+struct Result {
+	string workload;
+	string path;
+	double ms_per_frame;
+	double mtris_per_s;
+	double mpix_per_s;
+	double ns_per_triangle;
+	double bytes_per_frame;
+	double gb_per_s;
+};
+
+static const Vec2I kViewport(640, 480);
+static const double kFocalLength = 500;
+static const Vec3 kCameraCentre(0, 0, 1.5);
+
+// Rotation of a camera looking horizontally along the given heading
+// (in radians from the y axis), with z up
+static Mat3 CameraRotation(double heading) {
+	const double c = cos(heading), s = sin(heading);
+	Mat3 R;
+	R << c, -s, 0,
+		0, 0, -1,
+		s, c, 0;
+	return R;
+}
+
+// Camera at kCameraCentre with the given heading
+static LinearCamera MakeCamera(double heading) {
+	Mat3 K;
+	K << kFocalLength, 0, kViewport[0]/2.,
+		0, kFocalLength, kViewport[1]/2.,
+		0, 0, 1;
+	const Mat3 R = CameraRotation(heading);
+	LinearCamera camera;
+	camera.leftCols<3>() = K*R;
+	camera.col(3) = -K*R*kCameraCentre;
+	return camera;
+}
+
+// The world point seen at pixel (x,y) at the given depth by the camera
+// with the given heading
+static Vec3 PixelToWorld(double heading, double x, double y, double depth) {
+	const Vec3 ray((x - kViewport[0]/2.) / kFocalLength, (y - kViewport[1]/2.) / kFocalLength, 1);
+	return kCameraCentre + CameraRotation(heading).transpose() * ray * depth;
+}
+
+// A random Manhattan room containing the camera, optionally with a
+// rectangular notch cut from one corner
+static Room MakeRoom(Random& random) {
+	Room room;
+	room.floor_z = random.Uniform(0, 0.3);
+	room.ceiling_z = random.Uniform(2.4, 3.5);
+	const double x0 = -random.Uniform(1, 5), x1 = random.Uniform(1, 5);
+	const double y0 = -random.Uniform(0.5, 3), y1 = random.Uniform(2, 8);
+	room.corners.push_back(MakeVector(x0, y0));
+	room.corners.push_back(MakeVector(x1, y0));
+	if (random.Int(2)) {
+		// Notch the far right corner
+		const double nx = x1 - random.Uniform(0.2, 0.8)*(x1-0.5);
+		const double ny = y1 - random.Uniform(0.2, 0.8)*(y1-1);
+		room.corners.push_back(MakeVector(x1, ny));
+		room.corners.push_back(MakeVector(nx, ny));
+		room.corners.push_back(MakeVector(nx, y1));
+	} else {
+		room.corners.push_back(MakeVector(x1, y1));
+	}
+	room.corners.push_back(MakeVector(x0, y1));
+	room.corners.push_back(room.corners[0]);
+	for (int i = 0; i+1 < room.corners.size(); i++) {
+		room.wall_labels.push_back(3+i);
+	}
+	return room;
+}
+
+static void AddQuad(const Vec3& a, const Vec3& b, const Vec3& c, const Vec3& d, int label,
+										vector<Vec3>& vertices, vector<Vec3I>& indices, vector<int>& labels) {
+	const int base = vertices.size();
+	vertices.push_back(a);
+	vertices.push_back(b);
+	vertices.push_back(c);
+	vertices.push_back(d);
+	indices.push_back(Vec3I(base, base+1, base+2));
+	indices.push_back(Vec3I(base, base+2, base+3));
+	labels.push_back(label);
+	labels.push_back(label);
+}
+
+// Triangulate a room: two triangles per wall, and the bounding
+// rectangle of the corners for the floor and ceiling
+static void AddRoomMesh(const Room& room,
+												vector<Vec3>& vertices, vector<Vec3I>& indices, vector<int>& labels) {
+	double x0 = INFINITY, x1 = -INFINITY, y0 = INFINITY, y1 = -INFINITY;
+	for (int i = 0; i+1 < room.corners.size(); i++) {
+		const Vec2& a = room.corners[i];
+		const Vec2& b = room.corners[i+1];
+		AddQuad(Vec3(a[0], a[1], room.floor_z), Vec3(b[0], b[1], room.floor_z),
+						Vec3(b[0], b[1], room.ceiling_z), Vec3(a[0], a[1], room.ceiling_z),
+						room.wall_labels[i], vertices, indices, labels);
+		x0 = min(x0, a[0]);
+		x1 = max(x1, a[0]);
+		y0 = min(y0, a[1]);
+		y1 = max(y1, a[1]);
+	}
+	for (int k = 0; k < 2; k++) {
+		const double z = k == 0 ? room.floor_z : room.ceiling_z;
+		AddQuad(Vec3(x0, y0, z), Vec3(x1, y0, z), Vec3(x1, y1, z), Vec3(x0, y1, z),
+						1+k, vertices, indices, labels);
+	}
+}
+
+// Random triangles whose projections have edges of roughly min_size to
+// max_size pixels (log-uniform), at depths from 2 to 20
+static void AddTriangleSoup(double heading, int n, double min_size, double max_size,
+														Random& random,
+														vector<Vec3>& vertices, vector<Vec3I>& indices, vector<int>& labels) {
+	for (int i = 0; i < n; i++) {
+		const double x = random.Uniform(0, kViewport[0]);
+		const double y = random.Uniform(0, kViewport[1]);
+		const double depth = random.Uniform(2, 20);
+		const double radius = random.LogUniform(min_size, max_size) / sqrt(3.);
+		const double angle = random.Uniform(0, 2*M_PI);
+		const int base = vertices.size();
+		for (int k = 0; k < 3; k++) {
+			const double a = angle + k*2*M_PI/3 + random.Uniform(-0.5, 0.5);
+			vertices.push_back(PixelToWorld(heading, x + radius*cos(a), y + radius*sin(a),
+																	 depth * random.Uniform(0.95, 1.05)));
+		}
+		indices.push_back(Vec3I(base, base+1, base+2));
+		labels.push_back(1 + i%16);
+	}
+}
+
+// Layers of screen-filling quads, each split into a grid of 8x6 quads,
+// at increasing depth if front_to_back and decreasing depth otherwise
+static void AddStack(double heading, int layers, bool front_to_back,
+										 vector<Vec3>& vertices, vector<Vec3I>& indices, vector<int>& labels) {
+	const int nx = 8, ny = 6;
+	for (int l = 0; l < layers; l++) {
+		const double depth = 2 + 0.1 * (front_to_back ? l : layers-1-l);
+		for (int i = 0; i < ny; i++) {
+			for (int j = 0; j < nx; j++) {
+				const double xa = kViewport[0]*j/nx, xb = kViewport[0]*(j+1)/nx;
+				const double ya = kViewport[1]*i/ny, yb = kViewport[1]*(i+1)/ny;
+				AddQuad(PixelToWorld(heading, xa, ya, depth), PixelToWorld(heading, xb, ya, depth),
+								PixelToWorld(heading, xb, yb, depth), PixelToWorld(heading, xa, yb, depth),
+								1 + l%16, vertices, indices, labels);
+			}
+		}
+	}
+}
+
+// Triangles that lie strictly between pixel centres, so that each one
+// is set up but covers no pixels
+static void AddSetupOnly(double heading, int n, Random& random,
+												 vector<Vec3>& vertices, vector<Vec3I>& indices, vector<int>& labels) {
+	for (int i = 0; i < n; i++) {
+		const double x = random.Int(kViewport[0]-1);
+		const double y = random.Int(kViewport[1]-1);
+		const double depth = random.Uniform(2, 20);
+		const int base = vertices.size();
+		vertices.push_back(PixelToWorld(heading, x+0.2, y+0.2, depth));
+		vertices.push_back(PixelToWorld(heading, x+0.8, y+0.3, depth));
+		vertices.push_back(PixelToWorld(heading, x+0.4, y+0.8, depth));
+		indices.push_back(Vec3I(base, base+1, base+2));
+		labels.push_back(1 + i%16);
+	}
+}
+
+static vector<Workload> MakeWorkloads(bool quick) {
+	const int scale = quick ? 5 : 1;
+	vector<Workload> workloads;
+	Workload w;
+	w.kind = kMeshWorkload;
+
+	// Rooms, as in layout hypothesis scoring: one room per frame
+	{
+		Random random(1);
+		Workload rooms = w;
+		rooms.name = "rooms_mesh";
+		rooms.kind = kRoomMeshWorkload;
+		rooms.frames = 1000 / scale;
+		rooms.room_offsets.push_back(0);
+		for (int i = 0; i < rooms.frames; i++) {
+			rooms.rooms.push_back(MakeRoom(random));
+			AddRoomMesh(rooms.rooms.back(), rooms.vertices, rooms.indices, rooms.labels);
+			rooms.room_offsets.push_back(rooms.indices.size());
+		}
+		workloads.push_back(rooms);
+		rooms.name = "rooms_layout";
+		rooms.kind = kRoomLayoutWorkload;
+		workloads.push_back(rooms);
+	}
+
+	// Triangle soups with small, medium and large triangles
+	const struct { const char* name; int n; double min_size, max_size; } soups[] = {
+		{ "soup_small", 100000, 1, 4 },
+		{ "soup_medium", 20000, 8, 32 },
+		{ "soup_large", 1000, 64, 256 }
+	};
+	for (int i = 0; i < 3; i++) {
+		Random random(2+i);
+		Workload soup = w;
+		soup.name = soups[i].name;
+		soup.frames = 20 / scale;
+		AddTriangleSoup(0, soups[i].n / scale, soups[i].min_size, soups[i].max_size,
+										random, soup.vertices, soup.indices, soup.labels);
+		workloads.push_back(soup);
+	}
+
+	// High depth complexity
+	for (int k = 0; k < 2; k++) {
+		Workload stack = w;
+		stack.name = k == 0 ? "stack_back_to_front" : "stack_front_to_back";
+		stack.frames = 20 / scale;
+		AddStack(0, 32, k == 1, stack.vertices, stack.indices, stack.labels);
+		workloads.push_back(stack);
+	}
+
+	// Triangle setup alone
+	{
+		Random random(5);
+		Workload setup = w;
+		setup.name = "setup";
+		setup.frames = 20 / scale;
+		AddSetupOnly(0, 100000 / scale, random, setup.vertices, setup.indices, setup.labels);
+		workloads.push_back(setup);
+	}
+
+	// A furnished room seen from 16 cameras panning around its centre
+	{
+		Random random(6);
+		Workload sweep = w;
+		sweep.name = "camera_sweep";
+		sweep.kind = kSweepWorkload;
+		sweep.frames = 10 / scale;
+		Room room = MakeRoom(random);
+		AddRoomMesh(room, sweep.vertices, sweep.indices, sweep.labels);
+		for (int i = 0; i < 16; i++) {
+			const double heading = i*2*M_PI/16;
+			sweep.cameras.push_back(MakeCamera(heading));
+			AddTriangleSoup(heading, 5000 / scale / 16, 8, 32,
+											random, sweep.vertices, sweep.indices, sweep.labels);
+		}
+		workloads.push_back(sweep);
+	}
+	return workloads;
+}
+
+static MeshView<int> RoomMesh(const Workload& w, int room) {
+	const int offset = w.room_offsets[room];
+	const MeshView<int> mesh = {
+		w.vertices.data(), static_cast<int>(w.vertices.size()),
+		w.indices.data() + offset, w.labels.data() + offset,
+		w.room_offsets[room+1] - offset
+	};
+	return mesh;
+}
+
+// Render frame i of a workload (except the sweep)
+static void RenderFrame(const Workload& w, int i, SimpleRenderer& renderer) {
+	renderer.Clear(0);
+	if (w.kind == kMeshWorkload) {
+		renderer.RenderMesh(w.vertices, w.indices, w.labels);
+	} else if (w.kind == kRoomMeshWorkload) {
+		renderer.RenderMesh(RoomMesh(w, i % w.rooms.size()));
+	} else if (w.kind == kRoomLayoutWorkload) {
+		const Room& room = w.rooms[i % w.rooms.size()];
+		renderer.RenderManhattanLayout(room.floor_z, room.ceiling_z, room.corners,
+																	 room.wall_labels, 1, 2);
+	}
+}
+
+// Count the triangles, vertices, covered pixels and written pixels of
+// each frame, which are the same for every path
+static void MeasureWorkload(Workload& w) {
+	SimpleRenderer renderer(MakeCamera(0), kViewport);
+	w.triangles = w.vertices_used = w.fragments = w.pixels_written = 0;
+	if (w.kind == kSweepWorkload) {
+		for (int i = 0; i < w.cameras.size(); i++) {
+			renderer.Configure(w.cameras[i], kViewport);
+			renderer.Clear(0);
+			renderer.BeginOcclusionQuery(false);
+			renderer.RenderMesh(w.vertices, w.indices, w.labels);
+			w.fragments += renderer.EndOcclusionQuery();
+			w.vertices_used += renderer.vertices_transformed();
+			renderer.BeginOcclusionQuery(true);
+			renderer.RenderMesh(w.vertices, w.indices, w.labels);
+			w.pixels_written += renderer.EndOcclusionQuery();
+			w.triangles += w.indices.size();
+		}
+		return;
+	}
+	const int n = w.kind == kMeshWorkload ? 1 : w.rooms.size();
+	for (int i = 0; i < n; i++) {
+		renderer.Clear(0);
+		if (w.kind == kRoomLayoutWorkload) {
+			const Room& room = w.rooms[i];
+			const long pixels = renderer.RenderManhattanLayout(room.floor_z, room.ceiling_z, room.corners,
+																												 room.wall_labels, 1, 2);
+			w.fragments += pixels;
+			w.pixels_written += pixels;
+			continue;
+		}
+		const MeshView<int> mesh = w.kind == kMeshWorkload ?
+			MeshView<int>{ w.vertices.data(), static_cast<int>(w.vertices.size()),
+										 w.indices.data(), w.labels.data(), static_cast<int>(w.indices.size()) } :
+			RoomMesh(w, i);
+		// The first query does not modify the buffers
+		renderer.BeginOcclusionQuery(false);
+		renderer.RenderMesh(mesh);
+		w.fragments += renderer.EndOcclusionQuery();
+		w.vertices_used += renderer.vertices_transformed();
+		renderer.BeginOcclusionQuery(true);
+		renderer.RenderMesh(mesh);
+		w.pixels_written += renderer.EndOcclusionQuery();
+		w.triangles += mesh.num_triangles;
+	}
+	w.triangles /= n;
+	w.vertices_used /= n;
+	w.fragments /= n;
+	w.pixels_written /= n;
+}
+
+// Time one run of a workload on a path, in ms per frame. The number
+// of pixels skipped by hierarchical-Z culling in each frame is added
+// to culled_pixels.
+static double TimeRun(const Workload& w, const RenderPath& path, double& culled_pixels) {
+	if (w.kind == kSweepWorkload) {
+		MultiViewRenderer renderer(w.cameras, kViewport);
+		renderer.SetNumThreads(path.threads);
+		renderer.EnableHiZ(path.hiz);
+		for (int v = 0; v < renderer.num_views(); v++) {
+			renderer.view(v).SetBufferLayout(path.layout);
+		}
+		vector<int> naffected;
+		const Clock::time_point start = Clock::now();
+		for (int i = 0; i < w.frames; i++) {
+			renderer.Clear(0);
+			renderer.RenderMesh(w.vertices, w.indices, w.labels, naffected);
+			for (int v = 0; v < renderer.num_views(); v++) {
+				culled_pixels += renderer.view(v).hiz_culled_pixels();
+			}
+		}
+		return chrono::duration<double, milli>(Clock::now() - start).count() / w.frames;
+	}
+	SimpleRenderer renderer(MakeCamera(0), kViewport);
+	renderer.SetNumThreads(path.threads);
+	renderer.EnableHiZ(path.hiz);
+	renderer.SetBufferLayout(path.layout);
+	RenderFrame(w, 0, renderer);  // allocate scratch space
+	const Clock::time_point start = Clock::now();
+	for (int i = 0; i < w.frames; i++) {
+		RenderFrame(w, i, renderer);
+		culled_pixels += renderer.hiz_culled_pixels();
+	}
+	return chrono::duration<double, milli>(Clock::now() - start).count() / w.frames;
+}
+
+static Result Benchmark(const Workload& w, const RenderPath& path, int repeats) {
+	SetRasterPath(path.raster);
+	vector<double> times;
+	double culled_pixels = 0;
+	for (int i = 0; i < repeats; i++) {
+		times.push_back(TimeRun(w, path, culled_pixels));
+	}
+	culled_pixels /= repeats * w.frames;
+	sort(times.begin(), times.end());
+
+	Result r;
+	r.workload = w.name;
+	r.path = path.name;
+	r.ms_per_frame = times[times.size()/2];
+	const double seconds = r.ms_per_frame * 1e-3;
+	const int views = w.kind == kSweepWorkload ? w.cameras.size() : 1;
+	const double pixel_bytes = sizeof(int) + sizeof(double);
+	r.bytes_per_frame =
+		w.vertices_used * sizeof(Vec3) +
+		w.triangles * (sizeof(Vec3I) + sizeof(int)) +
+		max(0., w.fragments - culled_pixels) * sizeof(double) +
+		w.pixels_written * pixel_bytes +
+		views * kViewport[0] * kViewport[1] * pixel_bytes;
+	r.mtris_per_s = w.triangles / seconds * 1e-6;
+	r.mpix_per_s = w.pixels_written / seconds * 1e-6;
+	r.ns_per_triangle = w.triangles > 0 ? seconds / w.triangles * 1e9 : 0;
+	r.gb_per_s = r.bytes_per_frame / seconds * 1e-9;
+	return r;
+}
+
+static const char* RasterPathName(RasterPath path) {
+	return path == kRasterScalar ? "scalar" : (path == kRasterSSE ? "sse" : "avx2");
+}
+
+static vector<RenderPath> MakePaths(int threads) {
+	// Each raster path on one thread, then the options on the fastest
+	const RasterPath fastest = GetRasterPath();
+	vector<RenderPath> paths;
+	const RasterPath rasters[] = { kRasterScalar, kRasterSSE, kRasterAVX2 };
+	for (int i = 0; i < 3; i++) {
+		if (SetRasterPath(rasters[i])) {
+			RenderPath path = { RasterPathName(rasters[i]), rasters[i], 1, false, kRowMajorLayout };
+			paths.push_back(path);
+		}
+	}
+	SetRasterPath(fastest);
+	const string name = RasterPathName(fastest);
+	RenderPath path = { name+"+hiz", fastest, 1, true, kRowMajorLayout };
+	paths.push_back(path);
+	path.name = name+"+tiled";
+	path.hiz = false;
+	path.layout = kTiledLayout;
+	paths.push_back(path);
+	if (threads > 1) {
+		std::ostringstream mt;
+		mt << name << "+hiz+mt" << threads;
+		path.name = mt.str();
+		path.threads = threads;
+		path.hiz = true;
+		path.layout = kRowMajorLayout;
+		paths.push_back(path);
+	}
+	return paths;
+}
+
+static void WriteJson(ostream& out, const vector<Workload>& workloads,
+											const vector<Result>& results, int threads) {
+	out.precision(10);
+	out << "{\n";
+	out << "  \"benchmark\": \"renderer_bench\",\n";
+	out << "  \"version\": 1,\n";
+	out << "  \"viewport\": [" << kViewport[0] << ", " << kViewport[1] << "],\n";
+	out << "  \"threads\": " << threads << ",\n";
+	out << "  \"default_raster_path\": \"" << RasterPathName(GetRasterPath()) << "\",\n";
+	out << "  \"workloads\": [\n";
+	for (int i = 0; i < workloads.size(); i++) {
+		const Workload& w = workloads[i];
+		out << "    {\"name\": \"" << w.name << "\", \"frames\": " << w.frames
+				<< ", \"triangles_per_frame\": " << w.triangles
+				<< ", \"fragments_per_frame\": " << w.fragments
+				<< ", \"pixels_written_per_frame\": " << w.pixels_written << "}"
+				<< (i+1 < workloads.size() ? ",\n" : "\n");
+	}
+	out << "  ],\n";
+	out << "  \"results\": [\n";
+	for (int i = 0; i < results.size(); i++) {
+		const Result& r = results[i];
+		out << "    {\"workload\": \"" << r.workload << "\", \"path\": \"" << r.path << "\""
+				<< ", \"ms_per_frame\": " << r.ms_per_frame
+				<< ", \"mtris_per_s\": " << r.mtris_per_s
+				<< ", \"mpix_per_s\": " << r.mpix_per_s
+				<< ", \"ns_per_triangle\": " << r.ns_per_triangle
+				<< ", \"bytes_per_frame\": " << r.bytes_per_frame
+				<< ", \"gb_per_s\": " << r.gb_per_s << "}"
+				<< (i+1 < results.size() ? ",\n" : "\n");
+	}
+	out << "  ]\n";
+	out << "}\n";
+}
+
+int main(int argc, char **argv) {
+	bool quick = false;
+	int threads = max(1u, thread::hardware_concurrency());
+	string filter, json_path;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--quick") == 0) {
+			quick = true;
+		} else if (strcmp(argv[i], "--threads") == 0 && i+1 < argc) {
+			threads = max(1, atoi(argv[++i]));
+		} else if (strcmp(argv[i], "--filter") == 0 && i+1 < argc) {
+			filter = argv[++i];
+		} else if (strcmp(argv[i], "--json") == 0 && i+1 < argc) {
+			json_path = argv[++i];
+		} else {
+			cerr << "Usage: " << argv[0] << " [--quick] [--threads N] [--filter NAME] [--json FILE]" << endl;
+			return 1;
+		}
+	}
+
+	vector<Workload> workloads = MakeWorkloads(quick);
+	vector<Workload> selected;
+	for (int i = 0; i < workloads.size(); i++) {
+		if (workloads[i].name.find(filter) != string::npos) {
+			selected.push_back(workloads[i]);
+		}
+	}
+	const vector<RenderPath> paths = MakePaths(threads);
+	const int repeats = quick ? 3 : 5;
+
+	printf("%-22s %-18s %10s %10s %10s %10s %8s\n",
+				 "workload", "path", "ms/frame", "Mtris/s", "Mpix/s", "ns/tri", "GB/s");
+	vector<Result> results;
+	for (int i = 0; i < selected.size(); i++) {
+		MeasureWorkload(selected[i]);
+		for (int j = 0; j < paths.size(); j++) {
+			const Result r = Benchmark(selected[i], paths[j], repeats);
+			printf("%-22s %-18s %10.3f %10.2f %10.1f %10.1f %8.2f\n",
+						 r.workload.c_str(), r.path.c_str(), r.ms_per_frame, r.mtris_per_s,
+						 r.mpix_per_s, r.ns_per_triangle, r.gb_per_s);
+			fflush(stdout);
+			results.push_back(r);
+		}
+	}
+
+	if (!json_path.empty()) {
+		ofstream out(json_path.c_str());
+		if (!out) {
+			cerr << "Could not write " << json_path << endl;
+			return 1;
+		}
+		WriteJson(out, selected, results, threads);
+	}
+	return 0;
+}
@@ -0,0 +1,63 @@
+// Convert OBJ and PLY meshes to a binary scene file, with one mesh per
+// input file (see scene_file.h).
+//
+// Usage: scene_convert [--max-triangles N] [--no-planes] OUTPUT INPUT...
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+
+#include "matrix_types.h"
+#include "mesh_import.h"
+#include "scene_file.h"
+
+using namespace indoor_context;
+using namespace std;
+
+int main(int argc, char **argv) {
+	int max_triangles = 0;
+	bool with_planes = true;
+	int arg = 1;
+	for (; arg < argc && argv[arg][0] == '-'; arg++) {
+		if (strcmp(argv[arg], "--max-triangles") == 0 && arg+1 < argc) {
+			max_triangles = atoi(argv[++arg]);
+		} else if (strcmp(argv[arg], "--no-planes") == 0) {
+			with_planes = false;
+		} else {
+			break;
+		}
+	}
+	if (argc-arg < 2) {
+		cerr << "Usage: " << argv[0] << " [--max-triangles N] [--no-planes] OUTPUT INPUT..." << endl;
+		return 1;
+	}
+
+	SceneWriter writer;
+	writer.SetMaxChunkTriangles(max_triangles);
+	if (!writer.Open(argv[arg])) {
+		cerr << endl;
+		return 1;
+	}
+	long total = 0;
+	for (int i = arg+1; i < argc; i++) {
+		// Only one input is held in memory at a time
+		vector<Vec3> vertices;
+		vector<Vec3I> indices;
+		vector<int> labels;
+		if (!ReadMeshFile(argv[i], vertices, indices, labels) ||
+				!writer.AddMesh(vertices, indices, labels, with_planes)) {
+			cerr << endl;
+			return 1;
+		}
+		total += indices.size();
+	}
+	if (!writer.Close()) {
+		cerr << endl;
+		return 1;
+	}
+	cout << "Wrote " << total << " triangles in " << writer.num_chunks()
+			 << " chunks to " << argv[arg] << endl;
+	return 0;
+}
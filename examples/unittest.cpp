@@ -0,0 +1,1503 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <algorithm>
+
+#include "matrix_types.h"
+#include <Eigen/LU>
+#include "clipping.h"
+#include "simple_renderer.h"
+#include "command_buffer.h"
+#include "async_renderer.h"
+#include "retained_renderer.h"
+#include "pyramid_renderer.h"
+#include "scene_file.h"
+#include "mesh_import.h"
+#include "multi_view_renderer.h"
+
+#include "vector_utils.tpp"
+
+using namespace indoor_context;
+using namespace Eigen;
+using std::vector;
+
+// The number of failed checks
+static int num_failures = 0;
+
+// Record a failure if cond is false
+static void Check(bool cond, const char* test, const char* what) {
+	if (!cond) {
+		std::cerr << "FAILED: " << test << ": " << what << std::endl;
+		num_failures++;
+	}
+}
+
+// Make a camera with focal length f and principal point at the centre
+// of the viewport, looking horizontally along the given heading (z is
+// up) and rotated by roll about its optical axis
+static LinearCamera MakeCamera(Vec2I viewport, double f, double heading, double roll) {
+	Mat3 K;
+	K << f, 0, viewport[0]/2.,
+		0, f, viewport[1]/2.,
+		0, 0, 1;
+	Mat3 R, Rz;
+	R << cos(heading), -sin(heading), 0,
+		0, 0, -1,
+		sin(heading), cos(heading), 0;
+	Rz << cos(roll), -sin(roll), 0,
+		sin(roll), cos(roll), 0,
+		0, 0, 1;
+	const Vec3 centre(.3, -.2, 1.5);
+	LinearCamera camera;
+	camera.leftCols<3>() = K * Rz * R;
+	camera.col(3) = -camera.leftCols<3>() * centre;
+	return camera;
+}
+
+// A grid of quads at the given depth, each split into two triangles
+// with distinct labels. The grid lines are at pixel coordinates xs and
+// ys in the image of the camera.
+static void MakeQuadGrid(const LinearCamera& camera, double depth,
+												 const vector<double>& xs, const vector<double>& ys,
+												 vector<Vec3>& vertices, vector<Vec3I>& indices,
+												 vector<int>& labels) {
+	const Mat3 inv = camera.leftCols<3>().inverse();
+	const Vec3 centre = -inv * camera.col(3);
+	vertices.clear();
+	for (int y = 0; y < ys.size(); y++) {
+		for (int x = 0; x < xs.size(); x++) {
+			vertices.push_back(centre + inv * Vec3(xs[x], ys[y], 1) * depth);
+		}
+	}
+	indices.clear();
+	labels.clear();
+	const int nx = xs.size();
+	for (int y = 0; y+1 < ys.size(); y++) {
+		for (int x = 0; x+1 < nx; x++) {
+			int v = y*nx + x;
+			indices.push_back(MakeVector(v, v+1, v+nx+1));
+			labels.push_back(indices.size());
+			indices.push_back(MakeVector(v, v+nx+1, v+nx));
+			labels.push_back(indices.size());
+		}
+	}
+}
+
+// Grid lines that divide [a,b] into n cells, optionally moved at random
+// by up to 40% of a cell (except for the first and last)
+static vector<double> GridLines(double a, double b, int n, bool jitter, std::mt19937& rng) {
+	std::uniform_real_distribution<double> offset(-.4, .4);
+	vector<double> lines(n+1);
+	for (int i = 0; i <= n; i++) {
+		double t = jitter && i > 0 && i < n ? offset(rng) : 0;
+		lines[i] = a + (b-a)*(i+t)/n;
+	}
+	return lines;
+}
+
+// Random triangles in view of cameras made by MakeCamera with headings
+// near zero, with labels starting at 1. Every tenth triangle is large.
+static void MakeSoup(int n, std::mt19937& rng,
+										 vector<Vec3>& vertices, vector<Vec3I>& indices, vector<int>& labels) {
+	std::uniform_real_distribution<double> uniform(-1, 1);
+	vertices.clear();
+	indices.clear();
+	labels.clear();
+	for (int i = 0; i < n; i++) {
+		const Vec3 centre(uniform(rng)*4, 4.5+uniform(rng)*1.5, 1.5+uniform(rng)*2);
+		const double size = i%10 == 0 ? 2 : .4;
+		const int base = vertices.size();
+		for (int j = 0; j < 3; j++) {
+			vertices.push_back(centre + Vec3(uniform(rng), uniform(rng), uniform(rng))*size);
+		}
+		indices.push_back(MakeVector(base, base+1, base+2));
+		labels.push_back(i+1);
+	}
+}
+
+// Discards everything printed to std::cerr while it exists, for tests
+// that expect warnings
+class QuietErrors {
+public:
+	QuietErrors() : original_(std::cerr.rdbuf(buffer_.rdbuf())) { }
+	~QuietErrors() { std::cerr.rdbuf(original_); }
+private:
+	std::ostringstream buffer_;
+	std::streambuf* original_;
+};
+
+// Write a file in the working directory. Returns false on error.
+static bool WriteFile(const char* path, const std::string& contents) {
+	std::ofstream out(path, std::ios::binary);
+	out.write(contents.data(), contents.size());
+	return static_cast<bool>(out);
+}
+
+// Append the bytes of a value to a string
+template <typename T>
+static void AppendBytes(std::string& bytes, T value) {
+	bytes.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// The raster paths that the CPU supports
+static vector<RasterPath> SupportedRasterPaths() {
+	const RasterPath original = GetRasterPath();
+	vector<RasterPath> paths;
+	const RasterPath all[] = { kRasterScalar, kRasterSSE, kRasterAVX2 };
+	for (int i = 0; i < 3; i++) {
+		if (SetRasterPath(all[i])) {
+			paths.push_back(all[i]);
+		}
+	}
+	SetRasterPath(original);
+	return paths;
+}
+
+// Triangles that share edges and tile the view must cover every pixel
+// exactly once. Half of the trials use screen-aligned grids whose outer
+// vertices lie exactly on the boundary of the view, as for full-screen
+// quads, so that clipping produces vertices that round to the same
+// point. The others use random grids that extend beyond the view.
+static void TestSharedEdgeCoverage(RasterPath path) {
+	const char* kTest = "SharedEdgeCoverage";
+	SetRasterPath(path);
+	Vec2I viewport = MakeVector(80, 60);
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<double> angle(0, 2*M_PI);
+	vector<double> xs, ys;
+	vector<Vec3> vertices;
+	vector<Vec3I> indices;
+	vector<int> labels;
+	long uncovered = 0, overlapping = 0;
+	for (int trial = 0; trial < 40; trial++) {
+		const bool aligned = trial%2 == 0;
+		const LinearCamera camera = MakeCamera(viewport, 60, angle(rng), aligned ? 0 : angle(rng));
+		const double depth = 1 + trial*.1;
+		if (aligned) {
+			xs = GridLines(0, viewport[0], 8, false, rng);
+			ys = GridLines(0, viewport[1], 6, false, rng);
+		} else {
+			xs = GridLines(-viewport[0], 2*viewport[0], 11, true, rng);
+			ys = GridLines(-viewport[1], 2*viewport[1], 9, true, rng);
+		}
+		MakeQuadGrid(camera, depth, xs, ys, vertices, indices, labels);
+		SimpleRenderer re(camera, viewport);
+
+		// Count the pixels written by each triangle on its own
+		ArrayXXi count = ArrayXXi::Zero(viewport[1], viewport[0]);
+		for (int i = 0; i < indices.size(); i++) {
+			re.Clear(0);
+			const Vec3I& tri = indices[i];
+			re.Render(vertices[tri[0]], vertices[tri[1]], vertices[tri[2]], labels[i]);
+			count += (re.framebuffer() != 0).cast<int>();
+		}
+		uncovered += (count == 0).count();
+		overlapping += (count > 1).count();
+
+		// The whole mesh must also leave no background pixels, whether
+		// drawn serially or in parallel
+		for (int threads = 1; threads <= 4; threads *= 4) {
+			re.SetNumThreads(threads);
+			re.Clear(0);
+			re.RenderMesh(vertices, indices, labels);
+			uncovered += (re.framebuffer() == 0).count();
+		}
+	}
+	Check(uncovered == 0, kTest, "pixels left uncovered");
+	Check(overlapping == 0, kTest, "pixels written by more than one triangle");
+}
+
+// Render a mesh and then some individual triangles with the given
+// options, and return the frame buffer and depth buffer
+template <typename Renderer>
+static void RenderWithOptions(const LinearCamera& camera, const Vec2I& viewport,
+															const vector<Vec3>& vertices, const vector<Vec3I>& indices,
+															const vector<int>& labels,
+															RasterPath path, int threads, bool hiz, BufferLayout layout,
+															typename Renderer::LabelBuffer& frame,
+															typename Renderer::DepthBuffer& depth) {
+	SetRasterPath(path);
+	Renderer re(camera, viewport);
+	re.SetNumThreads(threads);
+	re.EnableHiZ(hiz);
+	re.SetBufferLayout(layout);
+	re.Clear(0);
+	re.RenderMesh(vertices, indices, labels);
+	for (int i = 0; i < 200; i++) {
+		const Vec3I& tri = indices[i];
+		re.Render(vertices[tri[0]], vertices[tri[1]], vertices[tri[2]], 1000+i);
+	}
+	re.CopyFrameBuffer(frame);
+	re.CopyDepthBuffer(depth);
+}
+
+// Every raster path, thread count, buffer layout, and hierarchical-Z
+// culling must give exactly the same output as the serial scalar
+// renderer. The mesh has layers of small quads facing the camera over
+// part of the view, whose depths differ by 0.05%, drawn out of order
+// but ending with the nearest, so that culling that is even slightly
+// too eager changes the output. These are followed by small and large
+// triangles at random depths, mostly behind them. Each of the latter is
+// drawn twice with different labels so that depth ties must be broken
+// in the same order.
+template <typename Renderer>
+static void TestRenderOptionsAgree(const char* kTest) {
+	const Vec2I viewport = MakeVector(203, 157);
+	std::mt19937 rng(3);
+	std::uniform_real_distribution<double> uniform(-1, 1);
+	vector<Vec3> soup_vertices;
+	vector<Vec3I> soup_indices;
+	for (int i = 0; i < 4000; i++) {
+		const Vec3 centre(uniform(rng)*4, 4.5+uniform(rng)*1.5, 1.5+uniform(rng)*2);
+		const double size = i%10 == 0 ? 2 : (i%3 == 0 ? 1 : .2);
+		const int base = soup_vertices.size();
+		for (int j = 0; j < 3; j++) {
+			soup_vertices.push_back(centre + Vec3(uniform(rng), uniform(rng), uniform(rng))*size);
+		}
+		soup_indices.push_back(MakeVector(base, base+1, base+2));
+	}
+
+	const RasterPath original = GetRasterPath();
+	const vector<RasterPath> paths = SupportedRasterPaths();
+	vector<Vec3> vertices, layer_vertices;
+	vector<Vec3I> indices, layer_indices;
+	vector<int> labels, layer_labels;
+	for (int view = 0; view < 3; view++) {
+		const LinearCamera camera = MakeCamera(viewport, 120, (view-1)*.3, view*.3);
+		vertices.clear();
+		indices.clear();
+		labels.clear();
+		const int order[] = { 3, 5, 2, 4, 1, 0 };
+		for (int layer = 0; layer < 6; layer++) {
+			const double depth = 1.5 * (1 + .0005*order[layer]);
+			MakeQuadGrid(camera, depth,
+									 GridLines(-10, viewport[0]*.6, 8, true, rng),
+									 GridLines(-10, viewport[1]+10, 9, true, rng),
+									 layer_vertices, layer_indices, layer_labels);
+			const int base = vertices.size();
+			vertices.insert(vertices.end(), layer_vertices.begin(), layer_vertices.end());
+			for (int i = 0; i < layer_indices.size(); i++) {
+				indices.push_back(layer_indices[i] + Vec3I::Constant(base));
+				labels.push_back(indices.size());
+			}
+		}
+		const int base = vertices.size();
+		vertices.insert(vertices.end(), soup_vertices.begin(), soup_vertices.end());
+		for (int i = 0; i < soup_indices.size(); i++) {
+			for (int j = 0; j < 2; j++) {
+				indices.push_back(soup_indices[i] + Vec3I::Constant(base));
+				labels.push_back(indices.size());
+			}
+		}
+
+		typename Renderer::LabelBuffer ref_frame, frame;
+		typename Renderer::DepthBuffer ref_depth, depth;
+		RenderWithOptions<Renderer>(camera, viewport, vertices, indices, labels,
+																kRasterScalar, 1, false, kRowMajorLayout,
+																ref_frame, ref_depth);
+		for (int i = 0; i < paths.size(); i++) {
+			for (int options = 0; options < 8; options++) {
+				const int threads = options & 1 ? 4 : 1;
+				const bool hiz = options & 2;
+				const BufferLayout layout = options & 4 ? kTiledLayout : kRowMajorLayout;
+				RenderWithOptions<Renderer>(camera, viewport, vertices, indices, labels,
+																		paths[i], threads, hiz, layout, frame, depth);
+				if (!(frame == ref_frame).all() || !(depth == ref_depth).all()) {
+					std::cerr << "FAILED: " << kTest << ": output differs with raster path " << paths[i]
+										<< ", " << threads << " threads, hiz " << hiz
+										<< ", layout " << layout << std::endl;
+					num_failures++;
+				}
+			}
+		}
+	}
+	SetRasterPath(original);
+}
+
+// The batch and per-mask triangle clippers must give the same polygons
+// as ClipToFrustrum
+static void TestBatchClipping() {
+	const char* kTest = "BatchClipping";
+	Vec2I viewport = MakeVector(320, 240);
+	LinearCamera camera = MakeCamera(viewport, 250, .3, 0);
+	Frustrum frustrum;
+	ComputeFrustrum(camera, viewport, frustrum);
+
+	// Random triangles around the camera, of which about a third cross
+	// the boundary of the view. The last triangle has an invalid index,
+	// and the count is not a multiple of the block size.
+	std::mt19937 rng(2);
+	std::uniform_real_distribution<double> uniform(-1, 1);
+	vector<Vec3> vertices;
+	vector<Vec3I> triangles;
+	for (int i = 0; i < 20000; i++) {
+		const Vec3 centre(uniform(rng)*8, uniform(rng)*8, 1.5+uniform(rng)*3);
+		const int base = vertices.size();
+		for (int j = 0; j < 3; j++) {
+			vertices.push_back(centre + Vec3(uniform(rng), uniform(rng), uniform(rng))*3);
+		}
+		triangles.push_back(MakeVector(base, base+1, base+2));
+	}
+	triangles.push_back(MakeVector(0, 1, static_cast<int>(vertices.size())));
+
+	const int n = triangles.size();
+	vector<Vec3> batch(n*kMaxClippedVertices);
+	vector<int> counts(n);
+	const int num_visible = ClipTrianglesToFrustrum(&vertices[0], vertices.size(),
+																									&triangles[0], n,
+																									frustrum, &batch[0], &counts[0]);
+
+	int expected_visible = 0;
+	long mismatches = 0;
+	vector<Vec3> poly(3), clipped, temp;
+	Vec3 single[kMaxClippedVertices];
+	for (int i = 0; i < n; i++) {
+		const Vec3I& tri = triangles[i];
+		if (tri.maxCoeff() >= vertices.size()) {
+			mismatches += counts[i] != 0;
+			continue;
+		}
+		int any = 0, all = kAllFrustrumPlanes;
+		for (int j = 0; j < 3; j++) {
+			poly[j] = vertices[tri[j]];
+			const int code = ComputeOutcode(frustrum, poly[j]);
+			any |= code;
+			all &= code;
+		}
+		const int m = all ? 0 : ClipToFrustrum(poly, frustrum, any, clipped, temp);
+		const int m_single = all ? 0 : ClipTriangleToFrustrum(poly[0], poly[1], poly[2],
+																												 frustrum, any, single);
+		if (m != counts[i] || m != m_single) {
+			mismatches++;
+			continue;
+		}
+		for (int j = 0; j < m; j++) {
+			mismatches += clipped[j] != batch[i*kMaxClippedVertices+j] || clipped[j] != single[j];
+		}
+		expected_visible += m > 0;
+	}
+	Check(mismatches == 0, kTest, "clipped polygons differ from ClipToFrustrum");
+	Check(num_visible == expected_visible, kTest, "wrong number of visible polygons");
+}
+
+// Frames rendered by AsyncRenderer must not depend on which target
+// they use, even if an earlier frame in another target left a scissor
+// rectangle or an occlusion query open. Each frame is compared with the
+// same commands executed by a new renderer.
+static void TestAsyncRendererTargets() {
+	const char* kTest = "AsyncRendererTargets";
+	const Vec2I viewport = MakeVector(120, 90);
+	const LinearCamera camera = MakeCamera(viewport, 80, 0, 0);
+	std::mt19937 rng(4);
+	vector<Vec3> vertices;
+	vector<Vec3I> indices;
+	vector<int> labels;
+	AsyncRenderer async(camera, viewport, 2);
+	CommandBuffer commands, direct_commands;
+	vector<Vec2> layout_corners;
+	layout_corners.push_back(MakeVector(-3., -1.));
+	layout_corners.push_back(MakeVector(3., -1.));
+	layout_corners.push_back(MakeVector(3., 5.));
+	layout_corners.push_back(MakeVector(-3., 5.));
+	layout_corners.push_back(layout_corners[0]);
+	const vector<int> wall_labels(4, 1004);
+	for (int f = 0; f < 7; f++) {
+		MakeSoup(300, rng, vertices, indices, labels);
+		CommandBuffer* buffers[] = { &commands, &direct_commands };
+		for (int i = 0; i < 2; i++) {
+			CommandBuffer& c = *buffers[i];
+			c.Reset();
+			c.Clear(0);
+			c.RenderInfinitePlane(0, 1001);
+			c.RenderManhattanLayout(0, 3, layout_corners, wall_labels, 1002, 1003);
+			c.BeginOcclusionQuery(true);
+			c.RenderMesh(vertices, indices, labels);
+			c.EndOcclusionQuery();
+			c.Render(vertices[0], vertices[1], vertices[2], 1000);
+			if (f%3 == 1) {
+				c.SetScissor(0, 50, 0, 50);
+			} else if (f%3 == 2) {
+				c.BeginOcclusionQuery(false);
+			}
+		}
+		AsyncRenderer::Frame frame = async.Submit(commands).get();
+		SimpleRenderer direct(camera, viewport);
+		CommandResults results;
+		direct_commands.Execute(direct, results);
+		const SimpleRenderer& target = async.target(frame.slot);
+		Check((target.framebuffer() == direct.framebuffer()).all(), kTest,
+					"frame buffer differs from a new renderer");
+		Check((target.depthbuffer() == direct.depthbuffer()).all(), kTest,
+					"depth buffer differs from a new renderer");
+		Check(frame.results.query_pixels == results.query_pixels, kTest,
+					"query counts differ from a new renderer");
+		Check(frame.results.triangles_affected == results.triangles_affected &&
+					frame.results.planes_affected == results.planes_affected &&
+					frame.results.pixels_written == results.pixels_written, kTest,
+					"results differ from a new renderer");
+		async.Release(frame);
+	}
+}
+
+// Reading the buffers of a tiled renderer must not change its layout,
+// and changes made through mutable_framebuffer() and
+// mutable_depthbuffer() in row-major layout must be kept.
+static void TestBufferAccessLayout() {
+	const char* kTest = "BufferAccessLayout";
+	const Vec2I viewport = MakeVector(100, 70);
+	const LinearCamera camera = MakeCamera(viewport, 70, 0, 0);
+	std::mt19937 rng(5);
+	vector<Vec3> vertices;
+	vector<Vec3I> indices;
+	vector<int> labels;
+	MakeSoup(200, rng, vertices, indices, labels);
+	SimpleRenderer re(camera, viewport);
+	re.SetBufferLayout(kTiledLayout);
+	re.Clear(0);
+	re.RenderMesh(vertices, indices, labels);
+	const Eigen::ArrayXXi frame = re.framebuffer();
+	const Eigen::ArrayXXd depth = re.depthbuffer();
+	Check(re.buffer_layout() == kTiledLayout, kTest, "reading the buffers changed the layout");
+	long mismatches = 0;
+	for (int y = 0; y < viewport[1]; y++) {
+		for (int x = 0; x < viewport[0]; x++) {
+			mismatches += frame(y, x) != re.frame_view()(y, x) ||
+				depth(y, x) != re.depth_view()(y, x);
+		}
+	}
+	Check(mismatches == 0, kTest, "buffers differ from frame_view() and depth_view()");
+
+	re.SetBufferLayout(kRowMajorLayout);
+	re.mutable_framebuffer()(3, 5) = -7;
+	re.mutable_depthbuffer()(3, 5) = -1;
+	re.SetBufferLayout(kTiledLayout);
+	Check(re.framebuffer()(3, 5) == -7 && re.depthbuffer()(3, 5) == -1, kTest,
+				"changes to the mutable buffers were lost");
+}
+
+// Random sequences of changes to a RetainedRenderer must give the same
+// labels and primitive handles as drawing the live primitives in order
+// of their handles with a new renderer. Updates often reduce the number
+// of triangles so that triangle ids are re-used.
+static void TestRetainedRendererChanges() {
+	const char* kTest = "RetainedRendererChanges";
+	const Vec2I viewport = MakeVector(110, 80);
+	const LinearCamera camera = MakeCamera(viewport, 75, .1, 0);
+	std::mt19937 rng(6);
+	std::uniform_int_distribution<int> random_op(0, 9), random_size(1, 8), random_label(1, 20);
+	RetainedRenderer retained(camera, viewport, 0);
+	vector<vector<Vec3> > prim_vertices;
+	vector<vector<Vec3I> > prim_indices;
+	vector<vector<int> > prim_labels;
+	vector<bool> live;
+	vector<Vec3> vertices;
+	vector<Vec3I> indices;
+	vector<int> labels;
+	for (int step = 0; step < 400; step++) {
+		const int op = random_op(rng);
+		if (op < 4 || retained.num_primitives() == 0) {
+			MakeSoup(random_size(rng), rng, vertices, indices, labels);
+			for (int i = 0; i < labels.size(); i++) {
+				labels[i] = random_label(rng);
+			}
+			const int handle = retained.AddPrimitive(vertices, indices, labels);
+			Check(handle == prim_vertices.size(), kTest, "unexpected handle");
+			prim_vertices.push_back(vertices);
+			prim_indices.push_back(indices);
+			prim_labels.push_back(labels);
+			live.push_back(true);
+		} else {
+			std::uniform_int_distribution<int> random_handle(0, prim_vertices.size()-1);
+			int handle = random_handle(rng);
+			while (!live[handle]) {
+				handle = random_handle(rng);
+			}
+			if (op < 7) {
+				const int n = op < 6 ? std::max<int>(prim_indices[handle].size()/2, 1) : random_size(rng);
+				MakeSoup(n, rng, vertices, indices, labels);
+				for (int i = 0; i < labels.size(); i++) {
+					labels[i] = random_label(rng);
+				}
+				Check(retained.UpdatePrimitive(handle, vertices, indices, labels), kTest,
+							"UpdatePrimitive failed");
+				prim_vertices[handle] = vertices;
+				prim_indices[handle] = indices;
+				prim_labels[handle] = labels;
+			} else if (op < 9) {
+				Check(retained.RemovePrimitive(handle), kTest, "RemovePrimitive failed");
+				live[handle] = false;
+			}
+		}
+		if (step%5 != 4) {
+			continue;
+		}
+
+		// Draw each triangle with its index in a single mesh of the live
+		// primitives and map these back to labels and handles
+		retained.Resolve();
+		vertices.clear();
+		indices.clear();
+		labels.clear();
+		vector<int> tri_label, tri_handle;
+		for (int h = 0; h < prim_vertices.size(); h++) {
+			if (!live[h]) {
+				continue;
+			}
+			const int base = vertices.size();
+			vertices.insert(vertices.end(), prim_vertices[h].begin(), prim_vertices[h].end());
+			for (int i = 0; i < prim_indices[h].size(); i++) {
+				indices.push_back(prim_indices[h][i] + Vec3I::Constant(base));
+				labels.push_back(tri_label.size());
+				tri_label.push_back(prim_labels[h][i]);
+				tri_handle.push_back(h);
+			}
+		}
+		SimpleRenderer direct(camera, viewport);
+		direct.Clear(-1);
+		direct.RenderMesh(vertices, indices, labels);
+		const Eigen::ArrayXXi& ids = direct.framebuffer();
+		long mismatches = 0;
+		for (int y = 0; y < viewport[1]; y++) {
+			for (int x = 0; x < viewport[0]; x++) {
+				const int id = ids(y, x);
+				mismatches += retained.framebuffer()(y, x) != (id < 0 ? 0 : tri_label[id]) ||
+					retained.primitive_ids()(y, x) != (id < 0 ? -1 : tri_handle[id]);
+			}
+		}
+		Check(mismatches == 0, kTest, "output differs from rendering the live primitives");
+		Check(retained.num_primitives() == std::count(live.begin(), live.end(), true), kTest,
+					"wrong number of primitives");
+	}
+}
+
+// Every pixel of a coarse pyramid level that is not marked in its
+// mixed mask must have a footprint in level 0 with a single label,
+// which is the label of the coarse pixel. The viewports have odd sizes
+// so that the footprints at the edges are clipped.
+static void TestPyramidMixedMask() {
+	const char* kTest = "PyramidMixedMask";
+	std::mt19937 rng(7);
+	vector<Vec3> vertices;
+	vector<Vec3I> indices;
+	vector<int> labels;
+	vector<Vec2> corners;
+	corners.push_back(MakeVector(-3., -1.));
+	corners.push_back(MakeVector(3., -1.));
+	corners.push_back(MakeVector(3., 3.));
+	corners.push_back(MakeVector(1., 3.));
+	corners.push_back(MakeVector(1., 6.));
+	corners.push_back(MakeVector(-3., 6.));
+	corners.push_back(corners[0]);
+	vector<int> wall_labels;
+	for (int i = 0; i+1 < corners.size(); i++) {
+		wall_labels.push_back(2000+i);
+	}
+	const Vec2I viewports[] = { MakeVector(101, 77), MakeVector(64, 48), MakeVector(37, 53) };
+	for (int view = 0; view < 3; view++) {
+		const Vec2I viewport = viewports[view];
+		const LinearCamera camera = MakeCamera(viewport, viewport[0]*.7, (view-1)*.4, view*.2);
+		PyramidRenderer pyramid(camera, viewport, 4);
+		pyramid.EnableMixedMask(true);
+		pyramid.Clear(0);
+		pyramid.RenderInfinitePlane(-.5, 1000);
+		pyramid.RenderManhattanLayout(0, 3, corners, wall_labels, 1001, 1002);
+		MakeSoup(60, rng, vertices, indices, labels);
+		pyramid.RenderMesh(vertices, indices, labels);
+
+		const Eigen::ArrayXXi fine = pyramid.level(0).framebuffer();
+		long unmarked = 0, mismatches = 0;
+		for (int l = 1; l < pyramid.num_levels(); l++) {
+			const Eigen::ArrayXXi coarse = pyramid.level(l).framebuffer();
+			const PyramidRenderer::MaskBuffer& mask = pyramid.mixed_mask(l);
+			for (int y = 0; y < coarse.rows(); y++) {
+				for (int x = 0; x < coarse.cols(); x++) {
+					if (mask(y, x)) {
+						continue;
+					}
+					unmarked++;
+					int xa, xb, ya, yb;
+					pyramid.Footprint(l, x, y, xa, xb, ya, yb);
+					mismatches += (fine.block(ya, xa, yb-ya, xb-xa) != coarse(y, x)).any();
+				}
+			}
+		}
+		Check(unmarked > 0, kTest, "every pixel is marked as mixed");
+		Check(mismatches == 0, kTest, "unmarked pixel has a mixed footprint");
+	}
+}
+
+// The OBJ and PLY readers must give the same mesh for small files
+// using each feature they support, appended to an existing mesh, and
+// must reject files with bad indices or truncated data
+static void TestMeshImport() {
+	const char* kTest = "MeshImport";
+	const char* kObj =
+		"# A floor quad and two walls\n"
+		"o room\n"
+		"v 0 0 0\n"
+		"v 1 0 0\n"
+		"v 1 1 0\n"
+		"v 0 1 0\n"
+		"vt 0 0\n"
+		"vn 0 0 1\n"
+		"usemtl floor\n"
+		"f 1/1/1 2/1/1 3/1/1 4/1/1\n"
+		"usemtl wall\n"
+		"v 0 0 1\n"
+		"f -5//1 -4//1 -1//1\n"
+		"usemtl floor\n"
+		"f 2/1 3/1 5/1\n";
+	const char* kPlyHeader =
+		"ply\n"
+		"format %s 1.0\n"
+		"comment A floor quad and two walls\n"
+		"element vertex 5\n"
+		"property float x\n"
+		"property float y\n"
+		"property float z\n"
+		"property uchar red\n"
+		"element face 3\n"
+		"property list uchar int vertex_indices\n"
+		"property int label\n"
+		"element edge 1\n"
+		"property int vertex1\n"
+		"property int vertex2\n"
+		"end_header\n";
+	const char* kPlyBody =
+		"0 0 0 255\n"
+		"1 0 0 255\n"
+		"1 1 0 255\n"
+		"0 1 0 255\n"
+		"0 0 1 255\n"
+		"4 0 1 2 3 7\n"
+		"3 0 1 4 8\n"
+		"3 1 2 4 9\n"
+		"0 1\n";
+	const int kFaces[][5] = { { 4, 0, 1, 2, 3 }, { 3, 0, 1, 4 }, { 3, 1, 2, 4 } };
+	const int kFaceLabels[] = { 7, 8, 9 };
+	const double kVertices[][3] = { { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+
+	char header[1024];
+	sprintf(header, kPlyHeader, "ascii");
+	const std::string ascii_ply = std::string(header) + kPlyBody;
+	const uint16_t one = 1;
+	sprintf(header, kPlyHeader, *reinterpret_cast<const char*>(&one) == 1 ?
+					"binary_little_endian" : "binary_big_endian");
+	std::string binary_ply = header;
+	for (int i = 0; i < 5; i++) {
+		for (int j = 0; j < 3; j++) {
+			AppendBytes(binary_ply, static_cast<float>(kVertices[i][j]));
+		}
+		AppendBytes(binary_ply, static_cast<uint8_t>(255));
+	}
+	for (int i = 0; i < 3; i++) {
+		AppendBytes(binary_ply, static_cast<uint8_t>(kFaces[i][0]));
+		for (int j = 1; j <= kFaces[i][0]; j++) {
+			AppendBytes(binary_ply, static_cast<int32_t>(kFaces[i][j]));
+		}
+		AppendBytes(binary_ply, static_cast<int32_t>(kFaceLabels[i]));
+	}
+	AppendBytes(binary_ply, static_cast<int32_t>(0));
+	AppendBytes(binary_ply, static_cast<int32_t>(1));
+
+	// The expected mesh, after one existing vertex and triangle
+	vector<Vec3> expected_vertices(1, Vec3(5, 5, 5));
+	for (int i = 0; i < 5; i++) {
+		expected_vertices.push_back(Vec3(kVertices[i][0], kVertices[i][1], kVertices[i][2]));
+	}
+	vector<Vec3I> expected_indices(1, MakeVector(0, 0, 0));
+	expected_indices.push_back(MakeVector(1, 2, 3));
+	expected_indices.push_back(MakeVector(1, 3, 4));
+	expected_indices.push_back(MakeVector(1, 2, 5));
+	expected_indices.push_back(MakeVector(2, 3, 5));
+	const int obj_labels[] = { -1, 0, 0, 1, 0 };
+	const int ply_labels[] = { -1, 7, 7, 8, 9 };
+
+	const char* kPaths[] = { "unittest_mesh.obj", "unittest_ascii.ply", "unittest_binary.ply" };
+	const std::string contents[] = { kObj, ascii_ply, binary_ply };
+	for (int f = 0; f < 3; f++) {
+		Check(WriteFile(kPaths[f], contents[f]), kTest, "could not write a fixture");
+		vector<Vec3> vertices(1, Vec3(5, 5, 5));
+		vector<Vec3I> indices(1, MakeVector(0, 0, 0));
+		vector<int> labels(1, -1);
+		Check(ReadMeshFile(kPaths[f], vertices, indices, labels), kTest, "could not read a fixture");
+		const int* expected_labels = f == 0 ? obj_labels : ply_labels;
+		Check(vertices == expected_vertices && indices == expected_indices &&
+					labels == vector<int>(expected_labels, expected_labels+5), kTest,
+					"wrong mesh read from a fixture");
+	}
+
+	// Invalid files
+	const char* kBadObj = "v 0 0 0\nv 1 0 0\nf 1 2 3\n";
+	const std::string bad_contents[] = {
+		kBadObj,
+		ascii_ply.substr(0, ascii_ply.size()-10),
+		binary_ply.substr(0, binary_ply.size()-3),
+		std::string(header, strlen(header)-4)
+	};
+	for (int f = 0; f < 4; f++) {
+		const char* path = kPaths[std::min(f, 2)];
+		Check(WriteFile(path, bad_contents[f]), kTest, "could not write a fixture");
+		vector<Vec3> vertices;
+		vector<Vec3I> indices;
+		vector<int> labels;
+		QuietErrors quiet;
+		Check(!ReadMeshFile(path, vertices, indices, labels), kTest, "invalid file was accepted");
+	}
+	for (int f = 0; f < 3; f++) {
+		std::remove(kPaths[f]);
+	}
+}
+
+// Scene files written with and without planes, and split into chunks,
+// must render exactly as the meshes they were written from, whether
+// they are mapped or read one chunk at a time
+static void TestSceneFileRoundTrip() {
+	const char* kTest = "SceneFileRoundTrip";
+	const char* kPath = "unittest_scene.icscene";
+	const Vec2I viewport = MakeVector(150, 110);
+	const LinearCamera camera = MakeCamera(viewport, 100, .2, .1);
+	std::mt19937 rng(8);
+	vector<Vec3> grid_vertices, soup_vertices;
+	vector<Vec3I> grid_indices, soup_indices;
+	vector<int> grid_labels, soup_labels;
+	MakeQuadGrid(camera, 3, GridLines(-20, viewport[0]*.7, 9, true, rng),
+							 GridLines(-20, viewport[1]+20, 7, true, rng),
+							 grid_vertices, grid_indices, grid_labels);
+	MakeSoup(300, rng, soup_vertices, soup_indices, soup_labels);
+	for (int i = 0; i < soup_labels.size(); i++) {
+		soup_labels[i] += 1000;
+	}
+
+	SimpleRenderer direct(camera, viewport);
+	direct.Clear(0);
+	const long expected_affected = direct.RenderMesh(grid_vertices, grid_indices, grid_labels) +
+		direct.RenderMesh(soup_vertices, soup_indices, soup_labels);
+
+	const int kChunkSizes[] = { 0, 50 };
+	for (int options = 0; options < 4; options++) {
+		const bool with_planes = options & 1;
+		const int max_triangles = kChunkSizes[options/2];
+		SceneWriter writer;
+		Check(writer.Open(kPath), kTest, "could not open the scene file");
+		writer.SetMaxChunkTriangles(max_triangles);
+		Check(writer.AddMesh(grid_vertices, grid_indices, grid_labels, with_planes) &&
+					writer.AddMesh(soup_vertices, soup_indices, soup_labels, with_planes) &&
+					writer.Close(), kTest, "could not write the scene file");
+
+		MappedSceneFile mapped;
+		if (!mapped.Open(kPath)) {
+			Check(false, kTest, "could not map the scene file");
+			continue;
+		}
+		const int expected_chunks = max_triangles == 0 ? 2 :
+			(grid_indices.size()+max_triangles-1)/max_triangles +
+			(soup_indices.size()+max_triangles-1)/max_triangles;
+		Check(mapped.num_chunks() == expected_chunks, kTest, "wrong number of chunks");
+		SimpleRenderer re(camera, viewport);
+		re.Clear(0);
+		long affected = 0;
+		for (int i = 0; i < mapped.num_chunks(); i++) {
+			Check((mapped.chunk(i).planes != NULL) == with_planes, kTest, "wrong planes in a chunk");
+			affected += RenderSceneChunk(mapped.chunk(i), re);
+		}
+		Check((re.framebuffer() == direct.framebuffer()).all() &&
+					(re.depthbuffer() == direct.depthbuffer()).all(), kTest,
+					"mapped scene renders differently from its meshes");
+		Check(affected == expected_affected, kTest, "wrong triangle count from mapped scene");
+
+		re.Clear(0);
+		affected = RenderSceneFile(kPath, re);
+		Check((re.framebuffer() == direct.framebuffer()).all() &&
+					(re.depthbuffer() == direct.depthbuffer()).all(), kTest,
+					"scene file renders differently from its meshes");
+		Check(affected == expected_affected, kTest, "wrong triangle count from scene file");
+	}
+	std::remove(kPath);
+}
+
+// Scene files that are truncated or whose header or chunk table is
+// corrupt must be rejected by both readers
+static void TestSceneFileValidation() {
+	const char* kTest = "SceneFileValidation";
+	const char* kPath = "unittest_scene.icscene";
+	std::mt19937 rng(9);
+	vector<Vec3> vertices;
+	vector<Vec3I> indices;
+	vector<int> labels;
+	MakeSoup(100, rng, vertices, indices, labels);
+	SceneWriter writer;
+	writer.SetMaxChunkTriangles(40);
+	Check(writer.Open(kPath) && writer.AddMesh(vertices, indices, labels) && writer.Close(),
+				kTest, "could not write the scene file");
+	std::ifstream in(kPath, std::ios::binary);
+	const std::string valid((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	in.close();
+	SceneFileHeader header;
+	memcpy(&header, valid.data(), sizeof(header));
+	const size_t table = header.chunk_table_offset;
+
+	vector<std::string> corrupt;
+	corrupt.push_back(valid.substr(0, valid.size()-1));
+	corrupt.push_back(valid.substr(0, table));
+	corrupt.push_back(valid.substr(0, sizeof(header)-1));
+	corrupt.push_back(valid);
+	corrupt.back()[0] = 'X';
+	corrupt.push_back(valid);
+	corrupt.back()[offsetof(SceneFileHeader, version)]++;
+	corrupt.push_back(valid);
+	corrupt.back()[offsetof(SceneFileHeader, byte_order)] ^= 0xff;
+	corrupt.push_back(valid);
+	corrupt.back()[offsetof(SceneFileHeader, num_chunks)]++;
+	corrupt.push_back(valid);
+	corrupt.back()[offsetof(SceneFileHeader, chunk_table_offset)] += 8;
+	const size_t kRecordFields[] = {
+		offsetof(SceneChunkRecord, num_vertices),
+		offsetof(SceneChunkRecord, num_triangles),
+		offsetof(SceneChunkRecord, vertex_offset),
+		offsetof(SceneChunkRecord, index_offset),
+		offsetof(SceneChunkRecord, label_offset),
+		offsetof(SceneChunkRecord, plane_offset)
+	};
+	for (int i = 0; i < 6; i++) {
+		// Move a section of the last chunk past the end of the file, and
+		// misalign it
+		for (int misalign = 0; misalign < (i < 2 ? 1 : 2); misalign++) {
+			corrupt.push_back(valid);
+			const size_t field = table + 2*sizeof(SceneChunkRecord) + kRecordFields[i];
+			uint64_t value;
+			memcpy(&value, &corrupt.back()[field], sizeof(value));
+			value = misalign ? value+8 : (i < 2 ? value+valid.size() : valid.size()+kSceneAlignment);
+			memcpy(&corrupt.back()[field], &value, sizeof(value));
+		}
+	}
+
+	Check(header.num_chunks == 3, kTest, "wrong number of chunks");
+	for (int i = 0; i < corrupt.size(); i++) {
+		Check(WriteFile(kPath, corrupt[i]), kTest, "could not write the scene file");
+		bool accepted;
+		{
+			QuietErrors quiet;
+			MappedSceneFile mapped;
+			SceneFileReader reader;
+			SimpleRenderer re(MakeCamera(MakeVector(40, 30), 30, 0, 0), MakeVector(40, 30));
+			accepted = mapped.Open(kPath) || reader.Open(kPath) || RenderSceneFile(kPath, re) != -1;
+		}
+		if (accepted) {
+			std::cerr << "FAILED: " << kTest << ": corrupt file " << i << " was accepted" << std::endl;
+			num_failures++;
+		}
+	}
+	std::remove(kPath);
+}
+
+// Each view of a MultiViewRenderer must have the same buffers and
+// count of affected triangles as an independent renderer with its
+// camera, however many threads render the views
+static void TestMultiViewRenderer() {
+	const char* kTest = "MultiViewRenderer";
+	const Vec2I viewport = MakeVector(97, 71);
+	std::mt19937 rng(10);
+	vector<LinearCamera> cameras;
+	for (int i = 0; i < 5; i++) {
+		cameras.push_back(MakeCamera(viewport, 60+10*i, (i-2)*.25, i*.15));
+	}
+	vector<Vec3> vertices[2];
+	vector<Vec3I> indices[2];
+	vector<int> labels[2];
+	MakeSoup(5000, rng, vertices[0], indices[0], labels[0]);
+	MakeQuadGrid(cameras[2], 4, GridLines(-30, viewport[0]+30, 6, true, rng),
+							 GridLines(-30, viewport[1]*.5, 4, true, rng),
+							 vertices[1], indices[1], labels[1]);
+	for (int i = 0; i < labels[1].size(); i++) {
+		labels[1][i] += 1000;
+	}
+
+	for (int options = 0; options < 4; options++) {
+		MultiViewRenderer multi(cameras, viewport);
+		multi.SetNumThreads(options & 1 ? 4 : 1);
+		multi.EnableHiZ(options & 2);
+		multi.Clear(0);
+		vector<int> naffected[2];
+		int total[2];
+		for (int m = 0; m < 2; m++) {
+			total[m] = multi.RenderMesh(vertices[m], indices[m], labels[m], naffected[m]);
+		}
+		for (int i = 0; i < cameras.size(); i++) {
+			SimpleRenderer re(cameras[i], viewport);
+			re.Clear(0);
+			for (int m = 0; m < 2; m++) {
+				const int n = re.RenderMesh(vertices[m], indices[m], labels[m]);
+				Check(naffected[m].size() == cameras.size() && naffected[m][i] == n, kTest,
+							"affected triangles differ from a single view");
+			}
+			Check((multi.view(i).framebuffer() == re.framebuffer()).all() &&
+						(multi.view(i).depthbuffer() == re.depthbuffer()).all(), kTest,
+						"view differs from a single view");
+		}
+		for (int m = 0; m < 2; m++) {
+			int sum = 0;
+			for (int i = 0; i < naffected[m].size(); i++) {
+				sum += naffected[m][i];
+			}
+			Check(total[m] == sum, kTest, "total differs from the sum over views");
+		}
+	}
+}
+
+// RunOcclusionQueries must count the same pixels as depth-only queries
+// made with BeginOcclusionQuery(false), with any number of threads and
+// with or without hierarchical-Z culling, and must not modify the
+// buffers. With a threshold, each count must be exact if it is below
+// the threshold and otherwise at least the threshold.
+static void TestOcclusionQueries() {
+	const char* kTest = "OcclusionQueries";
+	const Vec2I viewport = MakeVector(128, 96);
+	const LinearCamera camera = MakeCamera(viewport, 90, 0, .1);
+	std::mt19937 rng(11);
+	vector<Vec3> vertices, occluder_vertices;
+	vector<Vec3I> indices, occluder_indices;
+	vector<int> labels, occluder_labels;
+	MakeQuadGrid(camera, 4.5, GridLines(-10, viewport[0]*.6, 6, true, rng),
+							 GridLines(-10, viewport[1]+10, 5, true, rng),
+							 occluder_vertices, occluder_indices, occluder_labels);
+	MakeSoup(800, rng, vertices, indices, labels);
+	vector<int> query_offsets(1, 0);
+	std::uniform_int_distribution<int> random_size(1, 12);
+	while (query_offsets.back() < indices.size()) {
+		query_offsets.push_back(std::min<int>(query_offsets.back()+random_size(rng), indices.size()));
+	}
+	const int nqueries = query_offsets.size()-1;
+
+	// Count each query with BeginOcclusionQuery(false)
+	SimpleRenderer direct(camera, viewport);
+	direct.Clear(0);
+	direct.RenderMesh(occluder_vertices, occluder_indices, occluder_labels);
+	vector<long> expected(nqueries);
+	long max_count = 0;
+	for (int i = 0; i < nqueries; i++) {
+		direct.BeginOcclusionQuery(false);
+		for (int j = query_offsets[i]; j < query_offsets[i+1]; j++) {
+			direct.Render(vertices[indices[j][0]], vertices[indices[j][1]], vertices[indices[j][2]], 1);
+		}
+		expected[i] = direct.EndOcclusionQuery();
+		max_count = std::max(max_count, expected[i]);
+	}
+	const Eigen::ArrayXXi frame = direct.framebuffer();
+	const Eigen::ArrayXXd depth = direct.depthbuffer();
+	Check((frame == 0).any() && max_count > 0, kTest, "bad test scene");
+
+	const long thresholds[] = { 0, 40, max_count+1 };
+	for (int options = 0; options < 4; options++) {
+		SimpleRenderer re(camera, viewport);
+		re.SetNumThreads(options & 1 ? 4 : 1);
+		re.EnableHiZ(options & 2);
+		re.Clear(0);
+		re.RenderMesh(occluder_vertices, occluder_indices, occluder_labels);
+		for (int t = 0; t < 3; t++) {
+			vector<long> counts;
+			re.RunOcclusionQueries(vertices, indices, query_offsets, thresholds[t], counts);
+			long mismatches = counts.size() != nqueries;
+			for (int i = 0; i < nqueries && i < counts.size(); i++) {
+				if (thresholds[t] > 0 && expected[i] >= thresholds[t]) {
+					mismatches += counts[i] < thresholds[t] || counts[i] > expected[i];
+				} else {
+					mismatches += counts[i] != expected[i];
+				}
+			}
+			Check(mismatches == 0, kTest, "counts differ from BeginOcclusionQuery(false)");
+			Check((re.framebuffer() == frame).all() && (re.depthbuffer() == depth).all(), kTest,
+						"queries modified the buffers");
+		}
+	}
+}
+
+// For each DepthFillPolicy, SmoothInfiniteDepths must give the same
+// depths with one or several threads and either buffer layout, leave
+// no infinite depths, and return the number of infinite depths that it
+// replaced. The second trial has no finite depths at all.
+template <typename DepthT, DepthStorage kStorage>
+static void TestDepthFill(const char* kTest) {
+	typedef SimpleRendererT<int, DepthT, kStorage> Renderer;
+	typedef typename Renderer::DepthBuffer DepthBuffer;
+	const DepthT min_inverse = 1. / kClampDepth;
+	const Vec2I viewport = MakeVector(203, 157);
+	const LinearCamera camera = MakeCamera(viewport, 120, .2, 0);
+	std::mt19937 rng(12);
+	vector<Vec3> vertices;
+	vector<Vec3I> indices;
+	vector<int> labels;
+	MakeSoup(150, rng, vertices, indices, labels);
+	const DepthFillPolicy policies[] = { kFillNearest, kFillMaxFinite, kFillClamp };
+	for (int trial = 0; trial < 2; trial++) {
+		for (int p = 0; p < 3; p++) {
+			DepthBuffer ref_depth;
+			for (int options = 0; options < 4; options++) {
+				Renderer re(camera, viewport);
+				re.SetNumThreads(options & 1 ? 4 : 1);
+				re.SetBufferLayout(options & 2 ? kTiledLayout : kRowMajorLayout);
+				re.Clear(0);
+				if (trial == 0) {
+					re.RenderMesh(vertices, indices, labels);
+				}
+				const DepthBuffer before = re.depthbuffer();
+				long expected = 0;
+				for (int y = 0; y < before.rows(); y++) {
+					for (int x = 0; x < before.cols(); x++) {
+						expected += kStorage == kStoreDepth ? before(y, x) > kClampDepth :
+							before(y, x) < min_inverse;
+					}
+				}
+				int n;
+				{
+					QuietErrors quiet;
+					n = re.SmoothInfiniteDepths(policies[p]);
+				}
+				const DepthBuffer& depth = re.depthbuffer();
+				Check(expected > 0 && n == expected, kTest, "wrong number of depths replaced");
+				long infinite = 0;
+				for (int y = 0; y < depth.rows(); y++) {
+					for (int x = 0; x < depth.cols(); x++) {
+						infinite += kStorage == kStoreDepth ? !(depth(y, x) <= kClampDepth) :
+							!(depth(y, x) >= min_inverse);
+					}
+				}
+				Check(infinite == 0, kTest, "infinite depths remain");
+				if (options == 0) {
+					ref_depth = depth;
+				} else {
+					Check((depth == ref_depth).all(), kTest,
+								"depths depend on the number of threads or the layout");
+				}
+			}
+		}
+	}
+}
+
+// The per-label statistics after each of several calls to RenderMesh
+// in a frame must match a scan of the frame buffer, whether the frame
+// buffer is resolved serially or tile by tile. Some labels are outside
+// the range that is counted.
+static void TestLabelStats() {
+	const char* kTest = "LabelStats";
+	const Vec2I viewport = MakeVector(150, 100);
+	const LinearCamera camera = MakeCamera(viewport, 90, -.1, .05);
+	const int kNumLabels = 250;
+	std::mt19937 rng(13);
+	std::uniform_real_distribution<double> uniform(-1, 1);
+	Eigen::ArrayXXd costs[2];
+	vector<const Eigen::ArrayXXd*> cost_images;
+	for (int k = 0; k < 2; k++) {
+		costs[k].resize(viewport[1], viewport[0]);
+		for (int y = 0; y < viewport[1]; y++) {
+			for (int x = 0; x < viewport[0]; x++) {
+				costs[k](y, x) = uniform(rng);
+			}
+		}
+		cost_images.push_back(&costs[k]);
+	}
+	vector<Vec3> vertices[3];
+	vector<Vec3I> indices[3];
+	vector<int> labels[3];
+	for (int m = 0; m < 3; m++) {
+		MakeSoup(100 + 50*m, rng, vertices[m], indices[m], labels[m]);
+		for (int i = 0; i < labels[m].size(); i++) {
+			labels[m][i] += 100*m;
+		}
+	}
+
+	for (int options = 0; options < 4; options++) {
+		SimpleRenderer re(camera, viewport);
+		re.SetNumThreads(options & 1 ? 4 : 1);
+		re.SetBufferLayout(options & 2 ? kTiledLayout : kRowMajorLayout);
+		Check(re.SetLabelStats(kNumLabels, cost_images), kTest, "SetLabelStats failed");
+		for (int frame = 0; frame < 2; frame++) {
+			re.Clear(0);
+			for (int m = frame; m < 3; m++) {
+				re.RenderMesh(vertices[m], indices[m], labels[m]);
+				LabelStats expected;
+				expected.Reset(kNumLabels, 2);
+				const Eigen::ArrayXXi& buffer = re.framebuffer();
+				for (int y = 0; y < viewport[1]; y++) {
+					for (int x = 0; x < viewport[0]; x++) {
+						const int label = buffer(y, x);
+						if (label >= 0 && label < kNumLabels) {
+							expected.counts[label]++;
+							for (int k = 0; k < 2; k++) {
+								expected.cost_sums(k, label) += costs[k](y, x);
+							}
+						}
+					}
+				}
+				const LabelStats& stats = re.label_stats();
+				Check(stats.num_labels() == kNumLabels && stats.num_costs() == 2 &&
+							(stats.counts == expected.counts).all(), kTest,
+							"label counts differ from the frame buffer");
+				Check(stats.num_costs() == 2 &&
+							((stats.cost_sums - expected.cost_sums).abs() < 1e-9).all(), kTest,
+							"cost sums differ from the frame buffer");
+			}
+		}
+	}
+}
+
+// RenderManhattanLayout must match the same room drawn as infinite
+// planes for the floor and ceiling and two triangles per wall, except
+// for pixels on the boundary between two surfaces, which may be
+// resolved differently. The room is L-shaped, so some walls hide
+// others.
+static void TestManhattanLayout() {
+	const char* kTest = "ManhattanLayout";
+	const Vec2I viewport = MakeVector(160, 120);
+	vector<Vec2> corners;
+	corners.push_back(MakeVector(-3., -1.));
+	corners.push_back(MakeVector(3., -1.));
+	corners.push_back(MakeVector(3., 3.));
+	corners.push_back(MakeVector(1., 3.));
+	corners.push_back(MakeVector(1., 6.));
+	corners.push_back(MakeVector(-3., 6.));
+	corners.push_back(corners[0]);
+	const double floor_z = 0, ceiling_z = 3;
+	vector<int> wall_labels;
+	for (int i = 0; i+1 < corners.size(); i++) {
+		wall_labels.push_back(10+i);
+	}
+	for (int view = 0; view < 8; view++) {
+		const LinearCamera camera = MakeCamera(viewport, 70, view*M_PI/4, (view%3-1)*.2);
+		SimpleRenderer direct(camera, viewport);
+		direct.Clear(0);
+		direct.RenderInfinitePlane(floor_z, 1);
+		direct.RenderInfinitePlane(ceiling_z, 2);
+		for (int i = 0; i+1 < corners.size(); i++) {
+			const Vec3 a0(corners[i][0], corners[i][1], floor_z);
+			const Vec3 b0(corners[i+1][0], corners[i+1][1], floor_z);
+			const Vec3 a1(corners[i][0], corners[i][1], ceiling_z);
+			const Vec3 b1(corners[i+1][0], corners[i+1][1], ceiling_z);
+			direct.Render(a0, b0, b1, wall_labels[i]);
+			direct.Render(a0, b1, a1, wall_labels[i]);
+		}
+		const Eigen::ArrayXXi& expected = direct.framebuffer();
+		const Eigen::ArrayXXd& expected_depth = direct.depthbuffer();
+
+		for (int threads = 1; threads <= 4; threads += 3) {
+			SimpleRenderer re(camera, viewport);
+			re.SetNumThreads(threads);
+			re.Clear(0);
+			const long npixels = re.RenderManhattanLayout(floor_z, ceiling_z, corners, wall_labels, 1, 2);
+			const Eigen::ArrayXXi& frame = re.framebuffer();
+			const Eigen::ArrayXXd& depth = re.depthbuffer();
+			long mismatches = 0, edges = 0;
+			for (int y = 0; y < viewport[1]; y++) {
+				for (int x = 0; x < viewport[0]; x++) {
+					bool edge = false;
+					for (int dy = -1; dy <= 1; dy++) {
+						for (int dx = -1; dx <= 1; dx++) {
+							const int yy = std::min(std::max(y+dy, 0), viewport[1]-1);
+							const int xx = std::min(std::max(x+dx, 0), viewport[0]-1);
+							edge |= expected(yy, xx) != expected(y, x);
+						}
+					}
+					edges += edge;
+					if (!edge) {
+						mismatches += frame(y, x) != expected(y, x) ||
+							std::abs(depth(y, x) - expected_depth(y, x)) > 1e-6*expected_depth(y, x);
+					}
+				}
+			}
+			Check((expected != 0).all(), kTest, "room does not cover the view");
+			Check(edges < viewport[0]*viewport[1]/4, kTest, "too many edge pixels");
+			Check(mismatches == 0, kTest, "layout differs from triangles away from edges");
+			Check(npixels >= viewport[0]*viewport[1], kTest, "too few pixels written");
+		}
+	}
+}
+
+// On a mesh whose triangles share vertices, each referenced vertex
+// must be transformed once per call and every other reference must be
+// a cache hit. Vertices that no triangle references are not counted.
+static void TestVertexCache() {
+	const char* kTest = "VertexCache";
+	const Vec2I viewport = MakeVector(120, 90);
+	const LinearCamera camera = MakeCamera(viewport, 80, .1, 0);
+	std::mt19937 rng(14);
+	vector<Vec3> vertices;
+	vector<Vec3I> indices;
+	vector<int> labels;
+	MakeQuadGrid(camera, 3, GridLines(-20, viewport[0]+20, 12, true, rng),
+							 GridLines(-20, viewport[1]+20, 9, true, rng), vertices, indices, labels);
+	// A fan around the first vertex, and vertices that are not used
+	for (int i = 2; i < 12; i++) {
+		indices.push_back(MakeVector(0, i-1, i));
+		labels.push_back(indices.size());
+	}
+	for (int i = 0; i < 20; i++) {
+		vertices.push_back(Vec3(i, 5, 1));
+	}
+	vector<bool> referenced(vertices.size(), false);
+	for (int i = 0; i < indices.size(); i++) {
+		for (int j = 0; j < 3; j++) {
+			referenced[indices[i][j]] = true;
+		}
+	}
+	const long unique = std::count(referenced.begin(), referenced.end(), true);
+	const long references = 3*indices.size();
+	vector<int> query_offsets;
+	query_offsets.push_back(0);
+	query_offsets.push_back(indices.size()/2);
+	query_offsets.push_back(indices.size());
+
+	for (int threads = 1; threads <= 4; threads += 3) {
+		SimpleRenderer re(camera, viewport);
+		re.SetNumThreads(threads);
+		re.Clear(0);
+		re.RenderMesh(vertices, indices, labels);
+		Check(re.vertices_transformed() == unique, kTest, "wrong number of vertices transformed");
+		Check(re.vertex_cache_hits() == references-unique, kTest, "wrong number of cache hits");
+		re.RenderMesh(vertices, indices, labels);
+		vector<long> counts;
+		re.RunOcclusionQueries(vertices, indices, query_offsets, 0, counts);
+		Check(re.vertices_transformed() == 3*unique, kTest,
+					"vertices transformed are not counted per call");
+		Check(re.vertex_cache_hits() == 3*(references-unique), kTest,
+					"cache hits are not counted per call");
+		re.Clear(0);
+		Check(re.vertices_transformed() == 0 && re.vertex_cache_hits() == 0, kTest,
+					"Clear() did not reset the counters");
+	}
+}
+
+// TransformVertices must give identical results with AVX2 and scalar
+// code, for vertices in front of, behind and on the plane of the
+// camera, and for counts that are not a multiple of the block size
+static void TestTransformVertices() {
+	const char* kTest = "TransformVertices";
+	const RasterPath original = GetRasterPath();
+	if (!SetRasterPath(kRasterAVX2)) {
+		return;
+	}
+	const Vec2I viewport = MakeVector(100, 80);
+	const LinearCamera camera = MakeCamera(viewport, 70, .3, .2);
+	Frustrum frustrum;
+	ComputeFrustrum(camera, viewport, frustrum);
+	const Vec3 centre(.3, -.2, 1.5);
+	std::mt19937 rng(15);
+	std::uniform_real_distribution<double> uniform(-1, 1);
+	vector<Vec3> vertices;
+	for (int i = 0; i < 1000; i++) {
+		vertices.push_back(centre + Vec3(uniform(rng), uniform(rng), uniform(rng))*(i%7 == 0 ? .01 : 6));
+	}
+	// Vertices exactly in the image plane of the camera
+	for (int i = 0; i < 8; i++) {
+		const Vec3 side(cos(.3), -sin(.3), 0);
+		vertices.push_back(centre + side*(i-4) + Vec3(0, 0, uniform(rng)));
+	}
+	vector<int> ids;
+	for (int i = vertices.size()-1; i >= 0; i -= 1 + i%3) {
+		ids.push_back(i);
+	}
+
+	TransformedVertices out[2];
+	for (int n = 0; n <= ids.size(); n += ids.size()/7 + 1) {
+		for (int k = 0; k < 2; k++) {
+			SetRasterPath(k == 0 ? kRasterScalar : kRasterAVX2);
+			out[k].Reserve(vertices.size());
+			TransformVertices(camera, frustrum, &vertices[0], &ids[0], n, out[k]);
+		}
+		long mismatches = 0;
+		for (int k = 0; k < n; k++) {
+			const int i = ids[k];
+			mismatches += out[0].depth[i] != out[1].depth[i] || out[0].outcodes[i] != out[1].outcodes[i];
+			if (out[0].depth[i] > 0) {
+				mismatches += out[0].x[i] != out[1].x[i] || out[0].y[i] != out[1].y[i];
+			}
+		}
+		Check(mismatches == 0, kTest, "AVX2 and scalar results differ");
+	}
+	SetRasterPath(original);
+}
+
+// On a scene with known numbers of triangles of each kind, the render
+// statistics must count each submitted triangle exactly once, and the
+// stage counters must agree with them. The overdraw buffer must count
+// the fragments at each pixel. Without statistics support, nothing may
+// be counted.
+static void TestRenderStats() {
+	const char* kTest = "RenderStats";
+	const Vec2I viewport = MakeVector(120, 90);
+	const LinearCamera camera = MakeCamera(viewport, 80, 0, 0);
+	const Mat3 inv = camera.leftCols<3>().inverse();
+	const Vec3 centre = -inv * camera.col(3);
+	std::mt19937 rng(16);
+	std::uniform_real_distribution<double> uniform(0, 1);
+
+	// A grid within the view, triangles behind the camera, triangles
+	// crossing the left edge of the view, collinear triangles, tiny
+	// triangles between pixel centres, and invalid triangles
+	vector<Vec3> vertices;
+	vector<Vec3I> indices;
+	vector<int> labels;
+	MakeQuadGrid(camera, 3, GridLines(10, viewport[0]-10, 5, true, rng),
+							 GridLines(10, viewport[1]-10, 4, true, rng), vertices, indices, labels);
+	const int num_grid = indices.size();
+	const int kNumEach = 7;
+	for (int kind = 0; kind < 4; kind++) {
+		for (int i = 0; i < kNumEach; i++) {
+			const double x = 10 + uniform(rng)*(viewport[0]-20);
+			const double y = 10 + uniform(rng)*(viewport[1]-20);
+			const double px = floor(x);
+			const double py = floor(y);
+			Vec3 image[3];
+			double depth = 2;
+			if (kind == 0) {
+				image[0] = Vec3(x, y, 1);
+				image[1] = Vec3(x+5, y, 1);
+				image[2] = Vec3(x, y+5, 1);
+				depth = -2;
+			} else if (kind == 1) {
+				image[0] = Vec3(-20, y, 1);
+				image[1] = Vec3(x, y, 1);
+				image[2] = Vec3(x, y+8, 1);
+			} else if (kind == 2) {
+				image[0] = Vec3(x, y, 1);
+				image[1] = Vec3(x+4, y+2, 1);
+				image[2] = Vec3(x+8, y+4, 1);
+			} else {
+				image[0] = Vec3(px+.1, py+.1, 1);
+				image[1] = Vec3(px+.3, py+.1, 1);
+				image[2] = Vec3(px+.1, py+.3, 1);
+			}
+			const int base = vertices.size();
+			for (int j = 0; j < 3; j++) {
+				vertices.push_back(centre + inv * image[j] * depth);
+			}
+			indices.push_back(MakeVector(base, base+1, base+2));
+			labels.push_back(1000+indices.size());
+		}
+	}
+	for (int i = 0; i < kNumEach; i++) {
+		indices.push_back(MakeVector(0, 1, static_cast<int>(vertices.size())));
+		labels.push_back(2000+i);
+	}
+
+	if (!kRenderStatsSupported) {
+		SimpleRenderer re(camera, viewport);
+		{
+			QuietErrors quiet;
+			Check(!re.EnableStats(true, true), kTest, "EnableStats() succeeded without support");
+			re.Clear(0);
+			re.RenderMesh(vertices, indices, labels);
+		}
+		Check(re.render_stats().triangles_submitted == 0 && re.overdraw_buffer().size() == 0, kTest,
+					"statistics were collected without support");
+		return;
+	}
+
+	for (int options = 0; options < 4; options++) {
+		SimpleRenderer re(camera, viewport);
+		re.SetNumThreads(options & 1 ? 4 : 1);
+		re.EnableHiZ(options & 2);
+		Check(re.EnableStats(true), kTest, "EnableStats() failed");
+		re.Clear(0);
+		re.BeginOcclusionQuery(true);
+		{
+			QuietErrors quiet;
+			re.RenderMesh(vertices, indices, labels);
+		}
+		const long written = re.EndOcclusionQuery();
+		const RenderStats& stats = re.render_stats();
+		Check(stats.triangles_submitted == indices.size(), kTest, "wrong number of triangles submitted");
+		Check(stats.triangles_invalid + stats.triangles_culled + stats.triangles_degenerate +
+					stats.triangles_empty + stats.triangles_hiz_culled + stats.triangles_rasterized ==
+					stats.triangles_submitted, kTest, "triangles are not counted exactly once");
+		Check(stats.triangles_invalid == kNumEach && stats.triangles_culled == kNumEach &&
+					stats.triangles_degenerate == kNumEach && stats.triangles_empty == kNumEach &&
+					stats.triangles_clipped == kNumEach &&
+					stats.triangles_rasterized + stats.triangles_hiz_culled == num_grid + kNumEach, kTest,
+					"wrong number of triangles of some kind");
+		Check(stats.pixels_written == written && stats.pixels_counted == 0, kTest,
+					"wrong number of pixels written");
+		Check(stats.stage_counts[kStageTransform] == re.vertices_transformed() &&
+					stats.stage_counts[kStageClip] == kNumEach &&
+					stats.stage_counts[kStageEdges] == num_grid + 3*kNumEach &&
+					stats.stage_counts[kStageDepthEqn] == num_grid + kNumEach, kTest,
+					"stage counts disagree with the triangle counts");
+		if (options == 0) {
+			Check(stats.stage_counts[kStageFill] == num_grid + kNumEach, kTest,
+						"wrong number of rectangles filled");
+		}
+	}
+
+	// Every pixel is covered twice by a grid over the whole view, and
+	// once more by a grid over a block of pixels
+	const int kBlockWidth = 40, kBlockHeight = 30;
+	vector<Vec3> block_vertices;
+	vector<Vec3I> block_indices;
+	vector<int> block_labels;
+	MakeQuadGrid(camera, 3, GridLines(0, viewport[0], 7, true, rng),
+							 GridLines(0, viewport[1], 5, true, rng), vertices, indices, labels);
+	MakeQuadGrid(camera, 2, GridLines(0, kBlockWidth, 3, true, rng),
+							 GridLines(0, kBlockHeight, 2, true, rng), block_vertices, block_indices, block_labels);
+	for (int threads = 1; threads <= 4; threads += 3) {
+		SimpleRenderer re(camera, viewport);
+		re.SetNumThreads(threads);
+		Check(re.EnableStats(true, true), kTest, "EnableStats() failed");
+		re.Clear(0);
+		re.RenderMesh(vertices, indices, labels);
+		re.RenderMesh(block_vertices, block_indices, block_labels);
+		re.RenderMesh(vertices, indices, labels);
+		const OverdrawBuffer& overdraw = re.overdraw_buffer();
+		OverdrawBuffer expected = OverdrawBuffer::Constant(viewport[1], viewport[0], 2);
+		expected.block(0, 0, kBlockHeight, kBlockWidth) += 1;
+		Check(overdraw.rows() == viewport[1] && overdraw.cols() == viewport[0] &&
+					(overdraw == expected).all(), kTest, "wrong overdraw buffer");
+		Check(re.render_stats().fragments == expected.sum(), kTest, "wrong number of fragments");
+		vector<long> histogram;
+		re.GetOverdrawHistogram(histogram);
+		const long block = kBlockWidth*kBlockHeight;
+		Check(histogram.size() == 4 && histogram[0] == 0 && histogram[1] == 0 &&
+					histogram[2] == viewport[0]*viewport[1] - block && histogram[3] == block, kTest,
+					"wrong overdraw histogram");
+	}
+}
+
+int main() {
+	const RasterPath original = GetRasterPath();
+	const vector<RasterPath> paths = SupportedRasterPaths();
+	for (int i = 0; i < paths.size(); i++) {
+		TestSharedEdgeCoverage(paths[i]);
+	}
+	SetRasterPath(original);
+	TestRenderOptionsAgree<SimpleRendererT<int, double, kStoreDepth> >("RenderOptionsAgree");
+	TestRenderOptionsAgree<SimpleRendererT<int, float, kStoreInverseDepth> >("RenderOptionsAgreeFloat");
+	TestBatchClipping();
+	TestAsyncRendererTargets();
+	TestBufferAccessLayout();
+	TestRetainedRendererChanges();
+	TestPyramidMixedMask();
+	TestMeshImport();
+	TestSceneFileRoundTrip();
+	TestSceneFileValidation();
+	TestMultiViewRenderer();
+	TestOcclusionQueries();
+	TestDepthFill<double, kStoreDepth>("DepthFill");
+	TestDepthFill<float, kStoreInverseDepth>("DepthFillFloat");
+	TestLabelStats();
+	TestManhattanLayout();
+	TestVertexCache();
+	TestTransformVertices();
+	TestRenderStats();
+
+	if (num_failures > 0) {
+		std::cerr << num_failures << " checks failed" << std::endl;
+		return 1;
+	}
+	std::cout << "All tests passed" << std::endl;
+	return 0;
+}
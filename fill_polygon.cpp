@@ -2,10 +2,12 @@
 #include <vector>
 #include <utility>
 #include <limits>
+#include <memory>
 
 #include <Eigen/Geometry>
 
 #include "matrix_types.h"
+#include "clipping.h"
 
 #include "numeric_utils.tpp"
 #include "vector_utils.tpp"
@@ -22,11 +24,26 @@ namespace indoor_context {
 		const int n = poly.size();
 		if (n < 3) return 0;
 
+		// Polygons from the clipper fit in fixed-size arrays on the stack;
+		// larger ones fall back to the heap
+		double stack_ms[kMaxClippedVertices], stack_cs[kMaxClippedVertices], stack_ys[kMaxClippedVertices];
+		bool stack_ishoriz[kMaxClippedVertices];
+		std::vector<double> heap_values;
+		std::unique_ptr<bool[]> heap_ishoriz;
+		double *ms = stack_ms, *cs = stack_cs, *ys = stack_ys;  // slopes, intercepts, y-coords
+		bool* ishoriz = stack_ishoriz;
+		if (n > kMaxClippedVertices) {
+			heap_values.resize(3*n);
+			heap_ishoriz.reset(new bool[n]);
+			ms = &heap_values[0];
+			cs = &heap_values[n];
+			ys = &heap_values[2*n];
+			ishoriz = heap_ishoriz.get();
+		}
+
 		int imin, imax;
 		int ymin = std::numeric_limits<int>::max();
 		int ymax = std::numeric_limits<int>::min();
-		double ms[n], cs[n], ys[n];  // slopes, intercepts, y-coords
-		bool ishoriz[n];
 		for (int i = 0; i < n; i++) {
 			const Vec3& u = poly[i];
 			const Vec3& v = poly[(i+1)%n];
@@ -75,7 +92,7 @@ namespace indoor_context {
 
 			double xxa = ms[left]*y + cs[left];
 			double xxb = ms[right]*y + cs[right];
-			if (isnan(xxa) || isnan(xxb)) {
+			if (std::isnan(xxa) || std::isnan(xxb)) {
 				// ignore and move to next row
 				encountered_nan = true;
 				continue;
@@ -90,5 +107,6 @@ namespace indoor_context {
 		if (encountered_nan) {
 			std::cerr << "Warning: NaN coordinates were computed during FillPolygon";
 		}
+		return count;
 	}
 }  // namespace indoor_context
@@ -0,0 +1,256 @@
+#include "hiz_buffer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "matrix_types.h"
+
+namespace indoor_context {
+	static const int kTilesPerBlock = kHiZBlockSize / kHiZTileSize;
+
+	// How much of a tile a polygon covers
+	enum TileCoverage {
+		kTileOutside,
+		kTilePartial,
+		kTileInside
+	};
+
+	// Get the coverage of the pixels [x0,x1]x[y0,y1] (inclusive) by a
+	// polygon. Since the edge functions are linear in pixel coordinates,
+	// each is smallest and largest over the tile at opposite corners.
+	static TileCoverage CoverTile(const EdgeSetup& edges, int y0, int y1, int x0, int x1) {
+		TileCoverage coverage = kTileInside;
+		for (int i = 0; i < edges.num_edges; i++) {
+			const bool inc_x = edges.a[i] >= 0;
+			const bool inc_y = edges.b[i] >= 0;
+			const int64_t lo = edges.a[i]*(inc_x ? x0 : x1) + edges.b[i]*(inc_y ? y0 : y1) + edges.c[i];
+			if (lo < 0) {
+				const int64_t hi = edges.a[i]*(inc_x ? x1 : x0) + edges.b[i]*(inc_y ? y1 : y0) + edges.c[i];
+				if (hi < 0) return kTileOutside;
+				coverage = kTilePartial;
+			}
+		}
+		return coverage;
+	}
+
+	void HiZBuffer::Configure(const Vec2I& viewport,
+														DepthStorage storage,
+														double margin) {
+		viewport_ = viewport;
+		storage_ = storage;
+		margin_ = margin;
+		tiles_.resize((viewport[1]+kHiZTileSize-1) / kHiZTileSize,
+									(viewport[0]+kHiZTileSize-1) / kHiZTileSize);
+		blocks_.resize((viewport[1]+kHiZBlockSize-1) / kHiZBlockSize,
+									 (viewport[0]+kHiZBlockSize-1) / kHiZBlockSize);
+		stale_.resize(tiles_.rows(), tiles_.cols());
+		Reset();
+	}
+
+	void HiZBuffer::Reset() {
+		tiles_.setConstant(INFINITY);
+		blocks_.setConstant(INFINITY);
+		stale_.setZero();
+	}
+
+	template <typename DepthT>
+	void HiZBuffer::Rebuild(const Eigen::Array<DepthT, Eigen::Dynamic, Eigen::Dynamic>& depthbuffer) {
+		Update(depthbuffer, 0, viewport_[1], 0, viewport_[0]);
+	}
+
+	template <typename DepthT>
+	void HiZBuffer::Rebuild(const DepthT* depth, const PixelLayout& layout) {
+		Update(depth, layout, 0, viewport_[1], 0, viewport_[0]);
+	}
+
+	template <typename DepthT>
+	void HiZBuffer::Update(const Eigen::Array<DepthT, Eigen::Dynamic, Eigen::Dynamic>& depthbuffer,
+												 int ya, int yb, int xa, int xb) {
+		Update(depthbuffer.data(), MakePixelLayout(kRowMajorLayout, viewport_), ya, yb, xa, xb);
+	}
+
+	template <typename DepthT>
+	void HiZBuffer::Update(const DepthT* depth, const PixelLayout& layout,
+												 int ya, int yb, int xa, int xb) {
+		if (xa >= xb || ya >= yb) return;
+		const int txa = xa / kHiZTileSize;
+		const int txb = (xb-1) / kHiZTileSize + 1;
+		const int tya = ya / kHiZTileSize;
+		const int tyb = (yb-1) / kHiZTileSize + 1;
+		for (int ty = tya; ty < tyb; ty++) {
+			for (int tx = txa; tx < txb; tx++) {
+				UpdateTile(depth, layout, tx, ty);
+			}
+		}
+		UpdateBlocksOfTiles(tya, tyb, txa, txb);
+	}
+
+	template <typename DepthT>
+	void HiZBuffer::UpdateTile(const DepthT* depth, const PixelLayout& layout, int tx, int ty) {
+		const int y0 = ty * kHiZTileSize;
+		const int h = std::min(kHiZTileSize, viewport_[1]-y0);
+		const int x0 = tx * kHiZTileSize;
+		const int w = std::min(kHiZTileSize, viewport_[0]-x0);
+		const int col = layout.ColOffset(x0);
+		DepthT lo = depth[layout.RowOffset(y0) + col];
+		DepthT hi = lo;
+		for (int y = y0; y < y0+h; y++) {
+			const DepthT* run = depth + layout.RowOffset(y) + col;
+			for (int j = 0; j < w; j++) {
+				lo = std::min(lo, run[j]);
+				hi = std::max(hi, run[j]);
+			}
+		}
+		if (storage_ == kStoreDepth) {
+			tiles_(ty, tx) = hi;
+		} else {
+			// The farthest pixel has the smallest inverse depth
+			tiles_(ty, tx) = 1. / static_cast<double>(lo);
+		}
+		stale_(ty, tx) = 0;
+	}
+
+	void HiZBuffer::UpdateFromPolygon(const EdgeSetup& edges, const Vec3& depth_eqn,
+																		int ya, int yb, int xa, int xb) {
+		if (xa >= xb || ya >= yb) return;
+		const int txa = xa / kHiZTileSize;
+		const int txb = (xb-1) / kHiZTileSize + 1;
+		const int tya = ya / kHiZTileSize;
+		const int tyb = (yb-1) / kHiZTileSize + 1;
+		bool lowered = false;
+		for (int ty = tya; ty < tyb; ty++) {
+			const int y0 = ty * kHiZTileSize;
+			const int y1 = std::min(y0+kHiZTileSize, viewport_[1]) - 1;  // inclusive
+			for (int tx = txa; tx < txb; tx++) {
+				const int x0 = tx * kHiZTileSize;
+				const int x1 = std::min(x0+kHiZTileSize, viewport_[0]) - 1;  // inclusive
+				const TileCoverage coverage = CoverTile(edges, y0, y1, x0, x1);
+				if (coverage == kTileOutside) continue;
+				const double max_depth =
+					coverage == kTileInside && x0 >= xa && x1 < xb && y0 >= ya && y1 < yb ?
+					MaxDepthOverTile(depth_eqn, y0, y1, x0, x1) : INFINITY;
+				if (max_depth < INFINITY) {
+					if (max_depth < tiles_(ty, tx)) {
+						tiles_(ty, tx) = max_depth;
+						lowered = true;
+					}
+				} else {
+					stale_(ty, tx) = 1;
+				}
+			}
+		}
+		if (lowered) {
+			UpdateBlocksOfTiles(tya, tyb, txa, txb);
+		}
+	}
+
+	double HiZBuffer::MaxDepthOverTile(const Vec3& depth_eqn,
+																		 int y0, int y1, int x0, int x1) const {
+		// Inverse depth is linear in pixel coordinates, so its smallest
+		// value over the tile is at a corner. The rasterizer evaluates it in the precision of the
+		// depth buffer, so allow for rounding error in proportion to the
+		// terms it sums, much as the margin does for nearest depths.
+		const double base_a = depth_eqn[1]*y0 + depth_eqn[2];
+		const double base_b = depth_eqn[1]*y1 + depth_eqn[2];
+		const double min_inv = std::min(base_a, base_b) + depth_eqn[0]*(depth_eqn[0] >= 0 ? x0 : x1);
+		const double magnitude = std::max(std::abs(base_a), std::abs(base_b)) + std::abs(depth_eqn[0])*x1;
+		const double inv_bound = min_inv - margin_*magnitude;
+		return inv_bound > 0 ? (1.+margin_) / inv_bound : INFINITY;
+	}
+
+	template <typename DepthT>
+	void HiZBuffer::Refresh(const DepthT* depth, const PixelLayout& layout,
+													int ya, int yb, int xa, int xb) {
+		if (xa >= xb || ya >= yb) return;
+		const int txa = xa / kHiZTileSize;
+		const int txb = (xb-1) / kHiZTileSize + 1;
+		const int tya = ya / kHiZTileSize;
+		const int tyb = (yb-1) / kHiZTileSize + 1;
+		bool refreshed = false;
+		for (int ty = tya; ty < tyb; ty++) {
+			for (int tx = txa; tx < txb; tx++) {
+				if (stale_(ty, tx)) {
+					UpdateTile(depth, layout, tx, ty);
+					refreshed = true;
+				}
+			}
+		}
+		if (refreshed) {
+			UpdateBlocksOfTiles(tya, tyb, txa, txb);
+		}
+	}
+
+	void HiZBuffer::UpdateBlocksOfTiles(int tya, int tyb, int txa, int txb) {
+		UpdateBlocks(tya / kTilesPerBlock, (tyb-1) / kTilesPerBlock + 1,
+								 txa / kTilesPerBlock, (txb-1) / kTilesPerBlock + 1);
+	}
+
+	void HiZBuffer::UpdateBlocks(int bya, int byb, int bxa, int bxb) {
+		for (int by = bya; by < byb; by++) {
+			const int ty0 = by * kTilesPerBlock;
+			const int h = std::min<int>(kTilesPerBlock, tiles_.rows()-ty0);
+			for (int bx = bxa; bx < bxb; bx++) {
+				const int tx0 = bx * kTilesPerBlock;
+				const int w = std::min<int>(kTilesPerBlock, tiles_.cols()-tx0);
+				blocks_(by, bx) = tiles_.block(ty0, tx0, h, w).maxCoeff();
+			}
+		}
+	}
+
+	bool HiZBuffer::RectOccludes(int ya, int yb, int xa, int xb,
+															 double nearest_depth) const {
+		if (xa >= xb || ya >= yb) return true;
+		for (int by = ya / kHiZBlockSize; by <= (yb-1) / kHiZBlockSize; by++) {
+			for (int bx = xa / kHiZBlockSize; bx <= (xb-1) / kHiZBlockSize; bx++) {
+				if (!BlockOccludes(bx, by, nearest_depth)) {
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	template <typename DepthT>
+	bool HiZBuffer::RectOccludes(int ya, int yb, int xa, int xb, double nearest_depth,
+															 const DepthT* depth, const PixelLayout& layout) {
+		if (xa >= xb || ya >= yb) return true;
+		for (int by = ya / kHiZBlockSize; by <= (yb-1) / kHiZBlockSize; by++) {
+			for (int bx = xa / kHiZBlockSize; bx <= (xb-1) / kHiZBlockSize; bx++) {
+				if (BlockOccludes(bx, by, nearest_depth)) continue;
+				// Refreshing is only worthwhile if the tiles that are up to
+				// date already occlude the surface
+				const int tya = by * kTilesPerBlock;
+				const int tyb = std::min<int>(tya+kTilesPerBlock, tiles_.rows());
+				const int txa = bx * kTilesPerBlock;
+				const int txb = std::min<int>(txa+kTilesPerBlock, tiles_.cols());
+				for (int ty = tya; ty < tyb; ty++) {
+					for (int tx = txa; tx < txb; tx++) {
+						if (!stale_(ty, tx) && !TileOccludes(tx, ty, nearest_depth)) {
+							return false;
+						}
+					}
+				}
+				Refresh(depth, layout,
+								tya * kHiZTileSize, std::min(tyb * kHiZTileSize, viewport_[1]),
+								txa * kHiZTileSize, std::min(txb * kHiZTileSize, viewport_[0]));
+				if (!BlockOccludes(bx, by, nearest_depth)) {
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	template void HiZBuffer::Rebuild(const Eigen::ArrayXXd&);
+	template void HiZBuffer::Rebuild(const Eigen::ArrayXXf&);
+	template void HiZBuffer::Update(const Eigen::ArrayXXd&, int, int, int, int);
+	template void HiZBuffer::Update(const Eigen::ArrayXXf&, int, int, int, int);
+	template void HiZBuffer::Rebuild(const double*, const PixelLayout&);
+	template void HiZBuffer::Rebuild(const float*, const PixelLayout&);
+	template void HiZBuffer::Update(const double*, const PixelLayout&, int, int, int, int);
+	template void HiZBuffer::Update(const float*, const PixelLayout&, int, int, int, int);
+	template void HiZBuffer::Refresh(const double*, const PixelLayout&, int, int, int, int);
+	template void HiZBuffer::Refresh(const float*, const PixelLayout&, int, int, int, int);
+	template bool HiZBuffer::RectOccludes(int, int, int, int, double, const double*, const PixelLayout&);
+	template bool HiZBuffer::RectOccludes(int, int, int, int, double, const float*, const PixelLayout&);
+}  // namespace indoor_context
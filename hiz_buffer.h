@@ -0,0 +1,119 @@
+#pragma once
+
+#include "matrix_types.h"
+#include "rasterizer.h"
+#include "buffer_layout.h"
+
+namespace indoor_context {
+	// Size in pixels of the tiles at the finest level of a HiZBuffer
+	static const int kHiZTileSize = 8;
+	// Size in pixels of the blocks at the coarsest level of a HiZBuffer
+	static const int kHiZBlockSize = 64;
+
+	// A two-level hierarchy of maximum depths over a depth buffer, used
+	// to reject surfaces that are behind everything already drawn
+	// without visiting their pixels. The stored maxima are conservative:
+	// they may be larger than the true maxima, for example if pixels
+	// have been written but Update() has not been called yet, but never
+	// smaller. Since the depth test only ever brings pixels closer, a
+	// stored maximum remains conservative however much is drawn.
+	class HiZBuffer {
+	public:
+		// Initialize empty
+		HiZBuffer() : storage_(kStoreDepth), margin_(1e-9) { }
+
+		// Resize for a viewport and reset all maxima to infinity. The
+		// maxima are always kept as depths, but the depth buffers passed
+		// to Rebuild() and Update() hold the quantity given by
+		// storage. The margin allows for rounding error between the
+		// nearest depth of a polygon, computed at its vertices, and the
+		// per-pixel depths, so it should be larger for float buffers.
+		void Configure(const Vec2I& viewport,
+									 DepthStorage storage = kStoreDepth,
+									 double margin = 1e-9);
+		// Reset all maxima to infinity, as for a cleared depth buffer
+		void Reset();
+		// Recompute all maxima from a row-major depth buffer
+		template <typename DepthT>
+		void Rebuild(const Eigen::Array<DepthT, Eigen::Dynamic, Eigen::Dynamic>& depthbuffer);
+		// Recompute all maxima from a depth buffer with any layout
+		template <typename DepthT>
+		void Rebuild(const DepthT* depth, const PixelLayout& layout);
+		// Recompute the maxima of the tiles that overlap the rectangle
+		// [xa,xb)x[ya,yb), and of the blocks containing them. Call this
+		// after writing to the depth buffer within that rectangle.
+		template <typename DepthT>
+		void Update(const Eigen::Array<DepthT, Eigen::Dynamic, Eigen::Dynamic>& depthbuffer,
+								int ya, int yb, int xa, int xb);
+		// As above, for a depth buffer with any layout. Each row of a
+		// tile is one contiguous run of the buffer.
+		template <typename DepthT>
+		void Update(const DepthT* depth, const PixelLayout& layout,
+								int ya, int yb, int xa, int xb);
+		// Update the maxima after a polygon has been drawn, with the depth
+		// test, over the part of the rectangle [xa,xb)x[ya,yb) that it
+		// covers. depth_eqn gives its inverse depth at each pixel. Tiles
+		// that lie within the rectangle and are covered entirely by the
+		// polygon have their maxima lowered to its largest depth over the
+		// tile, which needs no access to the depth buffer. The other
+		// tiles of the rectangle that it overlaps are marked for Refresh().
+		void UpdateFromPolygon(const EdgeSetup& edges, const Vec3& depth_eqn,
+													 int ya, int yb, int xa, int xb);
+		// Recompute the maxima of the tiles overlapping the rectangle
+		// [xa,xb)x[ya,yb) that were marked by UpdateFromPolygon(), and of
+		// the blocks containing them
+		template <typename DepthT>
+		void Refresh(const DepthT* depth, const PixelLayout& layout,
+								 int ya, int yb, int xa, int xb);
+
+		// Returns true if a surface that is nowhere closer than
+		// nearest_depth would fail the depth test at every pixel of the
+		// given tile or block.
+		bool TileOccludes(int tx, int ty, double nearest_depth) const {
+			return Occludes(tiles_(ty, tx), nearest_depth);
+		}
+		bool BlockOccludes(int bx, int by, double nearest_depth) const {
+			return Occludes(blocks_(by, bx), nearest_depth);
+		}
+		// Returns true if a surface that is nowhere closer than
+		// nearest_depth would fail the depth test at every pixel of the
+		// rectangle [xa,xb)x[ya,yb), according to the block level only.
+		bool RectOccludes(int ya, int yb, int xa, int xb, double nearest_depth) const;
+		// As above, but first Refresh() the marked tiles of any block
+		// whose other tiles all occlude the surface
+		template <typename DepthT>
+		bool RectOccludes(int ya, int yb, int xa, int xb, double nearest_depth,
+											const DepthT* depth, const PixelLayout& layout);
+
+		// Get the max depth of each tile or block
+		const Eigen::ArrayXXd& tiles() const { return tiles_; }
+		const Eigen::ArrayXXd& blocks() const { return blocks_; }
+
+	private:
+		// Returns true if nearest_depth could not pass the depth test
+		// against a region whose maximum depth is max_depth
+		bool Occludes(double max_depth, double nearest_depth) const {
+			return nearest_depth * (1.-margin_) >= max_depth;
+		}
+		// Recompute the max of one tile from the depth buffer
+		template <typename DepthT>
+		void UpdateTile(const DepthT* depth, const PixelLayout& layout, int tx, int ty);
+		// Recompute the max of each block in a range from its tiles
+		void UpdateBlocks(int bya, int byb, int bxa, int bxb);
+		// Recompute the blocks containing the tiles [txa,txb)x[tya,tyb)
+		void UpdateBlocksOfTiles(int tya, int tyb, int txa, int txb);
+		// Returns an upper bound on the depths drawn by a polygon with
+		// the given inverse depth equation over the pixels [x0,x1]x[y0,y1]
+		// (inclusive), or infinity if they cannot be bounded
+		double MaxDepthOverTile(const Vec3& depth_eqn, int y0, int y1, int x0, int x1) const;
+
+		Vec2I viewport_;
+		DepthStorage storage_;
+		double margin_;
+		Eigen::ArrayXXd tiles_;  // max depth of each kHiZTileSize tile
+		Eigen::ArrayXXd blocks_;  // max depth of each kHiZBlockSize block
+		// Non-zero for tiles whose maxima may be loose because they were
+		// partly covered by a polygon passed to UpdateFromPolygon()
+		Eigen::Array<unsigned char, Eigen::Dynamic, Eigen::Dynamic> stale_;
+	};
+}  // namespace indoor_context
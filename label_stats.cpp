@@ -0,0 +1,74 @@
+#include "label_stats.h"
+
+#include <stdint.h>
+
+namespace indoor_context {
+	void LabelStats::Reset(int num_labels, int num_costs) {
+		counts.setZero(num_labels);
+		cost_sums.setZero(num_costs, num_labels);
+	}
+
+	void LabelStats::Add(const LabelStats& other) {
+		counts += other.counts;
+		cost_sums += other.cost_sums;
+	}
+
+	template <typename LabelT>
+	void AccumulateLabelStats(const Eigen::Array<LabelT, Eigen::Dynamic, Eigen::Dynamic>& labels,
+														const std::vector<const Eigen::ArrayXXd*>& cost_images,
+														int ya, int yb, int xa, int xb,
+														LabelStats& stats) {
+		const Vec2I size(labels.cols(), labels.rows());
+		AccumulateLabelStats(labels.data(), MakePixelLayout(kRowMajorLayout, size),
+												 cost_images, ya, yb, xa, xb, stats);
+	}
+
+	template <typename LabelT>
+	void AccumulateLabelStats(const LabelT* labels, const PixelLayout& layout,
+														const std::vector<const Eigen::ArrayXXd*>& cost_images,
+														int ya, int yb, int xa, int xb,
+														LabelStats& stats) {
+		const unsigned num_labels = stats.num_labels();
+		for (int y = ya; y < yb; y++) {
+			const LabelT* label_row = labels + layout.RowOffset(y);
+			for (int x = xa; x < xb; x++) {
+				// Negative labels wrap around and are ignored
+				const unsigned label = label_row[layout.ColOffset(x)];
+				if (label < num_labels) {
+					stats.counts[label]++;
+				}
+			}
+			// One cost image at a time so that each row is read
+			// sequentially
+			for (int k = 0; k < cost_images.size(); k++) {
+				const double* cost_row = &(*cost_images[k])(y, 0);
+				double* sums = &stats.cost_sums(k, 0);
+				for (int x = xa; x < xb; x++) {
+					const unsigned label = label_row[layout.ColOffset(x)];
+					if (label < num_labels) {
+						sums[label] += cost_row[x];
+					}
+				}
+			}
+		}
+	}
+
+	template void AccumulateLabelStats(const Eigen::Array<int, Eigen::Dynamic, Eigen::Dynamic>&,
+																		 const std::vector<const Eigen::ArrayXXd*>&,
+																		 int, int, int, int, LabelStats&);
+	template void AccumulateLabelStats(const Eigen::Array<uint16_t, Eigen::Dynamic, Eigen::Dynamic>&,
+																		 const std::vector<const Eigen::ArrayXXd*>&,
+																		 int, int, int, int, LabelStats&);
+	template void AccumulateLabelStats(const Eigen::Array<uint8_t, Eigen::Dynamic, Eigen::Dynamic>&,
+																		 const std::vector<const Eigen::ArrayXXd*>&,
+																		 int, int, int, int, LabelStats&);
+	template void AccumulateLabelStats(const int*, const PixelLayout&,
+																		 const std::vector<const Eigen::ArrayXXd*>&,
+																		 int, int, int, int, LabelStats&);
+	template void AccumulateLabelStats(const uint16_t*, const PixelLayout&,
+																		 const std::vector<const Eigen::ArrayXXd*>&,
+																		 int, int, int, int, LabelStats&);
+	template void AccumulateLabelStats(const uint8_t*, const PixelLayout&,
+																		 const std::vector<const Eigen::ArrayXXd*>&,
+																		 int, int, int, int, LabelStats&);
+}  // namespace indoor_context
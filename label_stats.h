@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+
+#include "matrix_types.h"
+#include "buffer_layout.h"
+
+namespace indoor_context {
+	// Per-label statistics over the pixels of a label buffer. Only
+	// labels in [0,num_labels) are counted; other labels, such as the
+	// background, are ignored.
+	struct LabelStats {
+		// Number of pixels with each label
+		Eigen::ArrayXi counts;
+		// Row k is the sum of cost image k over the pixels with each label
+		Eigen::ArrayXXd cost_sums;
+
+		// Get the number of labels
+		int num_labels() const { return counts.size(); }
+		// Get the number of cost images
+		int num_costs() const { return cost_sums.rows(); }
+
+		// Resize and set all statistics to zero
+		void Reset(int num_labels, int num_costs);
+		// Add the statistics of some other pixels, which must have the
+		// same dimensions
+		void Add(const LabelStats& other);
+	};
+
+	// Add the labels within the rectangle [xa,xb)x[ya,yb) of a label
+	// buffer to stats. Each cost image must be the same size as the
+	// label buffer.
+	template <typename LabelT>
+	void AccumulateLabelStats(const Eigen::Array<LabelT, Eigen::Dynamic, Eigen::Dynamic>& labels,
+														const std::vector<const Eigen::ArrayXXd*>& cost_images,
+														int ya, int yb, int xa, int xb,
+														LabelStats& stats);
+	// As above, for a label buffer with any layout. The cost images are
+	// always row-major.
+	template <typename LabelT>
+	void AccumulateLabelStats(const LabelT* labels, const PixelLayout& layout,
+														const std::vector<const Eigen::ArrayXXd*>& cost_images,
+														int ya, int yb, int xa, int xb,
+														LabelStats& stats);
+}  // namespace indoor_context
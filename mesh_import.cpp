@@ -0,0 +1,300 @@
+#include "mesh_import.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <map>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+namespace indoor_context {
+	using std::vector;
+	using std::string;
+
+	// Append the triangles of a fan over the polygon to indices and
+	// labels
+	static void AddFan(const vector<int>& polygon, int label,
+										 vector<Vec3I>& indices, vector<int>& labels) {
+		for (int i = 2; i < polygon.size(); i++) {
+			Vec3I tri;
+			tri << polygon[0], polygon[i-1], polygon[i];
+			indices.push_back(tri);
+			labels.push_back(label);
+		}
+	}
+
+	bool ReadObjFile(const string& path,
+									 vector<Vec3>& vertices,
+									 vector<Vec3I>& indices,
+									 vector<int>& labels) {
+		std::ifstream in(path.c_str());
+		if (!in) {
+			std::cerr << "Could not open OBJ file " << path;
+			return false;
+		}
+
+		// OBJ indices start from 1 at the first vertex of the file
+		const int base = vertices.size();
+		std::map<string, int> materials;
+		int material = 0;
+		vector<int> polygon;
+		string line, keyword, token;
+		for (int line_number = 1; std::getline(in, line); line_number++) {
+			std::istringstream tokens(line);
+			if (!(tokens >> keyword) || keyword[0] == '#') continue;
+			if (keyword == "v") {
+				Vec3 v;
+				if (!(tokens >> v[0] >> v[1] >> v[2])) {
+					std::cerr << "Invalid vertex at line " << line_number << " of " << path;
+					return false;
+				}
+				vertices.push_back(v);
+			} else if (keyword == "f") {
+				// Each vertex is v, v/vt, v//vn or v/vt/vn
+				polygon.clear();
+				const int num_read = vertices.size() - base;
+				while (tokens >> token) {
+					int index = atoi(token.c_str());
+					index = index < 0 ? num_read+index : index-1;
+					if (index < 0 || index >= num_read) {
+						std::cerr << "Invalid face at line " << line_number << " of " << path;
+						return false;
+					}
+					polygon.push_back(base+index);
+				}
+				AddFan(polygon, material, indices, labels);
+			} else if (keyword == "usemtl") {
+				tokens >> token;
+				std::map<string, int>::iterator it =
+					materials.insert(std::make_pair(token, static_cast<int>(materials.size()))).first;
+				material = it->second;
+			}
+		}
+		return true;
+	}
+
+	// Value types in PLY files
+	enum PlyType {
+		kPlyInt8, kPlyUInt8, kPlyInt16, kPlyUInt16,
+		kPlyInt32, kPlyUInt32, kPlyFloat32, kPlyFloat64, kPlyInvalid
+	};
+
+	struct PlyProperty {
+		string name;
+		bool is_list;
+		PlyType count_type;  // type of the length of a list
+		PlyType type;  // type of the value, or of each list item
+	};
+
+	struct PlyElement {
+		string name;
+		long count;
+		vector<PlyProperty> properties;
+	};
+
+	static PlyType ParsePlyType(const string& name) {
+		if (name == "char" || name == "int8") return kPlyInt8;
+		if (name == "uchar" || name == "uint8") return kPlyUInt8;
+		if (name == "short" || name == "int16") return kPlyInt16;
+		if (name == "ushort" || name == "uint16") return kPlyUInt16;
+		if (name == "int" || name == "int32") return kPlyInt32;
+		if (name == "uint" || name == "uint32") return kPlyUInt32;
+		if (name == "float" || name == "float32") return kPlyFloat32;
+		if (name == "double" || name == "float64") return kPlyFloat64;
+		return kPlyInvalid;
+	}
+
+	// Reads the values in the body of a PLY file
+	class PlyValueReader {
+	public:
+		PlyValueReader(std::istream& in, bool ascii, bool swap)
+			: in_(in), ascii_(ascii), swap_(swap) {
+		}
+
+		// Read one value. Returns false at the end of the file.
+		bool Read(PlyType type, double& value) {
+			if (ascii_) {
+				return static_cast<bool>(in_ >> value);
+			}
+			static const int kSizes[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+			const int size = kSizes[type];
+			char bytes[8];
+			if (!in_.read(bytes, size)) {
+				return false;
+			}
+			if (swap_) {
+				std::reverse(bytes, bytes+size);
+			}
+			switch (type) {
+			case kPlyInt8: value = Convert<int8_t>(bytes); break;
+			case kPlyUInt8: value = Convert<uint8_t>(bytes); break;
+			case kPlyInt16: value = Convert<int16_t>(bytes); break;
+			case kPlyUInt16: value = Convert<uint16_t>(bytes); break;
+			case kPlyInt32: value = Convert<int32_t>(bytes); break;
+			case kPlyUInt32: value = Convert<uint32_t>(bytes); break;
+			case kPlyFloat32: value = Convert<float>(bytes); break;
+			default: value = Convert<double>(bytes); break;
+			}
+			return true;
+		}
+
+	private:
+		template <typename T>
+		static double Convert(const char* bytes) {
+			T v;
+			memcpy(&v, bytes, sizeof(v));
+			return v;
+		}
+
+		std::istream& in_;
+		bool ascii_;
+		bool swap_;
+	};
+
+	bool ReadPlyFile(const string& path,
+									 vector<Vec3>& vertices,
+									 vector<Vec3I>& indices,
+									 vector<int>& labels) {
+		std::ifstream in(path.c_str(), std::ios::binary);
+		string line, keyword, token;
+		if (!in || !std::getline(in, line) || line.compare(0, 3, "ply") != 0) {
+			std::cerr << "Could not open PLY file " << path;
+			return false;
+		}
+
+		// Parse the header
+		string format;
+		vector<PlyElement> elements;
+		while (true) {
+			if (!std::getline(in, line)) {
+				std::cerr << "PLY file " << path << " has no end_header";
+				return false;
+			}
+			std::istringstream tokens(line);
+			if (!(tokens >> keyword)) continue;
+			if (keyword == "end_header") {
+				break;
+			} else if (keyword == "format") {
+				tokens >> format;
+			} else if (keyword == "element") {
+				PlyElement element;
+				tokens >> element.name >> element.count;
+				elements.push_back(element);
+			} else if (keyword == "property" && !elements.empty()) {
+				PlyProperty property;
+				tokens >> token;
+				property.is_list = token == "list";
+				property.count_type = kPlyUInt8;
+				if (property.is_list) {
+					tokens >> token;
+					property.count_type = ParsePlyType(token);
+					tokens >> token;
+				}
+				property.type = ParsePlyType(token);
+				tokens >> property.name;
+				if (property.type == kPlyInvalid || property.count_type == kPlyInvalid) {
+					std::cerr << "PLY file " << path << " has an unknown property type";
+					return false;
+				}
+				elements.back().properties.push_back(property);
+			}
+		}
+
+		bool ascii = format == "ascii";
+		const uint16_t one = 1;
+		const bool little_endian = *reinterpret_cast<const char*>(&one) == 1;
+		bool swap = false;
+		if (format == "binary_little_endian") {
+			swap = !little_endian;
+		} else if (format == "binary_big_endian") {
+			swap = little_endian;
+		} else if (!ascii) {
+			std::cerr << "PLY file " << path << " has unknown format " << format;
+			return false;
+		}
+
+		// Read the body. Faces may come before vertices, so the indices
+		// are checked at the end.
+		PlyValueReader reader(in, ascii, swap);
+		const int base = vertices.size();
+		const int first_triangle = indices.size();
+		int num_read = 0;
+		vector<int> polygon;
+		for (int e = 0; e < elements.size(); e++) {
+			const PlyElement& element = elements[e];
+			const bool is_vertex = element.name == "vertex";
+			const bool is_face = element.name == "face";
+			for (long i = 0; i < element.count; i++) {
+				Vec3 v = Vec3::Zero();
+				int label = 0;
+				polygon.clear();
+				for (int p = 0; p < element.properties.size(); p++) {
+					const PlyProperty& property = element.properties[p];
+					double value;
+					if (!property.is_list) {
+						if (!reader.Read(property.type, value)) {
+							std::cerr << "PLY file " << path << " is truncated";
+							return false;
+						}
+						if (is_vertex && property.name.size() == 1 &&
+								property.name[0] >= 'x' && property.name[0] <= 'z') {
+							v[property.name[0]-'x'] = value;
+						} else if (is_face && property.name == "label") {
+							label = value;
+						}
+						continue;
+					}
+					double count;
+					if (!reader.Read(property.count_type, count)) {
+						std::cerr << "PLY file " << path << " is truncated";
+						return false;
+					}
+					const bool is_indices = is_face &&
+						(property.name == "vertex_indices" || property.name == "vertex_index");
+					for (int k = 0; k < count; k++) {
+						if (!reader.Read(property.type, value)) {
+							std::cerr << "PLY file " << path << " is truncated";
+							return false;
+						}
+						if (is_indices) {
+							polygon.push_back(base+static_cast<int>(value));
+						}
+					}
+				}
+				if (is_vertex) {
+					vertices.push_back(v);
+					num_read++;
+				} else if (is_face) {
+					AddFan(polygon, label, indices, labels);
+				}
+			}
+		}
+
+		for (int i = first_triangle; i < indices.size(); i++) {
+			if (indices[i].minCoeff() < base || indices[i].maxCoeff() >= base+num_read) {
+				std::cerr << "PLY file " << path << " has an out-of-range vertex index";
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool ReadMeshFile(const string& path,
+										vector<Vec3>& vertices,
+										vector<Vec3I>& indices,
+										vector<int>& labels) {
+		const size_t dot = path.rfind('.');
+		string extension = dot == string::npos ? "" : path.substr(dot+1);
+		std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+		if (extension == "obj") {
+			return ReadObjFile(path, vertices, indices, labels);
+		} else if (extension == "ply") {
+			return ReadPlyFile(path, vertices, indices, labels);
+		}
+		std::cerr << "Unknown mesh file format: " << path;
+		return false;
+	}
+}  // namespace indoor_context
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "matrix_types.h"
+
+namespace indoor_context {
+	// Read a triangle mesh from a Wavefront OBJ file. Only vertex
+	// positions and faces are used. Faces with more than three vertices
+	// are split into triangle fans, and negative (relative) indices are
+	// supported. Each triangle is labelled with the index of the
+	// material selected by the last "usemtl" statement, numbered in
+	// order of first use, or 0 if there is none. The mesh is appended to
+	// vertices, indices and labels. Returns false on error.
+	bool ReadObjFile(const std::string& path,
+									 std::vector<Vec3>& vertices,
+									 std::vector<Vec3I>& indices,
+									 std::vector<int>& labels);
+
+	// Read a triangle mesh from a PLY file in ASCII or binary format.
+	// The x, y and z properties of the "vertex" element and the
+	// "vertex_indices" (or "vertex_index") list of the "face" element
+	// are used, and other elements and properties are skipped. Faces are
+	// split into triangle fans. Each triangle is labelled with the
+	// "label" property of its face if there is one, or 0 otherwise. The
+	// mesh is appended to vertices, indices and labels. Returns false on
+	// error.
+	bool ReadPlyFile(const std::string& path,
+									 std::vector<Vec3>& vertices,
+									 std::vector<Vec3I>& indices,
+									 std::vector<int>& labels);
+
+	// Read an OBJ or PLY file, depending on its extension
+	bool ReadMeshFile(const std::string& path,
+										std::vector<Vec3>& vertices,
+										std::vector<Vec3I>& indices,
+										std::vector<int>& labels);
+}  // namespace indoor_context
@@ -0,0 +1,120 @@
+#include "multi_view_renderer.h"
+
+#include <iostream>
+#include <functional>
+
+#include "matrix_types.h"
+#include "depth_equation.h"
+#include "thread_pool.h"
+
+namespace indoor_context {
+	using std::vector;
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	MultiViewRendererT<LabelT, DepthT, kStorage>::MultiViewRendererT() {
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	MultiViewRendererT<LabelT, DepthT, kStorage>::MultiViewRendererT(const vector<LinearCamera>& cameras,
+																																	 Vec2I viewport) {
+		Configure(cameras, viewport);
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void MultiViewRendererT<LabelT, DepthT, kStorage>::Configure(const vector<LinearCamera>& cameras,
+																															 Vec2I viewport) {
+		views_.resize(cameras.size());
+		for (int i = 0; i < cameras.size(); i++) {
+			views_[i].Configure(cameras[i], viewport);
+		}
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void MultiViewRendererT<LabelT, DepthT, kStorage>::Clear(LabelT bg) {
+		for (int i = 0; i < views_.size(); i++) {
+			views_[i].Clear(bg);
+		}
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void MultiViewRendererT<LabelT, DepthT, kStorage>::EnableHiZ(bool enable) {
+		for (int i = 0; i < views_.size(); i++) {
+			views_[i].EnableHiZ(enable);
+		}
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void MultiViewRendererT<LabelT, DepthT, kStorage>::SetNumThreads(int n) {
+		if (n <= 1) {
+			pool_.reset();
+		} else if (!pool_ || pool_->num_threads() != n) {
+			pool_.reset(new ThreadPool(n));
+		}
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	int MultiViewRendererT<LabelT, DepthT, kStorage>::num_threads() const {
+		return pool_ ? pool_->num_threads() : 1;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	int MultiViewRendererT<LabelT, DepthT, kStorage>::RenderMesh(const vector<Vec3>& vertices,
+																															 const vector<Vec3I>& indices,
+																															 const vector<LabelT>& labels,
+																															 vector<int>& naffected) {
+		naffected.assign(views_.size(), 0);
+		if (labels.size() != indices.size()) {
+			std::cerr << "MultiViewRenderer::RenderMesh() needs exactly one label per triangle";
+			return 0;
+		}
+
+		// Compute the plane of each triangle once for all views. Triangles
+		// with out-of-range indices get a zero plane here, and are
+		// reported and skipped by each view.
+		const int ntris = indices.size();
+		const int nv = vertices.size();
+		planes_.resize(4, ntris);
+		for (int i = 0; i < ntris; i++) {
+			const Vec3I& tri = indices[i];
+			if (tri.minCoeff() < 0 || tri.maxCoeff() >= nv) {
+				planes_.col(i).setZero();
+			} else {
+				planes_.col(i) = TrianglePlane(vertices[tri[0]], vertices[tri[1]], vertices[tri[2]]);
+			}
+		}
+
+		// Render each view in its own task
+		const int nthreads = num_threads();
+		thread_scratch_.resize(nthreads);
+		const std::function<void(int, int)> render_view = [&](int v, int thread) {
+			ThreadScratch& scratch = thread_scratch_[thread];
+			PlanesToDepthEqns(views_[v].depth_basis(), planes_,
+												scratch.depth_eqns, scratch.degenerate);
+			naffected[v] = views_[v].RenderMesh(vertices, indices, labels, scratch.depth_eqns);
+		};
+		if (pool_) {
+			pool_->ParallelFor(views_.size(), render_view);
+		} else {
+			for (int v = 0; v < views_.size(); v++) {
+				render_view(v, 0);
+			}
+		}
+
+		int total = 0;
+		for (int v = 0; v < views_.size(); v++) {
+			total += naffected[v];
+		}
+		return total;
+	}
+
+#define INSTANTIATE_MULTI_VIEW_RENDERER_ALL_STORAGE(LabelT, DepthT)				\
+	template class MultiViewRendererT<LabelT, DepthT, kStoreDepth>;				\
+	template class MultiViewRendererT<LabelT, DepthT, kStoreInverseDepth>;
+
+	INSTANTIATE_MULTI_VIEW_RENDERER_ALL_STORAGE(int, double)
+	INSTANTIATE_MULTI_VIEW_RENDERER_ALL_STORAGE(int, float)
+	INSTANTIATE_MULTI_VIEW_RENDERER_ALL_STORAGE(uint16_t, double)
+	INSTANTIATE_MULTI_VIEW_RENDERER_ALL_STORAGE(uint16_t, float)
+	INSTANTIATE_MULTI_VIEW_RENDERER_ALL_STORAGE(uint8_t, double)
+	INSTANTIATE_MULTI_VIEW_RENDERER_ALL_STORAGE(uint8_t, float)
+}  // namespace indoor_context
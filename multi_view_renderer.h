@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+
+#include "matrix_types.h"
+#include "depth_equation.h"
+#include "simple_renderer.h"
+
+namespace indoor_context {
+	class ThreadPool;
+
+	// Renders one scene from many cameras at once. The world-space
+	// geometry is submitted once: the plane of each triangle is computed
+	// once for all views, and each view converts the planes to depth
+	// equations in a single batch. The views are rendered concurrently,
+	// one view per task, and the output of each view is identical to that
+	// of an independent SimpleRendererT with the same camera.
+	template <typename LabelT = int,
+						typename DepthT = double,
+						DepthStorage kStorage = kStoreDepth>
+	class MultiViewRendererT {
+	public:
+		typedef SimpleRendererT<LabelT, DepthT, kStorage> ViewRenderer;
+
+		// Initialize with no views
+		MultiViewRendererT();
+		// Initialize with one view per camera, all with the same viewport
+		MultiViewRendererT(const std::vector<LinearCamera>& cameras, Vec2I viewport);
+
+		// Configure one view per camera, all with the same viewport
+		void Configure(const std::vector<LinearCamera>& cameras, Vec2I viewport);
+		// Clear all buffers of all views
+		void Clear(LabelT bg);
+		// Enable or disable hierarchical-Z culling in all views
+		void EnableHiZ(bool enable);
+		// Set the number of threads used by RenderMesh. Each view is
+		// rendered by a single thread, so there is no benefit in using
+		// more threads than views.
+		void SetNumThreads(int n);
+		// Get the number of threads used by RenderMesh
+		int num_threads() const;
+
+		// Get the number of views
+		int num_views() const { return views_.size(); }
+		// Get the renderer for a view, which owns its frame buffer and
+		// depth buffer. Do not call SetNumThreads() on it.
+		const ViewRenderer& view(int i) const { return views_[i]; }
+		ViewRenderer& view(int i) { return views_[i]; }
+
+		// Render an indexed triangle mesh into every view (see
+		// SimpleRendererT::RenderMesh). The number of triangles that
+		// affected at least one pixel of each view is written to the
+		// corresponding element of naffected. Returns the total over all
+		// views.
+		int RenderMesh(const std::vector<Vec3>& vertices,
+									 const std::vector<Vec3I>& indices,
+									 const std::vector<LabelT>& labels,
+									 std::vector<int>& naffected);
+
+	private:
+		// Depth equations for one view, re-used from one call to the next
+		struct ThreadScratch {
+			DepthEqnArray depth_eqns;
+			Eigen::Array<bool, Eigen::Dynamic, 1> degenerate;
+		};
+
+		std::vector<ViewRenderer, Eigen::aligned_allocator<ViewRenderer> > views_;
+		PlaneArray planes_;  // world-space plane of each triangle
+
+		// Copies of a renderer share the same pool
+		std::shared_ptr<ThreadPool> pool_;
+		std::vector<ThreadScratch> thread_scratch_;
+	};
+
+	typedef MultiViewRendererT<> MultiViewRenderer;
+}  // namespace indoor_context
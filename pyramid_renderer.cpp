@@ -0,0 +1,487 @@
+#include "pyramid_renderer.h"
+
+#include <iostream>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+
+#include "matrix_types.h"
+#include "clipping.h"
+#include "depth_equation.h"
+#include "thread_pool.h"
+
+#include "vector_utils.tpp"
+
+namespace indoor_context {
+	using std::vector;
+
+	// Relative margin between depth bounds before one surface is known
+	// to be in front of another. This absorbs the rounding of depths in
+	// the rasterizer and in DepthT.
+	static const double kDepthMargin = 1e-5;
+	// Vertices are snapped to 1/2^kSubpixelBits of a level 0 pixel by the
+	// rasterizer, so coverage is only decided for footprints that are
+	// further than this (in level 0 pixels) from an edge
+	static const double kCoverageMargin = 1. / 128;
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	PyramidRendererT<LabelT, DepthT, kStorage>::PyramidRendererT()
+		: first_level_(0), last_level_(-1), mask_enabled_(false) {
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	PyramidRendererT<LabelT, DepthT, kStorage>::PyramidRendererT(const LinearCamera& camera,
+																															 Vec2I viewport,
+																															 int num_levels)
+		: first_level_(0), last_level_(-1), mask_enabled_(false) {
+		Configure(camera, viewport, num_levels);
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void PyramidRendererT<LabelT, DepthT, kStorage>::Configure(const LinearCamera& camera,
+																														 Vec2I viewport,
+																														 int num_levels) {
+		if (num_levels < 1 || num_levels > 16) {
+			std::cerr << "PyramidRenderer::Configure() needs between 1 and 16 levels";
+			num_levels = std::max(1, std::min(num_levels, 16));
+		}
+		levels_.resize(num_levels);
+		for (int l = 0; l < num_levels; l++) {
+			Level& level = levels_[l];
+			// Pixel x of level l samples the centre of level 0 pixels
+			// [f*x, f*(x+1)), which is at f*x + (f-1)/2
+			const int f = level_scale(l);
+			level.scale = f;
+			const double offset = (f-1) / (2.*f);
+			Eigen::Matrix3d scale;
+			scale << 1./f, 0, -offset,
+				0, 1./f, -offset,
+				0, 0, 1;
+			const LinearCamera level_camera = scale * camera;
+			const Vec2I level_viewport((viewport[0]+f-1) / f, (viewport[1]+f-1) / f);
+			level.renderer.Configure(level_camera, level_viewport);
+
+			// The level 0 pixel centres in each footprint, in level l
+			// coordinates. Footprints at the right and bottom may be cut off
+			// by the viewport, but must still contain the sample of this
+			// level for its label to be that of the footprint.
+			level.col_lo.resize(level_viewport[0]);
+			level.col_hi.resize(level_viewport[0]);
+			for (int x = 0; x < level_viewport[0]; x++) {
+				const int last = std::min(f*(x+1), viewport[0]) - 1;
+				level.col_lo[x] = x - offset;
+				level.col_hi[x] = std::max<double>(x, (last - offset*f) / f);
+			}
+			level.row_lo.resize(level_viewport[1]);
+			level.row_hi.resize(level_viewport[1]);
+			for (int y = 0; y < level_viewport[1]; y++) {
+				const int last = std::min(f*(y+1), viewport[1]) - 1;
+				level.row_lo[y] = y - offset;
+				level.row_hi[y] = std::max<double>(y, (last - offset*f) / f);
+			}
+			level.mask.setZero(level_viewport[1], level_viewport[0]);
+			level.near_depth.setConstant(level_viewport[1], level_viewport[0], INFINITY);
+			level.far_depth.setConstant(level_viewport[1], level_viewport[0], INFINITY);
+		}
+		ComputeFrustrum(camera, viewport, frustrum_);
+		first_level_ = 0;
+		last_level_ = num_levels-1;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void PyramidRendererT<LabelT, DepthT, kStorage>::SetLevelRange(int first, int last) {
+		if (first < 0 || last >= num_levels() || first > last) {
+			std::cerr << "Invalid level range passed to PyramidRenderer::SetLevelRange()";
+			return;
+		}
+		first_level_ = first;
+		last_level_ = last;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void PyramidRendererT<LabelT, DepthT, kStorage>::EnableMixedMask(bool enable) {
+		mask_enabled_ = enable;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void PyramidRendererT<LabelT, DepthT, kStorage>::Clear(LabelT bg) {
+		// The background is a single surface at infinity
+		for (int l = 0; l < levels_.size(); l++) {
+			Level& level = levels_[l];
+			level.renderer.Clear(bg);
+			if (mask_enabled_ && l > 0) {
+				level.mask.setZero();
+				level.near_depth.setConstant(INFINITY);
+				level.far_depth.setConstant(INFINITY);
+			}
+		}
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void PyramidRendererT<LabelT, DepthT, kStorage>::EnableHiZ(bool enable) {
+		for (int l = 0; l < levels_.size(); l++) {
+			levels_[l].renderer.EnableHiZ(enable);
+		}
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void PyramidRendererT<LabelT, DepthT, kStorage>::SetNumThreads(int n) {
+		if (n <= 1) {
+			pool_.reset();
+		} else if (!pool_ || pool_->num_threads() != n) {
+			pool_.reset(new ThreadPool(n));
+		}
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	int PyramidRendererT<LabelT, DepthT, kStorage>::num_threads() const {
+		return pool_ ? pool_->num_threads() : 1;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void PyramidRendererT<LabelT, DepthT, kStorage>::Footprint(int level, int x, int y,
+																														 int& xa, int& xb,
+																														 int& ya, int& yb) const {
+		const int f = level_scale(level);
+		const Vec2I& viewport = levels_[0].renderer.viewport();
+		xa = std::min(f*x, viewport[0]);
+		xb = std::min(f*(x+1), viewport[0]);
+		ya = std::min(f*y, viewport[1]);
+		yb = std::min(f*(y+1), viewport[1]);
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	template <typename Op>
+	void PyramidRendererT<LabelT, DepthT, kStorage>::ForEachLevel(const Op& op) {
+		const int n = last_level_ - first_level_ + 1;
+		const std::function<void(int, int)> render_level = [&](int i, int /*thread*/) {
+			op(first_level_ + i);
+		};
+		if (pool_) {
+			pool_->ParallelFor(n, render_level);
+		} else {
+			for (int i = 0; i < n; i++) {
+				render_level(i, 0);
+			}
+		}
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	int PyramidRendererT<LabelT, DepthT, kStorage>::RenderMesh(const vector<Vec3>& vertices,
+																														 const vector<Vec3I>& indices,
+																														 const vector<LabelT>& labels) {
+		if (labels.size() != indices.size()) {
+			std::cerr << "PyramidRenderer::RenderMesh() needs exactly one label per triangle";
+			return 0;
+		}
+		const MeshView<LabelT> mesh = {
+			vertices.data(), static_cast<int>(vertices.size()),
+			indices.data(), labels.data(), static_cast<int>(indices.size())
+		};
+		return RenderMesh(mesh);
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	int PyramidRendererT<LabelT, DepthT, kStorage>::RenderMesh(const MeshView<LabelT>& mesh) {
+		// Compute the plane of each triangle once for all levels.
+		// Triangles with out-of-range indices get a zero plane here, and
+		// are reported and skipped by each level.
+		const int ntris = mesh.num_triangles;
+		const int nv = mesh.num_vertices;
+		planes_.resize(4, ntris);
+		for (int i = 0; i < ntris; i++) {
+			const Vec3I& tri = mesh.indices[i];
+			if (tri.minCoeff() < 0 || tri.maxCoeff() >= nv) {
+				planes_.col(i).setZero();
+			} else {
+				planes_.col(i) = TrianglePlane(mesh.vertices[tri[0]],
+																			 mesh.vertices[tri[1]],
+																			 mesh.vertices[tri[2]]);
+			}
+		}
+
+		// The masks of all levels are computed from the outcodes and
+		// level 0 pixel coordinates of the vertices
+		const bool mask = mask_enabled_ && last_level_ > 0;
+		if (mask) {
+			const LinearCamera& camera = levels_[0].renderer.camera();
+			vertex_outcodes_.resize(nv);
+			vertex_pixels_.resize(nv);
+			for (int i = 0; i < nv; i++) {
+				const Vec3& v = mesh.vertices[i];
+				vertex_outcodes_[i] = ComputeOutcode(frustrum_, v);
+				const Vec3 p = camera.leftCols<3>() * v + camera.col(3);
+				vertex_pixels_[i] = p.head<2>() / p[2];
+			}
+		}
+
+		int naffected = 0;
+		ForEachLevel([&](int l) {
+			Level& level = levels_[l];
+			PlanesToDepthEqns(level.renderer.depth_basis(), planes_,
+												level.depth_eqns, level.degenerate);
+			const int n = level.renderer.RenderMesh(mesh, level.depth_eqns);
+			if (l == first_level_) {
+				naffected = n;
+			}
+			if (!mask || l == 0) {
+				return;
+			}
+			for (int i = 0; i < ntris; i++) {
+				if (level.depth_eqns.col(i).isZero()) continue;
+				const Vec3I& tri = mesh.indices[i];
+				const int* codes = vertex_outcodes_.data();
+				if (codes[tri[0]] & codes[tri[1]] & codes[tri[2]]) continue;
+				if (codes[tri[0]] | codes[tri[1]] | codes[tri[2]]) {
+					level.polygon.resize(3);
+					for (int k = 0; k < 3; k++) {
+						level.polygon[k] = mesh.vertices[tri[k]];
+					}
+					MaskPolygon(level, level.polygon, level.depth_eqns.col(i), false);
+				} else {
+					level.projected.resize(3);
+					for (int k = 0; k < 3; k++) {
+						level.projected[k] = vertex_pixels_[tri[k]];
+					}
+					MaskProjectedPolygon(level, level.projected, level.depth_eqns.col(i), false);
+				}
+			}
+		});
+		return naffected;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	bool PyramidRendererT<LabelT, DepthT, kStorage>::RenderInfinitePlane(double z0, LabelT label) {
+		bool affected = false;
+		ForEachLevel([&](int l) {
+			Level& level = levels_[l];
+			const bool a = level.renderer.RenderInfinitePlane(z0, label);
+			if (l == first_level_) {
+				affected = a;
+			}
+			if (mask_enabled_ && l > 0) {
+				MaskInfinitePlane(level, z0, true);
+			}
+		});
+		return affected;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	long PyramidRendererT<LabelT, DepthT, kStorage>::RenderManhattanLayout(double floor_z,
+																																				 double ceiling_z,
+																																				 const vector<Vec2>& corners,
+																																				 const vector<LabelT>& wall_labels,
+																																				 LabelT floor_label,
+																																				 LabelT ceiling_label) {
+		long npixels = 0;
+		ForEachLevel([&](int l) {
+			Level& level = levels_[l];
+			const long n = level.renderer.RenderManhattanLayout(floor_z, ceiling_z, corners, wall_labels,
+																													floor_label, ceiling_label);
+			if (l == first_level_) {
+				npixels = n;
+			}
+			if (!mask_enabled_ || l == 0 || corners.size() != wall_labels.size()+1) {
+				return;
+			}
+			// Each wall is a single quad, so the diagonal between its two
+			// triangles is not marked
+			level.polygon.resize(4);
+			for (int i = 0; i+1 < corners.size(); i++) {
+				const Vec2& a = corners[i];
+				const Vec2& b = corners[i+1];
+				const Vec2 dir = b - a;
+				const Vec4 plane = MakeVector<double>(dir[1], -dir[0], 0, dir[0]*a[1] - dir[1]*a[0]);
+				Vec3 depth_eqn;
+				if (!PlaneToDepthEqn(level.renderer.depth_basis(), plane, depth_eqn)) continue;
+				level.polygon[0] = MakeVector<double>(a[0], a[1], floor_z);
+				level.polygon[1] = MakeVector<double>(b[0], b[1], floor_z);
+				level.polygon[2] = MakeVector<double>(b[0], b[1], ceiling_z);
+				level.polygon[3] = MakeVector<double>(a[0], a[1], ceiling_z);
+				MaskPolygon(level, level.polygon, depth_eqn, false);
+			}
+			MaskInfinitePlane(level, floor_z, false);
+			MaskInfinitePlane(level, ceiling_z, false);
+		});
+		return npixels;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void PyramidRendererT<LabelT, DepthT, kStorage>::MaskPolygon(Level& level,
+																															 const vector<Vec3>& polygon,
+																															 const Vec3& depth_eqn,
+																															 bool overwrite) {
+		// Clip against the frustrum of level 0
+		int all_outside = kAllFrustrumPlanes, any_outside = 0;
+		for (int i = 0; i < polygon.size(); i++) {
+			const int code = ComputeOutcode(frustrum_, polygon[i]);
+			all_outside &= code;
+			any_outside |= code;
+		}
+		if (all_outside) return;
+		const vector<Vec3>* clipped = &polygon;
+		if (any_outside) {
+			if (ClipToFrustrum(polygon, frustrum_, any_outside, level.clipped, level.temp) < 3) {
+				return;
+			}
+			clipped = &level.clipped;
+		}
+
+		// Project into level 0
+		const LinearCamera& camera = levels_[0].renderer.camera();
+		level.projected.resize(clipped->size());
+		for (int i = 0; i < clipped->size(); i++) {
+			const Vec3 p = camera.leftCols<3>() * (*clipped)[i] + camera.col(3);
+			level.projected[i] = p.head<2>() / p[2];
+		}
+		MaskProjectedPolygon(level, level.projected, depth_eqn, overwrite);
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void PyramidRendererT<LabelT, DepthT, kStorage>::MaskProjectedPolygon(Level& level,
+																																				vector<Vec2>& projected,
+																																				const Vec3& depth_eqn,
+																																				bool overwrite) {
+		// Transform from level 0 to this level
+		const int n = projected.size();
+		const double offset = (level.scale-1) / 2.;
+		double area = 0;
+		double xmin = INFINITY, xmax = -INFINITY, ymin = INFINITY, ymax = -INFINITY;
+		for (int i = 0; i < n; i++) {
+			Vec2& p = projected[i];
+			p = (p.array() - offset) / level.scale;
+			xmin = std::min(xmin, p[0]);
+			xmax = std::max(xmax, p[0]);
+			ymin = std::min(ymin, p[1]);
+			ymax = std::max(ymax, p[1]);
+		}
+		for (int i = 0; i < n; i++) {
+			const Vec2& p = projected[i];
+			const Vec2& q = projected[i+1 < n ? i+1 : 0];
+			area += p[0]*q[1] - q[0]*p[1];
+		}
+		// The negated comparisons also catch NaNs
+		if (!(xmin > -1e+9) || !(xmax < 1e+9) || !(ymin > -1e+9) || !(ymax < 1e+9)) return;
+
+		// Edge equations E(x,y) = a*x + b*y + c >= 0 inside, as in
+		// SetupEdges. A polygon with no area covers no footprint fully.
+		const bool has_area = area != 0;
+		const double sign = area > 0 ? 1 : -1;
+		level.edges.resize(has_area ? n : 0);
+		for (int i = 0; i < level.edges.size(); i++) {
+			const Vec2& p = projected[i];
+			const Vec2& q = projected[i+1 < n ? i+1 : 0];
+			Vec3& e = level.edges[i];
+			e[0] = sign * (p[1] - q[1]);
+			e[1] = sign * (q[0] - p[0]);
+			e[2] = -(e[0]*p[0] + e[1]*p[1]);
+		}
+
+		// Visit the footprints that overlap the bounding box
+		const Vec2I& viewport = level.renderer.viewport();
+		const int xa = std::max(0, static_cast<int>(std::ceil(xmin - .5)));
+		const int xb = std::min(viewport[0]-1, static_cast<int>(std::floor(xmax + .5)));
+		const int ya = std::max(0, static_cast<int>(std::ceil(ymin - .5)));
+		const int yb = std::min(viewport[1]-1, static_cast<int>(std::floor(ymax + .5)));
+		const double margin = kCoverageMargin / level.scale;
+		for (int y = ya; y <= yb; y++) {
+			const double cy = .5 * (level.row_lo[y] + level.row_hi[y]);
+			const double hy = .5 * (level.row_hi[y] - level.row_lo[y]);
+			for (int x = xa; x <= xb; x++) {
+				const double cx = .5 * (level.col_lo[x] + level.col_hi[x]);
+				const double hx = .5 * (level.col_hi[x] - level.col_lo[x]);
+				// The extremes of each edge function over the footprint are
+				// at its corners
+				bool full = has_area, outside = false;
+				for (int i = 0; i < level.edges.size(); i++) {
+					const Vec3& e = level.edges[i];
+					const double centre = e[0]*cx + e[1]*cy + e[2];
+					const double extent = std::abs(e[0])*hx + std::abs(e[1])*hy;
+					const double tol = margin * (std::abs(e[0]) + std::abs(e[1]));
+					if (centre + extent < -tol) {
+						outside = true;
+						break;
+					}
+					full &= centre - extent > tol;
+				}
+				if (outside) continue;
+				if (!has_area && (xmax < level.col_lo[x] - margin || xmin > level.col_hi[x] + margin ||
+													ymax < level.row_lo[y] - margin || ymin > level.row_hi[y] + margin)) {
+					continue;
+				}
+
+				// Likewise for the inverse depth
+				const double inv = depth_eqn[0]*cx + depth_eqn[1]*cy + depth_eqn[2];
+				const double inv_extent = std::abs(depth_eqn[0])*hx + std::abs(depth_eqn[1])*hy;
+				const double near = 1. / std::max(inv + inv_extent, 1. / kClampDepth);
+				const double far = inv > inv_extent ? 1. / (inv - inv_extent) : INFINITY;
+				UpdateMask(level, x, y, full, near, far, overwrite);
+			}
+		}
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void PyramidRendererT<LabelT, DepthT, kStorage>::MaskInfinitePlane(Level& level,
+																																		 double z0,
+																																		 bool overwrite) {
+		// The plane covers the pixels at which its inverse depth is
+		// positive
+		Vec3 depth_eqn;
+		PlaneToDepthEqn(level.renderer.depth_basis(), MakeVector<double>(0, 0, 1, -z0), depth_eqn);
+		const Vec2I& viewport = level.renderer.viewport();
+		const double tol = 1e-9 * (std::abs(depth_eqn[0])*viewport[0] +
+															 std::abs(depth_eqn[1])*viewport[1] +
+															 std::abs(depth_eqn[2]));
+		for (int y = 0; y < viewport[1]; y++) {
+			const double cy = .5 * (level.row_lo[y] + level.row_hi[y]);
+			const double hy = .5 * (level.row_hi[y] - level.row_lo[y]);
+			for (int x = 0; x < viewport[0]; x++) {
+				const double cx = .5 * (level.col_lo[x] + level.col_hi[x]);
+				const double hx = .5 * (level.col_hi[x] - level.col_lo[x]);
+				const double inv = depth_eqn[0]*cx + depth_eqn[1]*cy + depth_eqn[2];
+				const double inv_extent = std::abs(depth_eqn[0])*hx + std::abs(depth_eqn[1])*hy;
+				if (inv + inv_extent < -tol) continue;
+				const bool full = inv - inv_extent > tol;
+				const double near = 1. / std::max(inv + inv_extent, 1. / kClampDepth);
+				const double far = inv > inv_extent ? 1. / (inv - inv_extent) : INFINITY;
+				UpdateMask(level, x, y, full, near, far, overwrite);
+			}
+		}
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void PyramidRendererT<LabelT, DepthT, kStorage>::UpdateMask(Level& level, int x, int y,
+																															bool full, double near, double far,
+																															bool overwrite) {
+		// near_depth and far_depth bound the depths visible anywhere in
+		// the footprint. A pixel stays unmarked only while a single
+		// surface is visible over the whole footprint.
+		uint8_t& mixed = level.mask(y, x);
+		double& visible_near = level.near_depth(y, x);
+		double& visible_far = level.far_depth(y, x);
+		if (!overwrite && near > visible_far * (1+kDepthMargin)) {
+			return;  // hidden everywhere
+		}
+		if (full && (overwrite || far * (1+kDepthMargin) < visible_near)) {
+			// Visible everywhere
+			mixed = 0;
+			visible_near = near;
+			visible_far = far;
+		} else {
+			mixed = 1;
+			visible_near = std::min(visible_near, near);
+			visible_far = std::max(visible_far, far);
+		}
+	}
+
+#define INSTANTIATE_PYRAMID_RENDERER_ALL_STORAGE(LabelT, DepthT)					\
+	template class PyramidRendererT<LabelT, DepthT, kStoreDepth>;					\
+	template class PyramidRendererT<LabelT, DepthT, kStoreInverseDepth>;
+
+	INSTANTIATE_PYRAMID_RENDERER_ALL_STORAGE(int, double)
+	INSTANTIATE_PYRAMID_RENDERER_ALL_STORAGE(int, float)
+	INSTANTIATE_PYRAMID_RENDERER_ALL_STORAGE(uint16_t, double)
+	INSTANTIATE_PYRAMID_RENDERER_ALL_STORAGE(uint16_t, float)
+	INSTANTIATE_PYRAMID_RENDERER_ALL_STORAGE(uint8_t, double)
+	INSTANTIATE_PYRAMID_RENDERER_ALL_STORAGE(uint8_t, float)
+}  // namespace indoor_context
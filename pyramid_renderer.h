@@ -0,0 +1,178 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <stdint.h>
+
+#include "matrix_types.h"
+#include "clipping.h"
+#include "depth_equation.h"
+#include "simple_renderer.h"
+
+namespace indoor_context {
+	class ThreadPool;
+
+	// Renders a pyramid of label and depth buffers in one submission.
+	// Level l has 1/2^l of the resolution of level 0 in each direction:
+	// pixel (X,Y) of level l corresponds to the block of pixels
+	// [2^l*X, 2^l*(X+1)) x [2^l*Y, 2^l*(Y+1)) of level 0, which is its
+	// footprint (see Footprint()), and it samples the scene at the
+	// centre of that block. Each level is rasterized directly with a
+	// scaled camera, so its output is identical to that of an
+	// independent SimpleRendererT configured with level_camera(l) and
+	// level_viewport(l). The world-space plane of each triangle is
+	// computed once for all levels, and the levels are rendered
+	// concurrently, one level per task.
+	//
+	// Optionally, each coarse level also keeps a mask of "mixed" pixels.
+	// A pixel that is not marked is guaranteed to have a single label
+	// over all level 0 pixels in its footprint (the label of the coarse
+	// pixel itself), so refinement only needs to visit marked pixels.
+	// The mask is conservative: it is computed from the geometry of each
+	// polygon and bounds on its depth over the footprint rather than
+	// from the level 0 buffers, which need not be rendered. Pixels on an
+	// edge shared by two triangles with the same label are marked even
+	// though their footprint may be uniform.
+	template <typename LabelT = int,
+						typename DepthT = double,
+						DepthStorage kStorage = kStoreDepth>
+	class PyramidRendererT {
+	public:
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+		typedef SimpleRendererT<LabelT, DepthT, kStorage> LevelRenderer;
+		// Non-zero elements mark mixed pixels
+		typedef Eigen::Array<uint8_t, Eigen::Dynamic, Eigen::Dynamic> MaskBuffer;
+
+		// Initialize with no levels
+		PyramidRendererT();
+		// Initialize with num_levels levels, where level 0 has the given
+		// camera and viewport
+		PyramidRendererT(const LinearCamera& camera, Vec2I viewport, int num_levels);
+
+		// Configure num_levels levels, where level 0 has the given camera
+		// and viewport. All levels are rendered until SetLevelRange() is
+		// called.
+		void Configure(const LinearCamera& camera, Vec2I viewport, int num_levels);
+		// Render only levels first to last inclusive, for example only
+		// the coarsest level when scoring many hypotheses. Clear() still
+		// clears every level.
+		void SetLevelRange(int first, int last);
+		// Enable or disable the mixed-pixel masks (disabled by default).
+		// They are reset by the next call to Clear().
+		void EnableMixedMask(bool enable);
+		// Clear all buffers of all levels
+		void Clear(LabelT bg);
+		// Enable or disable hierarchical-Z culling in all levels
+		void EnableHiZ(bool enable);
+		// Set the number of threads used for rendering. Each level is
+		// rendered by a single thread, so there is no benefit in using
+		// more threads than levels.
+		void SetNumThreads(int n);
+		// Get the number of threads used for rendering
+		int num_threads() const;
+
+		// Get the number of levels
+		int num_levels() const { return levels_.size(); }
+		// Get the range of levels that are rendered
+		int first_level() const { return first_level_; }
+		int last_level() const { return last_level_; }
+		// Get the scale of a level relative to level 0
+		static int level_scale(int level) { return 1 << level; }
+		// Get the camera and viewport of a level
+		const LinearCamera& level_camera(int level) const { return levels_[level].renderer.camera(); }
+		const Vec2I& level_viewport(int level) const { return levels_[level].renderer.viewport(); }
+		// Get the renderer for a level, which owns its frame buffer and
+		// depth buffer. Do not call SetNumThreads() on it.
+		const LevelRenderer& level(int l) const { return levels_[l].renderer; }
+		LevelRenderer& level(int l) { return levels_[l].renderer; }
+		// Get the mixed-pixel mask of a level as a row-major array with
+		// the size of its viewport. Level 0 is never mixed. The masks are
+		// only maintained while EnableMixedMask(true) is in effect.
+		const MaskBuffer& mixed_mask(int level) const { return levels_[level].mask; }
+		bool mixed_mask_enabled() const { return mask_enabled_; }
+		// Get the footprint of pixel (x,y) of a level, which is the block
+		// of level 0 pixels [xa,xb) x [ya,yb), clipped to the viewport
+		void Footprint(int level, int x, int y, int& xa, int& xb, int& ya, int& yb) const;
+
+		// Render an indexed triangle mesh into every level (see
+		// SimpleRendererT::RenderMesh). Returns the number of triangles
+		// that affected at least one pixel of the first rendered level.
+		int RenderMesh(const std::vector<Vec3>& vertices,
+									 const std::vector<Vec3I>& indices,
+									 const std::vector<LabelT>& labels);
+		int RenderMesh(const MeshView<LabelT>& mesh);
+		// Render an infinite plane z=z0 into every level (see
+		// SimpleRendererT::RenderInfinitePlane). Returns true if at least
+		// one pixel of the first rendered level was affected.
+		bool RenderInfinitePlane(double z0, LabelT label);
+		// Render a room layout into every level (see
+		// SimpleRendererT::RenderManhattanLayout). Returns the number of
+		// pixels written to the first rendered level.
+		long RenderManhattanLayout(double floor_z,
+															 double ceiling_z,
+															 const std::vector<Vec2>& corners,
+															 const std::vector<LabelT>& wall_labels,
+															 LabelT floor_label,
+															 LabelT ceiling_label);
+
+	private:
+		struct Level {
+			EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+			LevelRenderer renderer;
+			int scale;  // see level_scale()
+			// The mask, and bounds on the depths visible in each footprint,
+			// as described in UpdateMask()
+			MaskBuffer mask;
+			Eigen::ArrayXXd near_depth, far_depth;
+			// The level 0 pixel centres in the footprints of each column
+			// and row, and the pixel centre of this level, span [lo,hi] in
+			// the coordinates of this level
+			Eigen::ArrayXd col_lo, col_hi, row_lo, row_hi;
+			// Scratch space
+			DepthEqnArray depth_eqns;
+			Eigen::Array<bool, Eigen::Dynamic, 1> degenerate;
+			std::vector<Vec3> polygon, clipped, temp, edges;
+			std::vector<Vec2> projected;
+		};
+
+		// Run op(level) for each rendered level, one level per task
+		template <typename Op>
+		void ForEachLevel(const Op& op);
+
+		// Update the mask of a level for a polygon with the given inverse
+		// depth equation. If overwrite is true then the polygon replaces
+		// the existing contents, otherwise it is depth-tested.
+		void MaskPolygon(Level& level,
+										 const std::vector<Vec3>& polygon,
+										 const Vec3& depth_eqn,
+										 bool overwrite);
+		// As above, for an unclipped polygon with vertices in level 0
+		// pixel coordinates. The vertices are overwritten.
+		void MaskProjectedPolygon(Level& level,
+															std::vector<Vec2>& projected,
+															const Vec3& depth_eqn,
+															bool overwrite);
+		// Update the mask of a level for an infinite plane z=z0
+		void MaskInfinitePlane(Level& level, double z0, bool overwrite);
+		// Update the mask of one pixel for a surface that covers all or
+		// part of its footprint, with depths in [near,far] there
+		void UpdateMask(Level& level, int x, int y, bool full,
+										double near, double far, bool overwrite);
+
+		std::vector<Level, Eigen::aligned_allocator<Level> > levels_;
+		int first_level_;
+		int last_level_;
+		bool mask_enabled_;
+		PlaneArray planes_;  // world-space plane of each triangle
+		// The frustrum of level 0, which contains all of its pixel
+		// centres. The frustrum of a coarser level does not, since its
+		// pixels are centred in their footprints.
+		Frustrum frustrum_;
+		// The outcode and level 0 pixel coordinates of each vertex
+		std::vector<int> vertex_outcodes_;
+		std::vector<Vec2> vertex_pixels_;
+		std::shared_ptr<ThreadPool> pool_;
+	};
+
+	typedef PyramidRendererT<> PyramidRenderer;
+}  // namespace indoor_context
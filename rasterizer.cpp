@@ -0,0 +1,640 @@
+#include "rasterizer.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <climits>
+
+#include "matrix_types.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RASTERIZER_X86
+#include <immintrin.h>
+#endif
+
+namespace indoor_context {
+	using std::vector;
+
+	// Vertices further than this from the origin (in pixels) are
+	// rejected, which keeps all edge function arithmetic within 64 bits
+	static const double kMaxVertexCoord = 1 << 20;
+
+	// Round a coordinate to fixed point
+	inline int64_t ToFixed(double x) {
+		return static_cast<int64_t>(std::floor(x * (1 << kSubpixelBits) + .5));
+	}
+
+	// Evaluate the constant part of a depth equation for row y
+	inline double DepthBase(const Vec3& depth_eqn, int y) {
+		return depth_eqn[1]*y + depth_eqn[2];
+	}
+
+	bool SetupEdges(const vector<Vec3>& poly,
+									const Vec2I& viewport,
+									EdgeSetup& edges,
+									EdgeRejection* rejection) {
+		return SetupEdges(poly.data(), poly.size(), viewport, edges, rejection);
+	}
+
+	bool SetupEdges(const Vec3* poly, int n,
+									const Vec2I& viewport,
+									EdgeSetup& edges,
+									EdgeRejection* rejection) {
+		EdgeRejection unused;
+		EdgeRejection& reason = rejection ? *rejection : unused;
+		reason = kEdgesZeroArea;
+		if (n < 3) return false;
+		if (n > kMaxPolygonEdges) {
+			std::cerr << "Warning: polygon with "<<n<<" vertices passed to SetupEdges";
+			return false;
+		}
+
+		// Convert to fixed point
+		int64_t xs[kMaxPolygonEdges], ys[kMaxPolygonEdges];
+		for (int i = 0; i < n; i++) {
+			const Vec3& v = poly[i];
+			double x = v[0] / v[2];
+			double y = v[1] / v[2];
+			// the negated comparisons also catch NaNs
+			if (!(std::abs(x) < kMaxVertexCoord) || !(std::abs(y) < kMaxVertexCoord)) {
+				reason = kEdgesInvalidVertex;
+				return false;
+			}
+			xs[i] = ToFixed(x);
+			ys[i] = ToFixed(y);
+		}
+
+		// Clipping can leave vertices so close together that they round
+		// to the same point. The edge between them would have a=b=0, and
+		// the fill rule bias would then exclude every pixel, so drop them.
+		int m = 1;
+		for (int i = 1; i < n; i++) {
+			if (xs[i] != xs[m-1] || ys[i] != ys[m-1]) {
+				xs[m] = xs[i];
+				ys[m] = ys[i];
+				m++;
+			}
+		}
+		while (m > 1 && xs[m-1] == xs[0] && ys[m-1] == ys[0]) {
+			m--;
+		}
+		n = m;
+
+		// The sign of the area tells us which side of each edge is inside
+		int64_t area = 0;
+		for (int i = 0; i < n; i++) {
+			int j = i+1 < n ? i+1 : 0;
+			area += xs[i]*ys[j] - xs[j]*ys[i];
+		}
+		if (area == 0) return false;
+		const int64_t sign = area > 0 ? 1 : -1;
+
+		// Compute the edge equations
+		edges.num_edges = n;
+		int64_t xmin = xs[0], xmax = xs[0], ymin = ys[0], ymax = ys[0];
+		for (int i = 0; i < n; i++) {
+			int j = i+1 < n ? i+1 : 0;
+			int64_t a = sign * (ys[i] - ys[j]);
+			int64_t b = sign * (xs[j] - xs[i]);
+			int64_t c = -(a*xs[i] + b*ys[i]);
+			// Top-left fill rule: pixels exactly on an edge belong to the
+			// polygon only if the interior is to the right of the edge, or
+			// below a horizontal edge. Otherwise bias the edge inwards by
+			// the smallest representable amount.
+			bool top_left = a > 0 || (a == 0 && b > 0);
+			edges.a[i] = a << kSubpixelBits;
+			edges.b[i] = b << kSubpixelBits;
+			edges.c[i] = top_left ? c : c-1;
+
+			xmin = std::min(xmin, xs[i]);
+			xmax = std::max(xmax, xs[i]);
+			ymin = std::min(ymin, ys[i]);
+			ymax = std::max(ymax, ys[i]);
+		}
+
+		// Compute the pixel bounds
+		const int64_t kOne = 1 << kSubpixelBits;
+		edges.xmin = std::max<int64_t>((xmin + kOne - 1) >> kSubpixelBits, 0);
+		edges.ymin = std::max<int64_t>((ymin + kOne - 1) >> kSubpixelBits, 0);
+		edges.xmax = std::min<int64_t>(xmax >> kSubpixelBits, viewport[0]-1);
+		edges.ymax = std::min<int64_t>(ymax >> kSubpixelBits, viewport[1]-1);
+		reason = edges.xmin <= edges.xmax && edges.ymin <= edges.ymax ? kEdgesAccepted : kEdgesNoPixels;
+		return reason == kEdgesAccepted;
+	}
+
+	bool EdgesOverlapRect(const EdgeSetup& edges, int ya, int yb, int xa, int xb) {
+		xa = std::max(xa, edges.xmin);
+		xb = std::min(xb, edges.xmax+1);
+		ya = std::max(ya, edges.ymin);
+		yb = std::min(yb, edges.ymax+1);
+		if (xa >= xb || ya >= yb) return false;
+
+		// Test the corner of the rectangle that is furthest inside each edge
+		for (int i = 0; i < edges.num_edges; i++) {
+			int x = edges.a[i] > 0 ? xb-1 : xa;
+			int y = edges.b[i] > 0 ? yb-1 : ya;
+			if (edges.a[i]*x + edges.b[i]*y + edges.c[i] < 0) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	int AccumulateCoverage(const EdgeSetup& edges,
+												 int ya, int yb, int xa, int xb,
+												 int* counts, int stride) {
+		xa = std::max(xa, edges.xmin);
+		xb = std::min(xb, edges.xmax+1);
+		ya = std::max(ya, edges.ymin);
+		yb = std::min(yb, edges.ymax+1);
+		const int n = edges.num_edges;
+		int count = 0;
+		for (int y = ya; y < yb; y++) {
+			int64_t e[kMaxPolygonEdges];
+			for (int i = 0; i < n; i++) {
+				e[i] = edges.a[i]*xa + edges.b[i]*y + edges.c[i];
+			}
+			int* row = counts + static_cast<long>(y)*stride;
+			for (int x = xa; x < xb; x++) {
+				bool inside = true;
+				for (int i = 0; i < n; i++) {
+					inside &= e[i] >= 0;
+					e[i] += edges.a[i];
+				}
+				if (inside) {
+					row[x]++;
+					count++;
+				}
+			}
+		}
+		return count;
+	}
+
+	// Compute the value stored in the depth buffer from the inverse depth
+	template <DepthStorage kStorage, typename DepthT>
+	inline DepthT DepthValue(DepthT depth_base, DepthT depth_coef, int x) {
+		DepthT inv_depth = depth_base + depth_coef*static_cast<DepthT>(x);
+		return kStorage == kStoreDepth ? 1 / inv_depth : inv_depth;
+	}
+
+	// The depth test
+	template <DepthStorage kStorage, typename DepthT>
+	inline bool DepthPasses(DepthT value, DepthT stored) {
+		if (kStorage == kStoreDepth) {
+			// Negative depths can happen when a wall is almost exactly
+			// oblique to the camera, in which case the pixel is ignored and
+			// the surface behind this one will pick up the depth.
+			return !(value < 0) && value < stored;
+		} else {
+			// Stored values are never negative, so this also rejects
+			// negative inverse depths
+			return value > stored;
+		}
+	}
+
+	// Rasterize one pixel at a time. The rectangle has already been
+	// clipped to the polygon bounds. If kWrite is false then the passing
+	// pixels are only counted. Stops at the end of the first row on which
+	// the count reaches limit.
+	template <typename LabelT, typename DepthT, DepthStorage kStorage, bool kWrite>
+	static int RasterizeScalar(const EdgeSetup& edges,
+														 const Vec3& depth_eqn,
+														 LabelT label,
+														 int ya, int yb, int xa, int xb,
+														 const RasterTarget<LabelT, DepthT>& target,
+														 int limit) {
+		const int n = edges.num_edges;
+		const DepthT depth_coef = depth_eqn[0];
+		int count = 0;
+		for (int y = ya; y < yb && count < limit; y++) {
+			int64_t e[kMaxPolygonEdges];
+			for (int i = 0; i < n; i++) {
+				e[i] = edges.a[i]*xa + edges.b[i]*y + edges.c[i];
+			}
+			const DepthT depth_base = DepthBase(depth_eqn, y);
+			DepthT* depth_row = target.depth + target.layout.RowOffset(y);
+			LabelT* label_row = target.labels + target.layout.RowOffset(y);
+			for (int x = xa; x < xb; x++) {
+				bool inside = true;
+				for (int i = 0; i < n; i++) {
+					inside &= e[i] >= 0;
+					e[i] += edges.a[i];
+				}
+				if (!inside) continue;
+
+				const int offset = target.layout.ColOffset(x);
+				DepthT value = DepthValue<kStorage>(depth_base, depth_coef, x);
+				if (DepthPasses<kStorage>(value, depth_row[offset])) {
+					if (kWrite) {
+						depth_row[offset] = value;
+						label_row[offset] = label;
+					}
+					count++;
+				}
+			}
+		}
+		return count;
+	}
+
+	// Get a bit mask of the pixels in [x,x+8) that are also in [xa,xb)
+	static inline int RunMask(int x, int xa, int xb) {
+		const int lo = std::max(xa-x, 0);
+		const int hi = std::min(xb-x, 8);
+		return ((1 << hi) - 1) & ~((1 << lo) - 1);
+	}
+
+#ifdef RASTERIZER_X86
+	// Get a bit mask of the pixels in [x,x+8) that are inside all edges,
+	// where e holds the edge functions at x, which are then advanced to
+	// x+8.
+	__attribute__((target("sse4.2")))
+	static inline int EdgeMaskSSE(int n, int64_t* e, const __m128i offsets[][4],
+																const int64_t* a) {
+		const __m128i izero = _mm_setzero_si128();
+		__m128i outside[4] = { izero, izero, izero, izero };
+		for (int i = 0; i < n; i++) {
+			__m128i ei = _mm_set1_epi64x(e[i]);
+			for (int j = 0; j < 4; j++) {
+				__m128i v = _mm_add_epi64(ei, offsets[i][j]);
+				outside[j] = _mm_or_si128(outside[j], _mm_cmpgt_epi64(izero, v));
+			}
+			e[i] += a[i]*8;
+		}
+		int bits = 0;
+		for (int j = 0; j < 4; j++) {
+			bits |= _mm_movemask_pd(_mm_castsi128_pd(outside[j])) << (2*j);
+		}
+		return ~bits & 0xff;
+	}
+
+	// Compute the depth buffer values for pixels [x,x+8)
+	template <DepthStorage kStorage>
+	__attribute__((target("sse4.2")))
+	static inline void DepthValuesSSE(double base, double coef, int x, double* out) {
+		const __m128d basev = _mm_set1_pd(base);
+		const __m128d coefv = _mm_set1_pd(coef);
+		for (int j = 0; j < 4; j++) {
+			__m128d v = _mm_add_pd(basev, _mm_mul_pd(coefv, _mm_set_pd(x+2*j+1, x+2*j)));
+			if (kStorage == kStoreDepth) v = _mm_div_pd(_mm_set1_pd(1.), v);
+			_mm_storeu_pd(out+2*j, v);
+		}
+	}
+
+	template <DepthStorage kStorage>
+	__attribute__((target("sse4.2")))
+	static inline void DepthValuesSSE(float base, float coef, int x, float* out) {
+		const __m128 basev = _mm_set1_ps(base);
+		const __m128 coefv = _mm_set1_ps(coef);
+		for (int j = 0; j < 2; j++) {
+			__m128 xs = _mm_setr_ps(x+4*j, x+4*j+1, x+4*j+2, x+4*j+3);
+			__m128 v = _mm_add_ps(basev, _mm_mul_ps(coefv, xs));
+			if (kStorage == kStoreDepth) v = _mm_div_ps(_mm_set1_ps(1.f), v);
+			_mm_storeu_ps(out+4*j, v);
+		}
+	}
+
+	// Rasterize eight pixels at a time using SSE4.2. The edge tests and
+	// depth computation are vectorized; the depth test and writes are
+	// done per pixel. Each group of eight is an aligned run, which is
+	// contiguous in memory in either buffer layout.
+	template <typename LabelT, typename DepthT, DepthStorage kStorage, bool kWrite>
+	__attribute__((target("sse4.2")))
+	static int RasterizeSSE(const EdgeSetup& edges,
+													const Vec3& depth_eqn,
+													LabelT label,
+													int ya, int yb, int xa, int xb,
+													const RasterTarget<LabelT, DepthT>& target,
+													int limit) {
+		const int n = edges.num_edges;
+		__m128i offsets[kMaxPolygonEdges][4];  // a*[0..7] in pairs
+		for (int i = 0; i < n; i++) {
+			for (int j = 0; j < 4; j++) {
+				offsets[i][j] = _mm_set_epi64x(edges.a[i]*(2*j+1), edges.a[i]*2*j);
+			}
+		}
+		const DepthT depth_coef = depth_eqn[0];
+
+		const int x0 = xa & ~7;
+		const int run_stride = target.layout.run_stride;
+		int count = 0;
+		for (int y = ya; y < yb && count < limit; y++) {
+			int64_t e[kMaxPolygonEdges];
+			for (int i = 0; i < n; i++) {
+				e[i] = edges.a[i]*x0 + edges.b[i]*y + edges.c[i];
+			}
+			const DepthT depth_base = DepthBase(depth_eqn, y);
+			DepthT* depth_run = target.depth + target.layout.RowOffset(y) + (x0 >> 3)*run_stride;
+			LabelT* label_run = target.labels + target.layout.RowOffset(y) + (x0 >> 3)*run_stride;
+			for (int x = x0; x < xb; x += 8, depth_run += run_stride, label_run += run_stride) {
+				int bits = EdgeMaskSSE(n, e, offsets, edges.a) & RunMask(x, xa, xb);
+				if (!bits) continue;
+
+				DepthT values[8];
+				DepthValuesSSE<kStorage>(depth_base, depth_coef, x, values);
+				for (int j = 0; j < 8; j++) {
+					if ((bits & (1 << j)) && DepthPasses<kStorage>(values[j], depth_run[j])) {
+						if (kWrite) {
+							depth_run[j] = values[j];
+							label_run[j] = label;
+						}
+						count++;
+					}
+				}
+			}
+		}
+		return count;
+	}
+
+	// Expand the low eight bits of a bit mask to a mask of 32-bit lanes
+	__attribute__((target("avx2")))
+	static inline __m256i BitsToMaskAVX2(int bits) {
+		const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+		return _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(bits), lane_bits), lane_bits);
+	}
+
+	// Get a bit mask of the pixels in [x,x+8) that are inside all edges,
+	// where e holds the edge functions at x, which are then advanced to
+	// x+8.
+	__attribute__((target("avx2")))
+	static inline int EdgeMaskAVX2(int n, int64_t* e, const __m256i* offsets_lo,
+																 const __m256i* offsets_hi, const int64_t* a) {
+		const __m256i izero = _mm256_setzero_si256();
+		__m256i outside_lo = izero, outside_hi = izero;
+		for (int i = 0; i < n; i++) {
+			__m256i ei = _mm256_set1_epi64x(e[i]);
+			outside_lo = _mm256_or_si256(outside_lo,
+																	 _mm256_cmpgt_epi64(izero, _mm256_add_epi64(ei, offsets_lo[i])));
+			outside_hi = _mm256_or_si256(outside_hi,
+																	 _mm256_cmpgt_epi64(izero, _mm256_add_epi64(ei, offsets_hi[i])));
+			e[i] += a[i]*8;
+		}
+		int bits = _mm256_movemask_pd(_mm256_castsi256_pd(outside_lo)) |
+			(_mm256_movemask_pd(_mm256_castsi256_pd(outside_hi)) << 4);
+		return ~bits & 0xff;
+	}
+
+	// Compute the depth buffer values for the covered pixels of [x,x+8),
+	// test them against the run of the depth buffer that holds them, and
+	// write those that pass if kWrite is true. Returns a bit mask of the
+	// pixels that passed.
+	template <DepthStorage kStorage, bool kWrite>
+	__attribute__((target("avx2")))
+	static inline int DepthTestAVX2(double base, double coef, int x, int bits, double* run) {
+		const __m256d basev = _mm256_set1_pd(base);
+		const __m256d coefv = _mm256_set1_pd(coef);
+		const __m256d xs = _mm256_set1_pd(x);
+		__m256d v_lo = _mm256_add_pd(basev, _mm256_mul_pd(coefv, _mm256_add_pd(xs, _mm256_setr_pd(0., 1., 2., 3.))));
+		__m256d v_hi = _mm256_add_pd(basev, _mm256_mul_pd(coefv, _mm256_add_pd(xs, _mm256_setr_pd(4., 5., 6., 7.))));
+
+		__m256i mask = BitsToMaskAVX2(bits);
+		__m256i mask_lo = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(mask));
+		__m256i mask_hi = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(mask, 1));
+		__m256d stored_lo = _mm256_maskload_pd(run, mask_lo);
+		__m256d stored_hi = _mm256_maskload_pd(run+4, mask_hi);
+		__m256d pass_lo, pass_hi;
+		if (kStorage == kStoreDepth) {
+			const __m256d one = _mm256_set1_pd(1.);
+			const __m256d zero = _mm256_setzero_pd();
+			v_lo = _mm256_div_pd(one, v_lo);
+			v_hi = _mm256_div_pd(one, v_hi);
+			// see DepthPasses
+			pass_lo = _mm256_and_pd(_mm256_cmp_pd(v_lo, stored_lo, _CMP_LT_OQ),
+															_mm256_cmp_pd(v_lo, zero, _CMP_NLT_UQ));
+			pass_hi = _mm256_and_pd(_mm256_cmp_pd(v_hi, stored_hi, _CMP_LT_OQ),
+															_mm256_cmp_pd(v_hi, zero, _CMP_NLT_UQ));
+		} else {
+			pass_lo = _mm256_cmp_pd(v_lo, stored_lo, _CMP_GT_OQ);
+			pass_hi = _mm256_cmp_pd(v_hi, stored_hi, _CMP_GT_OQ);
+		}
+		int pass = bits & (_mm256_movemask_pd(pass_lo) | (_mm256_movemask_pd(pass_hi) << 4));
+		if (kWrite && pass) {
+			mask = BitsToMaskAVX2(pass);
+			_mm256_maskstore_pd(run, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(mask)), v_lo);
+			_mm256_maskstore_pd(run+4, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(mask, 1)), v_hi);
+		}
+		return pass;
+	}
+
+	template <DepthStorage kStorage, bool kWrite>
+	__attribute__((target("avx2")))
+	static inline int DepthTestAVX2(float base, float coef, int x, int bits, float* run) {
+		__m256 v = _mm256_add_ps(_mm256_set1_ps(base),
+														 _mm256_mul_ps(_mm256_set1_ps(coef),
+																					 _mm256_setr_ps(x, x+1, x+2, x+3, x+4, x+5, x+6, x+7)));
+		__m256i mask = BitsToMaskAVX2(bits);
+		__m256 stored = _mm256_maskload_ps(run, mask);
+		__m256 pass_mask;
+		if (kStorage == kStoreDepth) {
+			v = _mm256_div_ps(_mm256_set1_ps(1.f), v);
+			// see DepthPasses
+			pass_mask = _mm256_and_ps(_mm256_cmp_ps(v, stored, _CMP_LT_OQ),
+																_mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_NLT_UQ));
+		} else {
+			pass_mask = _mm256_cmp_ps(v, stored, _CMP_GT_OQ);
+		}
+		int pass = bits & _mm256_movemask_ps(pass_mask);
+		if (kWrite && pass) {
+			_mm256_maskstore_ps(run, BitsToMaskAVX2(pass), v);
+		}
+		return pass;
+	}
+
+	// Write a label to the pixels of a run of eight selected by a bit
+	// mask
+	template <typename LabelT>
+	__attribute__((target("avx2")))
+	static inline void WriteLabelsAVX2(LabelT label, int pass, LabelT* run) {
+		for (int j = 0; j < 8; j++) {
+			if (pass & (1 << j)) run[j] = label;
+		}
+	}
+
+	__attribute__((target("avx2")))
+	static inline void WriteLabelsAVX2(int label, int pass, int* run) {
+		_mm256_maskstore_epi32(run, BitsToMaskAVX2(pass), _mm256_set1_epi32(label));
+	}
+
+	// Rasterize eight pixels at a time using AVX2, including the depth
+	// test and masked depth writes. Labels are also written with a
+	// masked store when they are 32 bits wide.
+	template <typename LabelT, typename DepthT, DepthStorage kStorage, bool kWrite>
+	__attribute__((target("avx2")))
+	static int RasterizeAVX2(const EdgeSetup& edges,
+													 const Vec3& depth_eqn,
+													 LabelT label,
+													 int ya, int yb, int xa, int xb,
+													 const RasterTarget<LabelT, DepthT>& target,
+													 int limit) {
+		const int n = edges.num_edges;
+		__m256i offsets_lo[kMaxPolygonEdges];  // a*[0..3]
+		__m256i offsets_hi[kMaxPolygonEdges];  // a*[4..7]
+		for (int i = 0; i < n; i++) {
+			const int64_t a = edges.a[i];
+			offsets_lo[i] = _mm256_setr_epi64x(0, a, 2*a, 3*a);
+			offsets_hi[i] = _mm256_setr_epi64x(4*a, 5*a, 6*a, 7*a);
+		}
+		const DepthT depth_coef = depth_eqn[0];
+
+		const int x0 = xa & ~7;
+		const int run_stride = target.layout.run_stride;
+		int count = 0;
+		for (int y = ya; y < yb && count < limit; y++) {
+			int64_t e[kMaxPolygonEdges];
+			for (int i = 0; i < n; i++) {
+				e[i] = edges.a[i]*x0 + edges.b[i]*y + edges.c[i];
+			}
+			const DepthT depth_base = DepthBase(depth_eqn, y);
+			DepthT* depth_run = target.depth + target.layout.RowOffset(y) + (x0 >> 3)*run_stride;
+			LabelT* label_run = target.labels + target.layout.RowOffset(y) + (x0 >> 3)*run_stride;
+			for (int x = x0; x < xb; x += 8, depth_run += run_stride, label_run += run_stride) {
+				int bits = EdgeMaskAVX2(n, e, offsets_lo, offsets_hi, edges.a) & RunMask(x, xa, xb);
+				if (!bits) continue;
+				int pass = DepthTestAVX2<kStorage, kWrite>(depth_base, depth_coef, x, bits, depth_run);
+				if (!pass) continue;
+				if (kWrite) WriteLabelsAVX2(label, pass, label_run);
+				count += __builtin_popcount(pass);
+			}
+		}
+		return count;
+	}
+#endif
+
+	// Returns true if the CPU supports the given implementation
+	static bool CpuSupports(RasterPath path) {
+#ifdef RASTERIZER_X86
+		__builtin_cpu_init();
+		switch (path) {
+		case kRasterAVX2: return __builtin_cpu_supports("avx2");
+		case kRasterSSE: return __builtin_cpu_supports("sse4.2");
+		default: return true;
+		}
+#else
+		return path == kRasterScalar;
+#endif
+	}
+
+	// Pick the fastest implementation that the CPU supports
+	static RasterPath BestRasterPath() {
+		if (CpuSupports(kRasterAVX2)) return kRasterAVX2;
+		if (CpuSupports(kRasterSSE)) return kRasterSSE;
+		return kRasterScalar;
+	}
+
+	static RasterPath raster_path = BestRasterPath();
+
+	RasterPath GetRasterPath() {
+		return raster_path;
+	}
+
+	bool SetRasterPath(RasterPath path) {
+		if (!CpuSupports(path)) return false;
+		raster_path = path;
+		return true;
+	}
+
+	// Clip to the polygon bounds and dispatch to the selected
+	// implementation
+	template <typename LabelT, typename DepthT, DepthStorage kStorage, bool kWrite>
+	static int Rasterize(const EdgeSetup& edges,
+											 const Vec3& depth_eqn,
+											 LabelT label,
+											 int ya, int yb, int xa, int xb,
+											 const RasterTarget<LabelT, DepthT>& target,
+											 int limit) {
+		xa = std::max(xa, edges.xmin);
+		xb = std::min(xb, edges.xmax+1);
+		ya = std::max(ya, edges.ymin);
+		yb = std::min(yb, edges.ymax+1);
+		if (xa >= xb || ya >= yb) return 0;
+
+		switch (raster_path) {
+#ifdef RASTERIZER_X86
+		case kRasterAVX2:
+			return RasterizeAVX2<LabelT, DepthT, kStorage, kWrite>(edges, depth_eqn, label,
+																														 ya, yb, xa, xb, target, limit);
+		case kRasterSSE:
+			return RasterizeSSE<LabelT, DepthT, kStorage, kWrite>(edges, depth_eqn, label,
+																														ya, yb, xa, xb, target, limit);
+#endif
+		default:
+			return RasterizeScalar<LabelT, DepthT, kStorage, kWrite>(edges, depth_eqn, label,
+																															 ya, yb, xa, xb, target, limit);
+		}
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	int RasterizePolygon(const EdgeSetup& edges,
+											 const Vec3& depth_eqn,
+											 LabelT label,
+											 int ya, int yb, int xa, int xb,
+											 const RasterTarget<LabelT, DepthT>& target) {
+		return Rasterize<LabelT, DepthT, kStorage, true>(edges, depth_eqn, label,
+																										 ya, yb, xa, xb, target, INT_MAX);
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	int RasterizeColumn(int x, int ya, int yb,
+											const Vec3& depth_eqn,
+											double min_inv_depth,
+											LabelT label,
+											const RasterTarget<LabelT, DepthT>& target) {
+		const int col = target.layout.ColOffset(x);
+		double inv_depth = depth_eqn[0]*x + DepthBase(depth_eqn, ya);
+		int count = 0;
+		for (int y = ya; y < yb; y++) {
+			const long offset = target.layout.RowOffset(y) + col;
+			const double inv = std::max(inv_depth, min_inv_depth);
+			const DepthT value = static_cast<DepthT>(kStorage == kStoreDepth ? 1. / inv : inv);
+			if (DepthPasses<kStorage>(value, target.depth[offset])) {
+				target.depth[offset] = value;
+				target.labels[offset] = label;
+				count++;
+			}
+			inv_depth += depth_eqn[1];
+		}
+		return count;
+	}
+
+	template <typename DepthT, DepthStorage kStorage>
+	int CountVisiblePixels(const EdgeSetup& edges,
+												 const Vec3& depth_eqn,
+												 int ya, int yb, int xa, int xb,
+												 const DepthT* depth, const PixelLayout& layout,
+												 int limit) {
+		// Nothing is written so the buffers can be treated as mutable
+		RasterTarget<uint8_t, DepthT> target;
+		target.depth = const_cast<DepthT*>(depth);
+		target.labels = NULL;
+		target.layout = layout;
+		return Rasterize<uint8_t, DepthT, kStorage, false>(edges, depth_eqn, 0,
+																											 ya, yb, xa, xb, target, limit);
+	}
+
+#define INSTANTIATE_RASTERIZER(LabelT, DepthT, kStorage)								\
+	template int RasterizePolygon<LabelT, DepthT, kStorage>(							\
+		const EdgeSetup&, const Vec3&, LabelT, int, int, int, int,					\
+		const RasterTarget<LabelT, DepthT>&);																\
+	template int RasterizeColumn<LabelT, DepthT, kStorage>(								\
+		int, int, int, const Vec3&, double, LabelT,													\
+		const RasterTarget<LabelT, DepthT>&);
+
+#define INSTANTIATE_RASTERIZER_ALL_STORAGE(LabelT, DepthT)			\
+	INSTANTIATE_RASTERIZER(LabelT, DepthT, kStoreDepth)						\
+	INSTANTIATE_RASTERIZER(LabelT, DepthT, kStoreInverseDepth)
+
+	INSTANTIATE_RASTERIZER_ALL_STORAGE(int, double)
+	INSTANTIATE_RASTERIZER_ALL_STORAGE(int, float)
+	INSTANTIATE_RASTERIZER_ALL_STORAGE(uint16_t, double)
+	INSTANTIATE_RASTERIZER_ALL_STORAGE(uint16_t, float)
+	INSTANTIATE_RASTERIZER_ALL_STORAGE(uint8_t, double)
+	INSTANTIATE_RASTERIZER_ALL_STORAGE(uint8_t, float)
+
+#define INSTANTIATE_VISIBILITY(DepthT, kStorage)												\
+	template int CountVisiblePixels<DepthT, kStorage>(										\
+		const EdgeSetup&, const Vec3&, int, int, int, int, const DepthT*, const PixelLayout&, int);
+
+	INSTANTIATE_VISIBILITY(double, kStoreDepth)
+	INSTANTIATE_VISIBILITY(double, kStoreInverseDepth)
+	INSTANTIATE_VISIBILITY(float, kStoreDepth)
+	INSTANTIATE_VISIBILITY(float, kStoreInverseDepth)
+}  // namespace indoor_context
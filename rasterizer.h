@@ -0,0 +1,133 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+#include "matrix_types.h"
+#include "buffer_layout.h"
+
+namespace indoor_context {
+	// Max number of edges in a polygon passed to the rasterizer. A
+	// triangle clipped against the six planes of a frustrum has at most
+	// nine vertices.
+	static const int kMaxPolygonEdges = 9;
+	// Number of fractional bits in the fixed-point vertex coordinates
+	static const int kSubpixelBits = 8;
+
+	// A convex polygon represented as the intersection of half-spaces
+	// E(x,y) = a*x + b*y + c >= 0, where (x,y) are integer pixel
+	// coordinates and the coefficients are in fixed point. Pixels exactly
+	// on an edge are included only for top and left edges, so polygons
+	// that share an edge never both draw the pixels along it.
+	struct EdgeSetup {
+		int num_edges;
+		int64_t a[kMaxPolygonEdges];  // change in E per pixel in x
+		int64_t b[kMaxPolygonEdges];  // change in E per pixel in y
+		int64_t c[kMaxPolygonEdges];  // E at pixel (0,0), including the fill rule bias
+		int xmin, xmax, ymin, ymax;  // inclusive pixel bounds, clipped to the viewport
+	};
+
+	// Why SetupEdges rejected a polygon
+	enum EdgeRejection {
+		kEdgesAccepted,
+		kEdgesInvalidVertex,  // a vertex has NaN or out-of-range coordinates
+		kEdgesZeroArea,  // the polygon has zero area after rounding
+		kEdgesNoPixels  // the polygon covers no pixel centres in the viewport
+	};
+
+	// Set up the edge equations for a convex polygon given in
+	// homogeneous image coordinates. Returns false if the polygon covers
+	// no pixels in the viewport, in which case the reason is written to
+	// rejection if it is not NULL.
+	bool SetupEdges(const std::vector<Vec3>& poly,
+									const Vec2I& viewport,
+									EdgeSetup& edges,
+									EdgeRejection* rejection = NULL);
+	// As above, for a polygon with n vertices
+	bool SetupEdges(const Vec3* poly, int n,
+									const Vec2I& viewport,
+									EdgeSetup& edges,
+									EdgeRejection* rejection = NULL);
+
+	// Returns true if any part of the rectangle [xa,xb)x[ya,yb) could be
+	// inside the polygon.
+	bool EdgesOverlapRect(const EdgeSetup& edges, int ya, int yb, int xa, int xb);
+
+	// What the rasterizer stores in the depth buffer
+	enum DepthStorage {
+		kStoreDepth,  // depth, cleared to infinity; smaller is closer
+		kStoreInverseDepth  // 1/depth, cleared to zero; larger is closer
+	};
+
+	// Buffers written by the rasterizer. Both have the same layout.
+	template <typename LabelT, typename DepthT>
+	struct RasterTarget {
+		DepthT* depth;
+		LabelT* labels;
+		PixelLayout layout;
+	};
+
+	// Fill the pixels of a polygon that fall within rows [ya,yb) and
+	// columns [xa,xb). The inverse depth at pixel (x,y) is
+	// depth_eqn*makeVector(x,y,1) (see PlaneToDepthEqn), evaluated in
+	// DepthT precision, and a pixel is written only if it is closer than
+	// the value already in the depth buffer. With kStoreInverseDepth the
+	// inverse depth is stored directly and no division is needed.
+	// Returns the number of pixels written.
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	int RasterizePolygon(const EdgeSetup& edges,
+											 const Vec3& depth_eqn,
+											 LabelT label,
+											 int ya, int yb, int xa, int xb,
+											 const RasterTarget<LabelT, DepthT>& target);
+
+	// Fill rows [ya,yb) of column x with a depth test, for surfaces
+	// whose extent in each column is known analytically. The inverse
+	// depth is evaluated at row ya and then advanced by depth_eqn[1] per
+	// row. It is clamped to at least min_inv_depth, which also absorbs
+	// rounding errors at the end of a span, so the caller only needs to
+	// ensure that the exact inverse depth is positive over the
+	// span. Returns the number of pixels written.
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	int RasterizeColumn(int x, int ya, int yb,
+											const Vec3& depth_eqn,
+											double min_inv_depth,
+											LabelT label,
+											const RasterTarget<LabelT, DepthT>& target);
+
+	// Count the pixels of a polygon within rows [ya,yb) and columns
+	// [xa,xb) that would pass the depth test against a depth buffer with
+	// the given layout, without writing anything. Stops at the end of
+	// the first row on which the count reaches limit, so the result may
+	// exceed limit.
+	template <typename DepthT, DepthStorage kStorage>
+	int CountVisiblePixels(const EdgeSetup& edges,
+												 const Vec3& depth_eqn,
+												 int ya, int yb, int xa, int xb,
+												 const DepthT* depth, const PixelLayout& layout,
+												 int limit);
+
+	// Add one to counts[y*stride+x] for each pixel (x,y) of a polygon
+	// within rows [ya,yb) and columns [xa,xb), regardless of depth. This
+	// is the coverage that RasterizePolygon tests, one pixel at a time.
+	// Returns the number of pixels counted.
+	int AccumulateCoverage(const EdgeSetup& edges,
+												 int ya, int yb, int xa, int xb,
+												 int* counts, int stride);
+
+	// Implementations of RasterizePolygon and CountVisiblePixels, which
+	// also select the implementation of TransformVertices. All of them
+	// produce identical output.
+	enum RasterPath {
+		kRasterScalar,  // one pixel at a time
+		kRasterSSE,  // eight pixels at a time using SSE4.2
+		kRasterAVX2  // eight pixels at a time using AVX2
+	};
+
+	// Get the implementation used by RasterizePolygon. By default this
+	// is the fastest one that the CPU supports.
+	RasterPath GetRasterPath();
+	// Choose the implementation used by RasterizePolygon, for testing
+	// and benchmarking. Returns false if the CPU does not support it.
+	bool SetRasterPath(RasterPath path);
+}  // namespace indoor_context
@@ -0,0 +1,64 @@
+#include "render_stats.h"
+
+#include <algorithm>
+
+namespace indoor_context {
+	const char* RenderStageName(RenderStage stage) {
+		switch (stage) {
+		case kStageTransform: return "transform";
+		case kStageClip: return "clip";
+		case kStageDepthEqn: return "depth_eqn";
+		case kStageEdges: return "edges";
+		case kStageFill: return "fill";
+		default: return "unknown";
+		}
+	}
+
+	void RenderStats::Reset() {
+		triangles_submitted = 0;
+		triangles_invalid = 0;
+		triangles_culled = 0;
+		triangles_degenerate = 0;
+		triangles_empty = 0;
+		triangles_hiz_culled = 0;
+		triangles_rasterized = 0;
+		triangles_clipped = 0;
+		nan_vertices = 0;
+		negative_depths = 0;
+		pixels_written = 0;
+		pixels_counted = 0;
+		fragments = 0;
+		std::fill(stage_counts, stage_counts+kNumRenderStages, 0);
+		std::fill(stage_seconds, stage_seconds+kNumRenderStages, 0.);
+	}
+
+	void RenderStats::Add(const RenderStats& other) {
+		triangles_submitted += other.triangles_submitted;
+		triangles_invalid += other.triangles_invalid;
+		triangles_culled += other.triangles_culled;
+		triangles_degenerate += other.triangles_degenerate;
+		triangles_empty += other.triangles_empty;
+		triangles_hiz_culled += other.triangles_hiz_culled;
+		triangles_rasterized += other.triangles_rasterized;
+		triangles_clipped += other.triangles_clipped;
+		nan_vertices += other.nan_vertices;
+		negative_depths += other.negative_depths;
+		pixels_written += other.pixels_written;
+		pixels_counted += other.pixels_counted;
+		fragments += other.fragments;
+		for (int i = 0; i < kNumRenderStages; i++) {
+			stage_counts[i] += other.stage_counts[i];
+			stage_seconds[i] += other.stage_seconds[i];
+		}
+	}
+
+	void OverdrawHistogram(const OverdrawBuffer& overdraw, std::vector<long>& histogram) {
+		histogram.clear();
+		if (overdraw.size() == 0) return;
+		histogram.assign(std::max(overdraw.maxCoeff(), 0)+1, 0);
+		const int* counts = overdraw.data();
+		for (int i = 0; i < overdraw.size(); i++) {
+			histogram[counts[i]]++;
+		}
+	}
+}  // namespace indoor_context
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <vector>
+#include <chrono>
+
+#include "matrix_types.h"
+
+namespace indoor_context {
+	// Statistics are compiled in unless RENDERER_NO_STATS is defined (see
+	// the RENDER_STATS option in CMakeLists.txt). Without them, the code
+	// that collects statistics is removed by the compiler and they stay
+	// at zero.
+#ifdef RENDERER_NO_STATS
+	static const bool kRenderStatsSupported = false;
+#else
+	static const bool kRenderStatsSupported = true;
+#endif
+
+	// The stages of the triangle pipeline that are timed
+	enum RenderStage {
+		kStageTransform,  // transforming and projecting vertices
+		kStageClip,  // clipping to the frustrum (ClipToFrustrum)
+		kStageDepthEqn,  // computing depth equations (PlaneToDepthEqn)
+		kStageEdges,  // converting polygons to edge equations (SetupEdges)
+		kStageFill,  // depth testing and writing pixels
+		kNumRenderStages
+	};
+
+	// Get the name of a stage, for reports
+	const char* RenderStageName(RenderStage stage);
+
+	// Counters for the triangles drawn by a renderer. Every triangle
+	// submitted is counted in exactly one of invalid, culled,
+	// degenerate, empty, hiz_culled and rasterized.
+	struct RenderStats {
+		long triangles_submitted;
+		long triangles_invalid;  // out-of-range vertex indices
+		long triangles_culled;  // entirely outside the frustrum
+		long triangles_degenerate;  // zero area, or seen edge-on
+		long triangles_empty;  // no pixel centres within the scissor rectangle
+		long triangles_hiz_culled;  // rejected by hierarchical-Z culling
+		long triangles_rasterized;
+		// Triangles that crossed a frustrum plane and were clipped
+		long triangles_clipped;
+
+		// Polygons rejected because a vertex had NaN or out-of-range
+		// image coordinates
+		long nan_vertices;
+		// Triangles whose inverse depth is negative or NaN somewhere in
+		// their clipped polygon. The depth test rejects these pixels, so
+		// they are never drawn.
+		long negative_depths;
+
+		// Pixels that passed the depth test and were written
+		long pixels_written;
+		// Pixels that passed the depth test in occlusion queries that do
+		// not write
+		long pixels_counted;
+		// Fragments rasterized, whether or not they passed the depth
+		// test. Only counted while the overdraw buffer is enabled.
+		long fragments;
+
+		// The number of items processed by each stage: vertices
+		// transformed, triangles clipped, depth equations computed,
+		// polygons set up and rectangles filled
+		long stage_counts[kNumRenderStages];
+		// The time spent in each stage, in seconds. With more than one
+		// thread this is summed over threads.
+		double stage_seconds[kNumRenderStages];
+
+		RenderStats() { Reset(); }
+		// Set all statistics to zero
+		void Reset();
+		// Add the statistics of some other triangles
+		void Add(const RenderStats& other);
+	};
+
+	// The number of fragments rasterized at each pixel, as a row-major
+	// array the size of the viewport
+	typedef Eigen::Array<int, Eigen::Dynamic, Eigen::Dynamic> OverdrawBuffer;
+
+	// Compute the histogram of an overdraw buffer: element k is the
+	// number of pixels with k fragments
+	void OverdrawHistogram(const OverdrawBuffer& overdraw, std::vector<long>& histogram);
+
+	// Adds the time from construction to destruction to one stage of a
+	// RenderStats, or does nothing if it is NULL
+	class StageTimer {
+	public:
+		typedef std::chrono::steady_clock Clock;
+
+		StageTimer(RenderStats* stats, RenderStage stage)
+			: stats_(kRenderStatsSupported ? stats : NULL), stage_(stage) {
+			if (stats_) start_ = Clock::now();
+		}
+		~StageTimer() {
+			if (stats_) {
+				stats_->stage_seconds[stage_] +=
+					std::chrono::duration<double>(Clock::now() - start_).count();
+			}
+		}
+
+	private:
+		RenderStats* stats_;
+		RenderStage stage_;
+		Clock::time_point start_;
+	};
+}  // namespace indoor_context
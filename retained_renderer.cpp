@@ -0,0 +1,268 @@
+#include "retained_renderer.h"
+
+#include <iostream>
+#include <algorithm>
+
+#include "matrix_types.h"
+
+namespace indoor_context {
+	using std::vector;
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	RetainedRendererT<LabelT, DepthT, kStorage>::RetainedRendererT()
+		: bg_(0),
+			num_live_(0) {
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	RetainedRendererT<LabelT, DepthT, kStorage>::RetainedRendererT(const LinearCamera& camera,
+																																 Vec2I viewport,
+																																 LabelT bg)
+		: num_live_(0) {
+		Configure(camera, viewport, bg);
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void RetainedRendererT<LabelT, DepthT, kStorage>::Configure(const LinearCamera& camera,
+																															Vec2I viewport,
+																															LabelT bg) {
+		bg_ = bg;
+		renderer_.Configure(camera, viewport);
+		renderer_.Clear(-1);
+		framebuffer_.setConstant(viewport[1], viewport[0], bg);
+		primitive_ids_.setConstant(viewport[1], viewport[0], -1);
+
+		// The bounds depend on the camera so the whole viewport must be
+		// re-rendered
+		dirty_.clear();
+		for (int i = 0; i < primitives_.size(); i++) {
+			if (primitives_[i].live) {
+				ComputeBounds(primitives_[i]);
+			}
+		}
+		Rect all = { 0, viewport[1], 0, viewport[0] };
+		AddDirty(all);
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	bool RetainedRendererT<LabelT, DepthT, kStorage>::CheckPrimitive(const vector<Vec3>& vertices,
+																																	 const vector<Vec3I>& indices,
+																																	 const vector<LabelT>& labels) const {
+		if (labels.size() != indices.size()) {
+			std::cerr << "RetainedRenderer needs exactly one label per triangle";
+			return false;
+		}
+		const int nv = vertices.size();
+		for (int i = 0; i < indices.size(); i++) {
+			if (indices[i].minCoeff() < 0 || indices[i].maxCoeff() >= nv) {
+				std::cerr << "Warning: triangle "<<i<<" has an out-of-range vertex index in RetainedRenderer";
+				return false;
+			}
+		}
+		return true;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	int RetainedRendererT<LabelT, DepthT, kStorage>::AddPrimitive(const vector<Vec3>& vertices,
+																																const vector<Vec3I>& indices,
+																																const vector<LabelT>& labels) {
+		if (!CheckPrimitive(vertices, indices, labels)) {
+			return -1;
+		}
+		const int handle = primitives_.size();
+		primitives_.push_back(Primitive());
+		primitives_[handle].num_ids = 0;
+		SetPrimitive(handle, vertices, indices, labels);
+		num_live_++;
+		return handle;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	bool RetainedRendererT<LabelT, DepthT, kStorage>::UpdatePrimitive(int handle,
+																																		const vector<Vec3>& vertices,
+																																		const vector<Vec3I>& indices,
+																																		const vector<LabelT>& labels) {
+		if (handle < 0 || handle >= primitives_.size() || !primitives_[handle].live) {
+			std::cerr << "Warning: invalid handle "<<handle<<" passed to RetainedRenderer::UpdatePrimitive()";
+			return false;
+		}
+		if (!CheckPrimitive(vertices, indices, labels)) {
+			return false;
+		}
+		// The region covered before the change must be re-rendered
+		if (primitives_[handle].visible) {
+			AddDirty(primitives_[handle].bounds);
+		}
+		SetPrimitive(handle, vertices, indices, labels);
+		return true;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	bool RetainedRendererT<LabelT, DepthT, kStorage>::RemovePrimitive(int handle) {
+		if (handle < 0 || handle >= primitives_.size() || !primitives_[handle].live) {
+			std::cerr << "Warning: invalid handle "<<handle<<" passed to RetainedRenderer::RemovePrimitive()";
+			return false;
+		}
+		Primitive& prim = primitives_[handle];
+		if (prim.visible) {
+			AddDirty(prim.bounds);
+		}
+		prim.live = false;
+		prim.vertices.clear();
+		prim.indices.clear();
+		prim.labels.clear();
+		num_live_--;
+		return true;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void RetainedRendererT<LabelT, DepthT, kStorage>::RemoveAll() {
+		for (int i = 0; i < primitives_.size(); i++) {
+			if (primitives_[i].live) {
+				RemovePrimitive(i);
+			}
+		}
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void RetainedRendererT<LabelT, DepthT, kStorage>::SetPrimitive(int handle,
+																																 const vector<Vec3>& vertices,
+																																 const vector<Vec3I>& indices,
+																																 const vector<LabelT>& labels) {
+		Primitive& prim = primitives_[handle];
+		prim.live = true;
+		prim.vertices = vertices;
+		prim.indices = indices;
+		prim.labels = labels;
+
+		// Re-use the triangle ids of the primitive if there are enough,
+		// since any pixels that still refer to them will be re-rendered
+		if (prim.num_ids < indices.size()) {
+			prim.first_id = id_primitive_.size();
+			prim.num_ids = indices.size();
+			id_primitive_.resize(prim.first_id + prim.num_ids);
+			id_label_.resize(prim.first_id + prim.num_ids);
+		}
+		for (int i = 0; i < indices.size(); i++) {
+			id_primitive_[prim.first_id+i] = handle;
+			id_label_[prim.first_id+i] = labels[i];
+		}
+
+		ComputeBounds(prim);
+		if (prim.visible) {
+			AddDirty(prim.bounds);
+		}
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void RetainedRendererT<LabelT, DepthT, kStorage>::ComputeBounds(Primitive& prim) {
+		prim.visible = false;
+		for (int i = 0; i < prim.indices.size(); i++) {
+			const Vec3I& tri = prim.indices[i];
+			Rect r;
+			if (!renderer_.TriangleBounds(prim.vertices[tri[0]], prim.vertices[tri[1]], prim.vertices[tri[2]],
+																		r.ya, r.yb, r.xa, r.xb)) {
+				continue;
+			}
+			if (!prim.visible) {
+				prim.bounds = r;
+				prim.visible = true;
+			} else {
+				prim.bounds.ya = std::min(prim.bounds.ya, r.ya);
+				prim.bounds.yb = std::max(prim.bounds.yb, r.yb);
+				prim.bounds.xa = std::min(prim.bounds.xa, r.xa);
+				prim.bounds.xb = std::max(prim.bounds.xb, r.xb);
+			}
+		}
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void RetainedRendererT<LabelT, DepthT, kStorage>::AddDirty(const Rect& rect) {
+		// Merge with any overlapping regions so that no pixel is rendered
+		// twice, repeating since the union may overlap other regions
+		Rect r = rect;
+		bool merged = true;
+		while (merged) {
+			merged = false;
+			for (int i = 0; i < dirty_.size(); i++) {
+				const Rect& d = dirty_[i];
+				if (d.xa < r.xb && r.xa < d.xb && d.ya < r.yb && r.ya < d.yb) {
+					r.ya = std::min(r.ya, d.ya);
+					r.yb = std::max(r.yb, d.yb);
+					r.xa = std::min(r.xa, d.xa);
+					r.xb = std::max(r.xb, d.xb);
+					dirty_[i] = dirty_.back();
+					dirty_.pop_back();
+					merged = true;
+					break;
+				}
+			}
+		}
+		dirty_.push_back(r);
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	long RetainedRendererT<LabelT, DepthT, kStorage>::Resolve() {
+		long npixels = 0;
+		for (int i = 0; i < dirty_.size(); i++) {
+			ResolveRect(dirty_[i]);
+			npixels += static_cast<long>(dirty_[i].yb-dirty_[i].ya) * (dirty_[i].xb-dirty_[i].xa);
+		}
+		dirty_.clear();
+		return npixels;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void RetainedRendererT<LabelT, DepthT, kStorage>::ResolveRect(const Rect& rect) {
+		renderer_.ClearRect(-1, rect.ya, rect.yb, rect.xa, rect.xb);
+
+		// Draw the primitives that overlap the rectangle, in order of
+		// their handles, as a single mesh
+		mesh_vertices_.clear();
+		mesh_indices_.clear();
+		mesh_ids_.clear();
+		for (int i = 0; i < primitives_.size(); i++) {
+			const Primitive& prim = primitives_[i];
+			if (!prim.live || !prim.visible ||
+					prim.bounds.xb <= rect.xa || rect.xb <= prim.bounds.xa ||
+					prim.bounds.yb <= rect.ya || rect.yb <= prim.bounds.ya) {
+				continue;
+			}
+			const int base = mesh_vertices_.size();
+			mesh_vertices_.insert(mesh_vertices_.end(), prim.vertices.begin(), prim.vertices.end());
+			for (int j = 0; j < prim.indices.size(); j++) {
+				mesh_indices_.push_back(prim.indices[j] + Vec3I::Constant(base));
+				mesh_ids_.push_back(prim.first_id + j);
+			}
+		}
+		renderer_.SetScissor(rect.ya, rect.yb, rect.xa, rect.xb);
+		renderer_.RenderMesh(mesh_vertices_, mesh_indices_, mesh_ids_);
+		renderer_.ResetScissor();
+
+		// Map triangle ids to primitives and labels
+		const BufferView<int> ids = renderer_.frame_view();
+		for (int y = rect.ya; y < rect.yb; y++) {
+			for (int x = rect.xa; x < rect.xb; x++) {
+				const int id = ids(y, x);
+				if (id < 0) {
+					primitive_ids_(y, x) = -1;
+					framebuffer_(y, x) = bg_;
+				} else {
+					primitive_ids_(y, x) = id_primitive_[id];
+					framebuffer_(y, x) = id_label_[id];
+				}
+			}
+		}
+	}
+
+#define INSTANTIATE_RETAINED_RENDERER_ALL_STORAGE(LabelT, DepthT)				\
+	template class RetainedRendererT<LabelT, DepthT, kStoreDepth>;				\
+	template class RetainedRendererT<LabelT, DepthT, kStoreInverseDepth>;
+
+	INSTANTIATE_RETAINED_RENDERER_ALL_STORAGE(int, double)
+	INSTANTIATE_RETAINED_RENDERER_ALL_STORAGE(int, float)
+	INSTANTIATE_RETAINED_RENDERER_ALL_STORAGE(uint16_t, double)
+	INSTANTIATE_RETAINED_RENDERER_ALL_STORAGE(uint16_t, float)
+	INSTANTIATE_RETAINED_RENDERER_ALL_STORAGE(uint8_t, double)
+	INSTANTIATE_RETAINED_RENDERER_ALL_STORAGE(uint8_t, float)
+}  // namespace indoor_context
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <vector>
+
+#include "matrix_types.h"
+#include "simple_renderer.h"
+
+namespace indoor_context {
+	// Renders a scene that is kept between frames. Primitives are
+	// registered with stable handles and each pixel records which
+	// primitive it shows. When primitives are added, updated or removed,
+	// only the screen regions they covered before and after the change
+	// are cleared and re-rendered on the next call to Resolve(), so the
+	// cost scales with the changed area rather than the scene size. The
+	// output is identical to rendering all primitives from scratch in
+	// order of their handles.
+	template <typename LabelT = int,
+						typename DepthT = double,
+						DepthStorage kStorage = kStoreDepth>
+	class RetainedRendererT {
+	public:
+		// Make sure we're aligned (since we have eigen members)
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+		typedef Eigen::Array<LabelT, Eigen::Dynamic, Eigen::Dynamic> LabelBuffer;
+		typedef Eigen::Array<DepthT, Eigen::Dynamic, Eigen::Dynamic> DepthBuffer;
+
+		// Initialize empty
+		RetainedRendererT();
+		// Initialize with the given camera, viewport and background label
+		RetainedRendererT(const LinearCamera& cam, Vec2I viewport, LabelT bg);
+
+		// Configure the camera, viewport and background label. The
+		// primitives are kept and the whole viewport is re-rendered on
+		// the next call to Resolve().
+		void Configure(const LinearCamera& cam, Vec2I viewport, LabelT bg);
+		// Set the number of threads used to re-render each dirty region
+		void SetNumThreads(int n) { renderer_.SetNumThreads(n); }
+		// Enable or disable hierarchical-Z culling
+		void EnableHiZ(bool enable) { renderer_.EnableHiZ(enable); }
+
+		// Add a primitive made of indexed triangles, each with its own
+		// label. Returns the handle of the new primitive, or -1 if the
+		// primitive is invalid.
+		int AddPrimitive(const std::vector<Vec3>& vertices,
+										 const std::vector<Vec3I>& indices,
+										 const std::vector<LabelT>& labels);
+		// Replace the geometry of a primitive. It keeps its handle and so
+		// its place in the drawing order. Returns false if the handle or
+		// the primitive is invalid.
+		bool UpdatePrimitive(int handle,
+												 const std::vector<Vec3>& vertices,
+												 const std::vector<Vec3I>& indices,
+												 const std::vector<LabelT>& labels);
+		// Remove a primitive. Its handle is not re-used. Returns false if
+		// the handle is invalid.
+		bool RemovePrimitive(int handle);
+		// Remove all primitives
+		void RemoveAll();
+
+		// Re-render the regions affected by changes since the last call.
+		// Returns the number of pixels that were re-rendered.
+		long Resolve();
+
+		// Get the label of each pixel
+		const LabelBuffer& framebuffer() const { return framebuffer_; }
+		// Get the depth of each pixel. See DepthStorage for its contents.
+		const DepthBuffer& depthbuffer() const { return renderer_.depthbuffer(); }
+		// Get the handle of the primitive at each pixel, or -1 for the
+		// background
+		const Eigen::ArrayXXi& primitive_ids() const { return primitive_ids_; }
+		// Get the number of primitives that have not been removed
+		int num_primitives() const { return num_live_; }
+		// Get the camera
+		const LinearCamera& camera() const { return renderer_.camera(); }
+		// Get the viewport
+		const Vec2I& viewport() const { return renderer_.viewport(); }
+
+	private:
+		// A rectangle [xa,xb)x[ya,yb) of pixels
+		struct Rect {
+			int ya, yb, xa, xb;
+		};
+
+		// A registered primitive. Its triangles are drawn into the
+		// internal renderer with the consecutive triangle ids starting at
+		// first_id.
+		struct Primitive {
+			bool live;
+			std::vector<Vec3> vertices;
+			std::vector<Vec3I> indices;
+			std::vector<LabelT> labels;
+			int first_id;
+			int num_ids;  // number of triangle ids reserved, at least indices.size()
+			bool visible;
+			Rect bounds;  // pixels that the primitive can cover, if visible
+		};
+
+		// Returns false and prints a warning if a primitive is invalid
+		bool CheckPrimitive(const std::vector<Vec3>& vertices,
+												const std::vector<Vec3I>& indices,
+												const std::vector<LabelT>& labels) const;
+		// Store the geometry of a primitive, assign its triangle ids and
+		// compute its bounds, which are marked dirty
+		void SetPrimitive(int handle,
+											const std::vector<Vec3>& vertices,
+											const std::vector<Vec3I>& indices,
+											const std::vector<LabelT>& labels);
+		// Compute the screen bounds of a primitive
+		void ComputeBounds(Primitive& prim);
+		// Mark a rectangle to be re-rendered
+		void AddDirty(const Rect& rect);
+		// Clear and re-render one rectangle
+		void ResolveRect(const Rect& rect);
+
+		LabelT bg_;
+		// Renders triangle ids rather than labels. Each id maps to a
+		// primitive and a label through id_primitive_ and id_label_.
+		SimpleRendererT<int, DepthT, kStorage> renderer_;
+		LabelBuffer framebuffer_;
+		Eigen::ArrayXXi primitive_ids_;
+
+		std::vector<Primitive> primitives_;
+		int num_live_;
+		std::vector<int> id_primitive_;
+		std::vector<LabelT> id_label_;
+		std::vector<Rect> dirty_;
+
+		// Scratch space for ResolveRect
+		std::vector<Vec3> mesh_vertices_;
+		std::vector<Vec3I> mesh_indices_;
+		std::vector<int> mesh_ids_;
+	};
+
+	typedef RetainedRendererT<> RetainedRenderer;
+}  // namespace indoor_context
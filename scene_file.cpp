@@ -0,0 +1,462 @@
+#include "scene_file.h"
+
+#include <iostream>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <stdint.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "matrix_types.h"
+#include "depth_equation.h"
+
+namespace indoor_context {
+	using std::vector;
+	using std::string;
+
+	// Sections are mapped directly onto these types
+	static_assert(sizeof(Vec3) == 3*sizeof(double), "Vec3 must be three packed doubles");
+	static_assert(sizeof(Vec3I) == 3*sizeof(int32_t), "Vec3I must be three packed int32s");
+	static_assert(sizeof(int) == sizeof(int32_t), "labels are stored as int32s");
+	static_assert(sizeof(SceneFileHeader) == 64, "unexpected header size");
+	static_assert(sizeof(SceneChunkRecord) == 64, "unexpected chunk record size");
+
+	// Returns true if a section of the given size at the given offset
+	// is aligned and lies within the file
+	static bool SectionInFile(uint64_t offset, uint64_t size, uint64_t file_size) {
+		return offset % kSceneAlignment == 0 && offset <= file_size && size <= file_size - offset;
+	}
+
+	// Check the header of a scene file of the given size. Returns false
+	// and prints a warning if it is not valid.
+	static bool CheckHeader(const SceneFileHeader& header, uint64_t file_size, const string& path) {
+		if (memcmp(header.magic, kSceneMagic, sizeof(kSceneMagic)) != 0) {
+			std::cerr << path << " is not a scene file";
+			return false;
+		}
+		if (header.byte_order != kSceneByteOrderMark) {
+			std::cerr << "Scene file " << path << " was written with a different byte order";
+			return false;
+		}
+		if (header.version != kSceneVersion) {
+			std::cerr << "Scene file " << path << " has unsupported version " << header.version;
+			return false;
+		}
+		if (header.num_chunks > INT_MAX ||
+				!SectionInFile(header.chunk_table_offset,
+											 header.num_chunks * sizeof(SceneChunkRecord),
+											 file_size)) {
+			std::cerr << "Scene file " << path << " has an invalid chunk table";
+			return false;
+		}
+		return true;
+	}
+
+	// Check a chunk record of a scene file of the given size. Returns
+	// false and prints a warning if it is not valid.
+	static bool CheckChunk(const SceneChunkRecord& record, uint64_t file_size,
+												 int index, const string& path) {
+		const uint64_t nv = record.num_vertices;
+		const uint64_t nt = record.num_triangles;
+		if (nv > INT_MAX || nt > INT_MAX ||
+				!SectionInFile(record.vertex_offset, nv*sizeof(Vec3), file_size) ||
+				!SectionInFile(record.index_offset, nt*sizeof(Vec3I), file_size) ||
+				!SectionInFile(record.label_offset, nt*sizeof(int32_t), file_size) ||
+				(record.plane_offset != 0 &&
+				 !SectionInFile(record.plane_offset, 4*nt*sizeof(double), file_size))) {
+			std::cerr << "Chunk " << index << " of scene file " << path << " is invalid";
+			return false;
+		}
+		return true;
+	}
+
+	// Read exactly size bytes at the given offset. Returns false on
+	// error or at the end of the file.
+	static bool ReadFully(int fd, void* data, uint64_t size, uint64_t offset) {
+		char* out = static_cast<char*>(data);
+		while (size > 0) {
+			const ssize_t n = pread(fd, out, size, offset);
+			if (n <= 0) return false;
+			out += n;
+			size -= n;
+			offset += n;
+		}
+		return true;
+	}
+
+	SceneWriter::SceneWriter()
+		: file_(NULL),
+			offset_(0),
+			max_chunk_triangles_(0) {
+	}
+
+	SceneWriter::~SceneWriter() {
+		if (file_ != NULL) {
+			Close();
+		}
+	}
+
+	bool SceneWriter::Open(const string& path) {
+		if (file_ != NULL) {
+			Close();
+		}
+		file_ = fopen(path.c_str(), "wb");
+		if (file_ == NULL) {
+			std::cerr << "Could not create scene file " << path;
+			return false;
+		}
+		offset_ = 0;
+		chunks_.clear();
+		// The header is written by Close(), once the chunk table is known
+		SceneFileHeader header;
+		memset(&header, 0, sizeof(header));
+		return Write(&header, sizeof(header));
+	}
+
+	void SceneWriter::SetMaxChunkTriangles(int n) {
+		max_chunk_triangles_ = std::max(n, 0);
+	}
+
+	bool SceneWriter::AddMesh(const vector<Vec3>& vertices,
+														const vector<Vec3I>& indices,
+														const vector<int>& labels,
+														bool with_planes) {
+		if (file_ == NULL) {
+			std::cerr << "SceneWriter::AddMesh() called before Open()";
+			return false;
+		}
+		if (labels.size() != indices.size()) {
+			std::cerr << "SceneWriter::AddMesh() needs exactly one label per triangle";
+			return false;
+		}
+		const int nv = vertices.size();
+		const int ntris = indices.size();
+		if (max_chunk_triangles_ == 0 || ntris <= max_chunk_triangles_) {
+			return WriteChunk(vertices.data(), nv, indices.data(), labels.data(), ntris, with_planes);
+		}
+
+		// Give each chunk its own copy of the vertices that it references
+		vertex_map_.assign(nv, -1);
+		for (int begin = 0; begin < ntris; begin += max_chunk_triangles_) {
+			const int end = std::min(begin+max_chunk_triangles_, ntris);
+			chunk_vertices_.clear();
+			chunk_indices_.clear();
+			for (int i = begin; i < end; i++) {
+				const Vec3I& tri = indices[i];
+				Vec3I mapped = Vec3I::Constant(-1);
+				if (tri.minCoeff() >= 0 && tri.maxCoeff() < nv) {
+					for (int j = 0; j < 3; j++) {
+						if (vertex_map_[tri[j]] < 0) {
+							vertex_map_[tri[j]] = chunk_vertices_.size();
+							chunk_vertices_.push_back(vertices[tri[j]]);
+						}
+						mapped[j] = vertex_map_[tri[j]];
+					}
+				}
+				chunk_indices_.push_back(mapped);
+			}
+			if (!WriteChunk(chunk_vertices_.data(), chunk_vertices_.size(),
+											chunk_indices_.data(), &labels[begin], end-begin, with_planes)) {
+				return false;
+			}
+			// Reset only the entries used by this chunk
+			for (int i = begin; i < end; i++) {
+				const Vec3I& tri = indices[i];
+				if (tri.minCoeff() >= 0 && tri.maxCoeff() < nv) {
+					for (int j = 0; j < 3; j++) {
+						vertex_map_[tri[j]] = -1;
+					}
+				}
+			}
+		}
+		return true;
+	}
+
+	bool SceneWriter::WriteChunk(const Vec3* vertices, int num_vertices,
+															 const Vec3I* indices, const int* labels, int num_triangles,
+															 bool with_planes) {
+		SceneChunkRecord record;
+		memset(&record, 0, sizeof(record));
+		record.num_vertices = num_vertices;
+		record.num_triangles = num_triangles;
+
+		if (!Align()) return false;
+		record.vertex_offset = offset_;
+		if (!Write(vertices, static_cast<uint64_t>(num_vertices)*sizeof(Vec3))) return false;
+		if (!Align()) return false;
+		record.index_offset = offset_;
+		if (!Write(indices, static_cast<uint64_t>(num_triangles)*sizeof(Vec3I))) return false;
+		if (!Align()) return false;
+		record.label_offset = offset_;
+		if (!Write(labels, static_cast<uint64_t>(num_triangles)*sizeof(int32_t))) return false;
+
+		if (with_planes) {
+			planes_.resize(4, num_triangles);
+			for (int i = 0; i < num_triangles; i++) {
+				const Vec3I& tri = indices[i];
+				if (tri.minCoeff() < 0 || tri.maxCoeff() >= num_vertices) {
+					planes_.col(i).setZero();
+				} else {
+					planes_.col(i) = TrianglePlane(vertices[tri[0]], vertices[tri[1]], vertices[tri[2]]);
+				}
+			}
+			if (!Align()) return false;
+			record.plane_offset = offset_;
+			if (!Write(planes_.data(), static_cast<uint64_t>(planes_.size())*sizeof(double))) return false;
+		}
+		chunks_.push_back(record);
+		return true;
+	}
+
+	bool SceneWriter::Close() {
+		if (file_ == NULL) {
+			return false;
+		}
+		SceneFileHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, kSceneMagic, sizeof(kSceneMagic));
+		header.version = kSceneVersion;
+		header.byte_order = kSceneByteOrderMark;
+		header.num_chunks = chunks_.size();
+
+		bool ok = Align();
+		header.chunk_table_offset = offset_;
+		ok = ok && Write(chunks_.data(), chunks_.size()*sizeof(SceneChunkRecord));
+		ok = ok && fseek(file_, 0, SEEK_SET) == 0;
+		ok = ok && fwrite(&header, sizeof(header), 1, file_) == 1;
+		ok = fclose(file_) == 0 && ok;
+		file_ = NULL;
+		if (!ok) {
+			std::cerr << "Could not write scene file";
+		}
+		return ok;
+	}
+
+	bool SceneWriter::Write(const void* data, uint64_t size) {
+		if (size > 0 && fwrite(data, 1, size, file_) != size) {
+			std::cerr << "Could not write scene file";
+			return false;
+		}
+		offset_ += size;
+		return true;
+	}
+
+	bool SceneWriter::Align() {
+		static const char zeros[kSceneAlignment] = { 0 };
+		return Write(zeros, (kSceneAlignment - offset_%kSceneAlignment) % kSceneAlignment);
+	}
+
+	MappedSceneFile::MappedSceneFile()
+		: data_(NULL),
+			size_(0) {
+	}
+
+	MappedSceneFile::~MappedSceneFile() {
+		Close();
+	}
+
+	bool MappedSceneFile::Open(const string& path) {
+		Close();
+		const int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			std::cerr << "Could not open scene file " << path;
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size < sizeof(SceneFileHeader)) {
+			std::cerr << path << " is not a scene file";
+			close(fd);
+			return false;
+		}
+		void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);  // the mapping keeps the file open
+		if (data == MAP_FAILED) {
+			std::cerr << "Could not map scene file " << path;
+			return false;
+		}
+		data_ = data;
+		size_ = st.st_size;
+
+		const char* base = static_cast<const char*>(data_);
+		const SceneFileHeader& header = *reinterpret_cast<const SceneFileHeader*>(base);
+		if (!CheckHeader(header, size_, path)) {
+			Close();
+			return false;
+		}
+		const SceneChunkRecord* records =
+			reinterpret_cast<const SceneChunkRecord*>(base + header.chunk_table_offset);
+		chunks_.resize(header.num_chunks);
+		for (int i = 0; i < chunks_.size(); i++) {
+			const SceneChunkRecord& record = records[i];
+			if (!CheckChunk(record, size_, i, path)) {
+				Close();
+				return false;
+			}
+			SceneChunk& chunk = chunks_[i];
+			chunk.mesh.vertices = reinterpret_cast<const Vec3*>(base + record.vertex_offset);
+			chunk.mesh.num_vertices = record.num_vertices;
+			chunk.mesh.indices = reinterpret_cast<const Vec3I*>(base + record.index_offset);
+			chunk.mesh.labels = reinterpret_cast<const int*>(base + record.label_offset);
+			chunk.mesh.num_triangles = record.num_triangles;
+			chunk.planes = record.plane_offset == 0 ? NULL :
+				reinterpret_cast<const double*>(base + record.plane_offset);
+		}
+		return true;
+	}
+
+	void MappedSceneFile::Close() {
+		if (data_ != NULL) {
+			munmap(data_, size_);
+		}
+		data_ = NULL;
+		size_ = 0;
+		chunks_.clear();
+	}
+
+	SceneFileReader::SceneFileReader()
+		: fd_(-1) {
+	}
+
+	SceneFileReader::~SceneFileReader() {
+		Close();
+	}
+
+	bool SceneFileReader::Open(const string& path) {
+		Close();
+		fd_ = open(path.c_str(), O_RDONLY);
+		if (fd_ < 0) {
+			std::cerr << "Could not open scene file " << path;
+			return false;
+		}
+		struct stat st;
+		SceneFileHeader header;
+		if (fstat(fd_, &st) != 0 || !ReadFully(fd_, &header, sizeof(header), 0)) {
+			std::cerr << path << " is not a scene file";
+			Close();
+			return false;
+		}
+		if (!CheckHeader(header, st.st_size, path)) {
+			Close();
+			return false;
+		}
+		records_.resize(header.num_chunks);
+		if (!ReadFully(fd_, records_.data(), records_.size()*sizeof(SceneChunkRecord),
+									 header.chunk_table_offset)) {
+			std::cerr << "Could not read scene file " << path;
+			Close();
+			return false;
+		}
+		for (int i = 0; i < records_.size(); i++) {
+			if (!CheckChunk(records_[i], st.st_size, i, path)) {
+				Close();
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void SceneFileReader::Close() {
+		if (fd_ >= 0) {
+			close(fd_);
+		}
+		fd_ = -1;
+		records_.clear();
+	}
+
+	bool SceneFileReader::ReadChunk(int i) {
+		if (i < 0 || i >= records_.size()) {
+			std::cerr << "Warning: invalid chunk " << i << " passed to SceneFileReader::ReadChunk()";
+			return false;
+		}
+		const SceneChunkRecord& record = records_[i];
+		const int nv = record.num_vertices;
+		const int nt = record.num_triangles;
+		vertices_.resize(nv);
+		indices_.resize(nt);
+		labels_.resize(nt);
+		planes_.resize(record.plane_offset == 0 ? 0 : 4*nt);
+		if (!ReadFully(fd_, vertices_.data(), nv*sizeof(Vec3), record.vertex_offset) ||
+				!ReadFully(fd_, indices_.data(), nt*sizeof(Vec3I), record.index_offset) ||
+				!ReadFully(fd_, labels_.data(), nt*sizeof(int32_t), record.label_offset) ||
+				!ReadFully(fd_, planes_.data(), planes_.size()*sizeof(double), record.plane_offset)) {
+			std::cerr << "Could not read chunk " << i << " of scene file";
+			return false;
+		}
+		chunk_.mesh.vertices = vertices_.data();
+		chunk_.mesh.num_vertices = nv;
+		chunk_.mesh.indices = indices_.data();
+		chunk_.mesh.labels = labels_.data();
+		chunk_.mesh.num_triangles = nt;
+		chunk_.planes = planes_.empty() ? NULL : planes_.data();
+		return true;
+	}
+
+	// Get the labels of a chunk as LabelT, converting them into
+	// converted if necessary
+	template <typename LabelT>
+	static const LabelT* ChunkLabels(const SceneChunk& chunk, vector<LabelT>& converted) {
+		converted.assign(chunk.mesh.labels, chunk.mesh.labels + chunk.mesh.num_triangles);
+		return converted.data();
+	}
+
+	static const int* ChunkLabels(const SceneChunk& chunk, vector<int>& /*converted*/) {
+		return chunk.mesh.labels;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	int RenderSceneChunk(const SceneChunk& chunk,
+											 SimpleRendererT<LabelT, DepthT, kStorage>& renderer) {
+		vector<LabelT> converted;
+		MeshView<LabelT> mesh;
+		mesh.vertices = chunk.mesh.vertices;
+		mesh.num_vertices = chunk.mesh.num_vertices;
+		mesh.indices = chunk.mesh.indices;
+		mesh.labels = ChunkLabels(chunk, converted);
+		mesh.num_triangles = chunk.mesh.num_triangles;
+		if (chunk.planes == NULL) {
+			return renderer.RenderMesh(mesh);
+		}
+		DepthEqnArray depth_eqns;
+		Eigen::Array<bool, Eigen::Dynamic, 1> degenerate;
+		PlanesToDepthEqns(renderer.depth_basis(), chunk.plane_array(), depth_eqns, degenerate);
+		return renderer.RenderMesh(mesh, depth_eqns);
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	long RenderSceneFile(const string& path,
+											 SimpleRendererT<LabelT, DepthT, kStorage>& renderer) {
+		SceneFileReader reader;
+		if (!reader.Open(path)) {
+			return -1;
+		}
+		long naffected = 0;
+		for (int i = 0; i < reader.num_chunks(); i++) {
+			if (!reader.ReadChunk(i)) {
+				return -1;
+			}
+			naffected += RenderSceneChunk(reader.chunk(), renderer);
+		}
+		return naffected;
+	}
+
+#define INSTANTIATE_RENDER_SCENE(LabelT, DepthT, kStorage)								\
+	template int RenderSceneChunk(const SceneChunk&,												\
+																SimpleRendererT<LabelT, DepthT, kStorage>&);	\
+	template long RenderSceneFile(const string&,														\
+																SimpleRendererT<LabelT, DepthT, kStorage>&);
+
+#define INSTANTIATE_RENDER_SCENE_ALL_STORAGE(LabelT, DepthT)					\
+	INSTANTIATE_RENDER_SCENE(LabelT, DepthT, kStoreDepth)									\
+	INSTANTIATE_RENDER_SCENE(LabelT, DepthT, kStoreInverseDepth)
+
+	INSTANTIATE_RENDER_SCENE_ALL_STORAGE(int, double)
+	INSTANTIATE_RENDER_SCENE_ALL_STORAGE(int, float)
+	INSTANTIATE_RENDER_SCENE_ALL_STORAGE(uint16_t, double)
+	INSTANTIATE_RENDER_SCENE_ALL_STORAGE(uint16_t, float)
+	INSTANTIATE_RENDER_SCENE_ALL_STORAGE(uint8_t, double)
+	INSTANTIATE_RENDER_SCENE_ALL_STORAGE(uint8_t, float)
+}  // namespace indoor_context
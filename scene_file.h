@@ -0,0 +1,211 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <stdint.h>
+
+#include "matrix_types.h"
+#include "depth_equation.h"
+#include "simple_renderer.h"
+
+namespace indoor_context {
+	// Binary scene files hold a sequence of triangle meshes, called
+	// chunks, in a form that can be mapped into memory and passed to
+	// SimpleRendererT::RenderMesh without parsing or copying. A file
+	// consists of a SceneFileHeader, then the data of each chunk, then
+	// a table with one SceneChunkRecord per chunk. Each chunk has these
+	// sections, each starting at a multiple of kSceneAlignment bytes:
+	//   vertices: num_vertices x 3 doubles, laid out as Vec3
+	//   indices: num_triangles x 3 int32s, laid out as Vec3I
+	//   labels: num_triangles int32s
+	//   planes (optional): the plane of each triangle as computed by
+	//     TrianglePlane, as 4 rows of num_triangles doubles, laid out as
+	//     a PlaneArray
+	// Values are stored in the byte order of the machine that wrote the
+	// file, which is checked when it is read.
+
+	// Identifies scene files
+	static const char kSceneMagic[8] = { 'I', 'C', 'S', 'C', 'E', 'N', 'E', 0 };
+	// The version written by SceneWriter. Readers reject other versions.
+	static const uint32_t kSceneVersion = 1;
+	// Written as a uint32 to detect files from machines with a
+	// different byte order
+	static const uint32_t kSceneByteOrderMark = 0x01020304;
+	// Alignment of each section in the file, which is also its
+	// alignment in memory when the file is mapped
+	static const int kSceneAlignment = 64;
+
+	struct SceneFileHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t byte_order;
+		uint64_t num_chunks;
+		uint64_t chunk_table_offset;
+		uint64_t reserved[4];
+	};
+
+	// Offsets are in bytes from the start of the file. plane_offset is
+	// zero if the chunk has no planes.
+	struct SceneChunkRecord {
+		uint64_t num_vertices;
+		uint64_t num_triangles;
+		uint64_t vertex_offset;
+		uint64_t index_offset;
+		uint64_t label_offset;
+		uint64_t plane_offset;
+		uint64_t reserved[2];
+	};
+
+	// A chunk of a scene file in memory
+	struct SceneChunk {
+		MeshView<int> mesh;
+		// The planes of the triangles in PlaneArray layout, or NULL if
+		// the file has none
+		const double* planes;
+
+		// Get the planes as a PlaneArray. Only call this if planes is
+		// not NULL.
+		Eigen::Map<const PlaneArray> plane_array() const {
+			return Eigen::Map<const PlaneArray>(planes, 4, mesh.num_triangles);
+		}
+	};
+
+	// Writes scene files. Chunks are written as they are added, so
+	// files larger than memory can be written one mesh at a time.
+	class SceneWriter {
+	public:
+		SceneWriter();
+		// Close the file if it is open
+		~SceneWriter();
+
+		// Create a file, replacing any existing file. Returns false on
+		// error.
+		bool Open(const std::string& path);
+		// Split meshes into chunks of at most n triangles, each with
+		// only the vertices that it references. Pass n=0 (the default)
+		// to write each mesh as one chunk.
+		void SetMaxChunkTriangles(int n);
+		// Append a mesh to the file. If with_planes is true then the
+		// plane of each triangle is computed and stored, so that readers
+		// can skip that computation. Triangles with out-of-range indices
+		// are stored with invalid indices, so the renderer skips
+		// them. Returns false on error.
+		bool AddMesh(const std::vector<Vec3>& vertices,
+								 const std::vector<Vec3I>& indices,
+								 const std::vector<int>& labels,
+								 bool with_planes = true);
+		// Write the chunk table and close the file. The file is only
+		// valid once this returns true.
+		bool Close();
+
+		// Get the number of chunks written so far
+		int num_chunks() const { return chunks_.size(); }
+
+	private:
+		// Write one chunk
+		bool WriteChunk(const Vec3* vertices, int num_vertices,
+										const Vec3I* indices, const int* labels, int num_triangles,
+										bool with_planes);
+		// Write bytes at the current position. Returns false on error.
+		bool Write(const void* data, uint64_t size);
+		// Write zeros up to the next multiple of kSceneAlignment
+		bool Align();
+
+		FILE* file_;
+		uint64_t offset_;  // current position in the file
+		int max_chunk_triangles_;
+		std::vector<SceneChunkRecord> chunks_;
+		// Scratch space for splitting meshes
+		std::vector<int> vertex_map_;
+		std::vector<Vec3> chunk_vertices_;
+		std::vector<Vec3I> chunk_indices_;
+		PlaneArray planes_;
+
+		// Not copyable
+		SceneWriter(const SceneWriter&);
+		SceneWriter& operator=(const SceneWriter&);
+	};
+
+	// Maps a whole scene file into memory. The chunks point into the
+	// mapping, so they are valid until Close() and are paged in from
+	// the file as they are rendered.
+	class MappedSceneFile {
+	public:
+		MappedSceneFile();
+		// Unmap the file if it is mapped
+		~MappedSceneFile();
+
+		// Map a file and check its header and chunk table. Returns false
+		// if the file cannot be mapped or is not a valid scene file.
+		bool Open(const std::string& path);
+		// Unmap the file
+		void Close();
+
+		// Get the number of chunks
+		int num_chunks() const { return chunks_.size(); }
+		// Get a chunk
+		const SceneChunk& chunk(int i) const { return chunks_[i]; }
+
+	private:
+		void* data_;
+		size_t size_;
+		std::vector<SceneChunk> chunks_;
+
+		// Not copyable
+		MappedSceneFile(const MappedSceneFile&);
+		MappedSceneFile& operator=(const MappedSceneFile&);
+	};
+
+	// Reads a scene file one chunk at a time into buffers that are
+	// re-used from one chunk to the next, so that only the largest
+	// chunk needs to fit in memory
+	class SceneFileReader {
+	public:
+		SceneFileReader();
+		// Close the file if it is open
+		~SceneFileReader();
+
+		// Open a file and read its header and chunk table. Returns false
+		// if the file cannot be read or is not a valid scene file.
+		bool Open(const std::string& path);
+		// Close the file
+		void Close();
+
+		// Get the number of chunks
+		int num_chunks() const { return records_.size(); }
+		// Read a chunk into memory. Returns false on error.
+		bool ReadChunk(int i);
+		// Get the chunk read by the last successful call to ReadChunk()
+		const SceneChunk& chunk() const { return chunk_; }
+
+	private:
+		int fd_;
+		std::vector<SceneChunkRecord> records_;
+		SceneChunk chunk_;
+		std::vector<Vec3> vertices_;
+		std::vector<Vec3I> indices_;
+		std::vector<int> labels_;
+		std::vector<double> planes_;
+
+		// Not copyable
+		SceneFileReader(const SceneFileReader&);
+		SceneFileReader& operator=(const SceneFileReader&);
+	};
+
+	// Render a chunk. Planes stored in the file are converted to depth
+	// equations in one batch rather than computed per triangle. Labels
+	// are converted to LabelT if necessary. Returns the number of
+	// triangles that affected at least one pixel.
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	int RenderSceneChunk(const SceneChunk& chunk,
+											 SimpleRendererT<LabelT, DepthT, kStorage>& renderer);
+
+	// Render every chunk of a scene file, reading one chunk at a time
+	// with SceneFileReader, so that files larger than memory can be
+	// rendered. Returns the number of triangles that affected at least
+	// one pixel, or -1 if the file could not be read.
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	long RenderSceneFile(const std::string& path,
+											 SimpleRendererT<LabelT, DepthT, kStorage>& renderer);
+}  // namespace indoor_context
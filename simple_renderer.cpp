@@ -1,13 +1,19 @@
 #include "simple_renderer.h"
 
 #include <iostream>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <climits>
 
 #include <Eigen/Geometry>
 
 #include "matrix_types.h"
 #include "clipping.h"
 #include "depth_equation.h"
-#include "fill_polygon.h"
+#include "rasterizer.h"
+#include "thread_pool.h"
+#include "vertex_transform.h"
 
 #include "vector_utils.tpp"
 
@@ -16,148 +22,1637 @@ namespace indoor_context {
 	using std::pair;
 
 	static const double kExtent = 1e+3;  // extent of horizontal surfaces for RenderHorizSurface
-	static const double kClampDepth = 1e+6;
+	// Size of screen tiles for the multi-threaded path. This must match the
+	// hierarchical-Z block size so that each task updates its own blocks.
+	static const int kTileSize = kHiZBlockSize;
+	static const int kMinChunkSize = 256;  // min triangles set up by one task
+	static const int kChunksPerThread = 4;  // triangle chunks per thread, for load balancing
+	static const int kLayoutBandSize = 32;  // rows drawn at a time by RenderManhattanLayout
+	static const int kTransformBlockSize = 4096;  // vertices transformed by one task
+	static const int kMinHiZTileTestArea = 1024;  // min bounding box area for testing Hi-Z tiles
+	static const int kMinHiZRefreshArea = kHiZTileSize*kHiZTileSize;  // min bounding box area for refreshing Hi-Z tiles
 
-	SimpleRenderer::SimpleRenderer() : viewport_(MakeVector(0,0)) {
+	// Margin for hierarchical-Z tests (see HiZBuffer::Configure). This
+	// must cover the rounding error of per-pixel depths in DepthT.
+	template <typename DepthT>
+	static double HiZMargin() {
+		return std::max(1e-9, 64.*std::numeric_limits<DepthT>::epsilon());
 	}
 
-	SimpleRenderer::SimpleRenderer(const LinearCamera& camera, Vec2I viewport) {
+	// Returns true if the stored depth a is further from the camera
+	// than b
+	template <DepthStorage kStorage, typename DepthT>
+	static bool IsFurther(DepthT a, DepthT b) {
+		return kStorage == kStoreDepth ? a > b : a < b;
+	}
+
+	// Report the triangles with out-of-range vertex indices that were
+	// skipped by one call, with a single warning rather than one per
+	// triangle. They are also counted in RenderStats::triangles_invalid.
+	static void WarnInvalidTriangles(long n, const char* caller) {
+		if (n > 0) {
+			std::cerr << "Warning: "<<n<<" triangles with out-of-range vertex indices skipped by "<<caller;
+		}
+	}
+
+	// Get the range [a,b) of integers n in [lo,hi) for which
+	// slope*n + offset > 0, which is a single span since the function
+	// is linear
+	static void PositiveSpan(double slope, double offset, int lo, int hi, int& a, int& b) {
+		a = lo;
+		b = hi;
+		if (slope == 0) {
+			if (!(offset > 0)) b = lo;
+			return;
+		}
+		// Compare before converting since the crossing may be huge
+		const double crossing = -offset / slope;
+		if (slope > 0) {
+			a = crossing >= hi ? hi : std::max<double>(std::floor(crossing)+1, lo);
+		} else {
+			b = crossing <= lo ? lo : std::min<double>(std::ceil(crossing), hi);
+		}
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	SimpleRendererT<LabelT, DepthT, kStorage>::SimpleRendererT()
+		: viewport_(MakeVector(0,0)),
+			scissor_ya_(0),
+			scissor_yb_(0),
+			scissor_xa_(0),
+			scissor_xb_(0),
+			layout_(kRowMajorLayout),
+			clear_pending_(false),
+			epoch_(0),
+			clear_label_(0),
+			hiz_enabled_(false),
+			hiz_culled_triangles_(0),
+			hiz_culled_pixels_(0),
+			vertex_stamp_(0),
+			vertices_transformed_(0),
+			vertex_cache_hits_(0),
+			stats_enabled_(false),
+			overdraw_enabled_(false),
+			stats_num_labels_(0),
+			label_stats_dirty_(false),
+			query_active_(false),
+			query_write_(false),
+			query_pixels_(0) {
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	SimpleRendererT<LabelT, DepthT, kStorage>::SimpleRendererT(const LinearCamera& camera, Vec2I viewport)
+		: layout_(kRowMajorLayout),
+			clear_pending_(false),
+			epoch_(0),
+			clear_label_(0),
+			hiz_enabled_(false),
+			vertex_stamp_(0),
+			stats_enabled_(false),
+			overdraw_enabled_(false),
+			stats_num_labels_(0),
+			label_stats_dirty_(false),
+			query_active_(false),
+			query_write_(false),
+			query_pixels_(0) {
 		Configure(camera, viewport);
 	}
 
-	void SimpleRenderer::Configure(const LinearCamera& camera, Vec2I viewport) {
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void SimpleRendererT<LabelT, DepthT, kStorage>::Configure(const LinearCamera& camera, Vec2I viewport) {
 		viewport_ = viewport;
 		camera_ = camera;
-		framebuffer_.resize(viewport[1], viewport[0]);
-		depthbuffer_.resize(viewport[1], viewport[0]);
+		depth_basis_ = ComputeDepthEqnBasis(camera);
+		ComputeFrustrum(camera, viewport, frustrum_);
+		const Vec2I storage_size = LayoutStorageSize(layout_, viewport);
+		framebuffer_.resize(storage_size[1], storage_size[0]);
+		depthbuffer_.resize(storage_size[1], storage_size[0]);
+		pixel_layout_ = MakePixelLayout(layout_, viewport);
+		const int tiles_x = (viewport[0]+kTileSize-1) / kTileSize;
+		const int tiles_y = (viewport[1]+kTileSize-1) / kTileSize;
+		tile_epochs_.assign(tiles_x*tiles_y, epoch_);
+		hiz_.Configure(viewport, kStorage, HiZMargin<DepthT>());
+		if (overdraw_enabled_) {
+			overdraw_.resize(viewport[1], viewport[0]);
+		}
+		ResetScissor();
+		// Check that the cost images still match the viewport
+		if (stats_num_labels_ > 0) {
+			SetLabelStats(stats_num_labels_, vector<const Eigen::ArrayXXd*>(stats_cost_images_));
+		}
 		Clear(0);
 	}
 
-	bool SimpleRenderer::Render(const Vec2& p, const Vec2& q, const Vec2& r, int label) {
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void SimpleRendererT<LabelT, DepthT, kStorage>::SetBufferLayout(BufferLayout layout) {
+		if (layout == layout_) return;
+		// Go through row-major copies so that the contents are preserved
+		FinishClear();
+		CopyToRowMajor(framebuffer_.data(), pixel_layout_, viewport_, frame_readout_);
+		CopyToRowMajor(depthbuffer_.data(), pixel_layout_, viewport_, depth_readout_);
+		layout_ = layout;
+		const Vec2I storage_size = LayoutStorageSize(layout_, viewport_);
+		framebuffer_.resize(storage_size[1], storage_size[0]);
+		depthbuffer_.resize(storage_size[1], storage_size[0]);
+		pixel_layout_ = MakePixelLayout(layout_, viewport_);
+		CopyFromRowMajor(frame_readout_, framebuffer_.data(), pixel_layout_);
+		CopyFromRowMajor(depth_readout_, depthbuffer_.data(), pixel_layout_);
+		frame_readout_.resize(0, 0);
+		depth_readout_.resize(0, 0);
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	const typename SimpleRendererT<LabelT, DepthT, kStorage>::LabelBuffer&
+	SimpleRendererT<LabelT, DepthT, kStorage>::framebuffer() const {
+		FinishClear();
+		if (layout_ == kRowMajorLayout) {
+			return framebuffer_;
+		}
+		CopyFrameBuffer(frame_readout_);
+		return frame_readout_;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	typename SimpleRendererT<LabelT, DepthT, kStorage>::LabelBuffer&
+	SimpleRendererT<LabelT, DepthT, kStorage>::mutable_framebuffer() {
+		FinishClear();
+		if (layout_ == kRowMajorLayout) {
+			return framebuffer_;
+		}
+		std::cerr << "Warning: mutable_framebuffer() requires kRowMajorLayout, returning a copy";
+		CopyFrameBuffer(frame_readout_);
+		return frame_readout_;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	const typename SimpleRendererT<LabelT, DepthT, kStorage>::DepthBuffer&
+	SimpleRendererT<LabelT, DepthT, kStorage>::depthbuffer() const {
+		FinishClear();
+		if (layout_ == kRowMajorLayout) {
+			return depthbuffer_;
+		}
+		CopyDepthBuffer(depth_readout_);
+		return depth_readout_;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	typename SimpleRendererT<LabelT, DepthT, kStorage>::DepthBuffer&
+	SimpleRendererT<LabelT, DepthT, kStorage>::mutable_depthbuffer() {
+		FinishClear();
+		if (layout_ == kRowMajorLayout) {
+			return depthbuffer_;
+		}
+		std::cerr << "Warning: mutable_depthbuffer() requires kRowMajorLayout, returning a copy";
+		CopyDepthBuffer(depth_readout_);
+		return depth_readout_;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	BufferView<LabelT> SimpleRendererT<LabelT, DepthT, kStorage>::frame_view() const {
+		FinishClear();
+		return BufferView<LabelT>(framebuffer_.data(), pixel_layout_, viewport_);
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	BufferView<DepthT> SimpleRendererT<LabelT, DepthT, kStorage>::depth_view() const {
+		FinishClear();
+		return BufferView<DepthT>(depthbuffer_.data(), pixel_layout_, viewport_);
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void SimpleRendererT<LabelT, DepthT, kStorage>::CopyFrameBuffer(LabelBuffer& out) const {
+		FinishClear();
+		CopyToRowMajor(framebuffer_.data(), pixel_layout_, viewport_, out);
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void SimpleRendererT<LabelT, DepthT, kStorage>::CopyDepthBuffer(DepthBuffer& out) const {
+		FinishClear();
+		CopyToRowMajor(depthbuffer_.data(), pixel_layout_, viewport_, out);
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	RasterTarget<LabelT, DepthT> SimpleRendererT<LabelT, DepthT, kStorage>::raster_target() {
+		RasterTarget<LabelT, DepthT> target;
+		target.depth = depthbuffer_.data();
+		target.labels = framebuffer_.data();
+		target.layout = pixel_layout_;
+		return target;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	bool SimpleRendererT<LabelT, DepthT, kStorage>::Render(const Vec2& p, const Vec2& q, const Vec2& r, LabelT label) {
 		return Render(Unproject(p), Unproject(q), Unproject(r), label);
 	}
 
-	bool SimpleRenderer::Render(const Vec3& p, const Vec3& q, const Vec3& r, int label) {
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	bool SimpleRendererT<LabelT, DepthT, kStorage>::Render(const Vec3& p, const Vec3& q, const Vec3& r, LabelT label) {
 		if (viewport_[0] < 0 || viewport_[1] < 0) {
 			std::cerr << "You must call SimpleRenderer::Configure() before Render()";
 			return false;
 		}
+		BeginStats();
+		TransformTriangle(p, q, r, scratch_, thread_render_stats(0));
+		bool affected = RenderTriangle(p, q, r, scratch_.vertices, MakeVector(0, 1, 2), label, NULL);
+		EndStats();
+		return affected;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void SimpleRendererT<LabelT, DepthT, kStorage>::TransformTriangle(const Vec3& p, const Vec3& q, const Vec3& r,
+																																		SetupScratch& scratch,
+																																		RenderStats* stats) {
+		static const int ids[] = { 0, 1, 2 };
+		const Vec3 vertices[] = { p, q, r };
+		StageTimer timer(stats, kStageTransform);
+		scratch.vertices.Reserve(3);
+		TransformVertices(camera_, frustrum_, vertices, ids, 3, scratch.vertices);
+		vertices_transformed_ += 3;
+		if (stats) stats->stage_counts[kStageTransform] += 3;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void SimpleRendererT<LabelT, DepthT, kStorage>::TransformMesh(const Vec3* vertices, int nv,
+																																const Vec3I* indices, int ntris) {
+		if (vertex_stamps_.size() < nv) {
+			vertex_stamps_.resize(nv, 0);
+		}
+		if (++vertex_stamp_ == 0) {
+			// The stamp has wrapped around, so old vertices could look
+			// transformed
+			vertex_stamps_.assign(vertex_stamps_.size(), 0);
+			vertex_stamp_ = 1;
+		}
+
+		// Find the distinct vertices, in order of first reference
+		unique_vertices_.clear();
+		long hits = 0;
+		for (int i = 0; i < ntris; i++) {
+			const Vec3I& tri = indices[i];
+			if (tri.minCoeff() < 0 || tri.maxCoeff() >= nv) continue;
+			for (int j = 0; j < 3; j++) {
+				unsigned int& stamp = vertex_stamps_[tri[j]];
+				if (stamp == vertex_stamp_) {
+					hits++;
+				} else {
+					stamp = vertex_stamp_;
+					unique_vertices_.push_back(tri[j]);
+				}
+			}
+		}
+
+		// Each vertex is written by exactly one task
+		transformed_.Reserve(nv);
+		const int n = unique_vertices_.size();
+		const int nblocks = (n+kTransformBlockSize-1) / kTransformBlockSize;
+		const std::function<void(int, int)> transform_block = [&](int b, int thread) {
+			const int begin = b*kTransformBlockSize;
+			const int end = std::min(begin+kTransformBlockSize, n);
+			RenderStats* stats = thread_render_stats(thread);
+			StageTimer timer(stats, kStageTransform);
+			TransformVertices(camera_, frustrum_, vertices, &unique_vertices_[begin],
+												end-begin, transformed_);
+			if (stats) stats->stage_counts[kStageTransform] += end-begin;
+		};
+		if (pool_ && nblocks > 1) {
+			pool_->ParallelFor(nblocks, transform_block);
+		} else {
+			for (int b = 0; b < nblocks; b++) {
+				transform_block(b, 0);
+			}
+		}
+		vertices_transformed_ += n;
+		vertex_cache_hits_ += hits;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	bool SimpleRendererT<LabelT, DepthT, kStorage>::RenderTriangle(const Vec3& p, const Vec3& q, const Vec3& r,
+																																 const TransformedVertices& transformed,
+																																 const Vec3I& ids,
+																																 LabelT label,
+																																 const Vec3* depth_eqn) {
+		RenderStats* stats = thread_render_stats(0);
+		if (stats) stats->triangles_submitted++;
+		TriangleSetup setup;
+		if (!SetupTriangle(p, q, r, transformed, ids, label, depth_eqn, setup, stats)) {
+			return false;
+		}
+		// Refreshing stale tiles costs more than culling saves for
+		// triangles smaller than a tile
+		const EdgeSetup& edges = setup.edges;
+		const bool refresh = (edges.xmax-edges.xmin+1) * (edges.ymax-edges.ymin+1) >= kMinHiZRefreshArea;
+		if (hiz_enabled_ && HiZRejects(setup, refresh, hiz_culled_pixels_)) {
+			hiz_culled_triangles_++;
+			if (stats) stats->triangles_hiz_culled++;
+			return false;
+		}
+		if (stats) stats->triangles_rasterized++;
+		const bool write = !query_active_ || query_write_;
+		int n = FillTriangle(setup, 0, viewport_[1], 0, viewport_[0],
+												 write, INT_MAX, hiz_culled_pixels_, stats);
+		if (query_active_) {
+			query_pixels_ += n;
+		}
+		return n > 0;
+	}
 
-		// Do 3D clipping
-		vector<Vec3> vs;
-		vs.push_back(p);
-		vs.push_back(q);
-		vs.push_back(r);
-		vector<Vec3> clipped;
-		ClipToFrustrum(vs, camera_, viewport_, clipped);
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	bool SimpleRendererT<LabelT, DepthT, kStorage>::SetupTriangle(const Vec3& p, const Vec3& q, const Vec3& r,
+																																const TransformedVertices& transformed,
+																																const Vec3I& ids,
+																																LabelT label,
+																																const Vec3* depth_eqn,
+																																TriangleSetup& setup,
+																																RenderStats* stats) const {
+		// Let the compiler remove the statistics if they are not supported
+		if (!kRenderStatsSupported) stats = NULL;
 
-		// Project into the camera
-		vector<Vec3> projected;
-		for (int i = 0; i < clipped.size(); i++) {
-			projected.push_back(camera_ * Unproject(clipped[i]));
+		// Triangles seen edge-on have zero depth equations
+		if (depth_eqn != NULL && depth_eqn->isZero(0)) {
+			if (stats) stats->triangles_degenerate++;
+			return false;
 		}
 
-		// Compute the triangle scanlines
-		int y0;
-		vector<pair<int, int> > scanlines;
-		ComputeFillScanlines(projected, viewport_, y0, scanlines);
+		// Reject triangles entirely outside one of the frustrum planes,
+		// and only clip against the planes that the triangle crosses
+		int outcode_p = transformed.outcodes[ids[0]];
+		int outcode_q = transformed.outcodes[ids[1]];
+		int outcode_r = transformed.outcodes[ids[2]];
+		if (outcode_p & outcode_q & outcode_r) {
+			if (stats) stats->triangles_culled++;
+			return false;
+		}
+
+		Vec3 projected[kMaxClippedVertices];
+		int n = 3;
+		int crossed = outcode_p | outcode_q | outcode_r;
+		if (crossed == 0) {
+			// Entirely inside the frustrum so no need to clip. The vertices
+			// have already been projected.
+			for (int i = 0; i < 3; i++) {
+				projected[i] = MakeVector(transformed.x[ids[i]], transformed.y[ids[i]], 1.);
+			}
+			setup.nearest_depth = std::min(std::min(transformed.depth[ids[0]], transformed.depth[ids[1]]),
+																		 transformed.depth[ids[2]]);
+		} else {
+			// Do 3D clipping, against only the planes that are crossed
+			Vec3 clipped[kMaxClippedVertices];
+			{
+				StageTimer timer(stats, kStageClip);
+				n = ClipTriangleToFrustrum(p, q, r, frustrum_, crossed, clipped);
+			}
+			if (stats) {
+				stats->stage_counts[kStageClip]++;
+				stats->triangles_clipped++;
+			}
+			// The triangle can cross several planes without meeting the
+			// frustrum
+			if (n < 3) {
+				if (stats) stats->triangles_culled++;
+				return false;
+			}
+
+			// Project into the camera
+			for (int i = 0; i < n; i++) {
+				projected[i] = camera_ * Unproject(clipped[i]);
+			}
+			setup.nearest_depth = projected[0][2];
+			for (int i = 1; i < n; i++) {
+				setup.nearest_depth = std::min(setup.nearest_depth, projected[i][2]);
+			}
+		}
+
+		// Compute the edge equations, and restrict the bounds to the
+		// scissor rectangle so that nothing outside it is drawn
+		EdgeSetup& edges = setup.edges;
+		EdgeRejection rejection;
+		bool visible;
+		{
+			StageTimer timer(stats, kStageEdges);
+			visible = SetupEdges(projected, n, viewport_, edges, &rejection);
+		}
+		if (stats) stats->stage_counts[kStageEdges]++;
+		if (!visible) {
+			if (stats) {
+				if (rejection == kEdgesInvalidVertex) {
+					stats->nan_vertices++;
+				}
+				if (rejection == kEdgesNoPixels) {
+					stats->triangles_empty++;
+				} else {
+					stats->triangles_degenerate++;
+				}
+			}
+			return false;
+		}
+		edges.xmin = std::max(edges.xmin, scissor_xa_);
+		edges.xmax = std::min(edges.xmax, scissor_xb_-1);
+		edges.ymin = std::max(edges.ymin, scissor_ya_);
+		edges.ymax = std::min(edges.ymax, scissor_yb_-1);
+		if (edges.xmin > edges.xmax || edges.ymin > edges.ymax) {
+			if (stats) stats->triangles_empty++;
+			return false;
+		}
 
 		// Set up the depth equation
-		Vec3 nrm = (p-q).cross( p-r );
-		Vec4 plane = Concatenate(nrm, -nrm.dot(p));
-		Vec3 depth_eqn = PlaneToDepthEqn(camera_, plane);
+		if (depth_eqn != NULL) {
+			setup.depth_eqn = *depth_eqn;
+		} else {
+			bool valid;
+			{
+				StageTimer timer(stats, kStageDepthEqn);
+				valid = PlaneToDepthEqn(depth_basis_, TrianglePlane(p, q, r), setup.depth_eqn);
+			}
+			if (stats) stats->stage_counts[kStageDepthEqn]++;
+			if (!valid) {
+				// The triangle is seen edge-on
+				if (stats) stats->triangles_degenerate++;
+				return false;
+			}
+		}
+		setup.label = label;
 
-		// Do the rendering
-		bool affected = false;
-		for (int i = 0; i < scanlines.size(); i++) {
-			// Pre-compute the first bit of the depth equation
-			double depth_base = depth_eqn.dot( MakeVector<double>(0., y0+i, 1.) );
-			double depth_coef = depth_eqn[0];
-
-			// Fill the row
-			Eigen::ArrayXXd::RowXpr depth_row = depthbuffer_.row(y0+i);
-			Eigen::ArrayXXi::RowXpr label_row = framebuffer_.row(y0+i);
-			for (int x = scanlines[i].first; x <= scanlines[i].second; x++) {
-				double depth = 1. / (depth_base + depth_coef*x);  // see PlaneToDepthEqn in geom_utils.h
-				if (depth < 0) {
-					// This can happen when a wall is almost exactly oblique to
-					// the camera. In such a situation almost any ray intersection
-					// will fail, though the scan line will include at least one
-					// pixel so that pixel will generate a bogus depth. It should
-					// be safe to ignore it as the surface behind this one will
-					// pick up the depth.
-					if (x != scanlines[i].first &&
-							x != scanlines[i].second &&
-							i != 0 &&
-							i != scanlines.size()) {
-						std::cerr << "Warning: negative depth="<<depth
-											<< " at ("<<x<<","<<(y0+i)<<"),"
-											<< " which is NOT on the boundary of a texel.";
-					}
-				} else if (depth < depth_row[x]) {
-					depth_row[x] = depth;
-					label_row[x] = label;
-					affected = true;
+		// The inverse depth is linear, so it is positive over the whole
+		// polygon if it is positive at the vertices
+		if (stats) {
+			for (int i = 0; i < n; i++) {
+				const Vec3& v = projected[i];
+				if (!(setup.depth_eqn.dot(v / v[2]) > 0)) {
+					stats->negative_depths++;
+					break;
+				}
+			}
+		}
+		return true;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	bool SimpleRendererT<LabelT, DepthT, kStorage>::HiZRejects(const TriangleSetup& setup,
+																															bool refresh,
+																															long& culled_pixels) {
+		const EdgeSetup& edges = setup.edges;
+		const bool occluded = refresh ?
+			hiz_.RectOccludes(edges.ymin, edges.ymax+1, edges.xmin, edges.xmax+1,
+												setup.nearest_depth, depthbuffer_.data(), pixel_layout_) :
+			hiz_.RectOccludes(edges.ymin, edges.ymax+1, edges.xmin, edges.xmax+1,
+												setup.nearest_depth);
+		if (occluded) {
+			culled_pixels += static_cast<long>(edges.xmax-edges.xmin+1) * (edges.ymax-edges.ymin+1);
+			return true;
+		}
+		return false;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	int SimpleRendererT<LabelT, DepthT, kStorage>::RasterizeRect(const TriangleSetup& setup,
+																															 int ya, int yb, int xa, int xb,
+																															 bool write, int limit,
+																															 RenderStats* stats) {
+		if (!kRenderStatsSupported) stats = NULL;
+		// Only the tiles within the bounding box need to be initialized
+		xa = std::max(xa, setup.edges.xmin);
+		xb = std::min(xb, setup.edges.xmax+1);
+		ya = std::max(ya, setup.edges.ymin);
+		yb = std::min(yb, setup.edges.ymax+1);
+		if (xa >= xb || ya >= yb) return 0;
+		FinishClearRect(ya, yb, xa, xb);
+
+		int n;
+		{
+			StageTimer timer(stats, kStageFill);
+			if (write) {
+				n = RasterizePolygon<LabelT, DepthT, kStorage>(
+						setup.edges, setup.depth_eqn, setup.label, ya, yb, xa, xb, raster_target());
+			} else {
+				n = CountVisiblePixels<DepthT, kStorage>(
+						setup.edges, setup.depth_eqn, ya, yb, xa, xb, depthbuffer_.data(), pixel_layout_, limit);
+			}
+		}
+		if (stats) {
+			stats->stage_counts[kStageFill]++;
+			if (write) {
+				stats->pixels_written += n;
+			} else {
+				stats->pixels_counted += n;
+			}
+			// Each task of the multi-threaded path owns the tiles that it
+			// writes, including their part of the overdraw buffer
+			if (write && overdraw_enabled_) {
+				stats->fragments += AccumulateCoverage(setup.edges, ya, yb, xa, xb,
+																							 overdraw_.data(), viewport_[0]);
+			}
+		}
+		return n;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	int SimpleRendererT<LabelT, DepthT, kStorage>::FillTriangle(const TriangleSetup& setup,
+																															int ya, int yb, int xa, int xb,
+																															bool write, int limit,
+																															long& culled_pixels,
+																															RenderStats* stats) {
+		if (!hiz_enabled_) {
+			return RasterizeRect(setup, ya, yb, xa, xb, write, limit, stats);
+		}
+
+		// Restrict to the bounding box so that the culled pixel counts
+		// are meaningful
+		const EdgeSetup& edges = setup.edges;
+		xa = std::max(xa, edges.xmin);
+		xb = std::min(xb, edges.xmax+1);
+		ya = std::max(ya, edges.ymin);
+		yb = std::min(yb, edges.ymax+1);
+		if (xa >= xb || ya >= yb) return 0;
+
+		// Small polygons have already been tested against the blocks by
+		// HiZRejects(), and testing their tiles as well costs more than
+		// it saves
+		int count = 0;
+		if ((xb-xa)*(yb-ya) < kMinHiZTileTestArea) {
+			count = RasterizeRect(setup, ya, yb, xa, xb, write, limit, stats);
+		} else {
+			count = FillUnoccludedTiles(setup, ya, yb, xa, xb, write, limit, culled_pixels, stats);
+		}
+		if (count > 0 && write) {
+			hiz_.UpdateFromPolygon(edges, setup.depth_eqn, ya, yb, xa, xb);
+		}
+		return count;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	int SimpleRendererT<LabelT, DepthT, kStorage>::FillUnoccludedTiles(const TriangleSetup& setup,
+																																		 int ya, int yb, int xa, int xb,
+																																		 bool write, int limit,
+																																		 long& culled_pixels,
+																																		 RenderStats* stats) {
+		hiz_.Refresh(depthbuffer_.data(), pixel_layout_, ya, yb, xa, xb);
+		const int tx_first = xa / kHiZTileSize;
+		const int tx_last = (xb-1) / kHiZTileSize;
+		const int ty_first = ya / kHiZTileSize;
+		const int ty_last = (yb-1) / kHiZTileSize;
+		bool any_occluded = false;
+		for (int ty = ty_first; ty <= ty_last && !any_occluded; ty++) {
+			for (int tx = tx_first; tx <= tx_last && !any_occluded; tx++) {
+				any_occluded = hiz_.TileOccludes(tx, ty, setup.nearest_depth);
+			}
+		}
+		if (!any_occluded) {
+			return RasterizeRect(setup, ya, yb, xa, xb, write, limit, stats);
+		}
+
+		// Rasterize each row of tiles in runs of tiles that are not
+		// occluded
+		int count = 0;
+		for (int ty = ty_first; ty <= ty_last && count < limit; ty++) {
+			const int y0 = std::max(ya, ty*kHiZTileSize);
+			const int y1 = std::min(yb, (ty+1)*kHiZTileSize);
+			int tx = tx_first;
+			while (tx <= tx_last) {
+				int run_end = tx;
+				while (run_end <= tx_last && !hiz_.TileOccludes(run_end, ty, setup.nearest_depth)) {
+					run_end++;
+				}
+				const int x0 = std::max(xa, tx*kHiZTileSize);
+				const int x1 = std::min(xb, run_end*kHiZTileSize);
+				if (run_end == tx) {
+					culled_pixels += (std::min(xb, (tx+1)*kHiZTileSize) - x0) * (y1-y0);
+					tx++;
+				} else {
+					count += RasterizeRect(setup, y0, y1, x0, x1, write, limit-count, stats);
+					tx = run_end;
 				}
 			}
 		}
+		return count;
+	}
 
-		return affected;
+	// Wrap a mesh stored in vectors. Returns false if there is not
+	// exactly one label per triangle.
+	template <typename LabelT>
+	static bool MakeMeshView(const vector<Vec3>& vertices,
+													 const vector<Vec3I>& indices,
+													 const vector<LabelT>& labels,
+													 MeshView<LabelT>& mesh) {
+		if (labels.size() != indices.size()) {
+			std::cerr << "SimpleRenderer::RenderMesh() needs exactly one label per triangle";
+			return false;
+		}
+		mesh.vertices = vertices.data();
+		mesh.num_vertices = vertices.size();
+		mesh.indices = indices.data();
+		mesh.labels = labels.data();
+		mesh.num_triangles = indices.size();
+		return true;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	int SimpleRendererT<LabelT, DepthT, kStorage>::RenderMesh(const vector<Vec3>& vertices,
+																														const vector<Vec3I>& indices,
+																														const vector<LabelT>& labels) {
+		MeshView<LabelT> mesh;
+		if (!MakeMeshView(vertices, indices, labels, mesh)) {
+			return 0;
+		}
+		return RenderMeshImpl(mesh, NULL);
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	int SimpleRendererT<LabelT, DepthT, kStorage>::RenderMesh(const vector<Vec3>& vertices,
+																														const vector<Vec3I>& indices,
+																														const vector<LabelT>& labels,
+																														const DepthEqnArray& depth_eqns) {
+		MeshView<LabelT> mesh;
+		if (!MakeMeshView(vertices, indices, labels, mesh)) {
+			return 0;
+		}
+		return RenderMesh(mesh, depth_eqns);
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	int SimpleRendererT<LabelT, DepthT, kStorage>::RenderMesh(const MeshView<LabelT>& mesh) {
+		return RenderMeshImpl(mesh, NULL);
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	int SimpleRendererT<LabelT, DepthT, kStorage>::RenderMesh(const MeshView<LabelT>& mesh,
+																														const DepthEqnArray& depth_eqns) {
+		if (depth_eqns.cols() != mesh.num_triangles) {
+			std::cerr << "SimpleRenderer::RenderMesh() needs exactly one depth equation per triangle";
+			return 0;
+		}
+		return RenderMeshImpl(mesh, &depth_eqns);
 	}
 
-	bool SimpleRenderer::RenderInfinitePlane(double z0, int label) {
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	int SimpleRendererT<LabelT, DepthT, kStorage>::RenderMeshImpl(const MeshView<LabelT>& mesh,
+																																const DepthEqnArray* depth_eqns) {
+		if (viewport_[0] < 0 || viewport_[1] < 0) {
+			std::cerr << "You must call SimpleRenderer::Configure() before RenderMesh()";
+			return 0;
+		}
+		BeginStats();
+		TransformMesh(mesh.vertices, mesh.num_vertices, mesh.indices, mesh.num_triangles);
+		if (pool_) {
+			int naffected = RenderMeshBinned(mesh, depth_eqns);
+			EndStats();
+			return naffected;
+		}
+
+		int naffected = 0;
+		const Vec3* vertices = mesh.vertices;
+		const int nv = mesh.num_vertices;
+		RenderStats* stats = thread_render_stats(0);
+		Vec3 depth_eqn;
+		long ninvalid = 0;
+		for (int i = 0; i < mesh.num_triangles; i++) {
+			const Vec3I& tri = mesh.indices[i];
+			if (tri.minCoeff() < 0 || tri.maxCoeff() >= nv) {
+				ninvalid++;
+				if (stats) {
+					stats->triangles_submitted++;
+					stats->triangles_invalid++;
+				}
+				continue;
+			}
+			if (depth_eqns != NULL) {
+				depth_eqn = depth_eqns->col(i);
+			}
+			if (RenderTriangle(vertices[tri[0]], vertices[tri[1]], vertices[tri[2]],
+												 transformed_, tri, mesh.labels[i],
+												 depth_eqns == NULL ? NULL : &depth_eqn)) {
+				naffected++;
+			}
+		}
+		WarnInvalidTriangles(ninvalid, "RenderMesh");
+		EndStats();
+		// Resolve on demand, so that a frame drawn by several calls is
+		// only resolved once
+		label_stats_dirty_ = stats_num_labels_ > 0;
+		return naffected;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	int SimpleRendererT<LabelT, DepthT, kStorage>::RenderMeshBinned(const MeshView<LabelT>& mesh,
+																																	const DepthEqnArray* depth_eqns) {
+		const Vec3* vertices = mesh.vertices;
+		const Vec3I* indices = mesh.indices;
+		const int ntris = mesh.num_triangles;
+		const int nv = mesh.num_vertices;
+		const int tiles_x = (viewport_[0]+kTileSize-1) / kTileSize;
+		const int tiles_y = (viewport_[1]+kTileSize-1) / kTileSize;
+		const int ntiles = tiles_x * tiles_y;
+		const int nchunks = std::max(1, std::min(ntris/kMinChunkSize,
+																						 pool_->num_threads()*kChunksPerThread));
+		chunks_.resize(nchunks);
+		thread_culled_pixels_.assign(pool_->num_threads(), 0);
+		thread_invalid_triangles_.assign(pool_->num_threads(), 0);
+		thread_query_pixels_.assign(pool_->num_threads(), 0);
+		const bool write = !query_active_ || query_write_;
+		thread_stats_.resize(pool_->num_threads());
+		for (int i = 0; i < thread_stats_.size(); i++) {
+			thread_stats_[i].Reset(stats_num_labels_, stats_cost_images_.size());
+		}
+
+		// Set up each chunk of triangles and bin them into tiles. The bins
+		// of each chunk are kept separate and visited in chunk order
+		// below, so that each tile sees its triangles in submission order.
+		pool_->ParallelFor(nchunks, [&](int c, int thread) {
+				MeshChunk& chunk = chunks_[c];
+				chunk.begin = static_cast<long>(ntris) * c / nchunks;
+				chunk.end = static_cast<long>(ntris) * (c+1) / nchunks;
+				chunk.triangles.clear();
+				chunk.tile_refs.clear();
+				chunk.hiz_culled_triangles = 0;
+				chunk.hiz_culled_pixels = 0;
+
+				RenderStats* stats = thread_render_stats(thread);
+				for (int i = chunk.begin; i < chunk.end; i++) {
+					const Vec3I& tri = indices[i];
+					if (stats) stats->triangles_submitted++;
+					if (tri.minCoeff() < 0 || tri.maxCoeff() >= nv) {
+						thread_invalid_triangles_[thread]++;
+						if (stats) stats->triangles_invalid++;
+						continue;
+					}
+					TriangleSetup setup;
+					Vec3 depth_eqn;
+					if (depth_eqns != NULL) {
+						depth_eqn = depth_eqns->col(i);
+					}
+					if (!SetupTriangle(vertices[tri[0]], vertices[tri[1]], vertices[tri[2]],
+														 transformed_, tri,
+														 mesh.labels[i], depth_eqns == NULL ? NULL : &depth_eqn,
+														 setup, stats)) {
+						continue;
+					}
+					// The hierarchical-Z buffer is not written during this
+					// phase, so it is safe to read it here
+					if (hiz_enabled_ && HiZRejects(setup, false, chunk.hiz_culled_pixels)) {
+						chunk.hiz_culled_triangles++;
+						if (stats) stats->triangles_hiz_culled++;
+						continue;
+					}
+					if (stats) stats->triangles_rasterized++;
+
+					// Add the triangle to each tile that it overlaps
+					const int ti = chunk.triangles.size();
+					const EdgeSetup& edges = setup.edges;
+					for (int ty = edges.ymin/kTileSize; ty <= edges.ymax/kTileSize; ty++) {
+						for (int tx = edges.xmin/kTileSize; tx <= edges.xmax/kTileSize; tx++) {
+							if (EdgesOverlapRect(edges, ty*kTileSize, (ty+1)*kTileSize,
+																	 tx*kTileSize, (tx+1)*kTileSize)) {
+								chunk.tile_refs.push_back(std::make_pair(ty*tiles_x+tx, ti));
+							}
+						}
+					}
+					chunk.triangles.push_back(setup);
+				}
+
+				// Counting sort by tile, preserving submission order
+				chunk.bin_offsets.assign(ntiles+1, 0);
+				for (int i = 0; i < chunk.tile_refs.size(); i++) {
+					chunk.bin_offsets[chunk.tile_refs[i].first+1]++;
+				}
+				for (int t = 0; t < ntiles; t++) {
+					chunk.bin_offsets[t+1] += chunk.bin_offsets[t];
+				}
+				chunk.bin_entries.resize(chunk.tile_refs.size());
+				for (int i = 0; i < chunk.tile_refs.size(); i++) {
+					chunk.bin_entries[chunk.bin_offsets[chunk.tile_refs[i].first]++] =
+						chunk.tile_refs[i].second;
+				}
+				for (int t = ntiles; t > 0; t--) {
+					chunk.bin_offsets[t] = chunk.bin_offsets[t-1];
+				}
+				chunk.bin_offsets[0] = 0;
+				chunk.entry_affected.assign(chunk.bin_entries.size(), 0);
+			});
+
+		// Rasterize the tiles. Each tile is written by exactly one task so
+		// no locking is needed. Once a tile is complete its labels are
+		// final, so the per-label statistics are accumulated immediately.
+		pool_->ParallelFor(ntiles, [&](int t, int thread) {
+				const int ya = (t/tiles_x) * kTileSize;
+				const int xa = (t%tiles_x) * kTileSize;
+				const int yb = std::min(ya+kTileSize, viewport_[1]);
+				const int xb = std::min(xa+kTileSize, viewport_[0]);
+				RenderStats* stats = thread_render_stats(thread);
+				for (int c = 0; c < nchunks; c++) {
+					MeshChunk& chunk = chunks_[c];
+					for (int e = chunk.bin_offsets[t]; e < chunk.bin_offsets[t+1]; e++) {
+						const TriangleSetup& setup = chunk.triangles[chunk.bin_entries[e]];
+						int n = FillTriangle(setup, ya, yb, xa, xb, write, INT_MAX,
+																 thread_culled_pixels_[thread], stats);
+						if (n > 0) {
+							chunk.entry_affected[e] = 1;
+							thread_query_pixels_[thread] += n;
+						}
+					}
+				}
+				if (hiz_enabled_) {
+					// Leave the blocks tight for the next call, whose
+					// triangles are tested against them before binning
+					hiz_.Refresh(depthbuffer_.data(), pixel_layout_, ya, yb, xa, xb);
+				}
+				if (stats_num_labels_ > 0) {
+					// Tiles with no triangles may not have been initialized
+					FinishClearRect(ya, yb, xa, xb);
+					AccumulateLabelStats(framebuffer_.data(), pixel_layout_, stats_cost_images_,
+															 ya, yb, xa, xb, thread_stats_[thread]);
+				}
+			});
+
+		// Count the triangles that affected at least one tile
+		int naffected = 0;
+		for (int c = 0; c < nchunks; c++) {
+			MeshChunk& chunk = chunks_[c];
+			chunk.triangle_affected.assign(chunk.triangles.size(), 0);
+			for (int e = 0; e < chunk.bin_entries.size(); e++) {
+				chunk.triangle_affected[chunk.bin_entries[e]] |= chunk.entry_affected[e];
+			}
+			naffected += std::count(chunk.triangle_affected.begin(),
+															chunk.triangle_affected.end(), 1);
+			hiz_culled_triangles_ += chunk.hiz_culled_triangles;
+			hiz_culled_pixels_ += chunk.hiz_culled_pixels;
+		}
+		long ninvalid = 0;
+		for (int i = 0; i < thread_culled_pixels_.size(); i++) {
+			hiz_culled_pixels_ += thread_culled_pixels_[i];
+			ninvalid += thread_invalid_triangles_[i];
+			if (query_active_) {
+				query_pixels_ += thread_query_pixels_[i];
+			}
+		}
+		WarnInvalidTriangles(ninvalid, "RenderMesh");
+		label_stats_.Reset(stats_num_labels_, stats_cost_images_.size());
+		for (int i = 0; i < thread_stats_.size(); i++) {
+			label_stats_.Add(thread_stats_[i]);
+		}
+		label_stats_dirty_ = false;
+		return naffected;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	bool SimpleRendererT<LabelT, DepthT, kStorage>::RenderInfinitePlane(double z0, LabelT label) {
 		Vec4 plane(0., 0., 1., -z0);
-		Vec3 depth_eqn = PlaneToDepthEqn(camera_, plane);
+		Vec3 depth_eqn;
+		PlaneToDepthEqn(depth_basis_, plane, depth_eqn);
+		FinishClear();
+		bool affected = false;
 		for (int y = 0; y < viewport_[1]; y++) {
-			Eigen::ArrayXXd::RowXpr depth_row = depthbuffer_.row(y);
-			Eigen::ArrayXXi::RowXpr frame_row = framebuffer_.row(y);
-			for (int x = 0; x < viewport_[0]; x++) {
-				double depth = 1. / (depth_eqn.dot( MakeVector<double>(x, y, 1.)) );
-				if (depth > 0) {
-					frame_row[x] = label;
-					depth_row[x] = std::min(depth, kClampDepth);
-				}
-			}
-		}
-	}
-
-	void SimpleRenderer::Clear(int bg) {
-		framebuffer_.setConstant(bg);
-		depthbuffer_.setConstant(INFINITY);
-	}
-
-	int SimpleRenderer::SmoothInfiniteDepths() {
-		int n = 0;
-		double maxdepth = 0;
-		for (int y = 0; y < depthbuffer_.rows(); y++) {
-			Eigen::ArrayXXd::RowXpr row = depthbuffer_.row(y);
-			for (int x = 0; x < depthbuffer_.cols(); x++) {
-				if (!std::isfinite(row[x]) || row[x] > kClampDepth) {
-					// Pick a neighbour to replace with
-					bool done = false;
-					for (int dy = -1; !done && dy <= 1; dy+=2) {
-						for (int dx = -1; !done && dx <= 1; dx+=2) {
-							if (x+dx >= 0 && x+dx < depthbuffer_.cols() &&
-									y+dy >= 0 && y+dy < depthbuffer_.rows()) {
-								double v = depthbuffer_(y+dy, x+dx);
-								if (std::isfinite(v) && v < kClampDepth) {
-									row[x] = depthbuffer_(y+dy, x+dx);
-									done = true;
-								}
-							}
+			DepthT* depth_row = depthbuffer_.data() + pixel_layout_.RowOffset(y);
+			LabelT* frame_row = framebuffer_.data() + pixel_layout_.RowOffset(y);
+			// The inverse depth is linear along the row, so the plane is in
+			// front of the camera over a single span
+			const double base = depth_eqn[1]*y + depth_eqn[2];
+			int xa, xb;
+			PositiveSpan(depth_eqn[0], base, 0, viewport_[0], xa, xb);
+			double inv_depth = base + depth_eqn[0]*xa;
+			for (int x = xa; x < xb; x++) {
+				// Clamping also absorbs rounding errors at the end of the span
+				const double inv = std::max(inv_depth, 1. / kClampDepth);
+				const int offset = pixel_layout_.ColOffset(x);
+				frame_row[offset] = label;
+				depth_row[offset] = kStorage == kStoreDepth ? 1. / inv : inv;
+				inv_depth += depth_eqn[0];
+			}
+			affected |= xa < xb;
+		}
+		// Depths may have increased so the maxima must be recomputed
+		if (hiz_enabled_) {
+			hiz_.Rebuild(depthbuffer_.data(), pixel_layout_);
+		}
+		return affected;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	long SimpleRendererT<LabelT, DepthT, kStorage>::RenderManhattanLayout(double floor_z,
+																																				double ceiling_z,
+																																				const vector<Vec2>& corners,
+																																				const vector<LabelT>& wall_labels,
+																																				LabelT floor_label,
+																																				LabelT ceiling_label) {
+		if (viewport_[0] < 0 || viewport_[1] < 0) {
+			std::cerr << "You must call SimpleRenderer::Configure() before RenderManhattanLayout()";
+			return 0;
+		}
+		const int nwalls = corners.empty() ? 0 : corners.size()-1;
+		if (wall_labels.size() != nwalls) {
+			std::cerr << "SimpleRenderer::RenderManhattanLayout() needs exactly one label per wall";
+			return 0;
+		}
+
+		// The floor and ceiling are in front of the camera where their
+		// inverse depth is positive
+		Vec3 floor_eqn, ceiling_eqn;
+		PlaneToDepthEqn(depth_basis_, MakeVector<double>(0, 0, 1, -floor_z), floor_eqn);
+		PlaneToDepthEqn(depth_basis_, MakeVector<double>(0, 0, 1, -ceiling_z), ceiling_eqn);
+
+		walls_.resize(nwalls);
+		int nvisible = 0;
+		for (int i = 0; i < nwalls; i++) {
+			if (SetupWall(corners[i], corners[i+1], floor_z, ceiling_z,
+										wall_labels[i], walls_[nvisible])) {
+				nvisible++;
+			}
+		}
+
+		// If the camera is between the floor and the ceiling then any ray
+		// that meets a wall does so before it meets either plane, so the
+		// planes only need to be drawn in the gaps between walls
+		const Vec3 centre = -camera_.leftCols<3>().inverse() * camera_.col(3);
+		const bool walls_occlude = centre[2] > floor_z && centre[2] < ceiling_z;
+
+		// Columns are independent, so each task renders a block of them
+		// and the output does not depend on the number of threads
+		if (scissor_xa_ >= scissor_xb_ || scissor_ya_ >= scissor_yb_) {
+			return 0;
+		}
+		FinishClearRect(scissor_ya_, scissor_yb_, scissor_xa_, scissor_xb_);
+		const RasterTarget<LabelT, DepthT> target = raster_target();
+		const int nthreads = num_threads();
+		thread_layout_pixels_.assign(nthreads, 0);
+		thread_layout_spans_.resize(nthreads);
+		thread_wall_spans_.resize(nthreads);
+		const int ntasks = (scissor_xb_-scissor_xa_+kTileSize-1) / kTileSize;
+		const std::function<void(int, int)> render_columns = [&](int task, int thread) {
+			const int xa = scissor_xa_ + task*kTileSize;
+			const int xb = std::min(xa+kTileSize, scissor_xb_);
+			vector<LayoutSpan>& spans = thread_layout_spans_[thread];
+			vector<pair<int, int> >& wall_spans = thread_wall_spans_[thread];
+			spans.clear();
+			const auto add_planes = [&](int x, int ya, int yb) {
+				LayoutSpan span = { x, 0, 0, &floor_eqn, floor_label };
+				PositiveSpan(floor_eqn[1], floor_eqn[0]*x + floor_eqn[2], ya, yb, span.ya, span.yb);
+				spans.push_back(span);
+				span.depth_eqn = &ceiling_eqn;
+				span.label = ceiling_label;
+				PositiveSpan(ceiling_eqn[1], ceiling_eqn[0]*x + ceiling_eqn[2], ya, yb, span.ya, span.yb);
+				spans.push_back(span);
+			};
+
+			// Solve for the spans covered by each surface in each column
+			for (int x = xa; x < xb; x++) {
+				if (!walls_occlude) {
+					add_planes(x, scissor_ya_, scissor_yb_);
+				}
+				wall_spans.clear();
+				for (int i = 0; i < nvisible; i++) {
+					const WallSetup& wall = walls_[i];
+					LayoutSpan span = { x, 0, 0, &wall.depth_eqn, wall.label };
+					if (x >= wall.xa && x < wall.xb && WallRowSpan(wall, x, span.ya, span.yb)) {
+						spans.push_back(span);
+						wall_spans.push_back(std::make_pair(span.ya, span.yb));
+					}
+				}
+				if (walls_occlude) {
+					std::sort(wall_spans.begin(), wall_spans.end());
+					int y = scissor_ya_;
+					for (int i = 0; i < wall_spans.size(); i++) {
+						if (y < wall_spans[i].first) {
+							add_planes(x, y, wall_spans[i].first);
+						}
+						y = std::max(y, wall_spans[i].second);
+					}
+					if (y < scissor_yb_) {
+						add_planes(x, y, scissor_yb_);
+					}
+				}
+			}
+
+			// Walking down whole columns of a row-major buffer would touch
+			// a different cache line for every pixel, so draw the spans one
+			// band of rows at a time. This does not change the order in
+			// which the spans are drawn over each pixel.
+			long& count = thread_layout_pixels_[thread];
+			for (int band = scissor_ya_; band < scissor_yb_; band += kLayoutBandSize) {
+				const int band_end = std::min(band+kLayoutBandSize, scissor_yb_);
+				for (int i = 0; i < spans.size(); i++) {
+					const LayoutSpan& span = spans[i];
+					const int ya = std::max(span.ya, band);
+					const int yb = std::min(span.yb, band_end);
+					if (ya < yb) {
+						count += RasterizeColumn<LabelT, DepthT, kStorage>(span.x, ya, yb, *span.depth_eqn,
+																															 1. / kClampDepth, span.label, target);
+					}
+				}
+			}
+		};
+		if (pool_) {
+			pool_->ParallelFor(ntasks, render_columns);
+		} else {
+			for (int task = 0; task < ntasks; task++) {
+				render_columns(task, 0);
+			}
+		}
+
+		long npixels = 0;
+		for (int i = 0; i < nthreads; i++) {
+			npixels += thread_layout_pixels_[i];
+		}
+		if (hiz_enabled_ && npixels > 0) {
+			hiz_.Update(depthbuffer_.data(), pixel_layout_, scissor_ya_, scissor_yb_, scissor_xa_, scissor_xb_);
+		}
+		return npixels;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	bool SimpleRendererT<LabelT, DepthT, kStorage>::SetupWall(const Vec2& a, const Vec2& b,
+																														double floor_z, double ceiling_z,
+																														LabelT label,
+																														WallSetup& wall) const {
+		// Walls seen edge-on have zero depth equations
+		const Vec2 dir = b - a;
+		const Vec4 plane = MakeVector<double>(dir[1], -dir[0], 0, dir[0]*a[1] - dir[1]*a[0]);
+		if (!PlaneToDepthEqn(depth_basis_, plane, wall.depth_eqn)) {
+			return false;
+		}
+		wall.label = label;
+		wall.homography.col(0) = camera_.col(0)*dir[0] + camera_.col(1)*dir[1];
+		wall.homography.col(1) = camera_.col(2);
+		wall.homography.col(2) = camera_.col(0)*a[0] + camera_.col(1)*a[1] + camera_.col(3);
+
+		// Clip the wall rectangle against the near and far planes, which
+		// are linear in (t,z)
+		double t[kMaxWallVertices] = { 0, 1, 1, 0 };
+		double z[kMaxWallVertices] = { floor_z, floor_z, ceiling_z, ceiling_z };
+		int n = 4;
+		for (int k = 0; k < 2; k++) {
+			const Vec4& w = frustrum_.planes[k];
+			const double wt = w[0]*dir[0] + w[1]*dir[1];
+			const double wz = w[2];
+			const double w0 = w[0]*a[0] + w[1]*a[1] + w[3];
+			int m = 0;
+			for (int i = 0; i < n; i++) {
+				const int j = i+1 < n ? i+1 : 0;
+				const double si = wt*t[i] + wz*z[i] + w0;
+				const double sj = wt*t[j] + wz*z[j] + w0;
+				if (si >= 0) {
+					wall.t[m] = t[i];
+					wall.z[m] = z[i];
+					m++;
+				}
+				if ((si >= 0) != (sj >= 0)) {
+					const double f = si / (si - sj);
+					wall.t[m] = t[i] + f*(t[j]-t[i]);
+					wall.z[m] = z[i] + f*(z[j]-z[i]);
+					m++;
+				}
+			}
+			n = m;
+			std::copy(wall.t, wall.t+n, t);
+			std::copy(wall.z, wall.z+n, z);
+		}
+		wall.num_vertices = n;
+		if (n < 3) {
+			return false;
+		}
+
+		// Find the columns spanned by the projected wall
+		double xmin = INFINITY, xmax = -INFINITY;
+		for (int i = 0; i < n; i++) {
+			const Vec3 v = wall.homography * MakeVector<double>(t[i], z[i], 1);
+			xmin = std::min(xmin, v[0] / v[2]);
+			xmax = std::max(xmax, v[0] / v[2]);
+		}
+		// Clamp before converting since the coordinates may be huge
+		wall.xa = std::ceil(std::max<double>(xmin, scissor_xa_));
+		wall.xb = std::ceil(std::min<double>(xmax, scissor_xb_));
+		return wall.xa < wall.xb;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	bool SimpleRendererT<LabelT, DepthT, kStorage>::WallRowSpan(const WallSetup& wall, int x,
+																															int& ya, int& yb) const {
+		// The rays through column x meet the wall along a line in (t,z),
+		// and since the clipped wall is convex this line crosses its
+		// boundary exactly twice
+		const Vec3 line = wall.homography.row(0) - x*wall.homography.row(2);
+		double ys[2];
+		int ncrossings = 0;
+		const int n = wall.num_vertices;
+		for (int i = 0; i < n && ncrossings < 2; i++) {
+			const int j = i+1 < n ? i+1 : 0;
+			const double si = line[0]*wall.t[i] + line[1]*wall.z[i] + line[2];
+			const double sj = line[0]*wall.t[j] + line[1]*wall.z[j] + line[2];
+			if ((si >= 0) != (sj >= 0)) {
+				const double f = si / (si - sj);
+				const Vec3 p = MakeVector<double>(wall.t[i] + f*(wall.t[j]-wall.t[i]),
+																					wall.z[i] + f*(wall.z[j]-wall.z[i]),
+																					1);
+				ys[ncrossings++] = wall.homography.row(1).dot(p) / wall.homography.row(2).dot(p);
+			}
+		}
+		if (ncrossings < 2) {
+			return false;
+		}
+		const double ymin = std::max<double>(std::min(ys[0], ys[1]), scissor_ya_);
+		const double ymax = std::min<double>(std::max(ys[0], ys[1]), scissor_yb_);
+		ya = std::ceil(ymin);
+		yb = std::ceil(ymax);
+		return ya < yb;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void SimpleRendererT<LabelT, DepthT, kStorage>::Clear(LabelT bg) {
+		// Invalidate all tiles rather than writing every pixel
+		clear_label_ = bg;
+		if (++epoch_ == 0) {
+			// The epoch has wrapped around, so old tiles could look valid
+			tile_epochs_.assign(tile_epochs_.size(), 0);
+			epoch_ = 1;
+		}
+		clear_pending_ = true;
+		hiz_.Reset();
+		hiz_culled_triangles_ = 0;
+		hiz_culled_pixels_ = 0;
+		vertices_transformed_ = 0;
+		vertex_cache_hits_ = 0;
+		render_stats_.Reset();
+		if (overdraw_enabled_) {
+			overdraw_.setZero();
+		}
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void SimpleRendererT<LabelT, DepthT, kStorage>::ClearRect(LabelT bg, int ya, int yb, int xa, int xb) {
+		xa = std::max(xa, 0);
+		xb = std::min(xb, viewport_[0]);
+		ya = std::max(ya, 0);
+		yb = std::min(yb, viewport_[1]);
+		if (xa >= xb || ya >= yb) return;
+		FinishClearRect(ya, yb, xa, xb);
+		const DepthT clear_depth = kStorage == kStoreDepth ? INFINITY : 0;
+		FillPixels(framebuffer_.data(), pixel_layout_, ya, yb, xa, xb, bg);
+		FillPixels(depthbuffer_.data(), pixel_layout_, ya, yb, xa, xb, clear_depth);
+		hiz_.Update(depthbuffer_.data(), pixel_layout_, ya, yb, xa, xb);
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void SimpleRendererT<LabelT, DepthT, kStorage>::FinishClear() const {
+		if (clear_pending_ && viewport_[0] > 0 && viewport_[1] > 0) {
+			FinishClearRect(0, viewport_[1], 0, viewport_[0]);
+		}
+		clear_pending_ = false;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void SimpleRendererT<LabelT, DepthT, kStorage>::FinishClearRect(int ya, int yb, int xa, int xb) const {
+		if (!clear_pending_) return;
+		const DepthT clear_depth = kStorage == kStoreDepth ? INFINITY : 0;
+		const int tiles_x = (viewport_[0]+kTileSize-1) / kTileSize;
+		for (int ty = ya / kTileSize; ty <= (yb-1) / kTileSize; ty++) {
+			for (int tx = xa / kTileSize; tx <= (xb-1) / kTileSize; tx++) {
+				unsigned int& epoch = tile_epochs_[ty*tiles_x + tx];
+				if (epoch != epoch_) {
+					const int y0 = ty*kTileSize;
+					const int x0 = tx*kTileSize;
+					const int y1 = std::min(y0+kTileSize, viewport_[1]);
+					const int x1 = std::min(x0+kTileSize, viewport_[0]);
+					FillPixels(framebuffer_.data(), pixel_layout_, y0, y1, x0, x1, clear_label_);
+					FillPixels(depthbuffer_.data(), pixel_layout_, y0, y1, x0, x1, clear_depth);
+					epoch = epoch_;
+				}
+			}
+		}
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void SimpleRendererT<LabelT, DepthT, kStorage>::SetScissor(int ya, int yb, int xa, int xb) {
+		scissor_xa_ = std::max(xa, 0);
+		scissor_xb_ = std::min(xb, viewport_[0]);
+		scissor_ya_ = std::max(ya, 0);
+		scissor_yb_ = std::min(yb, viewport_[1]);
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void SimpleRendererT<LabelT, DepthT, kStorage>::ResetScissor() {
+		SetScissor(0, viewport_[1], 0, viewport_[0]);
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	bool SimpleRendererT<LabelT, DepthT, kStorage>::TriangleBounds(const Vec3& p, const Vec3& q, const Vec3& r,
+																																 int& ya, int& yb, int& xa, int& xb) {
+		TransformTriangle(p, q, r, scratch_, NULL);
+		TriangleSetup setup;
+		if (!SetupTriangle(p, q, r, scratch_.vertices, MakeVector(0, 1, 2), 0, NULL, setup, NULL)) {
+			return false;
+		}
+		ya = setup.edges.ymin;
+		yb = setup.edges.ymax+1;
+		xa = setup.edges.xmin;
+		xb = setup.edges.xmax+1;
+		return true;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void SimpleRendererT<LabelT, DepthT, kStorage>::EnableHiZ(bool enable) {
+		if (enable && !hiz_enabled_) {
+			FinishClear();
+			hiz_.Rebuild(depthbuffer_.data(), pixel_layout_);
+		}
+		hiz_enabled_ = enable;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void SimpleRendererT<LabelT, DepthT, kStorage>::RebuildHiZ() {
+		FinishClear();
+		hiz_.Rebuild(depthbuffer_.data(), pixel_layout_);
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void SimpleRendererT<LabelT, DepthT, kStorage>::SetNumThreads(int n) {
+		if (n <= 1) {
+			pool_.reset();
+		} else if (!pool_ || pool_->num_threads() != n) {
+			pool_.reset(new ThreadPool(n));
+		}
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	bool SimpleRendererT<LabelT, DepthT, kStorage>::EnableStats(bool enable, bool overdraw) {
+		if (!kRenderStatsSupported) {
+			if (enable) {
+				std::cerr << "Warning: the renderer was built without statistics";
+			}
+			return false;
+		}
+		stats_enabled_ = enable;
+		overdraw_enabled_ = enable && overdraw;
+		if (overdraw_enabled_) {
+			overdraw_.setZero(viewport_[1], viewport_[0]);
+		} else {
+			overdraw_.resize(0, 0);
+		}
+		return true;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void SimpleRendererT<LabelT, DepthT, kStorage>::GetOverdrawHistogram(vector<long>& histogram) const {
+		OverdrawHistogram(overdraw_, histogram);
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void SimpleRendererT<LabelT, DepthT, kStorage>::BeginStats() {
+		if (!stats_enabled_) return;
+		thread_render_stats_.resize(num_threads());
+		for (int i = 0; i < thread_render_stats_.size(); i++) {
+			thread_render_stats_[i].Reset();
+		}
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void SimpleRendererT<LabelT, DepthT, kStorage>::EndStats() {
+		if (!stats_enabled_) return;
+		for (int i = 0; i < thread_render_stats_.size(); i++) {
+			render_stats_.Add(thread_render_stats_[i]);
+		}
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	bool SimpleRendererT<LabelT, DepthT, kStorage>::SetLabelStats(int num_labels,
+																																const vector<const Eigen::ArrayXXd*>& cost_images) {
+		bool ok = true;
+		for (int k = 0; k < cost_images.size(); k++) {
+			if (cost_images[k]->rows() != viewport_[1] || cost_images[k]->cols() != viewport_[0]) {
+				std::cerr << "Warning: cost image "<<k<<" does not match the viewport, "
+									<< "disabling label statistics";
+				ok = false;
+			}
+		}
+		stats_num_labels_ = ok ? std::max(num_labels, 0) : 0;
+		if (stats_num_labels_ > 0) {
+			stats_cost_images_ = cost_images;
+		} else {
+			stats_cost_images_.clear();
+		}
+		label_stats_.Reset(stats_num_labels_, stats_cost_images_.size());
+		label_stats_dirty_ = false;
+		return ok;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	const LabelStats& SimpleRendererT<LabelT, DepthT, kStorage>::ResolveLabelStats() const {
+		label_stats_.Reset(stats_num_labels_, stats_cost_images_.size());
+		if (stats_num_labels_ > 0) {
+			FinishClear();
+			AccumulateLabelStats(framebuffer_.data(), pixel_layout_, stats_cost_images_,
+													 0, viewport_[1], 0, viewport_[0], label_stats_);
+		}
+		label_stats_dirty_ = false;
+		return label_stats_;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	const LabelStats& SimpleRendererT<LabelT, DepthT, kStorage>::label_stats() const {
+		return label_stats_dirty_ ? ResolveLabelStats() : label_stats_;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void SimpleRendererT<LabelT, DepthT, kStorage>::BeginOcclusionQuery(bool write) {
+		if (query_active_) {
+			std::cerr << "Warning: BeginOcclusionQuery() called during another query, "
+								<< "which has been discarded";
+		}
+		query_active_ = true;
+		query_write_ = write;
+		query_pixels_ = 0;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	long SimpleRendererT<LabelT, DepthT, kStorage>::EndOcclusionQuery() {
+		if (!query_active_) {
+			std::cerr << "Warning: EndOcclusionQuery() called without BeginOcclusionQuery()";
+			return 0;
+		}
+		query_active_ = false;
+		return query_pixels_;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void SimpleRendererT<LabelT, DepthT, kStorage>::RunOcclusionQueries(const vector<Vec3>& vertices,
+																																			const vector<Vec3I>& indices,
+																																			const vector<int>& query_offsets,
+																																			long threshold,
+																																			vector<long>& counts) {
+		const int nqueries = std::max<int>(query_offsets.size()-1, 0);
+		counts.assign(nqueries, 0);
+		if (viewport_[0] < 0 || viewport_[1] < 0) {
+			std::cerr << "You must call SimpleRenderer::Configure() before RunOcclusionQueries()";
+			return;
+		}
+		if (nqueries > 0 && (query_offsets.front() < 0 || query_offsets.back() > indices.size())) {
+			std::cerr << "SimpleRenderer::RunOcclusionQueries() was given out-of-range query offsets";
+			return;
+		}
+		if (threshold <= 0) {
+			threshold = std::numeric_limits<long>::max();
+		}
+		// The queries run concurrently over the whole viewport so they
+		// cannot initialize tiles as they go
+		FinishClear();
+		BeginStats();
+		TransformMesh(vertices.data(), vertices.size(), indices.data(), indices.size());
+
+		// Nothing is written so the queries are independent, once the
+		// hierarchical-Z buffer is brought up to date
+		if (hiz_enabled_) {
+			hiz_.Refresh(depthbuffer_.data(), pixel_layout_, 0, viewport_[1], 0, viewport_[0]);
+		}
+		const int nthreads = num_threads();
+		thread_culled_pixels_.assign(nthreads, 0);
+		thread_culled_triangles_.assign(nthreads, 0);
+		thread_invalid_triangles_.assign(nthreads, 0);
+		const int nv = vertices.size();
+		const std::function<void(int, int)> run_query = [&](int q, int thread) {
+			long& count = counts[q];
+			RenderStats* stats = thread_render_stats(thread);
+			for (int i = query_offsets[q]; i < query_offsets[q+1] && count < threshold; i++) {
+				const Vec3I& tri = indices[i];
+				if (stats) stats->triangles_submitted++;
+				if (tri.minCoeff() < 0 || tri.maxCoeff() >= nv) {
+					thread_invalid_triangles_[thread]++;
+					if (stats) stats->triangles_invalid++;
+					continue;
+				}
+				TriangleSetup setup;
+				if (!SetupTriangle(vertices[tri[0]], vertices[tri[1]], vertices[tri[2]],
+													 transformed_, tri, 0, NULL, setup, stats)) {
+					continue;
+				}
+				long& culled_pixels = thread_culled_pixels_[thread];
+				if (hiz_enabled_ && HiZRejects(setup, false, culled_pixels)) {
+					thread_culled_triangles_[thread]++;
+					if (stats) stats->triangles_hiz_culled++;
+					continue;
+				}
+				if (stats) stats->triangles_rasterized++;
+				const int limit = std::min<long>(threshold-count, INT_MAX);
+				count += FillTriangle(setup, 0, viewport_[1], 0, viewport_[0],
+															false, limit, culled_pixels, stats);
+			}
+		};
+		if (pool_) {
+			pool_->ParallelFor(nqueries, run_query);
+		} else {
+			for (int q = 0; q < nqueries; q++) {
+				run_query(q, 0);
+			}
+		}
+		long ninvalid = 0;
+		for (int i = 0; i < nthreads; i++) {
+			hiz_culled_triangles_ += thread_culled_triangles_[i];
+			hiz_culled_pixels_ += thread_culled_pixels_[i];
+			ninvalid += thread_invalid_triangles_[i];
+		}
+		WarnInvalidTriangles(ninvalid, "RunOcclusionQueries");
+		EndStats();
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	int SimpleRendererT<LabelT, DepthT, kStorage>::num_threads() const {
+		return pool_ ? pool_->num_threads() : 1;
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	int SimpleRendererT<LabelT, DepthT, kStorage>::SmoothInfiniteDepths(DepthFillPolicy policy) {
+		FinishClear();
+		const int rows = viewport_[1];
+		const int cols = viewport_[0];
+		const int nthreads = num_threads();
+		thread_fill_.resize(nthreads);
+		for (int i = 0; i < nthreads; i++) {
+			thread_fill_[i].count = 0;
+			thread_fill_[i].found = false;
+		}
+		if (policy == kFillNearest) {
+			fill_rows_.resize(rows, cols);
+		}
+
+		// Count the infinite pixels and find the furthest finite
+		// depth. For kFillNearest, also find the nearest finite pixel in
+		// the same column as each pixel, with one pass down the columns
+		// and one pass up. Each task handles a block of columns a row at
+		// a time.
+		const std::function<void(int, int)> scan_columns = [&](int task, int thread) {
+			const int xa = task*kTileSize;
+			const int xb = std::min(xa+kTileSize, cols);
+			FillScratch& scratch = thread_fill_[thread];
+			for (int y = 0; y < rows; y++) {
+				const DepthT* row = depthbuffer_.data() + pixel_layout_.RowOffset(y);
+				for (int x = xa; x < xb; x++) {
+					const DepthT v = row[pixel_layout_.ColOffset(x)];
+					const bool finite = IsFiniteDepth(v);
+					if (finite) {
+						if (!scratch.found || IsFurther<kStorage>(v, scratch.furthest)) {
+							scratch.furthest = v;
 						}
+						scratch.found = true;
+					} else if (IsInfiniteDepth(v)) {
+						scratch.count++;
+					}
+					if (policy == kFillNearest) {
+						fill_rows_(y, x) = finite ? y : (y > 0 ? fill_rows_(y-1, x) : -1);
 					}
-					if (!done) {
-						std::cerr << "A value in the depth buffer was infinite "
-											<< "and ALL its neighbours were too. "
-											<< "Please implement a better algorithm "
-											<< "(e.g. walk towards image centre until valid value)";
+				}
+			}
+			if (policy == kFillNearest) {
+				// Ties go to the pixel above
+				for (int y = rows-2; y >= 0; y--) {
+					for (int x = xa; x < xb; x++) {
+						const int above = fill_rows_(y, x);
+						const int below = fill_rows_(y+1, x);
+						if (below > y && (above < 0 || below-y < y-above)) {
+							fill_rows_(y, x) = below;
+						}
 					}
-					n++;
 				}
 			}
+		};
+		const int ncol_tasks = (cols+kTileSize-1) / kTileSize;
+		if (pool_) {
+			pool_->ParallelFor(ncol_tasks, scan_columns);
+		} else {
+			for (int task = 0; task < ncol_tasks; task++) {
+				scan_columns(task, 0);
+			}
+		}
+
+		long n = 0;
+		bool found = false;
+		DepthT furthest = 0;
+		for (int i = 0; i < nthreads; i++) {
+			const FillScratch& scratch = thread_fill_[i];
+			n += scratch.count;
+			if (scratch.found && (!found || IsFurther<kStorage>(scratch.furthest, furthest))) {
+				furthest = scratch.furthest;
+			}
+			found |= scratch.found;
+		}
+		if (n == 0) {
+			return 0;
+		}
+		if (!found && policy != kFillClamp) {
+			std::cerr << "Warning: the depth buffer has no finite values, "
+								<< "so SmoothInfiniteDepths() will clamp all infinite values";
+			policy = kFillClamp;
+		}
+
+		// Replace the infinite depths, one band of rows per task. Only
+		// finite pixels are read so the bands are independent.
+		const DepthT fill_value = policy == kFillMaxFinite ? furthest :
+			static_cast<DepthT>(kStorage == kStoreDepth ? kClampDepth : 1. / kClampDepth);
+		const std::function<void(int, int)> fill_rows = [&](int task, int thread) {
+			const int ya = task*kTileSize;
+			const int yb = std::min(ya+kTileSize, rows);
+			if (policy == kFillNearest) {
+				FillNearestDepths(ya, yb, thread_fill_[thread]);
+			} else {
+				for (int y = ya; y < yb; y++) {
+					DepthT* row = depthbuffer_.data() + pixel_layout_.RowOffset(y);
+					for (int x = 0; x < cols; x++) {
+						DepthT& v = row[pixel_layout_.ColOffset(x)];
+						if (IsInfiniteDepth(v)) {
+							v = fill_value;
+						}
+					}
+				}
+			}
+		};
+		const int nrow_tasks = (rows+kTileSize-1) / kTileSize;
+		if (pool_) {
+			pool_->ParallelFor(nrow_tasks, fill_rows);
+		} else {
+			for (int task = 0; task < nrow_tasks; task++) {
+				fill_rows(task, 0);
+			}
+		}
+
+		// Depths only decrease, but the maxima are now much tighter
+		if (hiz_enabled_) {
+			hiz_.Rebuild(depthbuffer_.data(), pixel_layout_);
 		}
 		return n;
 	}
 
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	void SimpleRendererT<LabelT, DepthT, kStorage>::FillNearestDepths(int ya, int yb, FillScratch& scratch) {
+		// For each row this is a 1D distance transform of the squared
+		// vertical distances to the nearest finite pixel in each column,
+		// computed from the lower envelope of one parabola per column
+		// (Felzenszwalb and Huttenlocher)
+		const int cols = viewport_[0];
+		vector<int>& env_cols = scratch.envelope_cols;
+		vector<double>& env_values = scratch.envelope_values;
+		vector<double>& env_bounds = scratch.envelope_bounds;
+		env_cols.resize(cols);
+		env_values.resize(cols);
+		env_bounds.resize(cols+1);
+		for (int y = ya; y < yb; y++) {
+			DepthT* row = depthbuffer_.data() + pixel_layout_.RowOffset(y);
+			bool any = false;
+			for (int x = 0; x < cols && !any; x++) {
+				any = IsInfiniteDepth(row[pixel_layout_.ColOffset(x)]);
+			}
+			if (!any) continue;
+
+			// Build the envelope from the columns that have a finite pixel
+			int k = -1;
+			for (int q = 0; q < cols; q++) {
+				const int r = fill_rows_(y, q);
+				if (r < 0) continue;
+				const double value = static_cast<double>(y-r)*(y-r) + static_cast<double>(q)*q;
+				double s = -INFINITY;
+				while (k >= 0) {
+					s = (value - env_values[k]) / (2.*(q - env_cols[k]));
+					if (s > env_bounds[k]) break;
+					k--;
+				}
+				k++;
+				env_cols[k] = q;
+				env_values[k] = value;
+				env_bounds[k] = k == 0 ? -INFINITY : s;
+				env_bounds[k+1] = INFINITY;
+			}
+
+			// Read off the nearest finite pixel for each infinite one
+			for (int x = 0, j = 0; x < cols; x++) {
+				while (env_bounds[j+1] < x) j++;
+				DepthT& v = row[pixel_layout_.ColOffset(x)];
+				if (IsInfiniteDepth(v)) {
+					const int q = env_cols[j];
+					v = depthbuffer_.data()[pixel_layout_.Offset(fill_rows_(y, q), q)];
+				}
+			}
+		}
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	bool SimpleRendererT<LabelT, DepthT, kStorage>::IsInfiniteDepth(DepthT v) {
+		if (kStorage == kStoreDepth) {
+			return !std::isfinite(v) || v > kClampDepth;
+		} else {
+			return !std::isfinite(v) || v < static_cast<DepthT>(1. / kClampDepth);
+		}
+	}
+
+	template <typename LabelT, typename DepthT, DepthStorage kStorage>
+	bool SimpleRendererT<LabelT, DepthT, kStorage>::IsFiniteDepth(DepthT v) {
+		if (kStorage == kStoreDepth) {
+			return std::isfinite(v) && v < kClampDepth;
+		} else {
+			return std::isfinite(v) && v > static_cast<DepthT>(1. / kClampDepth);
+		}
+	}
+
+#define INSTANTIATE_RENDERER_ALL_STORAGE(LabelT, DepthT)					\
+	template class SimpleRendererT<LabelT, DepthT, kStoreDepth>;		\
+	template class SimpleRendererT<LabelT, DepthT, kStoreInverseDepth>;
+
+	INSTANTIATE_RENDERER_ALL_STORAGE(int, double)
+	INSTANTIATE_RENDERER_ALL_STORAGE(int, float)
+	INSTANTIATE_RENDERER_ALL_STORAGE(uint16_t, double)
+	INSTANTIATE_RENDERER_ALL_STORAGE(uint16_t, float)
+	INSTANTIATE_RENDERER_ALL_STORAGE(uint8_t, double)
+	INSTANTIATE_RENDERER_ALL_STORAGE(uint8_t, float)
 }
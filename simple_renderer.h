@@ -1,56 +1,567 @@
 #pragma once
 
+#include <vector>
+#include <utility>
+#include <memory>
+
 #include "matrix_types.h"
+#include "rasterizer.h"
+#include "depth_equation.h"
+#include "clipping.h"
+#include "hiz_buffer.h"
+#include "label_stats.h"
+#include "buffer_layout.h"
+#include "vertex_transform.h"
+#include "render_stats.h"
 
 namespace indoor_context {
-	class SimpleRenderer {
+	class ThreadPool;
+
+	// The depth at which surfaces that extend to infinity are clamped
+	static const double kClampDepth = 1e+6;
+
+	// How SmoothInfiniteDepths replaces infinite depths
+	enum DepthFillPolicy {
+		kFillNearest,  // the depth of the nearest finite pixel
+		kFillMaxFinite,  // the furthest finite depth in the buffer
+		kFillClamp  // kClampDepth
+	};
+
+	// An indexed triangle mesh in memory owned by the caller, such as a
+	// mesh mapped from a scene file (see scene_file.h). Each element of
+	// indices selects the three vertices of a triangle, which is drawn
+	// with the corresponding element of labels.
+	template <typename LabelT>
+	struct MeshView {
+		const Vec3* vertices;
+		int num_vertices;
+		const Vec3I* indices;
+		const LabelT* labels;
+		int num_triangles;
+	};
+
+	// Renders labelled polygons into a label buffer and a depth
+	// buffer. LabelT is the type of the labels and DepthT is the
+	// precision of the depth buffer. With kStoreInverseDepth the depth
+	// buffer holds 1/depth, which is cleared to zero and is larger for
+	// closer surfaces; this avoids a division per pixel. Instantiated for
+	// int, uint16_t and uint8_t labels with double and float depths.
+	template <typename LabelT = int,
+						typename DepthT = double,
+						DepthStorage kStorage = kStoreDepth>
+	class SimpleRendererT {
 	public:
 		// Make sure we're aligned (since we have eigen members)
 		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
+		typedef LabelT Label;
+		typedef DepthT Depth;
+		typedef Eigen::Array<LabelT, Eigen::Dynamic, Eigen::Dynamic> LabelBuffer;
+		typedef Eigen::Array<DepthT, Eigen::Dynamic, Eigen::Dynamic> DepthBuffer;
+
 		// Initialize empty
-		SimpleRenderer();
+		SimpleRendererT();
 		// Initialize with the given camera
-		//SimpleRenderer(const PosedCamera& cam);
+		//SimpleRendererT(const PosedCamera& cam);
 		// Initialize with the given camera and viewport
-		SimpleRenderer(const LinearCamera& cam, Vec2I viewport);
-
-		// Get the frame buffer
-		const Eigen::ArrayXXi& framebuffer() const { return framebuffer_; }
-		Eigen::ArrayXXi& framebuffer() { return framebuffer_; }
-		// Get the depth buffer
-		const Eigen::ArrayXXd& depthbuffer() const { return depthbuffer_; }
-		Eigen::ArrayXXd& depthbuffer() { return depthbuffer_; }
+		SimpleRendererT(const LinearCamera& cam, Vec2I viewport);
+
+		// Get the frame buffer as a row-major array. Clear() is lazy, so
+		// this first initializes any tiles that have not been drawn to
+		// since the last call to Clear(). For this reason, concurrent
+		// calls to the buffer accessors are only safe after a first call
+		// from one thread. With kTiledLayout this copies the buffer into
+		// a row-major array owned by the renderer on every call, which is
+		// not safe to do concurrently. Use frame_view() to read a tiled
+		// buffer without copying.
+		const LabelBuffer& framebuffer() const;
+		// Get the depth buffer as a row-major array. See DepthStorage for
+		// its contents. See also framebuffer().
+		const DepthBuffer& depthbuffer() const;
+		// Get the frame buffer or depth buffer for modification in
+		// place. This requires kRowMajorLayout, so switch layouts with
+		// SetBufferLayout() first if necessary. With kTiledLayout a
+		// warning is printed and a copy is returned, so any changes are
+		// lost. See also RebuildHiZ().
+		LabelBuffer& mutable_framebuffer();
+		DepthBuffer& mutable_depthbuffer();
+		// Get read-only views of the frame buffer and depth buffer in
+		// their current layout. These do not copy the buffers. They are
+		// invalidated by Configure() and SetBufferLayout().
+		BufferView<LabelT> frame_view() const;
+		BufferView<DepthT> depth_view() const;
+		// Copy the frame buffer or depth buffer into a row-major array,
+		// which is resized if necessary. This is safe to call
+		// concurrently after a first call to any buffer accessor.
+		void CopyFrameBuffer(LabelBuffer& out) const;
+		void CopyDepthBuffer(DepthBuffer& out) const;
+		// Get the memory layout of the buffers
+		BufferLayout buffer_layout() const { return layout_; }
 		// Get the camera
 		const LinearCamera& camera() const { return camera_; }
 		// Get the viewport
 		const Vec2I& viewport() const { return viewport_; }
+		// Get the depth equation basis for the camera
+		const DepthEqnBasis& depth_basis() const { return depth_basis_; }
+		// Get the number of threads used by RenderMesh
+		int num_threads() const;
 
 		// Configure the renderer with the given camera and viewport
 		void Configure(const LinearCamera& cam, Vec2I viewport);
-		// Clear all buffers
-		void Clear(int bg);
+		// Set the memory layout of the frame buffer and depth
+		// buffer. With kTiledLayout the pixels of each 8x8 tile are
+		// stored together, so a tall, thin triangle touches far fewer
+		// cache lines and pages than with kRowMajorLayout. The output is
+		// unchanged. The contents of the buffers are preserved. The
+		// layout is kept by Configure().
+		void SetBufferLayout(BufferLayout layout);
+		// Clear all buffers. This takes time proportional to the number
+		// of tiles rather than pixels: each tile is initialized the first
+		// time it is drawn to, or when the buffers are read.
+		void Clear(LabelT bg);
+		// Clear the rectangle [xa,xb)x[ya,yb) of all buffers
+		void ClearRect(LabelT bg, int ya, int yb, int xa, int xb);
+		// Restrict all drawing to the rectangle [xa,xb)x[ya,yb) until the
+		// next call to SetScissor(), ResetScissor() or Configure()
+		void SetScissor(int ya, int yb, int xa, int xb);
+		// Allow drawing to the whole viewport
+		void ResetScissor();
+		// Enable or disable hierarchical-Z culling. When enabled, the
+		// renderer maintains the max depth of each tile of the depth
+		// buffer and skips triangles and tiles that are entirely behind
+		// it. The output is unchanged. If you modify mutable_depthbuffer()
+		// while this is enabled then call RebuildHiZ().
+		void EnableHiZ(bool enable);
+		// Recompute the hierarchical-Z maxima from the depth buffer
+		void RebuildHiZ();
+		// Returns true if hierarchical-Z culling is enabled
+		bool hiz_enabled() const { return hiz_enabled_; }
+		// Get the number of triangles rejected by hierarchical-Z culling
+		// since the last call to Clear()
+		long hiz_culled_triangles() const { return hiz_culled_triangles_; }
+		// Get the number of pixels skipped by hierarchical-Z culling since
+		// the last call to Clear(). This counts the pixels of the culled
+		// tiles that fall within each triangle's bounding box.
+		long hiz_culled_pixels() const { return hiz_culled_pixels_; }
+		// Get the number of vertices transformed into the camera since
+		// the last call to Clear(). RenderMesh() and
+		// RunOcclusionQueries() transform each vertex referenced by the
+		// mesh once per call, however many triangles share it.
+		long vertices_transformed() const { return vertices_transformed_; }
+		// Get the number of vertex references served from the
+		// post-transform cache rather than transformed again, since the
+		// last call to Clear()
+		long vertex_cache_hits() const { return vertex_cache_hits_; }
+		// Enable or disable the collection of statistics for the
+		// triangles drawn by Render(), RenderMesh() and
+		// RunOcclusionQueries() (see RenderStats). This reads a clock
+		// several times per triangle, so it is disabled by default. If
+		// overdraw is true then the number of fragments rasterized at
+		// each pixel is also recorded in overdraw_buffer(), which visits
+		// every fragment a second time. Returns false if the library was
+		// built without statistics (see kRenderStatsSupported).
+		bool EnableStats(bool enable, bool overdraw = false);
+		// Returns true if statistics are being collected
+		bool stats_enabled() const { return stats_enabled_; }
+		// Get the statistics since the last call to Clear()
+		const RenderStats& render_stats() const { return render_stats_; }
+		// Get the number of fragments rasterized at each pixel since the
+		// last call to Clear(), as a row-major array the size of the
+		// viewport. This is empty unless enabled by EnableStats().
+		const OverdrawBuffer& overdraw_buffer() const { return overdraw_; }
+		// Get the histogram of overdraw_buffer(): element k is the number
+		// of pixels with k fragments
+		void GetOverdrawHistogram(std::vector<long>& histogram) const;
+		// Set the number of threads used by RenderMesh. With more than
+		// one thread, triangles are set up in parallel, binned into
+		// screen tiles, and the tiles are rasterized concurrently. The
+		// output is identical to the single-threaded path.
+		void SetNumThreads(int n);
+		// Compute per-label statistics as a by-product of RenderMesh.
+		// After each call to RenderMesh, label_stats() holds the number of
+		// pixels with each label in [0,num_labels) and the sum of each
+		// cost image over those pixels. The statistics cover the whole
+		// frame buffer, so pixels that are overwritten by later triangles
+		// only count towards their final label. With more than one
+		// thread, each tile is resolved as soon as it has been
+		// rasterized, while it is still in cache. The cost images must be
+		// the same size as the viewport and must remain valid while
+		// statistics are enabled. With one thread, the frame buffer is
+		// resolved when label_stats() is next called, so a frame drawn
+		// by several calls to RenderMesh is only resolved once. Pass
+		// num_labels=0 to disable. Returns false if the cost images have
+		// the wrong size.
+		bool SetLabelStats(int num_labels,
+											 const std::vector<const Eigen::ArrayXXd*>& cost_images);
+		// Recompute the per-label statistics from the frame buffer, for
+		// example after calling Render(), RenderInfinitePlane() or
+		// RenderManhattanLayout()
+		const LabelStats& ResolveLabelStats() const;
+		// Get the per-label statistics as of the last call to RenderMesh()
+		// or ResolveLabelStats(). After a single-threaded RenderMesh()
+		// they are resolved here, so they also include anything drawn
+		// since.
+		const LabelStats& label_stats() const;
+
+		// Begin an occlusion query. Until EndOcclusionQuery(), the pixels
+		// of triangles drawn by Render() and RenderMesh() that pass the
+		// depth test against the current buffers are counted. If write is
+		// false then neither buffer is modified, so pixels covered by
+		// several triangles in the query are counted once per triangle.
+		void BeginOcclusionQuery(bool write);
+		// End the current occlusion query and return the number of
+		// pixels that passed the depth test
+		long EndOcclusionQuery();
+		// Returns true between BeginOcclusionQuery() and EndOcclusionQuery()
+		bool query_active() const { return query_active_; }
+		// Run a batch of depth-only occlusion queries against the current
+		// buffers, which are not modified. Query i consists of triangles
+		// [query_offsets[i], query_offsets[i+1]) of the mesh, and the
+		// number of their pixels that pass the depth test is written to
+		// counts[i]. Each query stops early once its count reaches
+		// threshold, in which case the count is at least threshold; pass
+		// zero for no threshold. Queries run in parallel if
+		// SetNumThreads() was given more than one thread.
+		void RunOcclusionQueries(const std::vector<Vec3>& vertices,
+														 const std::vector<Vec3I>& indices,
+														 const std::vector<int>& query_offsets,
+														 long threshold,
+														 std::vector<long>& counts);
+
+		// Get the rectangle [xa,xb)x[ya,yb) containing every pixel that a
+		// triangle could cover within the scissor rectangle, after
+		// clipping. Returns false if the triangle covers no pixels.
+		bool TriangleBounds(const Vec3& p, const Vec3& q, const Vec3& r,
+												int& ya, int& yb, int& xa, int& xb);
 
 		// Render a triangle. Return true if at least one pixel was affected.
-		bool Render(const Vec2& p, const Vec2& q, const Vec2& r, int label);
+		bool Render(const Vec2& p, const Vec2& q, const Vec2& r, LabelT label);
 		// Render a triangle (homogeneous coords). Return true if at least
 		// one pixel was affected.
-		bool Render(const Vec3& p, const Vec3& q, const Vec3& r, int label);
-		// Render an infinite plane z=z0. Internally we just use very large extents.
-		bool OldRenderInfinitePlane(double z0, int label);
+		bool Render(const Vec3& p, const Vec3& q, const Vec3& r, LabelT label);
+		// Render an indexed triangle mesh. Each element of indices
+		// selects the three vertices of a triangle, which is drawn with
+		// the corresponding element of labels. The output is identical to
+		// calling Render() for each triangle in turn, but no memory is
+		// allocated per triangle. Returns the number of triangles that
+		// affected at least one pixel. See also SetNumThreads().
+		int RenderMesh(const std::vector<Vec3>& vertices,
+									 const std::vector<Vec3I>& indices,
+									 const std::vector<LabelT>& labels);
+		// As above, but with the depth equation of each triangle given
+		// as the corresponding column of depth_eqns, as computed by
+		// PlanesToDepthEqns from TrianglePlane. Triangles whose depth
+		// equation is zero are skipped. This lets callers that render
+		// the same mesh from many cameras share the world-space work.
+		int RenderMesh(const std::vector<Vec3>& vertices,
+									 const std::vector<Vec3I>& indices,
+									 const std::vector<LabelT>& labels,
+									 const DepthEqnArray& depth_eqns);
+		// As above, for meshes that are not stored in vectors. The mesh
+		// is not copied.
+		int RenderMesh(const MeshView<LabelT>& mesh);
+		int RenderMesh(const MeshView<LabelT>& mesh, const DepthEqnArray& depth_eqns);
 		// Render an infinite plane z=z0. Internally we just use very large extents.
-		bool RenderInfinitePlane(double z0, int label);
+		bool OldRenderInfinitePlane(double z0, LabelT label);
+		// Render an infinite plane z=z0, overwriting the buffers wherever
+		// it is in front of the camera. The plane is solved analytically
+		// in each row and the inverse depth is computed incrementally.
+		// Return true if at least one pixel was affected.
+		bool RenderInfinitePlane(double z0, LabelT label);
+		// Render a room layout made of a floor z=floor_z, a ceiling
+		// z=ceiling_z and vertical walls between them. Wall i runs from
+		// corners[i] to corners[i+1] (in the xy-plane) and is drawn with
+		// wall_labels[i]; repeat the first corner at the end to close the
+		// room. In Manhattan layouts the walls are axis-aligned, but any
+		// vertical walls are supported. Rather than clipping and
+		// rasterizing triangles, the rows covered by each surface are
+		// solved analytically in each image column and written as
+		// vertical spans with incrementally computed depth. The floor and
+		// ceiling are infinite planes as in RenderInfinitePlane, and all
+		// surfaces are depth-tested against the buffers. Columns are
+		// rendered in parallel if SetNumThreads() was given more than one
+		// thread. Returns the number of pixels written.
+		long RenderManhattanLayout(double floor_z,
+															 double ceiling_z,
+															 const std::vector<Vec2>& corners,
+															 const std::vector<LabelT>& wall_labels,
+															 LabelT floor_label,
+															 LabelT ceiling_label);
 
 		// We often get NaN/inf pixels when there are walls close to the
 		// horizon, or due to clipping issues near the boundary of the
-		// image. As a simple work around we replace any such values by the
-		// max finite value (which are clamped to kClampDepth). Returns the
+		// image. As a simple work around we replace any such values
+		// according to policy. With kFillNearest each one takes the depth
+		// of the nearest finite pixel in Euclidean distance, so holes of
+		// any size are filled. Only finite pixels are read, so the result
+		// does not depend on the scan order or the number of threads. If
+		// there are no finite pixels then kFillClamp is used
+		// instead. Takes time linear in the number of pixels. Returns the
 		// number of pixels modified.
-		int SmoothInfiniteDepths();
+		int SmoothInfiniteDepths(DepthFillPolicy policy = kFillNearest);
 	private:
+		// A triangle that has been clipped, projected and converted to
+		// edge equations, ready to be rasterized
+		struct TriangleSetup {
+			LabelT label;
+			EdgeSetup edges;
+			Vec3 depth_eqn;
+			double nearest_depth;  // min depth over the clipped triangle
+		};
+
+		// Scratch space for triangles drawn one at a time. Triangles are
+		// clipped and set up in fixed-size arrays on the stack.
+		struct SetupScratch {
+			TransformedVertices vertices;
+		};
+
+		// A contiguous range of mesh triangles that is set up and binned
+		// by one task of the multi-threaded path
+		struct MeshChunk {
+			int begin, end;  // range of triangles in the mesh
+			std::vector<TriangleSetup> triangles;
+			std::vector<std::pair<int, int> > tile_refs;  // (tile, triangle) pairs
+			std::vector<int> bin_offsets;  // start of each tile in bin_entries
+			std::vector<int> bin_entries;  // indices into triangles, grouped by tile
+			std::vector<unsigned char> entry_affected;  // parallel to bin_entries
+			std::vector<unsigned char> triangle_affected;  // parallel to triangles
+			long hiz_culled_triangles;
+			long hiz_culled_pixels;
+		};
+
+		// Max vertices of a wall rectangle clipped to the near and far
+		// planes
+		static const int kMaxWallVertices = 6;
+
+		// A wall of a room layout, set up for rendering column by column
+		struct WallSetup {
+			LabelT label;
+			// Maps (t,z,1) to homogeneous image coordinates, where t is the
+			// position along the wall, from 0 at its first corner to 1 at
+			// its second
+			Mat3 homography;
+			Vec3 depth_eqn;
+			// The visible part of the wall in (t,z) coordinates
+			int num_vertices;
+			double t[kMaxWallVertices];
+			double z[kMaxWallVertices];
+			int xa, xb;  // columns [xa,xb) that the wall may cover
+		};
+
+		// A vertical span [ya,yb) of column x covered by one surface of a
+		// room layout
+		struct LayoutSpan {
+			int x, ya, yb;
+			const Vec3* depth_eqn;
+			LabelT label;
+		};
+
+		// Set up one wall of a room layout. Returns false if the wall is
+		// not visible.
+		bool SetupWall(const Vec2& a, const Vec2& b,
+									 double floor_z, double ceiling_z,
+									 LabelT label,
+									 WallSetup& wall) const;
+		// Get the rows [ya,yb) of column x covered by a wall. Returns
+		// false if there are none.
+		bool WallRowSpan(const WallSetup& wall, int x, int& ya, int& yb) const;
+
+		// Transform the vertices of a triangle that is drawn on its own
+		// into scratch.vertices, as elements 0, 1 and 2
+		void TransformTriangle(const Vec3& p, const Vec3& q, const Vec3& r,
+													 SetupScratch& scratch,
+													 RenderStats* stats);
+		// Transform each vertex referenced by a mesh into transformed_,
+		// once, in parallel if there is more than one thread. Triangles
+		// with out-of-range indices are ignored.
+		void TransformMesh(const Vec3* vertices, int num_vertices,
+											 const Vec3I* indices, int num_triangles);
+		// Render a triangle. The elements ids of transformed hold its
+		// transformed vertices. If depth_eqn is not NULL then it is used
+		// instead of computing the depth equation from the vertices.
+		bool RenderTriangle(const Vec3& p, const Vec3& q, const Vec3& r,
+												const TransformedVertices& transformed,
+												const Vec3I& ids,
+												LabelT label,
+												const Vec3* depth_eqn);
+		// Clip, project and set up the edge equations for a triangle,
+		// without allocating. The elements ids of transformed hold its
+		// transformed vertices. Returns false if the triangle is not
+		// visible. If depth_eqn is not NULL then it is used instead of
+		// computing the depth equation from the vertices. If stats is not
+		// NULL then the reason for rejecting the triangle is counted
+		// there, along with the time spent in each stage.
+		bool SetupTriangle(const Vec3& p, const Vec3& q, const Vec3& r,
+											 const TransformedVertices& transformed,
+											 const Vec3I& ids,
+											 LabelT label,
+											 const Vec3* depth_eqn,
+											 TriangleSetup& setup,
+											 RenderStats* stats) const;
+		// Returns true if hierarchical-Z culling rejects an entire
+		// triangle, in which case the culled pixels are added to
+		// culled_pixels. If refresh is true then stale tiles may be
+		// recomputed first, which is not safe during concurrent tests.
+		bool HiZRejects(const TriangleSetup& setup, bool refresh, long& culled_pixels);
+		// Rasterize the part of a set-up triangle that falls within
+		// rows [ya,yb) and columns [xa,xb). If write is false then the
+		// pixels that pass the depth test are counted but not written,
+		// stopping once the count reaches limit. Returns the number of
+		// pixels that passed. Pixels skipped by hierarchical-Z culling are
+		// added to culled_pixels. Statistics are added to stats if it is
+		// not NULL.
+		int FillTriangle(const TriangleSetup& setup,
+										 int ya, int yb, int xa, int xb,
+										 bool write, int limit,
+										 long& culled_pixels,
+										 RenderStats* stats);
+		// As above, testing each tile of the rectangle against the
+		// hierarchical-Z buffer first, but without updating it
+		int FillUnoccludedTiles(const TriangleSetup& setup,
+														int ya, int yb, int xa, int xb,
+														bool write, int limit,
+														long& culled_pixels,
+														RenderStats* stats);
+		// As above, without hierarchical-Z culling
+		int RasterizeRect(const TriangleSetup& setup,
+											int ya, int yb, int xa, int xb,
+											bool write, int limit,
+											RenderStats* stats);
+		// Implementation of all versions of RenderMesh. If depth_eqns
+		// is NULL then the depth equations are computed per triangle.
+		int RenderMeshImpl(const MeshView<LabelT>& mesh,
+											 const DepthEqnArray* depth_eqns);
+		// Implementation of RenderMesh for more than one thread
+		int RenderMeshBinned(const MeshView<LabelT>& mesh,
+												 const DepthEqnArray* depth_eqns);
+		// Per-thread state for SmoothInfiniteDepths
+		struct FillScratch {
+			long count;  // number of infinite pixels
+			bool found;  // true if there was a finite pixel
+			DepthT furthest;  // the furthest finite depth, if found
+			// The lower envelope of the distance parabolas for one row
+			std::vector<int> envelope_cols;
+			std::vector<double> envelope_values;
+			std::vector<double> envelope_bounds;
+		};
+
+		// Replace the infinite depths in rows [ya,yb) with the depth of
+		// the nearest finite pixel, using fill_rows_
+		void FillNearestDepths(int ya, int yb, FillScratch& scratch);
+
+		// Initialize the tiles that have not been touched since the last
+		// call to Clear(), in the whole viewport or in the rectangle
+		// [xa,xb)x[ya,yb). Tiles are kTileSize pixels square, matching
+		// the tiles of the multi-threaded path, so tasks that each own a
+		// tile can call this concurrently.
+		void FinishClear() const;
+		void FinishClearRect(int ya, int yb, int xa, int xb) const;
+
+		// Returns true if a value in the depth buffer should be replaced
+		// by SmoothInfiniteDepths
+		static bool IsInfiniteDepth(DepthT v);
+		// Returns true if a value in the depth buffer can be used as a
+		// replacement by SmoothInfiniteDepths
+		static bool IsFiniteDepth(DepthT v);
+
+		// Get the buffers as a target for the rasterizer
+		RasterTarget<LabelT, DepthT> raster_target();
+
+		// Statistics are collected per thread during each call and then
+		// added to render_stats_. BeginStats() resets the per-thread
+		// statistics and EndStats() adds them up.
+		void BeginStats();
+		void EndStats();
+		// Get the statistics to update from a thread, or NULL if they are
+		// not being collected
+		RenderStats* thread_render_stats(int thread) {
+			return kRenderStatsSupported && stats_enabled_ ? &thread_render_stats_[thread] : NULL;
+		}
+
 		Vec2I viewport_;
 		LinearCamera camera_;
-		Eigen::ArrayXXi framebuffer_;
-		Eigen::ArrayXXd depthbuffer_;
+		DepthEqnBasis depth_basis_;  // computed from camera_ in Configure
+		Frustrum frustrum_;  // computed from camera_ and viewport_ in Configure
+		int scissor_ya_, scissor_yb_, scissor_xa_, scissor_xb_;
+		// The buffers are initialized lazily after Clear(), including by
+		// the const accessors, so they are mutable. They are stored with
+		// layout_, so with kTiledLayout they cannot be indexed as
+		// images; see pixel_layout_.
+		mutable LabelBuffer framebuffer_;
+		mutable DepthBuffer depthbuffer_;
+		BufferLayout layout_;
+		PixelLayout pixel_layout_;
+		// Row-major copies returned by the const buffer accessors with
+		// kTiledLayout
+		mutable LabelBuffer frame_readout_;
+		mutable DepthBuffer depth_readout_;
+		// Lazy clear state. A tile is valid if its element of
+		// tile_epochs_ equals epoch_, which is incremented by Clear().
+		mutable std::vector<unsigned int> tile_epochs_;
+		mutable bool clear_pending_;  // true if some tiles may be invalid
+		unsigned int epoch_;
+		LabelT clear_label_;
+
+		SetupScratch scratch_;
+
+		bool hiz_enabled_;
+		HiZBuffer hiz_;
+		long hiz_culled_triangles_;
+		long hiz_culled_pixels_;
+
+		// Post-transform vertex cache for meshes. A vertex has been
+		// transformed by the current call if its element of
+		// vertex_stamps_ equals vertex_stamp_.
+		TransformedVertices transformed_;
+		std::vector<unsigned int> vertex_stamps_;
+		unsigned int vertex_stamp_;
+		std::vector<int> unique_vertices_;  // the vertices to transform
+		long vertices_transformed_;
+		long vertex_cache_hits_;
+
+		// Statistics (see EnableStats)
+		bool stats_enabled_;
+		bool overdraw_enabled_;
+		RenderStats render_stats_;
+		std::vector<RenderStats> thread_render_stats_;
+		OverdrawBuffer overdraw_;
+
+		// State for the multi-threaded path. Copies of a renderer share
+		// the same pool.
+		std::shared_ptr<ThreadPool> pool_;
+		std::vector<MeshChunk> chunks_;
+		std::vector<long> thread_culled_pixels_;
+		std::vector<long> thread_culled_triangles_;  // for RunOcclusionQueries
+		std::vector<long> thread_invalid_triangles_;
+
+		// Per-label statistics (see SetLabelStats)
+		int stats_num_labels_;
+		std::vector<const Eigen::ArrayXXd*> stats_cost_images_;
+		// label_stats_ is resolved lazily by the const label_stats() after
+		// single-threaded calls to RenderMesh, so it is mutable
+		mutable LabelStats label_stats_;
+		mutable bool label_stats_dirty_;
+		std::vector<LabelStats> thread_stats_;
+
+		// Occlusion query state (see BeginOcclusionQuery)
+		bool query_active_;
+		bool query_write_;
+		long query_pixels_;
+		std::vector<long> thread_query_pixels_;
+
+		// Scratch space for RenderManhattanLayout
+		std::vector<WallSetup> walls_;
+		std::vector<long> thread_layout_pixels_;
+		std::vector<std::vector<LayoutSpan> > thread_layout_spans_;
+		std::vector<std::vector<std::pair<int, int> > > thread_wall_spans_;
+
+		// Scratch space for SmoothInfiniteDepths. Element (y,x) of
+		// fill_rows_ is the row of the nearest finite pixel in column x,
+		// or -1 if there are none.
+		Eigen::ArrayXXi fill_rows_;
+		std::vector<FillScratch> thread_fill_;
 	};
+
+	// The original renderer, with int labels and double depths
+	typedef SimpleRendererT<> SimpleRenderer;
 }  // namespace indoor_context
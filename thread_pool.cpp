@@ -0,0 +1,126 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace indoor_context {
+	ThreadPool::ThreadPool(int num_threads)
+		: num_threads_(std::max(num_threads, 1)),
+			ranges_(std::max(num_threads, 1)),
+			fn_(NULL),
+			generation_(0),
+			num_running_(0),
+			stopping_(false) {
+		for (int i = 0; i < num_threads_; i++) {
+			ranges_[i].begin = ranges_[i].end = 0;
+		}
+		for (int i = 1; i < num_threads_; i++) {
+			workers_.push_back(std::thread(&ThreadPool::WorkerLoop, this, i));
+		}
+	}
+
+	ThreadPool::~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> guard(state_lock_);
+			stopping_ = true;
+		}
+		start_cond_.notify_all();
+		for (int i = 0; i < workers_.size(); i++) {
+			workers_[i].join();
+		}
+	}
+
+	void ThreadPool::ParallelFor(int ntasks, const std::function<void(int, int)>& fn) {
+		std::lock_guard<std::mutex> call_guard(call_lock_);
+		if (ntasks <= 0) return;
+
+		// Don't wake the workers for a single task
+		if (num_threads_ == 1 || ntasks == 1) {
+			for (int i = 0; i < ntasks; i++) {
+				fn(i, 0);
+			}
+			return;
+		}
+
+		// Give each thread a contiguous range of tasks
+		for (int i = 0; i < num_threads_; i++) {
+			std::lock_guard<std::mutex> guard(ranges_[i].lock);
+			ranges_[i].begin = static_cast<long>(ntasks) * i / num_threads_;
+			ranges_[i].end = static_cast<long>(ntasks) * (i+1) / num_threads_;
+		}
+
+		// Wake the workers and join in
+		{
+			std::lock_guard<std::mutex> guard(state_lock_);
+			fn_ = &fn;
+			num_running_ = num_threads_-1;
+			generation_++;
+		}
+		start_cond_.notify_all();
+		RunTasks(0);
+
+		// Wait for the workers to finish their last tasks
+		std::unique_lock<std::mutex> lock(state_lock_);
+		while (num_running_ > 0) {
+			done_cond_.wait(lock);
+		}
+		fn_ = NULL;
+	}
+
+	void ThreadPool::WorkerLoop(int thread) {
+		int seen = 0;
+		std::unique_lock<std::mutex> lock(state_lock_);
+		while (true) {
+			while (!stopping_ && generation_ == seen) {
+				start_cond_.wait(lock);
+			}
+			if (stopping_) return;
+			seen = generation_;
+
+			lock.unlock();
+			RunTasks(thread);
+			lock.lock();
+
+			if (--num_running_ == 0) {
+				done_cond_.notify_one();
+			}
+		}
+	}
+
+	void ThreadPool::RunTasks(int thread) {
+		while (true) {
+			int task = PopTask(thread);
+			if (task >= 0) {
+				(*fn_)(task, thread);
+			} else if (!StealTasks(thread)) {
+				return;
+			}
+		}
+	}
+
+	int ThreadPool::PopTask(int thread) {
+		TaskRange& range = ranges_[thread];
+		std::lock_guard<std::mutex> guard(range.lock);
+		return range.begin < range.end ? range.begin++ : -1;
+	}
+
+	bool ThreadPool::StealTasks(int thread) {
+		for (int i = 1; i < num_threads_; i++) {
+			TaskRange& victim = ranges_[(thread+i) % num_threads_];
+			int begin, end;
+			{
+				std::lock_guard<std::mutex> guard(victim.lock);
+				int n = victim.end - victim.begin;
+				if (n <= 0) continue;
+				end = victim.end;
+				begin = end - (n+1)/2;
+				victim.end = begin;
+			}
+			TaskRange& range = ranges_[thread];
+			std::lock_guard<std::mutex> guard(range.lock);
+			range.begin = begin;
+			range.end = end;
+			return true;
+		}
+		return false;
+	}
+}  // namespace indoor_context
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace indoor_context {
+	// A fixed set of worker threads that execute parallel loops. Each
+	// loop is split into one contiguous range of tasks per thread, and
+	// threads that finish their own range steal from the back of the
+	// ranges of other threads. The calling thread takes part as thread 0.
+	class ThreadPool {
+	public:
+		// Initialize with the given number of threads, including the caller
+		explicit ThreadPool(int num_threads);
+		// Stop and join all workers
+		~ThreadPool();
+
+		// Get the number of threads, including the caller
+		int num_threads() const { return num_threads_; }
+
+		// Call fn(task, thread) for each task in [0,ntasks), where thread
+		// is in [0,num_threads()) and identifies the thread running the
+		// task, so that callers can keep per-thread scratch space. Blocks
+		// until all tasks have finished. Calls from several threads are
+		// serialized.
+		void ParallelFor(int ntasks, const std::function<void(int, int)>& fn);
+
+	private:
+		// A range of tasks owned by one thread
+		struct TaskRange {
+			std::mutex lock;
+			int begin, end;
+		};
+
+		// Main loop for worker threads
+		void WorkerLoop(int thread);
+		// Run tasks from our own range, then steal until none are left
+		void RunTasks(int thread);
+		// Take the next task from our own range. Returns -1 if it is empty.
+		int PopTask(int thread);
+		// Move the back half of some other thread's range into our own
+		// range. Returns false if all ranges are empty.
+		bool StealTasks(int thread);
+
+		int num_threads_;
+		std::vector<std::thread> workers_;
+		std::vector<TaskRange> ranges_;
+
+		std::mutex call_lock_;  // serializes calls to ParallelFor
+		std::mutex state_lock_;  // protects the members below
+		std::condition_variable start_cond_;
+		std::condition_variable done_cond_;
+		const std::function<void(int, int)>* fn_;
+		int generation_;
+		int num_running_;
+		bool stopping_;
+
+		// Not copyable
+		ThreadPool(const ThreadPool&);
+		ThreadPool& operator=(const ThreadPool&);
+	};
+}  // namespace indoor_context
@@ -11,12 +11,6 @@ namespace indoor_context {
 		return v.template head<N-1>() / v[N-1];
 	}
 
-	// Append a "1" to the end of a vector
-	template <typename T, int N>
-	Eigen::Matrix<T,N+1,1> Unproject(const Eigen::Matrix<T,N,1>& v) {
-		return Concatenate(v, 1.);
-	}
-
 	// Create a 2-vector
 	template <typename T>
 	Eigen::Matrix<T,2,1> MakeVector(const T& x1, const T& x2) {
@@ -102,6 +96,12 @@ namespace indoor_context {
 		return r;
 	}
 
+	// Append a "1" to the end of a vector
+	template <typename T, int N>
+	Eigen::Matrix<T,N+1,1> Unproject(const Eigen::Matrix<T,N,1>& v) {
+		return Concatenate(v, 1.);
+	}
+
 	// Divide the elements of a vector by the last element, as in
 	// unproject(project(v)).
 	template <typename T>
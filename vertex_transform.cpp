@@ -0,0 +1,127 @@
+#include "vertex_transform.h"
+
+#include "matrix_types.h"
+#include "rasterizer.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VERTEX_TRANSFORM_X86
+#include <immintrin.h>
+#endif
+
+namespace indoor_context {
+	void TransformedVertices::Reserve(int n) {
+		if (x.size() < n) {
+			x.resize(n);
+			y.resize(n);
+			depth.resize(n);
+			outcodes.resize(n);
+		}
+	}
+
+	// Transform one vertex. The sums are evaluated in the same order as
+	// in the vectorized version so that the results are identical.
+	static inline void TransformVertex(const LinearCamera& camera,
+																		 const Frustrum& frustrum,
+																		 const Vec3& v,
+																		 int id,
+																		 TransformedVertices& out) {
+		double h[3];
+		for (int i = 0; i < 3; i++) {
+			h[i] = ((camera(i, 0)*v[0] + camera(i, 1)*v[1]) + camera(i, 2)*v[2]) + camera(i, 3);
+		}
+		out.x[id] = h[0] / h[2];
+		out.y[id] = h[1] / h[2];
+		out.depth[id] = h[2];
+		int code = 0;
+		for (int i = 0; i < 6; i++) {
+			const Vec4& w = frustrum.planes[i];
+			if (((v[0]*w[0] + v[1]*w[1]) + v[2]*w[2]) + w[3] < 0) {
+				code |= 1 << i;
+			}
+		}
+		out.outcodes[id] = code;
+	}
+
+#ifdef VERTEX_TRANSFORM_X86
+	// Evaluate ((a*x + b*y) + c*z) + d for four vertices
+	__attribute__((target("avx2")))
+	static inline __m256d AffineAVX2(__m256d x, __m256d y, __m256d z,
+																	 double a, double b, double c, double d) {
+		__m256d s = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(a), x),
+															_mm256_mul_pd(_mm256_set1_pd(b), y));
+		s = _mm256_add_pd(s, _mm256_mul_pd(_mm256_set1_pd(c), z));
+		return _mm256_add_pd(s, _mm256_set1_pd(d));
+	}
+
+	// Transform vertices four at a time, gathering their coordinates
+	// into registers. Returns the number of vertices processed, which is
+	// a multiple of four.
+	__attribute__((target("avx2")))
+	static int TransformVerticesAVX2(const LinearCamera& camera,
+																	 const Frustrum& frustrum,
+																	 const Vec3* vertices,
+																	 const int* ids,
+																	 int n,
+																	 TransformedVertices& out) {
+		const double* base = vertices[0].data();
+		const __m128i three = _mm_set1_epi32(3);
+		// The masked gathers with a zero source are equivalent to
+		// _mm256_i32gather_pd, which leaves its source register undefined
+		// and so trips -Wmaybe-uninitialized
+		const __m256d zero = _mm256_setzero_pd();
+		const __m256d all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+		int k = 0;
+		for (; k+4 <= n; k += 4) {
+			const __m128i offsets = _mm_mullo_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ids+k)), three);
+			const __m256d x = _mm256_mask_i32gather_pd(zero, base, offsets, all, 8);
+			const __m256d y = _mm256_mask_i32gather_pd(zero, base+1, offsets, all, 8);
+			const __m256d z = _mm256_mask_i32gather_pd(zero, base+2, offsets, all, 8);
+
+			double h[3][4];
+			for (int i = 0; i < 3; i++) {
+				_mm256_storeu_pd(h[i], AffineAVX2(x, y, z, camera(i, 0), camera(i, 1), camera(i, 2), camera(i, 3)));
+			}
+			const __m256d w = _mm256_loadu_pd(h[2]);
+			double u[4], v[4];
+			_mm256_storeu_pd(u, _mm256_div_pd(_mm256_loadu_pd(h[0]), w));
+			_mm256_storeu_pd(v, _mm256_div_pd(_mm256_loadu_pd(h[1]), w));
+
+			int codes[4] = { 0, 0, 0, 0 };
+			for (int i = 0; i < 6; i++) {
+				const Vec4& p = frustrum.planes[i];
+				const __m256d d = AffineAVX2(x, y, z, p[0], p[1], p[2], p[3]);
+				const int outside = _mm256_movemask_pd(_mm256_cmp_pd(d, _mm256_setzero_pd(), _CMP_LT_OQ));
+				for (int j = 0; j < 4; j++) {
+					codes[j] |= ((outside >> j) & 1) << i;
+				}
+			}
+
+			for (int j = 0; j < 4; j++) {
+				const int id = ids[k+j];
+				out.x[id] = u[j];
+				out.y[id] = v[j];
+				out.depth[id] = h[2][j];
+				out.outcodes[id] = codes[j];
+			}
+		}
+		return k;
+	}
+#endif
+
+	void TransformVertices(const LinearCamera& camera,
+												 const Frustrum& frustrum,
+												 const Vec3* vertices,
+												 const int* ids,
+												 int n,
+												 TransformedVertices& out) {
+		int k = 0;
+#ifdef VERTEX_TRANSFORM_X86
+		if (GetRasterPath() == kRasterAVX2) {
+			k = TransformVerticesAVX2(camera, frustrum, vertices, ids, n, out);
+		}
+#endif
+		for (; k < n; k++) {
+			TransformVertex(camera, frustrum, vertices[ids[k]], ids[k], out);
+		}
+	}
+}  // namespace indoor_context
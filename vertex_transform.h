@@ -0,0 +1,38 @@
+#pragma once
+
+#include "matrix_types.h"
+#include "clipping.h"
+
+namespace indoor_context {
+	// The output of the vertex transform stage for an array of
+	// vertices, in structure-of-arrays form. Element i describes vertex
+	// i of the input. Only the elements of the vertices that were
+	// transformed are set.
+	struct TransformedVertices {
+		// Image coordinates, after the perspective divide
+		Eigen::ArrayXd x, y;
+		// Camera depth, which is the homogeneous coordinate that x and y
+		// were divided by
+		Eigen::ArrayXd depth;
+		// Bit i is set if the vertex is outside the i-th frustrum plane
+		// (see ComputeOutcode)
+		Eigen::ArrayXi outcodes;
+
+		// Make room for at least n vertices. The contents are not
+		// preserved.
+		void Reserve(int n);
+	};
+
+	// Transform the vertices selected by ids[0..n) into a camera,
+	// writing element ids[k] of out for each k. The vertices are
+	// processed in blocks of four with AVX2 when the rasterizer uses it
+	// (see GetRasterPath()), and the results are identical either
+	// way. The image coordinates are only meaningful for vertices in
+	// front of the camera.
+	void TransformVertices(const LinearCamera& camera,
+												 const Frustrum& frustrum,
+												 const Vec3* vertices,
+												 const int* ids,
+												 int n,
+												 TransformedVertices& out);
+}  // namespace indoor_context